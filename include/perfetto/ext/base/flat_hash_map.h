@@ -143,6 +143,7 @@ class FlatHashMap {
     capacity_ = other.capacity_;
     size_ = other.size_;
     max_probe_length_ = other.max_probe_length_;
+    num_tombstones_ = other.num_tombstones_;
     load_limit_ = other.load_limit_;
     load_limit_percent_ = other.load_limit_percent_;
 
@@ -215,8 +216,10 @@ class FlatHashMap {
       // If we got to this point the key does not exist (otherwise we would have
       // hit the the return above) and we are going to insert a new entry.
       // Before doing so, ensure we stay under the target load limit.
-      if (PERFETTO_UNLIKELY(size_ >= load_limit_)) {
-        MaybeGrowAndRehash(/*grow=*/true);
+      // Tombstones count towards it, as they make the probes as long as live
+      // entries do. If they are most of the load, rehash without growing.
+      if (PERFETTO_UNLIKELY(size_ + num_tombstones_ >= load_limit_)) {
+        MaybeGrowAndRehash(/*grow=*/size_ >= load_limit_ / 2);
         continue;
       }
       PERFETTO_DCHECK(insertion_slot != kSlotNotFound);
@@ -229,6 +232,8 @@ class FlatHashMap {
     Value* value_idx = &values_[insertion_slot];
     new (&keys_[insertion_slot]) Key(std::move(key));
     new (value_idx) Value(std::move(value));
+    if (tags_[insertion_slot] == kTombstone)
+      num_tombstones_--;
     tags_[insertion_slot] = tag;
     PERFETTO_DCHECK(probe_len > 0 && probe_len <= capacity_);
     max_probe_length_ = std::max(max_probe_length_, probe_len);
@@ -313,6 +318,7 @@ class FlatHashMap {
     keys_[idx].~Key();
     values_[idx].~Value();
     size_--;
+    num_tombstones_++;
   }
 
   PERFETTO_NO_INLINE void MaybeGrowAndRehash(bool grow) {
@@ -356,6 +362,7 @@ class FlatHashMap {
 
     capacity_ = n;
     max_probe_length_ = 0;
+    num_tombstones_ = 0;
     size_ = 0;
     load_limit_ = n * static_cast<size_t>(load_limit_percent_) / 100;
     load_limit_ = std::min(load_limit_, n);
@@ -377,6 +384,7 @@ class FlatHashMap {
   size_t capacity_ = 0;
   size_t size_ = 0;
   size_t max_probe_length_ = 0;
+  size_t num_tombstones_ = 0;
   size_t load_limit_ = 0;  // Updated every time |capacity_| changes.
   int load_limit_percent_ =
       kDefaultLoadLimitPct;  // Load factor limit in % of |capacity_|.
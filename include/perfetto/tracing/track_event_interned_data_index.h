@@ -22,6 +22,7 @@
 #include "perfetto/base/compiler.h"
 #include "perfetto/tracing/event_context.h"
 
+#include <list>
 #include <map>
 #include <type_traits>
 #include <unordered_map>
@@ -143,6 +144,48 @@ struct HashedInternedDataTraits {
   };
 };
 
+// Keeps at most |MaxEntries| values in the index, evicting the least recently
+// used one when full. An evicted value that is seen again is re-emitted into
+// the trace under a new interning id, so this trades a bit of trace size for
+// bounded memory usage in the per-sequence incremental state. Useful for
+// interned data with an unbounded number of distinct values.
+//
+// Like the other traits, the index is scoped to a single packet sequence:
+// interning ids are not shared across sequences or processes.
+template <size_t MaxEntries>
+struct LruInternedDataTraits {
+  static_assert(MaxEntries > 0, "MaxEntries must be positive");
+
+  template <typename ValueType>
+  class Index {
+   public:
+    bool LookUpOrInsert(size_t* iid, const ValueType& value) {
+      auto it = data_.find(value);
+      if (it != data_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        *iid = it->second->second;
+        return true;
+      }
+      if (data_.size() >= MaxEntries) {
+        data_.erase(lru_.back().first);
+        lru_.pop_back();
+      }
+      // Ids of evicted values are never reused, as they could still be
+      // referenced by packets which were already written on this sequence.
+      *iid = ++last_iid_;
+      lru_.emplace_front(value, *iid);
+      data_.emplace(value, lru_.begin());
+      return false;
+    }
+
+   private:
+    using LruList = std::list<std::pair<ValueType, size_t>>;
+    LruList lru_;  // Most recently used first.
+    std::unordered_map<ValueType, typename LruList::iterator> data_;
+    size_t last_iid_ = 0;
+  };
+};
+
 // A templated base class for an interned data type which corresponds to a field
 // in interned_data.proto.
 //
@@ -191,6 +191,27 @@ TYPED_TEST(FlatHashMapTest, FillWithTombstones) {
   }
 }
 
+// Erasing and inserting different keys must not grow the map, nor fill it
+// with tombstones, when the number of live entries stays the same.
+TYPED_TEST(FlatHashMapTest, ReuseTombstones) {
+  FlatHashMap<size_t, size_t, std::hash<size_t>, typename TestFixture::Probe>
+      fmap;
+  for (size_t i = 0; i < 100; i++)
+    ASSERT_TRUE(fmap.Insert(i, i).second);
+  const size_t capacity = fmap.capacity();
+
+  for (size_t i = 100; i < 100000; i++) {
+    ASSERT_TRUE(fmap.Erase(i - 100));
+    ASSERT_TRUE(fmap.Insert(i, i).second);
+  }
+  ASSERT_EQ(fmap.size(), 100u);
+  ASSERT_EQ(fmap.capacity(), capacity);
+  for (size_t i = 0; i < 100000 - 100; i++)
+    ASSERT_EQ(fmap.Find(i), nullptr);
+  for (size_t i = 100000 - 100; i < 100000; i++)
+    ASSERT_EQ(*fmap.Find(i), i);
+}
+
 TYPED_TEST(FlatHashMapTest, Collisions) {
   FlatHashMap<int, int, CollidingHasher, typename TestFixture::Probe> fmap(
       /*initial_capacity=*/0, /*load_limit_pct=*/100);
@@ -27,6 +27,10 @@
 #include "perfetto/protozero/proto_utils.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cinttypes>
@@ -48,6 +52,26 @@ using TokenId = KernelSymbolMap::TokenTable::TokenId;
 constexpr size_t kSymNameMaxLen = 128;
 constexpr size_t kSymMaxSizeBytes = 1024 * 1024;
 
+// Bump the version when changing the layout of the cache file.
+constexpr char kCacheFileMagic[8] = {'P', 'F', 'K', 'S', 'Y', 'M', '0', '1'};
+
+struct CacheFileHeader {
+  char magic[8];
+  uint64_t key;
+  uint64_t base_addr;
+  uint64_t num_syms;
+  uint32_t sym_index_sampling;
+  uint32_t token_index_sampling;
+  uint32_t num_tokens;
+  uint32_t num_index;
+  uint32_t num_token_index;
+  uint32_t sym_buf_size;
+  uint32_t token_buf_size;
+  uint32_t reserved;
+};
+static_assert(sizeof(CacheFileHeader) % 8 == 0,
+              "The arrays following the header must stay aligned");
+
 // Reads a kallsyms file in blocks of 4 pages each and decode its lines using
 // a simple FSM. Calls the passed lambda for each valid symbol.
 // It skips undefined symbols and other useless stuff.
@@ -204,9 +228,33 @@ TokenId KernelSymbolMap::TokenTable::Add(const std::string& token) {
   }
   *(tok_wptr++) = static_cast<char>(token.at(token_size - 1) | 0x80);
   PERFETTO_DCHECK(tok_wptr == buf_.data() + buf_.size());
+  UpdateViews();
   return id;
 }
 
+void KernelSymbolMap::TokenTable::UpdateViews() {
+  buf_data_ = buf_.data();
+  buf_size_ = buf_.size();
+  index_data_ = index_.data();
+  index_size_ = index_.size();
+}
+
+void KernelSymbolMap::TokenTable::SetExternalStorage(const char* buf,
+                                                     size_t buf_size,
+                                                     const uint32_t* index,
+                                                     size_t index_size,
+                                                     TokenId num_tokens) {
+  buf_.clear();
+  buf_.shrink_to_fit();
+  index_.clear();
+  index_.shrink_to_fit();
+  buf_data_ = buf;
+  buf_size_ = buf_size;
+  index_data_ = index;
+  index_size_ = index_size;
+  num_tokens_ = num_tokens;
+}
+
 // NOTE: the caller need to mask the returned chars with 0x7f. The last char of
 // the StringView will have its MSB set (it's used as a EOF char internally).
 base::StringView KernelSymbolMap::TokenTable::Lookup(TokenId id) {
@@ -218,23 +266,30 @@ base::StringView KernelSymbolMap::TokenTable::Lookup(TokenId id) {
   // store only one position every kTokenIndexSampling. From there, the token
   // can be found with a linear scan of at most kTokenIndexSampling steps.
   size_t index_off = id / kTokenIndexSampling;
-  PERFETTO_DCHECK(index_off < index_.size());
+  if (index_off >= index_size_)
+    return base::StringView("<error>");
   TokenId cur_id = static_cast<TokenId>(index_off * kTokenIndexSampling);
-  uint32_t begin = index_[index_off];
-  PERFETTO_DCHECK(begin == 0 || buf_[begin - 1] & 0x80);
-  const size_t buf_size = buf_.size();
-  for (uint32_t off = begin; off < buf_size; ++off) {
+  uint32_t begin = index_data_[index_off];
+  PERFETTO_DCHECK(begin == 0 || buf_data_[begin - 1] & 0x80);
+  for (uint32_t off = begin; off < buf_size_; ++off) {
     // Advance |off| until the end of the token (which has the MSB set).
-    if ((buf_[off] & 0x80) == 0)
+    if ((buf_data_[off] & 0x80) == 0)
       continue;
     if (cur_id == id)
-      return base::StringView(&buf_[begin], off - begin + 1);
+      return base::StringView(&buf_data_[begin], off - begin + 1);
     ++cur_id;
     begin = off + 1;
   }
   return base::StringView();
 }
 
+KernelSymbolMap::KernelSymbolMap() = default;
+
+KernelSymbolMap::~KernelSymbolMap() {
+  if (mapped_)
+    munmap(mapped_, mapped_size_);
+}
+
 size_t KernelSymbolMap::Parse(const std::string& kallsyms_path) {
   PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, KALLSYMS_PARSE);
   using SymAddr = uint64_t;
@@ -342,8 +397,10 @@ size_t KernelSymbolMap::Parse(const std::string& kallsyms_path) {
 
     uint32_t sym_rel_addr = static_cast<uint32_t>(sym_addr - base_addr_);
     const size_t sym_num = num_syms_++;
-    if (sym_num % kSymIndexSampling == 0)
-      index_.emplace_back(std::make_pair(sym_rel_addr, size_before));
+    if (sym_num % kSymIndexSampling == 0) {
+      index_addrs_.emplace_back(sym_rel_addr);
+      index_offs_.emplace_back(size_before);
+    }
     PERFETTO_DCHECK(sym_addr >= prev_sym_addr);
     uint32_t delta = static_cast<uint32_t>(sym_addr - prev_sym_addr);
     wptr = protozero::proto_utils::WriteVarInt(delta, wptr);
@@ -362,6 +419,13 @@ size_t KernelSymbolMap::Parse(const std::string& kallsyms_path) {
 
   buf_.resize(static_cast<size_t>(wptr - buf_.data()));
   buf_.shrink_to_fit();
+  index_addrs_.shrink_to_fit();
+  index_offs_.shrink_to_fit();
+  sym_buf_ = buf_.data();
+  sym_buf_size_ = buf_.size();
+  index_addrs_data_ = index_addrs_.data();
+  index_offs_data_ = index_offs_.data();
+  index_size_ = index_addrs_.size();
   base::MaybeReleaseAllocatorMemToOS();  // For Scudo, b/170217718.
 
   if (num_syms_ == 0) {
@@ -380,23 +444,27 @@ size_t KernelSymbolMap::Parse(const std::string& kallsyms_path) {
 }
 
 std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
-  if (index_.empty() || sym_addr < base_addr_)
+  if (index_size_ == 0 || sym_addr < base_addr_)
     return "";
 
   // First find the highest symbol address <= sym_addr.
-  // Start with a binary search using the sparse index.
-
+  // Start with a binary search using the sparse index. The loop body compiles
+  // to a conditional move rather than a hard to predict branch. The first
+  // entry is the base address (i.e. 0), so there always is a match.
   const uint32_t sym_rel_addr = static_cast<uint32_t>(sym_addr - base_addr_);
-  auto it = std::upper_bound(index_.cbegin(), index_.cend(),
-                             std::make_pair(sym_rel_addr, 0u));
-  if (it != index_.cbegin())
-    --it;
+  const uint32_t* lo = index_addrs_data_;
+  for (size_t n = index_size_; n > 1;) {
+    size_t half = n / 2;
+    lo = lo[half] <= sym_rel_addr ? lo + half : lo;
+    n -= half;
+  }
+  const size_t index_pos = static_cast<size_t>(lo - index_addrs_data_);
 
   // Then continue with a linear scan (of at most kSymIndexSampling steps).
-  uint32_t addr = it->first;
-  uint32_t off = it->second;
-  const uint8_t* rdptr = &buf_[off];
-  const uint8_t* const buf_end = buf_.data() + buf_.size();
+  uint32_t addr = index_addrs_data_[index_pos];
+  uint32_t off = index_offs_data_[index_pos];
+  const uint8_t* rdptr = sym_buf_ + off;
+  const uint8_t* const buf_end = sym_buf_ + sym_buf_size_;
   bool parsing_addr = true;
   const uint8_t* next_rdptr = nullptr;
   uint64_t sym_start_addr = 0;
@@ -451,4 +519,135 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
   return sym_name;
 }
 
+bool KernelSymbolMap::SaveToFile(const std::string& path, uint64_t key) const {
+  CacheFileHeader hdr{};
+  memcpy(hdr.magic, kCacheFileMagic, sizeof(hdr.magic));
+  hdr.key = key;
+  hdr.base_addr = base_addr_;
+  hdr.num_syms = num_syms_;
+  hdr.sym_index_sampling = static_cast<uint32_t>(kSymIndexSampling);
+  hdr.token_index_sampling = static_cast<uint32_t>(kTokenIndexSampling);
+  hdr.num_tokens = tokens_.num_tokens_;
+  hdr.num_index = static_cast<uint32_t>(index_size_);
+  hdr.num_token_index = static_cast<uint32_t>(tokens_.index_size_);
+  hdr.sym_buf_size = static_cast<uint32_t>(sym_buf_size_);
+  hdr.token_buf_size = static_cast<uint32_t>(tokens_.buf_size_);
+
+  // Several processes of the same user (e.g. traced_probes and traced_perf)
+  // can race to write the same file. Each writes its own temporary file and
+  // the last rename() wins, which is fine as the contents are the same.
+  // The file is only ever read back by the same user, see LoadFromFile().
+  std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (!fd) {
+    PERFETTO_PLOG("Failed to create %s", tmp_path.c_str());
+    return false;
+  }
+  struct Chunk {
+    const void* data;
+    size_t size;
+  };
+  const Chunk chunks[] = {
+      {&hdr, sizeof(hdr)},
+      {index_addrs_data_, index_size_ * sizeof(uint32_t)},
+      {index_offs_data_, index_size_ * sizeof(uint32_t)},
+      {tokens_.index_data_, tokens_.index_size_ * sizeof(uint32_t)},
+      {sym_buf_, sym_buf_size_},
+      {tokens_.buf_data_, tokens_.buf_size_},
+  };
+  for (const Chunk& chunk : chunks) {
+    if (base::WriteAll(*fd, chunk.data, chunk.size) !=
+        static_cast<ssize_t>(chunk.size)) {
+      PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+      unlink(tmp_path.c_str());
+      return false;
+    }
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool KernelSymbolMap::LoadFromFile(const std::string& path, uint64_t key) {
+  PERFETTO_DCHECK(num_syms_ == 0 && !mapped_);
+  base::ScopedFile fd = base::OpenFile(path, O_RDONLY);
+  if (!fd)
+    return false;
+  struct stat st;
+  if (fstat(*fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(CacheFileHeader)) {
+    return false;
+  }
+  // The symbols are used as-is, so only trust a file that nobody else could
+  // have written.
+  if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    PERFETTO_ELOG("Ignoring kallsyms cache %s: owned by uid %u, mode %o",
+                  path.c_str(), static_cast<unsigned>(st.st_uid),
+                  static_cast<unsigned>(st.st_mode & 0777));
+    return false;
+  }
+  const size_t file_size = static_cast<size_t>(st.st_size);
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, *fd, 0);
+  if (mapped == MAP_FAILED) {
+    PERFETTO_PLOG("mmap(%s) failed", path.c_str());
+    return false;
+  }
+
+  // The file might have been written by an older version or be otherwise
+  // corrupted. Validate everything the lookups rely on to stay within bounds.
+  CacheFileHeader hdr;
+  memcpy(&hdr, mapped, sizeof(hdr));
+  const uint8_t* const begin = static_cast<const uint8_t*>(mapped);
+  const uint32_t* index_addrs =
+      reinterpret_cast<const uint32_t*>(begin + sizeof(hdr));
+  const uint32_t* index_offs = index_addrs + hdr.num_index;
+  const uint32_t* token_index = index_offs + hdr.num_index;
+  const uint8_t* sym_buf =
+      reinterpret_cast<const uint8_t*>(token_index + hdr.num_token_index);
+  const char* token_buf =
+      reinterpret_cast<const char*>(sym_buf + hdr.sym_buf_size);
+
+  bool valid =
+      memcmp(hdr.magic, kCacheFileMagic, sizeof(hdr.magic)) == 0 &&
+      hdr.key == key && hdr.sym_index_sampling == kSymIndexSampling &&
+      hdr.token_index_sampling == kTokenIndexSampling && hdr.num_index > 0 &&
+      file_size == sizeof(hdr) +
+                       (2 * static_cast<uint64_t>(hdr.num_index) +
+                        hdr.num_token_index) *
+                           sizeof(uint32_t) +
+                       hdr.sym_buf_size + hdr.token_buf_size &&
+      index_addrs[0] == 0;
+  for (uint32_t i = 0; valid && i < hdr.num_index; i++) {
+    valid = index_offs[i] < hdr.sym_buf_size &&
+            (i == 0 || index_addrs[i - 1] <= index_addrs[i]);
+  }
+  for (uint32_t i = 0; valid && i < hdr.num_token_index; i++)
+    valid = token_index[i] < hdr.token_buf_size;
+  if (!valid) {
+    PERFETTO_DLOG("Ignoring stale or invalid kallsyms cache %s", path.c_str());
+    munmap(mapped, file_size);
+    return false;
+  }
+
+  mapped_ = mapped;
+  mapped_size_ = file_size;
+  base_addr_ = hdr.base_addr;
+  num_syms_ = static_cast<size_t>(hdr.num_syms);
+  sym_buf_ = sym_buf;
+  sym_buf_size_ = hdr.sym_buf_size;
+  index_addrs_data_ = index_addrs;
+  index_offs_data_ = index_offs;
+  index_size_ = hdr.num_index;
+  tokens_.SetExternalStorage(token_buf, hdr.token_buf_size, token_index,
+                             hdr.num_token_index, hdr.num_tokens);
+  PERFETTO_DLOG("Mapped %zu kallsyms entries from %s", num_syms_,
+                path.c_str());
+  return true;
+}
+
 }  // namespace perfetto
@@ -111,6 +111,25 @@ class StringView;
 // 2. Skip over at most kSymIndexSamplinig until the symbol is found.
 // 3. For each token index, lookup the corresponding token string and
 //    concatenate them to build the symbol name.
+//
+// The symbols index is kept as two parallel arrays (addresses and offsets) so
+// that step 1 can be a branchless binary search over a dense uint32_t array.
+//
+// Cache file
+// ----------
+// Parsing /proc/kallsyms takes hundreds of ms of CPU. The tables above can be
+// written to a file with SaveToFile() and mmap()-ed back by LoadFromFile(),
+// in which case lookups operate directly on the mapped pages (and so they are
+// shared by all the processes that map the same file). The file is laid out
+// as follows, all in host endianness:
+//   CacheFileHeader
+//   uint32_t index_addrs[num_index]
+//   uint32_t index_offs[num_index]
+//   uint32_t token_index[num_token_index]
+//   uint8_t sym_buf[sym_buf_size]
+//   char token_buf[token_buf_size]
+// The header carries a caller-provided key identifying the kernel the
+// symbols belong to. LoadFromFile() rejects files with a different key.
 
 class KernelSymbolMap {
  public:
@@ -122,9 +141,22 @@ class KernelSymbolMap {
   // Trades off size of the TokenTable |index_| vs worst-case linear scans size.
   static size_t kTokenIndexSampling;
 
+  KernelSymbolMap();
+  ~KernelSymbolMap();
+
   // Parses a kallsyms file. Returns the number of valid symbols decoded.
   size_t Parse(const std::string& kallsyms_path);
 
+  // Writes the parsed symbols to |path|, tagging them with |key|. The file is
+  // written to a temporary file first and renamed over |path|, so that
+  // concurrent readers never observe a partially written file.
+  bool SaveToFile(const std::string& path, uint64_t key) const;
+
+  // Maps a file written by SaveToFile() with the same |key|. Files not owned
+  // by the current user, or writable by its group or others, are rejected. On
+  // failure the map is left empty. Must be called on an empty map.
+  bool LoadFromFile(const std::string& path, uint64_t key);
+
   // Looks up the closest symbol (i.e. the one with the highest address <=
   // |addr|) from its absolute 64-bit address.
   // Returns an empty string if the symbol is not found (which can happen only
@@ -136,11 +168,14 @@ class KernelSymbolMap {
 
   // Returns the size in bytes used by the adddress table (without counting
   // the tokens).
-  size_t addr_bytes() const { return buf_.size() + index_.size() * 8; }
+  size_t addr_bytes() const { return sym_buf_size_ + index_size_ * 8; }
 
   // Returns the total memory usage in bytes.
   size_t size_bytes() const { return addr_bytes() + tokens_.size_bytes(); }
 
+  // True if the tables live in a mapped cache file rather than on the heap.
+  bool is_mapped() const { return mapped_ != nullptr; }
+
   // Token table.
   class TokenTable {
    public:
@@ -149,14 +184,26 @@ class KernelSymbolMap {
     ~TokenTable();
     TokenId Add(const std::string&);
     base::StringView Lookup(TokenId);
-    size_t size_bytes() const { return buf_.size() + index_.size() * 4; }
+    size_t size_bytes() const { return buf_size_ + index_size_ * 4; }
 
     void shrink_to_fit() {
       buf_.shrink_to_fit();
       index_.shrink_to_fit();
+      UpdateViews();
     }
 
    private:
+    friend class KernelSymbolMap;
+
+    // Makes the table use memory owned by someone else (the mapped cache
+    // file) rather than |buf_| and |index_|.
+    void SetExternalStorage(const char* buf,
+                            size_t buf_size,
+                            const uint32_t* index,
+                            size_t index_size,
+                            TokenId num_tokens);
+    void UpdateViews();
+
     TokenId num_tokens_ = 0;
 
     std::vector<char> buf_;  // Token buffer.
@@ -164,19 +211,40 @@ class KernelSymbolMap {
     // The value i-th in the vector contains the offset (within |buf_|) of the
     // (i * kTokenIndexSamplinig)-th token.
     std::vector<uint32_t> index_;
+
+    // What Lookup() reads: either |buf_| and |index_| or external storage.
+    const char* buf_data_ = nullptr;
+    size_t buf_size_ = 0;
+    const uint32_t* index_data_ = nullptr;
+    size_t index_size_ = 0;
   };
 
  private:
+  KernelSymbolMap(const KernelSymbolMap&) = delete;
+  KernelSymbolMap& operator=(const KernelSymbolMap&) = delete;
+
   TokenTable tokens_;  // Token table.
 
   uint64_t base_addr_ = 0;    // Address of the first symbol (after sorting).
   size_t num_syms_ = 0;       // Number of valid symbols stored.
   std::vector<uint8_t> buf_;  // Symbol buffer.
 
-  // The key is (address - base_addr_), the value is the byte offset in |buf_|
-  // where the symbol entry starts (i.e. the start of the varint that tells the
-  // delta from the previous symbol).
-  std::vector<std::pair<uint32_t /*rel_addr*/, uint32_t /*offset*/>> index_;
+  // The i-th entries are (address - base_addr_) of the
+  // (i * kSymIndexSampling)-th symbol and the byte offset in |buf_| where
+  // its entry starts (i.e. the start of the varint that tells the delta from
+  // the previous symbol).
+  std::vector<uint32_t> index_addrs_;
+  std::vector<uint32_t> index_offs_;
+
+  // What Lookup() reads: either the vectors above or the mapped cache file.
+  const uint8_t* sym_buf_ = nullptr;
+  size_t sym_buf_size_ = 0;
+  const uint32_t* index_addrs_data_ = nullptr;
+  const uint32_t* index_offs_data_ = nullptr;
+  size_t index_size_ = 0;
+
+  void* mapped_ = nullptr;
+  size_t mapped_size_ = 0;
 };
 
 }  // namespace perfetto
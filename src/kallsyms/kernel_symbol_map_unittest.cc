@@ -16,6 +16,9 @@
 
 #include "src/kallsyms/kernel_symbol_map.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cinttypes>
 #include <random>
 #include <unordered_map>
@@ -160,5 +163,63 @@ TEST(KernelSymbolMapTest, GoldenTest) {
   }
 }
 
+TEST(KernelSymbolMapTest, CacheFile) {
+  base::TempFile tmp = base::TempFile::Create();
+  static const char kContents[] =
+      "ffffff8f73e2fa10 t one\n"
+      "ffffff8f73e2fa20 t two_\n"
+      "ffffff8f73e2fa30 T _three\n"
+      "ffffff8f73e2fa40 t _fo_ur_\n"
+      "ffffff8f73e2fa50 r _rodata\n"
+      "ffffff8f73e2fa60 t __si__x__\n";
+  base::WriteAll(tmp.fd(), kContents, sizeof(kContents));
+  base::FlushFile(tmp.fd());
+
+  KernelSymbolMap parsed;
+  ASSERT_EQ(parsed.Parse(tmp.path().c_str()), 5u);
+  base::TempDir cache_dir = base::TempDir::Create();
+  std::string cache_path = cache_dir.path() + "/kallsyms.cache";
+  ASSERT_TRUE(parsed.SaveToFile(cache_path, 42));
+  struct stat st;
+  ASSERT_EQ(stat(cache_path.c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0077, 0u);
+
+  KernelSymbolMap mapped;
+  ASSERT_TRUE(mapped.LoadFromFile(cache_path, 42));
+  EXPECT_TRUE(mapped.is_mapped());
+  EXPECT_EQ(mapped.num_syms(), 5u);
+  EXPECT_EQ(mapped.size_bytes(), parsed.size_bytes());
+  for (uint64_t addr = 0xffffff8f73e2fa00ULL; addr < 0xffffff8f73e2fa70ULL;
+       addr++) {
+    ASSERT_EQ(mapped.Lookup(addr), parsed.Lookup(addr));
+  }
+  EXPECT_EQ(mapped.Lookup(0xffffff8f73e2fa48ULL), "_fo_ur_");
+  EXPECT_EQ(mapped.Lookup(0xffffff8f73e2fa61ULL), "__si__x__");
+
+  // A different kernel.
+  KernelSymbolMap other_key;
+  EXPECT_FALSE(other_key.LoadFromFile(cache_path, 43));
+  EXPECT_EQ(other_key.num_syms(), 0u);
+  EXPECT_EQ(other_key.Lookup(0xffffff8f73e2fa10ULL), "");
+
+  // A file that others could have tampered with.
+  ASSERT_EQ(chmod(cache_path.c_str(), 0620), 0);
+  KernelSymbolMap group_writable;
+  EXPECT_FALSE(group_writable.LoadFromFile(cache_path, 42));
+  EXPECT_EQ(group_writable.num_syms(), 0u);
+  ASSERT_EQ(chmod(cache_path.c_str(), 0600), 0);
+
+  // A truncated file.
+  std::string data;
+  ASSERT_TRUE(base::ReadFile(cache_path, &data));
+  ASSERT_EQ(truncate(cache_path.c_str(), static_cast<off_t>(data.size() - 1)),
+            0);
+  KernelSymbolMap truncated;
+  EXPECT_FALSE(truncated.LoadFromFile(cache_path, 42));
+  EXPECT_EQ(truncated.num_syms(), 0u);
+
+  unlink(cache_path.c_str());
+}
+
 }  // namespace
 }  // namespace perfetto
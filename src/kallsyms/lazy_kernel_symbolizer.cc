@@ -18,12 +18,18 @@
 
 #include <string>
 
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/no_destructor.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 
@@ -38,6 +44,12 @@ namespace {
 const char kKallsymsPath[] = "/proc/kallsyms";
 const char kPtrRestrictPath[] = "/proc/sys/kernel/kptr_restrict";
 const char kLowerPtrRestrictAndroidProp[] = "security.lower_kptr_restrict";
+const char kCacheFileName[] = "kallsyms.cache";
+
+std::string& CacheDir() {
+  static base::NoDestructor<std::string> cache_dir;
+  return cache_dir.ref();
+}
 
 // This class takes care of temporarily lowering kptr_restrict and putting it
 // back to the original value if necessary. It solves the following problem:
@@ -156,10 +168,35 @@ KernelSymbolMap* LazyKernelSymbolizer::GetOrCreateKernelSymbolMap() {
 
   symbol_map_.reset(new KernelSymbolMap());
 
-  // If kptr_restrict is set, try temporarily lifting it (it works only if
-  // traced_probes is run as a privileged user).
-  ScopedKptrUnrestrict kptr_unrestrict;
-  symbol_map_->Parse(kKallsymsPath);
+  std::string cache_path;
+  uint64_t key = 0;
+  if (!CacheDir().empty()) {
+    // Only the current user should be able to replace the cache file.
+    if (mkdir(CacheDir().c_str(), 0700) != 0 && errno != EEXIST)
+      PERFETTO_PLOG("Failed to create %s", CacheDir().c_str());
+    cache_path = CacheDir() + "/" + kCacheFileName;
+    key = ComputeKernelKey();
+    if (symbol_map_->LoadFromFile(cache_path, key))
+      return symbol_map_.get();
+  }
+
+  {
+    // If kptr_restrict is set, try temporarily lifting it (it works only if
+    // traced_probes is run as a privileged user).
+    ScopedKptrUnrestrict kptr_unrestrict;
+    symbol_map_->Parse(kKallsymsPath);
+  }
+
+  if (!cache_path.empty() && symbol_map_->num_syms() > 0 &&
+      symbol_map_->SaveToFile(cache_path, key)) {
+    // Switch to the mapped copy, so that its pages can be shared with other
+    // processes and the heap copy can be freed.
+    std::unique_ptr<KernelSymbolMap> mapped(new KernelSymbolMap());
+    if (mapped->LoadFromFile(cache_path, key)) {
+      symbol_map_ = std::move(mapped);
+      base::MaybeReleaseAllocatorMemToOS();
+    }
+  }
   return symbol_map_.get();
 }
 
@@ -169,6 +206,43 @@ void LazyKernelSymbolizer::Destroy() {
   base::MaybeReleaseAllocatorMemToOS();  // For Scudo, b/170217718.
 }
 
+// static
+void LazyKernelSymbolizer::SetCacheDir(const std::string& dir) {
+  CacheDir() = dir;
+}
+
+// static
+uint64_t LazyKernelSymbolizer::ComputeKernelKey() {
+  base::Hash hash;
+  std::string str;
+
+  // The ELF notes of the kernel image, which include its GNU build id.
+  if (base::ReadFile("/sys/kernel/notes", &str))
+    hash.Update(str.data(), str.size());
+  struct utsname uts {};
+  if (uname(&uts) == 0) {
+    hash.Update(uts.release);
+    hash.Update(uts.version);
+  }
+
+  // KASLR relocates the kernel at every boot.
+  str.clear();
+  if (base::ReadFile("/proc/sys/kernel/random/boot_id", &str))
+    hash.Update(str.data(), str.size());
+
+  // The set of loaded modules. Only the name and size columns are used, as
+  // the load addresses are masked or not depending on kptr_restrict.
+  str.clear();
+  if (base::ReadFile("/proc/modules", &str)) {
+    for (base::StringSplitter lines(std::move(str), '\n'); lines.Next();) {
+      base::StringSplitter cols(&lines, ' ');
+      for (int i = 0; i < 2 && cols.Next(); i++)
+        hash.Update(cols.cur_token(), cols.cur_token_size() + 1);
+    }
+  }
+  return hash.digest();
+}
+
 // static
 bool LazyKernelSymbolizer::CanReadKernelSymbolAddresses(
     const char* ksyms_path_for_testing) {
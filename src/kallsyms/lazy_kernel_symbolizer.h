@@ -17,7 +17,10 @@
 #ifndef SRC_KALLSYMS_LAZY_KERNEL_SYMBOLIZER_H_
 #define SRC_KALLSYMS_LAZY_KERNEL_SYMBOLIZER_H_
 
+#include <stdint.h>
+
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/base/thread_checker.h"
 
@@ -36,6 +39,12 @@ class KernelSymbolMap;
 // this way all CpuReader instances can share the same symbol map instance.
 // The object being shared is LazyKernelSymbolizer, which is cheap and always
 // valid. LazyKernelSymbolizer may or may not contain a valid symbol map.
+//
+// If a cache directory is set, the parsed map is also saved there and mapped
+// back, so that further instances skip parsing /proc/kallsyms altogether as
+// long as the kernel, its modules and the boot (i.e. KASLR) are the same.
+// The file is only shared with other processes running as the same user
+// (e.g. traced_probes and traced_perf on Linux, if both run as root).
 class LazyKernelSymbolizer {
  public:
   // Constructs an empty instance. Does NOT load any symbols upon construction.
@@ -52,6 +61,17 @@ class LazyKernelSymbolizer {
   // GetOrCreateKernelSymbolMap() will create it again.
   void Destroy();
 
+  // Sets the directory where the kallsyms cache file is kept. Must be called
+  // before any symbolizer is used. The directory must be writable only by
+  // trusted processes, as the cached symbols are used as-is. The directory and
+  // the file are private to the current user, so daemons running as different
+  // users (e.g. on Android) must each be given their own directory.
+  static void SetCacheDir(const std::string& dir);
+
+  // Returns a key identifying the running kernel image, its modules and the
+  // current boot. Exposed for testing.
+  static uint64_t ComputeKernelKey();
+
   // Exposed for testing.
   static bool CanReadKernelSymbolAddresses(
       const char* ksyms_path_for_testing = nullptr);
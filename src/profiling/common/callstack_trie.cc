@@ -16,6 +16,8 @@
 
 #include "src/profiling/common/callstack_trie.h"
 
+#include <algorithm>
+#include <new>
 #include <vector>
 
 #include "perfetto/ext/base/string_splitter.h"
@@ -29,11 +31,24 @@ GlobalCallstackTrie::Node* GlobalCallstackTrie::GetOrCreateChild(
     Node* self,
     const Interned<Frame>& loc) {
   Node* child = self->GetChild(loc);
-  if (!child)
-    child = self->AddChild(loc, ++next_callstack_id_, self);
+  if (!child) {
+    child = node_arena_.New(loc, ++next_callstack_id_, self);
+    self->AddChild(child);
+  }
   return child;
 }
 
+void GlobalCallstackTrie::DeleteChildren(Node* node) {
+  for (Node* child : node->children_)
+    DeleteNode(child);
+  node->children_.clear();
+}
+
+void GlobalCallstackTrie::DeleteNode(Node* node) {
+  DeleteChildren(node);
+  node_arena_.Delete(node);
+}
+
 std::vector<Interned<Frame>> GlobalCallstackTrie::BuildInverseCallstack(
     const Node* node) const {
   std::vector<Interned<Frame>> res;
@@ -84,16 +99,21 @@ void GlobalCallstackTrie::IncrementNode(Node* node) {
 void GlobalCallstackTrie::DecrementNode(Node* node) {
   PERFETTO_DCHECK(node->ref_count_ >= 1);
 
-  bool delete_prev = false;
+  // All the descendants of an unreferenced node are unreferenced as well, so
+  // only the closest one to the root needs to be removed from its parent.
+  Node* unreferenced = nullptr;
   Node* prev = nullptr;
   while (node != nullptr) {
-    if (delete_prev)
-      node->RemoveChild(prev);
     node->ref_count_ -= 1;
-    delete_prev = node->ref_count_ == 0;
+    if (node->ref_count_ == 0 && node->parent_ != nullptr)
+      unreferenced = node;
     prev = node;
     node = node->parent_;
   }
+  if (unreferenced) {
+    unreferenced->parent_->RemoveChild(unreferenced);
+    static_cast<RootNode*>(prev)->trie->DeleteNode(unreferenced);
+  }
 }
 
 Interned<Frame> GlobalCallstackTrie::InternCodeLocation(
@@ -126,29 +146,58 @@ Interned<Frame> GlobalCallstackTrie::MakeRootFrame() {
   return frame_interner_.Intern(frame);
 }
 
-GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::AddChild(
-    const Interned<Frame>& loc,
-    uint64_t callstack_id,
-    Node* parent) {
-  auto it = children_.emplace(loc, callstack_id, parent);
-  return const_cast<Node*>(&(*it.first));
+void GlobalCallstackTrie::Node::AddChild(Node* child) {
+  auto it = std::lower_bound(children_.begin(), children_.end(), child,
+                             [](const Node* one, const Node* other) {
+                               return one->location_ < other->location_;
+                             });
+  PERFETTO_DCHECK(it == children_.end() ||
+                  !((*it)->location_ == child->location_));
+  children_.insert(it, child);
 }
-void GlobalCallstackTrie::Node::RemoveChild(Node* node) {
-  children_.erase(*node);
+
+void GlobalCallstackTrie::Node::RemoveChild(Node* child) {
+  auto it = std::find(children_.begin(), children_.end(), child);
+  PERFETTO_DCHECK(it != children_.end());
+  children_.erase(it);
+  if (children_.empty())
+    children_.shrink_to_fit();
 }
 
 GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::GetChild(
     const Interned<Frame>& loc) {
-  // This will be nicer with C++14 transparent comparators.
-  // Then we will be able to look up by just the key using a sutiable
-  // comparator.
-  //
-  // For now we need to allow to construct Node from the key.
-  Node node(loc);
-  auto it = children_.find(node);
-  if (it == children_.end())
+  auto it = std::lower_bound(
+      children_.begin(), children_.end(), loc,
+      [](const Node* node, const Interned<Frame>& l) {
+        return node->location_ < l;
+      });
+  if (it == children_.end() || !((*it)->location_ == loc))
     return nullptr;
-  return const_cast<Node*>(&(*it));
+  return *it;
+}
+
+GlobalCallstackTrie::Node* GlobalCallstackTrie::NodeArena::New(
+    Interned<Frame> frame,
+    uint64_t id,
+    Node* parent) {
+  Slot* slot = free_list_;
+  if (slot) {
+    free_list_ = slot->next_free;
+  } else {
+    if (used_in_last_chunk_ == kNodesPerChunk) {
+      chunks_.emplace_back(new Slot[kNodesPerChunk]);
+      used_in_last_chunk_ = 0;
+    }
+    slot = &chunks_.back()[used_in_last_chunk_++];
+  }
+  return new (slot->node) Node(std::move(frame), id, parent);
+}
+
+void GlobalCallstackTrie::NodeArena::Delete(Node* node) {
+  node->~Node();
+  Slot* slot = reinterpret_cast<Slot*>(node);
+  slot->next_free = free_list_;
+  free_list_ = slot;
 }
 
 }  // namespace profiling
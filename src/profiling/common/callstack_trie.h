@@ -17,7 +17,7 @@
 #ifndef SRC_PROFILING_COMMON_CALLSTACK_TRIE_H_
 #define SRC_PROFILING_COMMON_CALLSTACK_TRIE_H_
 
-#include <set>
+#include <memory>
 #include <string>
 #include <typeindex>
 #include <vector>
@@ -80,7 +80,8 @@ struct Frame {
 // GlobalCallstackTrie::Node that is owned by the parent callsite. Each node has
 // a pointer to its parent, which means the function call-graph can be
 // reconstructed from a GlobalCallstackTrie::Node by walking down the parent
-// chain.
+// chain. The nodes are allocated from an arena owned by the trie, and keep
+// their children in a sorted array of pointers.
 //
 // For the following two callstacks:
 //  * libc_init -> main -> foo -> alloc_buf
@@ -105,47 +106,30 @@ class GlobalCallstackTrie {
     // This is opaque except to GlobalCallstackTrie.
     friend class GlobalCallstackTrie;
 
-    // Allow building a node out of a frame for GetChild.
-    explicit Node(Interned<Frame> frame) : Node(frame, 0, nullptr) {}
-    Node(const Node&) = default;
-    Node(Node&&) = default;
-
-    Node(Interned<Frame> frame, uint64_t id)
-        : Node(std::move(frame), id, nullptr) {}
     Node(Interned<Frame> frame, uint64_t id, Node* parent)
         : id_(id), parent_(parent), location_(frame) {}
+    Node(const Node&) = delete;
+    Node& operator=(const Node&) = delete;
 
     ~Node() { PERFETTO_DCHECK(!ref_count_); }
 
     uint64_t id() const { return id_; }
 
    private:
-    Node* GetOrCreateChild(const Interned<Frame>& loc);
-    // Deletes all descendant nodes, regardless of |ref_count_|.
-    void DeleteChildren() { children_.clear(); }
+    void AddChild(Node* child);
+    void RemoveChild(Node* child);
+    Node* GetChild(const Interned<Frame>& loc);
 
     uint64_t ref_count_ = 0;
     uint64_t id_;
     Node* const parent_;
     const Interned<Frame> location_;
-
-    class NodeComparator {
-     public:
-      bool operator()(const Node& one, const Node& other) const {
-        return one.location_ < other.location_;
-      }
-    };
-    Node* AddChild(const Interned<Frame>& loc,
-                   uint64_t next_callstack_id_,
-                   Node* parent);
-    void RemoveChild(Node* node);
-    Node* GetChild(const Interned<Frame>& loc);
-
-    std::set<Node, NodeComparator> children_;
+    // Sorted by location_.
+    std::vector<Node*> children_;
   };
 
   GlobalCallstackTrie() = default;
-  ~GlobalCallstackTrie() = default;
+  ~GlobalCallstackTrie() { DeleteChildren(&root_); }
   GlobalCallstackTrie(const GlobalCallstackTrie&) = delete;
   GlobalCallstackTrie& operator=(const GlobalCallstackTrie&) = delete;
 
@@ -170,11 +154,48 @@ class GlobalCallstackTrie {
   // of nodes (Node.ref_count_).
   void ClearTrie() {
     PERFETTO_DLOG("Clearing trie");
-    root_.DeleteChildren();
+    DeleteChildren(&root_);
   }
 
  private:
+  // Hands out the memory for the Nodes in chunks of kNodesPerChunk, reusing
+  // the one of deleted Nodes. This saves the malloc overhead of every Node,
+  // and keeps the nodes of a trie close to each other.
+  class NodeArena {
+   public:
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    Node* New(Interned<Frame> frame, uint64_t id, Node* parent);
+    void Delete(Node* node);
+
+   private:
+    static constexpr size_t kNodesPerChunk = 1024;
+
+    union Slot {
+      Slot* next_free;
+      alignas(Node) unsigned char node[sizeof(Node)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> chunks_;
+    size_t used_in_last_chunk_ = kNodesPerChunk;
+    Slot* free_list_ = nullptr;
+  };
+
+  // The root knows its trie, so that DecrementNode can return the nodes it
+  // removes to the NodeArena.
+  struct RootNode : public Node {
+    RootNode(Interned<Frame> frame, uint64_t id, GlobalCallstackTrie* t)
+        : Node(std::move(frame), id, nullptr), trie(t) {}
+    GlobalCallstackTrie* const trie;
+  };
+
   Node* GetOrCreateChild(Node* self, const Interned<Frame>& loc);
+  // Deletes all descendant nodes of |node|, regardless of |ref_count_|.
+  void DeleteChildren(Node* node);
+  // Deletes |node| and all its descendants.
+  void DeleteNode(Node* node);
 
   Interned<Frame> MakeRootFrame();
 
@@ -184,9 +205,11 @@ class GlobalCallstackTrie {
 
   uint64_t next_callstack_id_ = 0;
 
+  NodeArena node_arena_;
+
   // Note: profile_module in trace processor relies on the value of this root
   // callsite being exactly "1". See the perf_sample parsing code.
-  Node root_{MakeRootFrame(), ++next_callstack_id_};
+  RootNode root_{MakeRootFrame(), ++next_callstack_id_, this};
 };
 
 }  // namespace profiling
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/common/elf_cache.h"
+
+#include <sys/stat.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace profiling {
+
+// static
+constexpr size_t ElfCache::kDefaultMaxEntries;
+
+// static
+ElfCache* ElfCache::GetInstance() {
+  static ElfCache* instance = new ElfCache();
+  return instance;
+}
+
+// static
+base::Optional<ElfCache::Key> ElfCache::KeyForMappedFile(
+    const std::string& path,
+    uint64_t inode) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1 ||
+      static_cast<uint64_t>(st.st_ino) != inode) {
+    return base::nullopt;
+  }
+  int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                     static_cast<int64_t>(st.st_mtim.tv_nsec);
+  return Key{path, 0, static_cast<uint64_t>(st.st_dev), inode, mtime_ns};
+}
+
+ElfCache::ElfCache(size_t max_entries) : max_entries_(max_entries) {}
+
+ElfCache::~ElfCache() = default;
+
+bool ElfCache::Lookup(const Key& key, unwindstack::MapInfo* map_info) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end())
+    return false;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  const Entry& entry = *it->second;
+  PERFETTO_DCHECK(!map_info->elf());
+  map_info->elf() = entry.elf;
+  map_info->set_elf_offset(entry.elf_offset);
+  map_info->set_elf_start_offset(entry.elf_start_offset);
+  return true;
+}
+
+void ElfCache::Insert(const Key& key, unwindstack::MapInfo* map_info) {
+  std::shared_ptr<unwindstack::Elf>& elf = map_info->elf();
+  if (!elf || !elf->valid() || map_info->memory_backed_elf())
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_.count(key))
+    return;
+  entries_.emplace_front(Entry{key, elf, map_info->elf_offset(),
+                               map_info->elf_start_offset()});
+  index_.emplace(key, entries_.begin());
+  if (entries_.size() > max_entries_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+}
+
+void ElfCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.clear();
+  entries_.clear();
+}
+
+size_t ElfCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace profiling
+}  // namespace perfetto
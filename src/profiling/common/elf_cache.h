@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_COMMON_ELF_CACHE_H_
+#define SRC_PROFILING_COMMON_ELF_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+
+#include "perfetto/ext/base/optional.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Cache of the parsed unwindstack::Elf objects (headers, symbols and CFI) of
+// file-backed mappings, shared by the unwinding state of all the profiled
+// processes. Libraries like libc.so or libart.so are mapped by almost every
+// process, and would otherwise be parsed again for each of them.
+//
+// Entries are keyed by the path and offset of the mapping, and by the device,
+// inode and modification time of the file, so that a file that was replaced
+// on disk, or rewritten in place, doesn't match. The Elf objects are
+// refcounted: evicting an entry, least recently used first once there are more
+// than |max_entries|, only drops the reference held by the cache.
+//
+// This class is thread-safe.
+class ElfCache {
+ public:
+  struct Key {
+    std::string path;
+    uint64_t offset;
+    uint64_t dev;
+    uint64_t inode;
+    int64_t mtime_ns;
+
+    bool operator<(const Key& other) const {
+      return std::tie(inode, dev, mtime_ns, offset, path) <
+             std::tie(other.inode, other.dev, other.mtime_ns, other.offset,
+                      other.path);
+    }
+  };
+
+  // Returns the key of the file at |path|, at offset 0, if it is still the
+  // file with |inode| that was mapped. Returns nullopt if it was replaced, or
+  // can't be stat()ed from this process (e.g. it was deleted, or is in another
+  // mount namespace), in which case the Elf must not be shared.
+  static base::Optional<Key> KeyForMappedFile(const std::string& path,
+                                              uint64_t inode);
+
+  static constexpr size_t kDefaultMaxEntries = 512;
+
+  // Process-wide instance, used by the unwinders of both heapprofd and
+  // traced_perf.
+  static ElfCache* GetInstance();
+
+  explicit ElfCache(size_t max_entries = kDefaultMaxEntries);
+  ~ElfCache();
+
+  ElfCache(const ElfCache&) = delete;
+  ElfCache& operator=(const ElfCache&) = delete;
+
+  // If there is an entry for |key|, sets it as the Elf of |map_info|, which
+  // must not have one yet, and returns true.
+  bool Lookup(const Key& key, unwindstack::MapInfo* map_info);
+
+  // Adds the Elf of |map_info|, which must have been loaded already.
+  // Elf objects that are invalid, or were read from the memory of the process
+  // rather than from the file, are not cached.
+  void Insert(const Key& key, unwindstack::MapInfo* map_info);
+
+  void Clear();
+
+  size_t size();
+
+ private:
+  struct Entry {
+    Key key;
+    std::shared_ptr<unwindstack::Elf> elf;
+    uint64_t elf_offset;
+    uint64_t elf_start_offset;
+  };
+
+  const size_t max_entries_;
+  std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  std::map<Key, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_COMMON_ELF_CACHE_H_
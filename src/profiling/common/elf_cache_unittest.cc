@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/common/elf_cache.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kSelfExe[] = "/proc/self/exe";
+
+// Returns a map of |path| with its Elf loaded.
+std::shared_ptr<unwindstack::MapInfo> LoadedMap(const std::string& path) {
+  std::shared_ptr<unwindstack::MapInfo> map_info = unwindstack::MapInfo::Create(
+      0x1000, 0x2000, 0, PROT_READ | PROT_EXEC, std::string(path));
+  map_info->GetElf(unwindstack::Memory::CreateProcessMemory(getpid()),
+                   unwindstack::Regs::CurrentArch());
+  return map_info;
+}
+
+ElfCache::Key Key(uint64_t inode) {
+  return ElfCache::Key{kSelfExe, /*offset=*/0, /*dev=*/0, inode,
+                       /*mtime_ns=*/0};
+}
+
+std::shared_ptr<unwindstack::MapInfo> EmptyMap() {
+  return unwindstack::MapInfo::Create(0x1000, 0x2000, 0, PROT_READ | PROT_EXEC,
+                                      kSelfExe);
+}
+
+TEST(ElfCacheTest, LookupSharesElf) {
+  ElfCache cache;
+  auto loaded = LoadedMap(kSelfExe);
+  ASSERT_TRUE(loaded->elf());
+  ASSERT_TRUE(loaded->elf()->valid());
+  cache.Insert(Key(1), loaded.get());
+  EXPECT_EQ(cache.size(), 1u);
+
+  auto map = EmptyMap();
+  ASSERT_TRUE(cache.Lookup(Key(1), map.get()));
+  EXPECT_EQ(map->elf(), loaded->elf());
+
+  // A different inode means that the file was replaced.
+  auto other_map = EmptyMap();
+  EXPECT_FALSE(cache.Lookup(Key(2), other_map.get()));
+  EXPECT_FALSE(other_map->elf());
+}
+
+TEST(ElfCacheTest, EvictsLeastRecentlyUsed) {
+  ElfCache cache(/*max_entries=*/2);
+  auto loaded = LoadedMap(kSelfExe);
+  cache.Insert(Key(1), loaded.get());
+  cache.Insert(Key(2), loaded.get());
+  auto map = EmptyMap();
+  ASSERT_TRUE(cache.Lookup(Key(1), map.get()));
+
+  cache.Insert(Key(3), loaded.get());
+  EXPECT_EQ(cache.size(), 2u);
+  EXPECT_TRUE(cache.Lookup(Key(1), EmptyMap().get()));
+  EXPECT_FALSE(cache.Lookup(Key(2), EmptyMap().get()));
+  EXPECT_TRUE(cache.Lookup(Key(3), EmptyMap().get()));
+
+  // Evicted Elf objects stay alive for the maps that use them.
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0u);
+  EXPECT_TRUE(map->elf()->valid());
+}
+
+TEST(ElfCacheTest, IgnoresInvalidElf) {
+  base::TempFile tmp = base::TempFile::Create();
+  ASSERT_EQ(base::WriteAll(tmp.fd(), "not an elf", 10), 10);
+  ElfCache cache;
+  auto loaded = LoadedMap(tmp.path());
+  cache.Insert({tmp.path(), 0, 0, 1, 0}, loaded.get());
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(ElfCacheTest, KeyForMappedFile) {
+  base::TempFile tmp = base::TempFile::Create();
+  struct stat st;
+  ASSERT_EQ(fstat(tmp.fd(), &st), 0);
+  uint64_t inode = static_cast<uint64_t>(st.st_ino);
+
+  base::Optional<ElfCache::Key> key =
+      ElfCache::KeyForMappedFile(tmp.path(), inode);
+  ASSERT_TRUE(key);
+  EXPECT_EQ(key->path, tmp.path());
+  EXPECT_EQ(key->dev, static_cast<uint64_t>(st.st_dev));
+  EXPECT_EQ(key->inode, inode);
+
+  // The file at the path isn't the one that was mapped anymore.
+  EXPECT_FALSE(ElfCache::KeyForMappedFile(tmp.path(), inode + 1));
+
+  // A file rewritten in place keeps its inode, but not its key.
+  struct timespec times[2] = {{1, 0}, {1, 0}};
+  ASSERT_EQ(futimens(tmp.fd(), times), 0);
+  base::Optional<ElfCache::Key> rewritten_key =
+      ElfCache::KeyForMappedFile(tmp.path(), inode);
+  ASSERT_TRUE(rewritten_key);
+  EXPECT_TRUE(*key < *rewritten_key || *rewritten_key < *key);
+
+  std::string path = tmp.path();
+  tmp.Unlink();
+  EXPECT_FALSE(ElfCache::KeyForMappedFile(path, inode));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
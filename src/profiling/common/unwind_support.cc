@@ -55,7 +55,8 @@ size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
   return static_cast<size_t>(rd);
 }
 
-FDMaps::FDMaps(base::ScopedFile fd) : fd_(std::move(fd)) {}
+FDMaps::FDMaps(base::ScopedFile fd, ElfCache* elf_cache)
+    : fd_(std::move(fd)), elf_cache_(elf_cache) {}
 
 bool FDMaps::Parse() {
   // If the process has already exited, lseek or ReadFileDescriptor will
@@ -69,6 +70,10 @@ bool FDMaps::Parse() {
 
   unwindstack::SharedString name("");
   std::shared_ptr<unwindstack::MapInfo> prev_map;
+  // Consecutive maps of the same file share the stat() of the file.
+  std::string file_name;
+  uint64_t file_inode = 0;
+  base::Optional<ElfCache::Key> file_key;
   return android::procinfo::ReadMapFileContent(
       &content[0], [&](const android::procinfo::MapInfo& mapinfo) {
         // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
@@ -84,16 +89,61 @@ bool FDMaps::Parse() {
         maps_.emplace_back(unwindstack::MapInfo::Create(
             prev_map, mapinfo.start, mapinfo.end, mapinfo.pgoff, flags, name));
         prev_map = maps_.back();
+        // Anonymous and device maps have no file to share the Elf of.
+        if (!elf_cache_ || mapinfo.inode == 0 ||
+            (flags & unwindstack::MAPS_FLAGS_DEVICE_MAP) != 0) {
+          return;
+        }
+        if (mapinfo.name != file_name || mapinfo.inode != file_inode) {
+          file_name = mapinfo.name;
+          file_inode = mapinfo.inode;
+          file_key = ElfCache::KeyForMappedFile(file_name, file_inode);
+        }
+        if (!file_key)
+          return;
+        ElfCache::Key key = *file_key;
+        key.offset = mapinfo.pgoff;
+        bool from_cache = elf_cache_->Lookup(key, prev_map.get());
+        pending_elfs_.emplace(prev_map.get(),
+                              PendingElf{std::move(key), from_cache});
       });
 }
 
 void FDMaps::Reset() {
+  pending_elfs_.clear();
   maps_.clear();
 }
 
+void FDMaps::CacheLoadedElfs(
+    const std::vector<unwindstack::FrameData>& frames,
+    const std::shared_ptr<unwindstack::Memory>& memory,
+    unwindstack::ArchEnum arch) {
+  if (pending_elfs_.empty())
+    return;
+  for (const unwindstack::FrameData& frame : frames) {
+    if (!frame.map_info)
+      continue;
+    auto it = pending_elfs_.find(frame.map_info.get());
+    if (it == pending_elfs_.end())
+      continue;
+    if (it->second.from_cache) {
+      elf_cache_hits_++;
+    } else {
+      // The Elf has been loaded by the unwind already. Going through GetElf
+      // synchronizes with other threads unwinding with the same MapInfo.
+      unwindstack::MapInfo* map_info = frame.map_info.get();
+      map_info->GetElf(memory, arch);
+      elf_cache_->Insert(it->second.key, map_info);
+      elf_cache_misses_++;
+    }
+    pending_elfs_.erase(it);
+  }
+}
+
 UnwindingMetadata::UnwindingMetadata(base::ScopedFile maps_fd,
-                                     base::ScopedFile mem_fd)
-    : fd_maps(std::move(maps_fd)),
+                                     base::ScopedFile mem_fd,
+                                     ElfCache* elf_cache)
+    : fd_maps(std::move(maps_fd), elf_cache),
       fd_mem(std::make_shared<FDMemory>(std::move(mem_fd))) {
   if (!fd_maps.Parse())
     PERFETTO_DLOG("Failed initial maps parse");
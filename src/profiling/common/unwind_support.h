@@ -22,6 +22,8 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <unwindstack/Maps.h>
 #include <unwindstack/Unwinder.h>
@@ -33,23 +35,38 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "src/profiling/common/elf_cache.h"
 
 namespace perfetto {
 namespace profiling {
 
 // Read /proc/[pid]/maps from an open file descriptor.
+//
+// If |elf_cache| is set, the parsed file-backed maps reuse the Elf objects
+// from it, and CacheLoadedElfs adds the ones that unwinds had to load.
 class FDMaps : public unwindstack::Maps {
  public:
-  explicit FDMaps(base::ScopedFile fd);
+  explicit FDMaps(base::ScopedFile fd, ElfCache* elf_cache = nullptr);
 
   FDMaps(const FDMaps&) = delete;
   FDMaps& operator=(const FDMaps&) = delete;
 
-  FDMaps(FDMaps&& m) : Maps(std::move(m)) { fd_ = std::move(m.fd_); }
+  FDMaps(FDMaps&& m) : Maps(std::move(m)) {
+    fd_ = std::move(m.fd_);
+    elf_cache_ = m.elf_cache_;
+    pending_elfs_ = std::move(m.pending_elfs_);
+    elf_cache_hits_ = m.elf_cache_hits_;
+    elf_cache_misses_ = m.elf_cache_misses_;
+  }
 
   FDMaps& operator=(FDMaps&& m) {
-    if (&m != this)
+    if (&m != this) {
       fd_ = std::move(m.fd_);
+      elf_cache_ = m.elf_cache_;
+      pending_elfs_ = std::move(m.pending_elfs_);
+      elf_cache_hits_ = m.elf_cache_hits_;
+      elf_cache_misses_ = m.elf_cache_misses_;
+    }
     Maps::operator=(std::move(m));
     return *this;
   }
@@ -59,8 +76,31 @@ class FDMaps : public unwindstack::Maps {
   bool Parse() override;
   void Reset();
 
+  // Accounts for the maps of |frames| that are used for the first time since
+  // the last Parse(): if their Elf was loaded by the unwind rather than taken
+  // from the cache, it is added to the cache.
+  void CacheLoadedElfs(const std::vector<unwindstack::FrameData>& frames,
+                       const std::shared_ptr<unwindstack::Memory>& memory,
+                       unwindstack::ArchEnum arch);
+
+  // Number of maps whose Elf was reused from the cache, and loaded from the
+  // file, respectively. Each map is counted once per Parse().
+  uint64_t elf_cache_hits() const { return elf_cache_hits_; }
+  uint64_t elf_cache_misses() const { return elf_cache_misses_; }
+
  private:
+  struct PendingElf {
+    ElfCache::Key key;
+    bool from_cache;
+  };
+
   base::ScopedFile fd_;
+  ElfCache* elf_cache_;
+  // Cacheable maps not used by an unwind yet. The MapInfos are owned by
+  // |maps_|, so this has to be cleared whenever they are.
+  std::unordered_map<const unwindstack::MapInfo*, PendingElf> pending_elfs_;
+  uint64_t elf_cache_hits_ = 0;
+  uint64_t elf_cache_misses_ = 0;
 };
 
 class FDMemory : public unwindstack::Memory {
@@ -91,7 +131,9 @@ class StackOverlayMemory : public unwindstack::Memory {
 };
 
 struct UnwindingMetadata {
-  UnwindingMetadata(base::ScopedFile maps_fd, base::ScopedFile mem_fd);
+  UnwindingMetadata(base::ScopedFile maps_fd,
+                    base::ScopedFile mem_fd,
+                    ElfCache* elf_cache = nullptr);
 
   // move-only
   UnwindingMetadata(const UnwindingMetadata&) = delete;
@@ -109,6 +151,12 @@ struct UnwindingMetadata {
 
   const std::string& GetBuildId(const unwindstack::FrameData& frame);
 
+  // See FDMaps::CacheLoadedElfs. To be called with the frames of each unwind.
+  void CacheLoadedElfs(const std::vector<unwindstack::FrameData>& frames,
+                       unwindstack::ArchEnum arch) {
+    fd_maps.CacheLoadedElfs(frames, fd_mem, arch);
+  }
+
   std::string empty_string_;
   FDMaps fd_maps;
   // The API of libunwindstack expects shared_ptr for Memory.
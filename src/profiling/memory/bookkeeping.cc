@@ -53,9 +53,9 @@ void HeapTracker::RecordMalloc(
     }
   }
 
-  auto it = allocations_.find(address);
-  if (it != allocations_.end()) {
-    Allocation& alloc = it->second;
+  Allocation* existing = allocations_.Find(address);
+  if (existing) {
+    Allocation& alloc = *existing;
     PERFETTO_DCHECK(alloc.sequence_number != sequence_number);
     if (alloc.sequence_number < sequence_number) {
       // As we are overwriting the previous allocation, the previous allocation
@@ -81,9 +81,9 @@ void HeapTracker::RecordMalloc(
     }
   } else {
     GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(frames);
-    allocations_.emplace(address,
-                         Allocation(sample_size, alloc_size, sequence_number,
-                                    MaybeCreateCallstackAllocations(node)));
+    allocations_.Insert(address,
+                        Allocation(sample_size, alloc_size, sequence_number,
+                                   MaybeCreateCallstackAllocations(node)));
   }
 
   RecordOperation(sequence_number, {address, timestamp});
@@ -92,7 +92,7 @@ void HeapTracker::RecordMalloc(
 void HeapTracker::RecordOperation(uint64_t sequence_number,
                                   const PendingOperation& operation) {
   if (sequence_number != committed_sequence_number_ + 1) {
-    pending_operations_.emplace(sequence_number, operation);
+    pending_operations_.Insert(sequence_number, operation);
     return;
   }
 
@@ -100,11 +100,14 @@ void HeapTracker::RecordOperation(uint64_t sequence_number,
 
   // At this point some other pending operations might be eligible to be
   // committed.
-  auto it = pending_operations_.begin();
-  while (it != pending_operations_.end() &&
-         it->first == committed_sequence_number_ + 1) {
-    CommitOperation(it->first, it->second);
-    it = pending_operations_.erase(it);
+  while (pending_operations_.size() > 0) {
+    uint64_t next_sequence_number = committed_sequence_number_ + 1;
+    PendingOperation* next = pending_operations_.Find(next_sequence_number);
+    if (!next)
+      break;
+    PendingOperation next_operation = *next;
+    pending_operations_.Erase(next_sequence_number);
+    CommitOperation(next_sequence_number, next_operation);
   }
 }
 
@@ -117,16 +120,16 @@ void HeapTracker::CommitOperation(uint64_t sequence_number,
   uint64_t address = operation.allocation_address;
 
   // We will see many frees for addresses we do not know about.
-  auto leaf_it = allocations_.find(address);
-  if (leaf_it == allocations_.end())
+  Allocation* leaf = allocations_.Find(address);
+  if (!leaf)
     return;
 
-  Allocation& value = leaf_it->second;
+  Allocation& value = *leaf;
   if (value.sequence_number == sequence_number) {
     AddToCallstackAllocations(operation.timestamp, value);
   } else if (value.sequence_number < sequence_number) {
     SubtractFromCallstackAllocations(value);
-    allocations_.erase(leaf_it);
+    allocations_.Erase(address);
   }
   // else (value.sequence_number > sequence_number:
   //  This allocation has been replaced by a newer one in RecordMalloc.
@@ -146,11 +149,12 @@ uint64_t HeapTracker::GetSizeForTesting(
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  std::unique_ptr<CallstackAllocations>* alloc_ptr =
+      callstack_allocations_.Find(node);
+  if (!alloc_ptr) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **alloc_ptr;
   return alloc.value.totals.allocated - alloc.value.totals.freed;
 }
 
@@ -164,11 +168,12 @@ uint64_t HeapTracker::GetMaxForTesting(
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  std::unique_ptr<CallstackAllocations>* alloc_ptr =
+      callstack_allocations_.Find(node);
+  if (!alloc_ptr) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **alloc_ptr;
   return alloc.value.retain_max.max;
 }
 
@@ -182,11 +187,12 @@ uint64_t HeapTracker::GetMaxCountForTesting(
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  std::unique_ptr<CallstackAllocations>* alloc_ptr =
+      callstack_allocations_.Find(node);
+  if (!alloc_ptr) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **alloc_ptr;
   return alloc.value.retain_max.max_count;
 }
 
@@ -17,10 +17,11 @@
 #ifndef SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 #define SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 
-#include <map>
+#include <memory>
 #include <vector>
 
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/profiling/common/callstack_trie.h"
 #include "src/profiling/common/interner.h"
 #include "src/profiling/memory/unwound_messages.h"
@@ -89,6 +90,23 @@
 namespace perfetto {
 namespace profiling {
 
+// Allocation addresses are aligned, and FlatHashMap picks the slot with the low
+// bits of the hash, so they need mixing (this is the finalizer of
+// MurmurHash3).
+struct HeapTrackerHasher {
+  size_t operator()(uint64_t x) const {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+  size_t operator()(const void* ptr) const {
+    return (*this)(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)));
+  }
+};
+
 // Snapshot for memory allocations of a particular process. Shares callsites
 // with other processes.
 class HeapTracker {
@@ -119,6 +137,11 @@ class HeapTracker {
 
     GlobalCallstackTrie::Node* const node;
 
+    // The totals.allocation_count and totals.free_count at the previous call
+    // to GetCallstackAllocations, to tell which callstacks changed since.
+    uint64_t dumped_allocation_count = 0;
+    uint64_t dumped_free_count = 0;
+
     ~CallstackAllocations() { GlobalCallstackTrie::DecrementNode(node); }
 
     bool operator<(const CallstackAllocations& other) const {
@@ -138,17 +161,24 @@ class HeapTracker {
                     uint64_t sequence_number,
                     uint64_t timestamp);
 
+  // Calls |fn| for every CallstackAllocations, or, if |only_changed| is set,
+  // only for those whose totals changed since the previous call.
+  // |only_changed| is ignored in dump_at_max_mode, where the max of every
+  // callstack can change at once.
   template <typename F>
-  void GetCallstackAllocations(F fn) {
+  void GetCallstackAllocations(F fn, bool only_changed = false) {
     // There are two reasons we remove the unused callstack allocations on the
     // next iteration of Dump:
     // * We need to remove them after the callstacks were dumped, which
     //   currently happens after the allocations are dumped.
     // * This way, we do not destroy and recreate callstacks as frequently.
-    for (auto it_and_alloc : dead_callstack_allocations_) {
-      auto& it = it_and_alloc.first;
-      uint64_t allocated = it_and_alloc.second;
-      const CallstackAllocations& alloc = it->second;
+    for (const auto& node_and_alloc : dead_callstack_allocations_) {
+      GlobalCallstackTrie::Node* node = node_and_alloc.first;
+      uint64_t allocated = node_and_alloc.second;
+      std::unique_ptr<CallstackAllocations>* alloc_ptr =
+          callstack_allocations_.Find(node);
+      PERFETTO_DCHECK(alloc_ptr);
+      const CallstackAllocations& alloc = **alloc_ptr;
       // For non-dump-at-max, we need to check, even if there are still no
       // allocations referencing this callstack, whether there were any
       // allocations that happened but were freed again. If that was the case,
@@ -160,27 +190,38 @@ class HeapTracker {
         // TODO(fmayer): We could probably be smarter than throw away
         // our whole frames cache.
         ClearFrameCache();
-        callstack_allocations_.erase(it);
+        callstack_allocations_.Erase(node);
       }
     }
     dead_callstack_allocations_.clear();
 
-    for (auto it = callstack_allocations_.begin();
-         it != callstack_allocations_.end(); ++it) {
-      const CallstackAllocations& alloc = it->second;
-      fn(alloc);
+    for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
+      CallstackAllocations& alloc = *it.value();
+      if (dump_at_max_mode_) {
+        fn(alloc);
+      } else {
+        if (!only_changed ||
+            alloc.value.totals.allocation_count !=
+                alloc.dumped_allocation_count ||
+            alloc.value.totals.free_count != alloc.dumped_free_count) {
+          fn(alloc);
+        }
+        alloc.dumped_allocation_count = alloc.value.totals.allocation_count;
+        alloc.dumped_free_count = alloc.value.totals.free_count;
+      }
 
       if (alloc.allocs == 0)
         dead_callstack_allocations_.emplace_back(
-            it, !dump_at_max_mode_ ? alloc.value.totals.allocation_count : 0);
+            it.key(),
+            !dump_at_max_mode_ ? alloc.value.totals.allocation_count : 0);
     }
   }
 
   template <typename F>
   void GetAllocations(F fn) {
-    for (const auto& addr_and_allocation : allocations_) {
-      const Allocation& alloc = addr_and_allocation.second;
-      fn(addr_and_allocation.first, alloc.sample_size, alloc.alloc_size,
+    for (auto it = allocations_.GetIterator(); it; ++it) {
+      const Allocation& alloc = it.value();
+      fn(it.key(), alloc.sample_size, alloc.alloc_size,
          alloc.callstack_allocations()->node->id());
     }
   }
@@ -256,15 +297,17 @@ class HeapTracker {
 
   CallstackAllocations* MaybeCreateCallstackAllocations(
       GlobalCallstackTrie::Node* node) {
-    auto callstack_allocations_it = callstack_allocations_.find(node);
-    if (callstack_allocations_it == callstack_allocations_.end()) {
+    std::unique_ptr<CallstackAllocations>* callstack_allocations =
+        callstack_allocations_.Find(node);
+    if (!callstack_allocations) {
       GlobalCallstackTrie::IncrementNode(node);
       bool inserted;
-      std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
+      std::tie(callstack_allocations, inserted) = callstack_allocations_.Insert(
+          node, std::unique_ptr<CallstackAllocations>(
+                    new CallstackAllocations(node)));
       PERFETTO_DCHECK(inserted);
     }
-    return &callstack_allocations_it->second;
+    return callstack_allocations->get();
   }
 
   void RecordOperation(uint64_t sequence_number,
@@ -298,11 +341,11 @@ class HeapTracker {
         alloc.callstack_allocations()->value.retain_max.max_count =
             alloc.callstack_allocations()->value.retain_max.cur_count;
       } else {
-        for (auto& p : callstack_allocations_) {
+        for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
           // We need to reset max = cur for every CallstackAllocation, as we
           // do not know which ones have changed since the last max.
           // TODO(fmayer): Add an index to speed this up
-          CallstackAllocations& csa = p.second;
+          CallstackAllocations& csa = *it.value();
           csa.value.retain_max.max = csa.value.retain_max.cur;
           csa.value.retain_max.max_count = csa.value.retain_max.cur_count;
         }
@@ -330,14 +373,20 @@ class HeapTracker {
 
   // We cannot use an interner here, because after the last allocation goes
   // away, we still need to keep the CallstackAllocations around until the next
-  // dump.
-  std::map<GlobalCallstackTrie::Node*, CallstackAllocations>
+  // dump. They are behind a unique_ptr, as the Allocations point to them and
+  // FlatHashMap moves its values when it grows.
+  base::FlatHashMap<GlobalCallstackTrie::Node*,
+                    std::unique_ptr<CallstackAllocations>,
+                    HeapTrackerHasher>
       callstack_allocations_;
 
-  std::vector<std::pair<decltype(callstack_allocations_)::iterator, uint64_t>>
+  std::vector<std::pair<GlobalCallstackTrie::Node*, uint64_t>>
       dead_callstack_allocations_;
 
-  std::map<uint64_t /* allocation address */, Allocation> allocations_;
+  base::FlatHashMap<uint64_t /* allocation address */,
+                    Allocation,
+                    HeapTrackerHasher>
+      allocations_;
 
   // An operation is either a commit of an allocation or freeing of an
   // allocation. An operation is a free if its seq_id is larger than
@@ -346,7 +395,9 @@ class HeapTracker {
   //
   // If its seq_id is less than the sequence_number of the corresponding
   // allocation it could be either, but is ignored either way.
-  std::map<uint64_t /* seq_id */, PendingOperation /* allocation address */>
+  base::FlatHashMap<uint64_t /* seq_id */,
+                    PendingOperation /* allocation address */,
+                    HeapTrackerHasher>
       pending_operations_;
 
   uint64_t committed_timestamp_ = 0;
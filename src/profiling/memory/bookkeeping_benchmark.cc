@@ -0,0 +1,160 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "src/profiling/common/proc_utils.h"
+#include "src/profiling/memory/bookkeeping.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr size_t kNumCallstacks = 512;
+constexpr size_t kCallstackDepth = 16;
+constexpr uint64_t kSampleSize = 4096;
+
+struct Callstack {
+  std::vector<unwindstack::FrameData> frames;
+  std::vector<std::string> build_ids;
+};
+
+std::vector<Callstack> MakeCallstacks() {
+  std::vector<Callstack> callstacks(kNumCallstacks);
+  for (size_t i = 0; i < kNumCallstacks; ++i) {
+    for (size_t j = 0; j < kCallstackDepth; ++j) {
+      unwindstack::FrameData frame{};
+      // The callstacks share their outermost frames, like real ones.
+      uint64_t pc = j < kCallstackDepth / 2 ? j : i * kCallstackDepth + j;
+      frame.function_name = "fun" + std::to_string(pc);
+      frame.pc = pc;
+      frame.rel_pc = pc;
+      callstacks[i].frames.emplace_back(std::move(frame));
+      callstacks[i].build_ids.emplace_back("buildid");
+    }
+  }
+  return callstacks;
+}
+
+uint32_t GetRssKb() {
+  base::Optional<std::string> status = ReadStatus(getpid());
+  if (!status)
+    return 0;
+  return GetRssAnonAndSwap(*status).value_or(0);
+}
+
+uint64_t Address(uint64_t i) {
+  return 0x7000000000 + i * 32;
+}
+
+}  // namespace
+
+// Keeps state.range(0) allocations live, and replaces the oldest one for every
+// iteration.
+static void BM_HeapTrackerMallocFree(benchmark::State& state) {
+  std::vector<Callstack> callstacks = MakeCallstacks();
+  const uint64_t live = static_cast<uint64_t>(state.range(0));
+
+  uint32_t rss_before = GetRssKb();
+  GlobalCallstackTrie callsites;
+  HeapTracker tracker(&callsites, /*dump_at_max_mode=*/false);
+  uint64_t sequence_number = 0;
+  uint64_t next_alloc = 0;
+  for (; next_alloc < live; ++next_alloc) {
+    const Callstack& callstack = callstacks[next_alloc % kNumCallstacks];
+    sequence_number++;
+    tracker.RecordMalloc(callstack.frames, callstack.build_ids,
+                         Address(next_alloc), kSampleSize, kSampleSize,
+                         sequence_number, sequence_number);
+  }
+  state.counters["mem_kb"] =
+      static_cast<double>(GetRssKb()) - static_cast<double>(rss_before);
+
+  for (auto _ : state) {
+    sequence_number++;
+    tracker.RecordFree(Address(next_alloc - live), sequence_number,
+                       sequence_number);
+    const Callstack& callstack = callstacks[next_alloc % kNumCallstacks];
+    sequence_number++;
+    tracker.RecordMalloc(callstack.frames, callstack.build_ids,
+                         Address(next_alloc), kSampleSize, kSampleSize,
+                         sequence_number, sequence_number);
+    next_alloc++;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 2);
+}
+BENCHMARK(BM_HeapTrackerMallocFree)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+// Like BM_HeapTrackerMallocFree, but the operations arrive out of order, as
+// they do when several threads of the client race on the shared memory buffer.
+static void BM_HeapTrackerMallocFreeReordered(benchmark::State& state) {
+  std::vector<Callstack> callstacks = MakeCallstacks();
+  const uint64_t live = static_cast<uint64_t>(state.range(0));
+
+  GlobalCallstackTrie callsites;
+  HeapTracker tracker(&callsites, /*dump_at_max_mode=*/false);
+  uint64_t sequence_number = 0;
+  uint64_t next_alloc = 0;
+  for (; next_alloc < live; ++next_alloc) {
+    const Callstack& callstack = callstacks[next_alloc % kNumCallstacks];
+    sequence_number++;
+    tracker.RecordMalloc(callstack.frames, callstack.build_ids,
+                         Address(next_alloc), kSampleSize, kSampleSize,
+                         sequence_number, sequence_number);
+  }
+
+  for (auto _ : state) {
+    // Record the malloc before the free that precedes it.
+    const Callstack& callstack = callstacks[next_alloc % kNumCallstacks];
+    tracker.RecordMalloc(callstack.frames, callstack.build_ids,
+                         Address(next_alloc), kSampleSize, kSampleSize,
+                         sequence_number + 2, sequence_number + 2);
+    tracker.RecordFree(Address(next_alloc - live), sequence_number + 1,
+                       sequence_number + 1);
+    sequence_number += 2;
+    next_alloc++;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 2);
+}
+BENCHMARK(BM_HeapTrackerMallocFreeReordered)->Arg(1000)->Arg(100000);
+
+static void BM_HeapTrackerDump(benchmark::State& state) {
+  std::vector<Callstack> callstacks = MakeCallstacks();
+  const uint64_t live = static_cast<uint64_t>(state.range(0));
+
+  GlobalCallstackTrie callsites;
+  HeapTracker tracker(&callsites, /*dump_at_max_mode=*/false);
+  for (uint64_t i = 0; i < live; ++i) {
+    const Callstack& callstack = callstacks[i % kNumCallstacks];
+    tracker.RecordMalloc(callstack.frames, callstack.build_ids, Address(i),
+                         kSampleSize, kSampleSize, i + 1, i + 1);
+  }
+
+  for (auto _ : state) {
+    uint64_t total = 0;
+    tracker.GetCallstackAllocations(
+        [&total](const HeapTracker::CallstackAllocations& alloc) {
+          total += alloc.value.totals.allocated;
+        });
+    benchmark::DoNotOptimize(total);
+  }
+}
+BENCHMARK(BM_HeapTrackerDump)->Arg(100000)->Arg(1000000);
+
+}  // namespace profiling
+}  // namespace perfetto
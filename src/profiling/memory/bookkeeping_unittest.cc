@@ -246,6 +246,42 @@ TEST(BookkeepingTest, ManyAllocations) {
   }
 }
 
+TEST(BookkeepingTest, OnlyChanged) {
+  uint64_t sequence_number = 1;
+  GlobalCallstackTrie c;
+  HeapTracker hd(&c, false);
+
+  auto dumped = [&hd](bool only_changed) {
+    std::vector<uint64_t> allocated;
+    hd.GetCallstackAllocations(
+        [&allocated](const HeapTracker::CallstackAllocations& alloc) {
+          allocated.push_back(alloc.value.totals.allocated);
+        },
+        only_changed);
+    return allocated;
+  };
+
+  hd.RecordMalloc(stack(), DummyBuildIds(stack().size()), 0x1, 5, 5,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  hd.RecordMalloc(stack2(), DummyBuildIds(stack2().size()), 0x2, 2, 2,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  EXPECT_THAT(dumped(true), ::testing::UnorderedElementsAre(5u, 2u));
+  EXPECT_THAT(dumped(true), ::testing::IsEmpty());
+
+  hd.RecordMalloc(stack(), DummyBuildIds(stack().size()), 0x3, 3, 3,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  EXPECT_THAT(dumped(true), ::testing::ElementsAre(8u));
+  EXPECT_THAT(dumped(false), ::testing::UnorderedElementsAre(8u, 2u));
+
+  hd.RecordFree(0x2, sequence_number, 100 * sequence_number);
+  sequence_number++;
+  EXPECT_THAT(dumped(true), ::testing::ElementsAre(2u));
+  EXPECT_THAT(dumped(true), ::testing::IsEmpty());
+}
+
 TEST(BookkeepingTest, ArbitraryOrder) {
   std::vector<unwindstack::FrameData> s = stack();
   std::vector<unwindstack::FrameData> s2 = stack2();
@@ -16,6 +16,7 @@
 
 #include "src/profiling/memory/client.h"
 
+#include <pthread.h>
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
@@ -56,6 +57,11 @@ namespace {
 
 const char kSingleByte[1] = {'x'};
 constexpr auto kResendBackoffUs = 100;
+// Maximum number of frames sent when frame pointer unwinding is enabled.
+constexpr size_t kMaxFramePointerPcs = 256;
+// A batch of frees is flushed when a free is added this long after the first
+// one in it.
+constexpr uint64_t kFreeBatchMaxAgeMs = 100;
 
 inline bool IsMainThread() {
   return getpid() == base::GetThreadId();
@@ -70,6 +76,21 @@ bool Contained(const StackRange& base, const char* ptr) {
   return (ptr >= base.begin && ptr < base.end);
 }
 
+uint64_t GetCoarseMonotonicMs() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0)
+    return 0;
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 +
+         static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+// pthread_self() is cheaper than gettid(), which is a syscall on glibc.
+size_t GetFreeBatchIndex() {
+  uint64_t hash =
+      static_cast<uint64_t>(pthread_self()) * 0x9E3779B97F4A7C15ull;
+  return static_cast<size_t>(hash >> 32) % kFreeBatchShards;
+}
+
 }  // namespace
 
 uint64_t GetMaxTries(const ClientConfiguration& client_config) {
@@ -139,6 +160,47 @@ StackRange GetMainThreadStackRange() {
   return {nullptr, nullptr};
 }
 
+// Both on x86_64 and arm64 the frame pointer points to a frame record made
+// of the frame pointer of the caller followed by the return address.
+//
+// This reads from the stack of the current thread, which ASAN can consider
+// out of bounds.
+size_t UnwindFramePointers(const char* frame_pointer,
+                           const char* stackptr,
+                           const char* stackend,
+                           uint64_t* pcs,
+                           size_t max_pcs)
+    __attribute__((no_sanitize("address", "hwaddress"))) {
+  if (!kFramePointerUnwindingSupported)
+    return 0;
+  size_t num_pcs = 0;
+  const char* fp = frame_pointer;
+  while (num_pcs < max_pcs && fp >= stackptr &&
+         fp + 2 * sizeof(uint64_t) <= stackend &&
+         reinterpret_cast<uintptr_t>(fp) % alignof(uint64_t) == 0) {
+    const uint64_t* record = reinterpret_cast<const uint64_t*>(fp);
+    uint64_t pc = record[1];
+#if defined(__aarch64__)
+    // Strip the pointer authentication code, if any. XPACLRI is in the hint
+    // space, so this is a no-op on CPUs that do not support it.
+    __asm__("mov x30, %1\n\thint 0x7\n\tmov %0, x30"
+            : "=r"(pc)
+            : "r"(pc)
+            : "x30");
+#endif
+    if (pc == 0)
+      break;
+    pcs[num_pcs++] = pc;
+    const char* next = reinterpret_cast<const char*>(record[0]);
+    // Callers' frames are at higher addresses. Anything else means that we
+    // have reached a function that does not maintain the frame pointer.
+    if (next <= fp)
+      break;
+    fp = next;
+  }
+  return num_pcs;
+}
+
 // static
 base::Optional<base::UnixSocketRaw> Client::ConnectToHeapprofd(
     const std::string& sock_name) {
@@ -264,6 +326,12 @@ Client::Client(base::UnixSocketRaw sock,
       pid_at_creation_(pid_at_creation) {}
 
 Client::~Client() {
+  // Don't lose the frees still batched when the session ends or a new client
+  // replaces this one. The frees of a forked child must not be sent, see
+  // IsPostFork().
+  if (client_config_.batch_frees && !IsPostFork() && !FlushFreeBatches())
+    PERFETTO_ELOG("Failed to send batched frees.");
+
   // This is work-around for code like the following:
   // https://android.googlesource.com/platform/libcore/+/4ecb71f94378716f88703b9f7548b5d24839262f/ojluni/src/main/native/UNIXProcess_md.c#427
   // They fork, close all fds by iterating over /proc/self/fd using opendir.
@@ -366,9 +434,18 @@ bool Client::RecordMalloc(uint32_t heap_id,
     return postfork_return_value_;
   }
 
+  // Send the buffered frees first, so that heapprofd doesn't have to hold
+  // back this allocation waiting for the frees with lower sequence numbers.
+  if (client_config_.batch_frees && !FlushFreeBatches())
+    return false;
+
   AllocMetadata metadata;
   const char* stackptr = reinterpret_cast<char*>(__builtin_frame_address(0));
-  unwindstack::AsmGetRegs(metadata.register_data);
+  const bool frame_pointers =
+      kFramePointerUnwindingSupported && client_config_.frame_pointer_unwinding;
+  // The registers are only needed by heapprofd to unwind the raw stack.
+  if (!frame_pointers)
+    unwindstack::AsmGetRegs(metadata.register_data);
   const char* stackend = GetStackEnd(stackptr);
   if (!stackend) {
     PERFETTO_ELOG("Failed to find stackend.");
@@ -394,10 +471,21 @@ bool Client::RecordMalloc(uint32_t heap_id,
   }
 
   WireMessage msg{};
-  msg.record_type = RecordType::Malloc;
   msg.alloc_header = &metadata;
-  msg.payload = const_cast<char*>(stackptr);
-  msg.payload_size = static_cast<size_t>(stack_size);
+  uint64_t pcs[kMaxFramePointerPcs];
+  if (frame_pointers) {
+    // Only send the return addresses, rather than the whole stack, so
+    // heapprofd does not need to unwind.
+    size_t num_pcs = UnwindFramePointers(stackptr, stackptr, stackend, pcs,
+                                         kMaxFramePointerPcs);
+    msg.record_type = RecordType::MallocPcs;
+    msg.payload = reinterpret_cast<char*>(pcs);
+    msg.payload_size = num_pcs * sizeof(uint64_t);
+  } else {
+    msg.record_type = RecordType::Malloc;
+    msg.payload = const_cast<char*>(stackptr);
+    msg.payload_size = static_cast<size_t>(stack_size);
+  }
 
   if (SendWireMessageWithRetriesIfBlocking(msg) == -1)
     return false;
@@ -438,9 +526,91 @@ bool Client::RecordFree(uint32_t heap_id, const uint64_t alloc_address) {
       1 + sequence_number_[heap_id].fetch_add(1, std::memory_order_acq_rel);
   current_entry.addr = alloc_address;
   current_entry.heap_id = heap_id;
+
+  if (client_config_.batch_frees) {
+    FreeBatch* batch = &free_batches_[GetFreeBatchIndex()];
+    ScopedSpinlock lock(&batch->lock, ScopedSpinlock::Mode::TryOnce);
+    // If another thread holds this batch, send this free on its own rather
+    // than waiting.
+    if (lock.locked()) {
+      uint64_t now_ms = GetCoarseMonotonicMs();
+      if (batch->num_entries == 0) {
+        batch->first_entry_ms = now_ms;
+        MarkFreeBatchesPending(now_ms);
+      }
+      batch->entries[batch->num_entries++] = current_entry;
+      if (batch->num_entries < kFreeBatchSize &&
+          now_ms - batch->first_entry_ms < kFreeBatchMaxAgeMs) {
+        lock.Unlock();
+        // Other threads' batches might have been sitting there for a while.
+        uint64_t pending_since_ms =
+            free_batches_pending_since_ms_.load(std::memory_order_relaxed);
+        if (pending_since_ms == 0 ||
+            now_ms - pending_since_ms < kFreeBatchMaxAgeMs) {
+          return true;
+        }
+        return FlushFreeBatches();
+      }
+      return FlushFreeBatch(batch);
+    }
+  }
+
   WireMessage msg = {};
   msg.record_type = RecordType::Free;
   msg.free_header = &current_entry;
+  return SendFreeMessage(msg);
+}
+
+bool Client::FlushFreeBatch(FreeBatch* batch) {
+  if (batch->num_entries == 0)
+    return true;
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.payload = reinterpret_cast<char*>(&batch->entries[0]);
+  msg.payload_size = batch->num_entries * sizeof(FreeEntry);
+  batch->num_entries = 0;
+  return SendFreeMessage(msg);
+}
+
+bool Client::FlushFreeBatches() {
+  free_batches_pending_since_ms_.store(0, std::memory_order_relaxed);
+  for (FreeBatch& batch : free_batches_) {
+    ScopedSpinlock lock(&batch.lock, ScopedSpinlock::Mode::TryOnce);
+    if (!lock.locked()) {
+      // A thread holding the lock is about to flush or add to the batch. Make
+      // sure that it's looked at again by the next FlushStaleFreeBatches().
+      MarkFreeBatchesPending(GetCoarseMonotonicMs());
+      continue;
+    }
+    if (!FlushFreeBatch(&batch))
+      return false;
+  }
+  return true;
+}
+
+void Client::MarkFreeBatchesPending(uint64_t now_ms) {
+  uint64_t expected = 0;
+  free_batches_pending_since_ms_.compare_exchange_strong(
+      expected, now_ms, std::memory_order_relaxed);
+}
+
+bool Client::HasStaleFreeBatches() {
+  uint64_t pending_since_ms =
+      free_batches_pending_since_ms_.load(std::memory_order_relaxed);
+  return pending_since_ms != 0 &&
+         GetCoarseMonotonicMs() - pending_since_ms >= kFreeBatchMaxAgeMs;
+}
+
+bool Client::FlushStaleFreeBatches() {
+  if (PERFETTO_UNLIKELY(IsPostFork())) {
+    return postfork_return_value_;
+  }
+  if (!HasStaleFreeBatches())
+    return true;
+  return FlushFreeBatches();
+}
+
+bool Client::SendFreeMessage(const WireMessage& msg) {
   // Do not send control socket byte, as frees are very cheap to handle, so we
   // just delay to the next alloc. Sending the control socket byte is ~10x the
   // rest of the client overhead.
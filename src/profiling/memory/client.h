@@ -28,6 +28,7 @@
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "src/profiling/memory/sampler.h"
+#include "src/profiling/memory/scoped_spinlock.h"
 #include "src/profiling/memory/shared_ring_buffer.h"
 #include "src/profiling/memory/unhooked_allocator.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -45,9 +46,32 @@ StackRange GetThreadStackRange();
 StackRange GetSigAltStackRange();
 StackRange GetMainThreadStackRange();
 
+// Whether UnwindFramePointers can be used on this architecture.
+#if defined(__aarch64__) || defined(__x86_64__)
+constexpr bool kFramePointerUnwindingSupported = true;
+#else
+constexpr bool kFramePointerUnwindingSupported = false;
+#endif
+
+// Follows the chain of frame records starting at |frame_pointer| and stores
+// the return address of each frame into |pcs|, stopping after |max_pcs| or as
+// soon as a frame record falls outside of [stackptr, stackend). Returns the
+// number of entries written. Only gives complete stacks if all callers were
+// compiled with frame pointers.
+size_t UnwindFramePointers(const char* frame_pointer,
+                           const char* stackptr,
+                           const char* stackend,
+                           uint64_t* pcs,
+                           size_t max_pcs);
+
 constexpr uint64_t kInfiniteTries = 0;
 constexpr uint32_t kClientSockTimeoutMs = 1000;
 
+// With ClientConfiguration.batch_frees, frees are buffered in one of
+// kFreeBatchShards batches, picked by thread, of up to kFreeBatchSize entries.
+constexpr size_t kFreeBatchShards = 16;
+constexpr size_t kFreeBatchSize = 64;
+
 uint64_t GetMaxTries(const ClientConfiguration& client_config);
 
 // Profiling client, used to sample and record the malloc/free family of calls,
@@ -83,8 +107,19 @@ class Client {
                     uint64_t alloc_address) PERFETTO_WARN_UNUSED_RESULT;
 
   // Add address to buffer of deallocations. Flushes the buffer if necessary.
+  // The buffers are also flushed by RecordMalloc, by FlushStaleFreeBatches and
+  // on destruction.
   bool RecordFree(uint32_t heap_id,
                   uint64_t alloc_address) PERFETTO_WARN_UNUSED_RESULT;
+
+  // Returns whether some frees have been batched for longer than
+  // kFreeBatchMaxAgeMs. Only reads the clock if there are batched frees, so
+  // that it can be checked on every allocation, including the ones that are
+  // not sampled.
+  bool HasStaleFreeBatches();
+
+  // Sends the batched frees if HasStaleFreeBatches().
+  bool FlushStaleFreeBatches() PERFETTO_WARN_UNUSED_RESULT;
   bool RecordHeapInfo(uint32_t heap_id,
                       const char* heap_name,
                       uint64_t interval);
@@ -122,6 +157,21 @@ class Client {
 
   bool IsPostFork();
 
+  struct FreeBatch {
+    Spinlock lock;
+    uint32_t num_entries;
+    // CLOCK_MONOTONIC_COARSE time of the first entry.
+    uint64_t first_entry_ms;
+    FreeEntry entries[kFreeBatchSize];
+  };
+
+  // Needs to be called with |batch->lock| held.
+  bool FlushFreeBatch(FreeBatch* batch) PERFETTO_WARN_UNUSED_RESULT;
+  // Sets |free_batches_pending_since_ms_| unless it's set already.
+  void MarkFreeBatchesPending(uint64_t now_ms);
+  bool FlushFreeBatches() PERFETTO_WARN_UNUSED_RESULT;
+  bool SendFreeMessage(const WireMessage&) PERFETTO_WARN_UNUSED_RESULT;
+
   ClientConfiguration client_config_;
   uint64_t max_shmem_tries_;
   base::UnixSocketRaw sock_;
@@ -130,6 +180,11 @@ class Client {
   std::atomic<uint64_t>
       sequence_number_[base::ArraySize(ClientConfiguration{}.heaps)] = {};
   SharedRingBuffer shmem_;
+  FreeBatch free_batches_[kFreeBatchShards] = {};
+  // CLOCK_MONOTONIC_COARSE time since which some batch has been holding frees,
+  // or 0 if none is. This can be older than the oldest batched free, but not
+  // newer.
+  std::atomic<uint64_t> free_batches_pending_since_ms_{0};
 
   // Used to detect (during the slow path) the situation where the process has
   // forked during profiling, and is performing malloc operations in the child.
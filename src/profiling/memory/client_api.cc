@@ -399,10 +399,13 @@ AHeapProfile_reportAllocation(uint32_t heap_id, uint64_t id, uint64_t size) {
     }
 
     sampled_alloc_sz = heap.sampler.SampleSize(static_cast<size_t>(size));
-    if (sampled_alloc_sz == 0)  // not sampling
-      return false;
-    if (client_ptr->write_avail() <
-        client_ptr->adaptive_sampling_shmem_threshold()) {
+    if (sampled_alloc_sz == 0) {  // not sampling
+      // Unsampled allocations are the heartbeat that sends the frees batched
+      // by threads that aren't doing anything else.
+      if (PERFETTO_LIKELY(!client_ptr->HasStaleFreeBatches()))
+        return false;
+    } else if (client_ptr->write_avail() <
+               client_ptr->adaptive_sampling_shmem_threshold()) {
       bool should_increment = true;
       if (client_ptr->adaptive_sampling_max_sampling_interval_bytes() != 0) {
         should_increment =
@@ -419,6 +422,12 @@ AHeapProfile_reportAllocation(uint32_t heap_id, uint64_t id, uint64_t size) {
     client = client_ptr;  // owning copy
   }                       // unlock
 
+  if (sampled_alloc_sz == 0) {
+    if (!client->FlushStaleFreeBatches())
+      ShutdownLazy(client);
+    return false;
+  }
+
   if (!client->RecordMalloc(heap_id, sampled_alloc_sz, size, id)) {
     ShutdownLazy(client);
     return false;
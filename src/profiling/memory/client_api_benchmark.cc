@@ -89,6 +89,29 @@ static void BM_ClientApiOneTenthAllocation(benchmark::State& state) {
 
 BENCHMARK(BM_ClientApiOneTenthAllocation);
 
+static void BM_ClientApiOneTenthAllocationFramePointers(
+    benchmark::State& state) {
+  const uint32_t heap_id = GetHeapId();
+
+  ClientConfiguration client_config{};
+  client_config.default_interval = 32000;
+  client_config.all_heaps = true;
+  client_config.frame_pointer_unwinding = true;
+  g_client_config = client_config;
+  PERFETTO_CHECK(AHeapProfile_initSession(malloc, free));
+
+  PERFETTO_CHECK(g_shmem_fd);
+  auto ringbuf = SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+
+  for (auto _ : state) {
+    AHeapProfile_reportAllocation(heap_id, 0x123, 3200);
+  }
+  DisconnectGlobalServerSocket();
+  ringbuf->SetShuttingDown();
+}
+
+BENCHMARK(BM_ClientApiOneTenthAllocationFramePointers);
+
 static void BM_ClientApiOneHundrethAllocation(benchmark::State& state) {
   const uint32_t heap_id = GetHeapId();
 
@@ -215,6 +238,42 @@ static void BM_ClientApiEnabledHeapFree(benchmark::State& state) {
 
 BENCHMARK(BM_ClientApiEnabledHeapFree);
 
+// Frees from several threads, with and without ClientConfiguration.batch_frees
+// depending on the argument.
+static void BM_ClientApiEnabledHeapFreeThreads(benchmark::State& state) {
+  const uint32_t heap_id = GetHeapId();
+  static std::unique_ptr<SharedRingBuffer> ringbuf;
+
+  if (state.thread_index == 0) {
+    ClientConfiguration client_config{};
+    client_config.default_interval = 32000;
+    client_config.all_heaps = true;
+    client_config.batch_frees = state.range(0) != 0;
+    g_client_config = client_config;
+    PERFETTO_CHECK(AHeapProfile_initSession(malloc, free));
+
+    PERFETTO_CHECK(g_shmem_fd);
+    ringbuf.reset(new SharedRingBuffer(std::move(
+        *SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd))))));
+  }
+
+  for (auto _ : state) {
+    AHeapProfile_reportFree(heap_id, 0x123);
+  }
+
+  if (state.thread_index == 0) {
+    DisconnectGlobalServerSocket();
+    ringbuf->SetShuttingDown();
+    ringbuf.reset();
+  }
+}
+
+BENCHMARK(BM_ClientApiEnabledHeapFreeThreads)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
 static void BM_ClientApiMallocFree(benchmark::State& state) {
   for (auto _ : state) {
     volatile char* x = static_cast<char*>(malloc(100));
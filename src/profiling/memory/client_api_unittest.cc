@@ -25,7 +25,10 @@
 #include "src/profiling/memory/wire_protocol.h"
 #include "test/gtest_and_gmock.h"
 
+#include <unistd.h>
+
 #include <memory>
+#include <vector>
 
 namespace perfetto {
 namespace profiling {
@@ -71,6 +74,25 @@ std::shared_ptr<Client> ConstructClient(
 
 namespace {
 
+// Returns the addresses of all the frees in the FreeBatch records in |ringbuf|.
+std::vector<uint64_t> ReadBatchedFrees(SharedRingBuffer* ringbuf) {
+  std::vector<uint64_t> freed;
+  for (auto buf = ringbuf->BeginRead(); buf; buf = ringbuf->BeginRead()) {
+    WireMessage msg;
+    EXPECT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data),
+                                   buf.size, &msg));
+    if (msg.record_type == RecordType::FreeBatch) {
+      for (size_t i = 0; i < msg.payload_size / sizeof(FreeEntry); ++i) {
+        FreeEntry entry;
+        memcpy(&entry, msg.payload + i * sizeof(FreeEntry), sizeof(entry));
+        freed.push_back(entry.addr);
+      }
+    }
+    ringbuf->EndRead(std::move(buf));
+  }
+  return freed;
+}
+
 TEST(ClientApiTest, NoClient) {
   uint32_t heap_id = AHeapProfile_registerHeap(AHeapInfo_create("NoClient"));
   EXPECT_FALSE(AHeapProfile_reportAllocation(heap_id, 1, 1));
@@ -122,6 +144,115 @@ TEST(ClientApiTest, ClientAllHeaps) {
   EXPECT_FALSE(AHeapProfile_reportAllocation(heap_id, 1, 1));
 }
 
+TEST(ClientApiTest, BatchedFrees) {
+  uint32_t heap_id =
+      AHeapProfile_registerHeap(AHeapInfo_create("BatchedFrees"));
+  ClientConfiguration client_config{};
+  client_config.default_interval = 1;
+  client_config.all_heaps = true;
+  client_config.batch_frees = true;
+
+  g_client_config = client_config;
+
+  AHeapProfile_initSession(malloc, free);
+  PERFETTO_CHECK(g_shmem_fd);
+  auto ringbuf = SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+  g_shmem_fd = 0;
+  PERFETTO_CHECK(ringbuf);
+  EXPECT_TRUE(AHeapProfile_reportAllocation(heap_id, 1, 1));
+  AHeapProfile_reportFree(heap_id, 1);
+  AHeapProfile_reportFree(heap_id, 2);
+  // The frees are sent before the next allocation.
+  EXPECT_TRUE(AHeapProfile_reportAllocation(heap_id, 3, 1));
+
+  std::vector<RecordType> record_types;
+  std::vector<uint64_t> freed;
+  for (auto buf = ringbuf->BeginRead(); buf; buf = ringbuf->BeginRead()) {
+    WireMessage msg;
+    ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data),
+                                   buf.size, &msg));
+    // Heaps registered by other tests are announced as well.
+    if (msg.record_type != RecordType::HeapName)
+      record_types.push_back(msg.record_type);
+    if (msg.record_type == RecordType::FreeBatch) {
+      for (size_t i = 0; i < msg.payload_size / sizeof(FreeEntry); ++i) {
+        FreeEntry entry;
+        memcpy(&entry, msg.payload + i * sizeof(FreeEntry), sizeof(entry));
+        freed.push_back(entry.addr);
+      }
+    }
+    ringbuf->EndRead(std::move(buf));
+  }
+  EXPECT_THAT(record_types,
+              testing::ElementsAre(RecordType::Malloc, RecordType::FreeBatch,
+                                   RecordType::Malloc));
+  EXPECT_THAT(freed, testing::ElementsAre(1u, 2u));
+
+  DisconnectGlobalServerSocket();
+  ringbuf->SetShuttingDown();
+}
+
+TEST(ClientApiTest, BatchedFreeSentByUnsampledAllocation) {
+  uint32_t heap_id = AHeapProfile_registerHeap(
+      AHeapInfo_create("BatchedFreeSentByUnsampledAllocation"));
+  ClientConfiguration client_config{};
+  // Practically never sample.
+  client_config.default_interval = 1ull << 40;
+  client_config.all_heaps = true;
+  client_config.batch_frees = true;
+
+  g_client_config = client_config;
+
+  AHeapProfile_initSession(malloc, free);
+  PERFETTO_CHECK(g_shmem_fd);
+  auto ringbuf = SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+  g_shmem_fd = 0;
+  PERFETTO_CHECK(ringbuf);
+  AHeapProfile_reportFree(heap_id, 1);
+  EXPECT_THAT(ReadBatchedFrees(&*ringbuf), testing::IsEmpty());
+
+  // Once the free is older than the batching period, the next allocation
+  // sends it even though it's not sampled itself.
+  usleep(200 * 1000);
+  EXPECT_FALSE(AHeapProfile_reportAllocation(heap_id, 2, 1));
+  EXPECT_THAT(ReadBatchedFrees(&*ringbuf), testing::ElementsAre(1u));
+
+  DisconnectGlobalServerSocket();
+  ringbuf->SetShuttingDown();
+}
+
+TEST(ClientApiTest, BatchedFreeSentOnClientDestruction) {
+  uint32_t heap_id = AHeapProfile_registerHeap(
+      AHeapInfo_create("BatchedFreeSentOnClientDestruction"));
+  ClientConfiguration client_config{};
+  client_config.default_interval = 1;
+  client_config.all_heaps = true;
+  client_config.batch_frees = true;
+
+  g_client_config = client_config;
+
+  AHeapProfile_initSession(malloc, free);
+  PERFETTO_CHECK(g_shmem_fd);
+  auto ringbuf = SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+  g_shmem_fd = 0;
+  PERFETTO_CHECK(ringbuf);
+  AHeapProfile_reportFree(heap_id, 1);
+  EXPECT_THAT(ReadBatchedFrees(&*ringbuf), testing::IsEmpty());
+
+  // A new session replaces, and destroys, the disconnected client.
+  DisconnectGlobalServerSocket();
+  AHeapProfile_initSession(malloc, free);
+  EXPECT_THAT(ReadBatchedFrees(&*ringbuf), testing::ElementsAre(1u));
+
+  ringbuf->SetShuttingDown();
+  auto new_ringbuf =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+  g_shmem_fd = 0;
+  PERFETTO_CHECK(new_ringbuf);
+  DisconnectGlobalServerSocket();
+  new_ringbuf->SetShuttingDown();
+}
+
 }  // namespace
 
 }  // namespace profiling
@@ -135,6 +135,40 @@ TEST(ClientTest, GetMaxTriesBlockInfinite) {
   EXPECT_EQ(GetMaxTries(cfg), kInfiniteTries);
 }
 
+TEST(ClientTest, UnwindFramePointers) {
+  if (!kFramePointerUnwindingSupported)
+    GTEST_SKIP();
+  // Three frame records, the outermost one pointing outside of the stack.
+  uint64_t stack[12] = {};
+  const char* stackptr = reinterpret_cast<const char*>(&stack[0]);
+  const char* stackend = reinterpret_cast<const char*>(&stack[12]);
+  stack[2] = reinterpret_cast<uint64_t>(&stack[6]);
+  stack[3] = 0x1000;
+  stack[6] = reinterpret_cast<uint64_t>(&stack[10]);
+  stack[7] = 0x2000;
+  stack[10] = reinterpret_cast<uint64_t>(stackend) + 64;
+  stack[11] = 0x3000;
+
+  uint64_t pcs[8];
+  ASSERT_EQ(UnwindFramePointers(reinterpret_cast<const char*>(&stack[2]),
+                                stackptr, stackend, pcs, 8),
+            3u);
+  EXPECT_EQ(pcs[0], 0x1000u);
+  EXPECT_EQ(pcs[1], 0x2000u);
+  EXPECT_EQ(pcs[2], 0x3000u);
+
+  // Stops at max_pcs.
+  EXPECT_EQ(UnwindFramePointers(reinterpret_cast<const char*>(&stack[2]),
+                                stackptr, stackend, pcs, 2),
+            2u);
+
+  // Stops when the frame pointer does not move towards the stack end.
+  stack[6] = reinterpret_cast<uint64_t>(&stack[2]);
+  EXPECT_EQ(UnwindFramePointers(reinterpret_cast<const char*>(&stack[2]),
+                                stackptr, stackend, pcs, 8),
+            2u);
+}
+
 TEST(ClientTest, GetMaxTriesNoBlock) {
   ClientConfiguration cfg = {};
   cfg.block_client = false;
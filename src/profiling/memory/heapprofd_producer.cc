@@ -41,6 +41,7 @@
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "perfetto/tracing/core/forward_decls.h"
 #include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
+#include "src/profiling/common/elf_cache.h"
 #include "src/profiling/common/producer_support.h"
 #include "src/profiling/common/profiler_guardrails.h"
 #include "src/profiling/memory/shared_ring_buffer.h"
@@ -70,13 +71,30 @@ constexpr uint64_t kMaxShmemSize = 500 * 1048576;    // ~500 MB
 constexpr int kProfilingSignal = __SIGRTMIN + 4;
 constexpr int kHeapprofdSignalValue = 0;
 
-std::vector<UnwindingWorker> MakeUnwindingWorkers(HeapprofdProducer* delegate,
-                                                  size_t n) {
+// Maximum number of records waiting in the SharedUnwindingQueue. Past that,
+// the worker owning the client unwinds them itself.
+constexpr size_t kMaxSharedUnwindingTasks = 256;
+
+// With ContinuousDumpConfig.incremental, at most kMaxIncrementalDumps
+// incremental dumps of a heap follow each full one, so that a trace that lost
+// or overwrote the previous full dump gets the complete state again.
+constexpr uint32_t kMaxIncrementalDumps = 9;
+
+std::vector<UnwindingWorker> MakeUnwindingWorkers(
+    HeapprofdProducer* delegate,
+    size_t n,
+    const std::shared_ptr<SharedUnwindingQueue>& queue) {
   std::vector<UnwindingWorker> ret;
   for (size_t i = 0; i < n; ++i) {
     ret.emplace_back(delegate,
                      base::ThreadTaskRunner::CreateAndStart("heapprofdunwind"));
   }
+  // The queue keeps pointers to the workers, only hand them out once the
+  // vector is not going to reallocate any more.
+  for (UnwindingWorker& worker : ret) {
+    queue->AddWorker(&worker);
+    worker.SetSharedQueue(queue);
+  }
   return ret;
 }
 
@@ -141,6 +159,9 @@ bool HeapprofdConfigToClientConfiguration(
   cli_config->block_client_timeout_us =
       heapprofd_config.block_client_timeout_us();
   cli_config->all_heaps = heapprofd_config.all_heaps();
+  cli_config->frame_pointer_unwinding =
+      heapprofd_config.frame_pointer_unwinding();
+  cli_config->batch_frees = heapprofd_config.batch_frees();
   cli_config->adaptive_sampling_shmem_threshold =
       heapprofd_config.adaptive_sampling_shmem_threshold();
   cli_config->adaptive_sampling_max_sampling_interval_bytes =
@@ -209,14 +230,20 @@ HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
     : task_runner_(task_runner),
       mode_(mode),
       exit_when_done_(exit_when_done),
-      unwinding_workers_(MakeUnwindingWorkers(this, kUnwinderThreads)),
+      unwinding_queue_(new SharedUnwindingQueue(kMaxSharedUnwindingTasks)),
+      unwinding_workers_(
+          MakeUnwindingWorkers(this, kUnwinderThreads, unwinding_queue_)),
       socket_delegate_(this),
       weak_factory_(this) {
   CheckDataSourceCpuTask();
   CheckDataSourceMemoryTask();
 }
 
-HeapprofdProducer::~HeapprofdProducer() = default;
+HeapprofdProducer::~HeapprofdProducer() {
+  // Stop the workers from handing tasks to each other while they are being
+  // torn down.
+  unwinding_queue_->Shutdown();
+}
 
 void HeapprofdProducer::SetTargetProcess(pid_t target_pid,
                                          std::string target_cmdline) {
@@ -656,6 +683,8 @@ void HeapprofdProducer::SetStats(
   stats->set_unwinding_errors(process_state.unwinding_errors);
   stats->set_heap_samples(process_state.heap_samples);
   stats->set_map_reparses(process_state.map_reparses);
+  stats->set_elf_cache_hits(process_state.elf_cache_hits);
+  stats->set_elf_cache_misses(process_state.elf_cache_misses);
   stats->set_total_unwinding_time_us(process_state.total_unwinding_time_us);
   stats->set_client_spinlock_blocked_us(
       process_state.client_spinlock_blocked_us);
@@ -678,11 +707,24 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
 
     bool from_startup = data_source->signaled_pids.find(pid) ==
                         data_source->signaled_pids.cend();
+    // Incremental dumps only make sense on top of a full one, so the first
+    // dump is full.
+    bool incremental = false;
+    if (data_source->config.continuous_dump_config().incremental() &&
+        !data_source->config.dump_at_max()) {
+      incremental = heap_info.dumped &&
+                    heap_info.incremental_dumps < kMaxIncrementalDumps;
+      heap_info.incremental_dumps =
+          incremental ? heap_info.incremental_dumps + 1 : 0;
+    }
+    heap_info.dumped = true;
 
-    auto new_heapsamples = [pid, from_startup, process_state, data_source,
-                            &heap_info](
+    auto new_heapsamples = [pid, from_startup, incremental, process_state,
+                            data_source, &heap_info](
                                ProfilePacket::ProcessHeapSamples* proto) {
       proto->set_pid(static_cast<uint64_t>(pid));
+      if (incremental)
+        proto->set_incremental(true);
       proto->set_timestamp(heap_info.heap_tracker.dump_timestamp());
       proto->set_from_startup(from_startup);
       proto->set_disconnected(process_state->disconnected);
@@ -707,7 +749,8 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
         [&dump_state,
          &data_source](const HeapTracker::CallstackAllocations& alloc) {
           dump_state.WriteAllocation(alloc, data_source->config.dump_at_max());
-        });
+        },
+        incremental);
     dump_state.DumpCallstacks(&callsites_);
   }
 }
@@ -1053,6 +1096,8 @@ void HeapprofdProducer::HandleAllocRecord(AllocRecord* alloc_rec) {
     process_state.unwinding_errors++;
   if (alloc_rec->reparsed_map)
     process_state.map_reparses++;
+  process_state.elf_cache_hits += alloc_rec->elf_cache_hits;
+  process_state.elf_cache_misses += alloc_rec->elf_cache_misses;
   process_state.heap_samples++;
   process_state.unwinding_time_us.Add(alloc_rec->unwinding_time_us);
   process_state.total_unwinding_time_us += alloc_rec->unwinding_time_us;
@@ -1160,6 +1205,11 @@ bool HeapprofdProducer::MaybeFinishDataSource(DataSource* ds) {
       weak_producer->endpoint_->NotifyDataSourceStopped(ds_id);
     weak_producer->data_sources_.erase(ds_id);
 
+    // Drop the parsed files shared by the unwinders once nothing is being
+    // profiled. The ones still used by connected clients stay alive.
+    if (weak_producer->data_sources_.empty())
+      ElfCache::GetInstance()->Clear();
+
     if (exit_when_done) {
       // Post this as a task to allow NotifyDataSourceStopped to post tasks.
       weak_producer->task_runner_->PostTask([weak_producer] {
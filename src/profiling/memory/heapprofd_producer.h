@@ -179,6 +179,9 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
       std::string heap_name;
       uint64_t sampling_interval = 0u;
       uint64_t orig_sampling_interval = 0u;
+      bool dumped = false;
+      // Incremental dumps since the last full one.
+      uint32_t incremental_dumps = 0;
     };
     ProcessState(GlobalCallstackTrie* c, bool d)
         : callsites(c), dump_at_max_mode(d) {}
@@ -190,6 +193,8 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
     uint64_t heap_samples = 0;
     uint64_t map_reparses = 0;
     uint64_t unwinding_errors = 0;
+    uint64_t elf_cache_hits = 0;
+    uint64_t elf_cache_misses = 0;
 
     uint64_t total_unwinding_time_us = 0;
     uint64_t client_spinlock_blocked_us = 0;
@@ -313,6 +318,9 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
 
   std::map<FlushRequestID, size_t> flushes_in_progress_;
   std::map<DataSourceInstanceID, DataSource> data_sources_;
+  // Malloc records that the UnwindingWorker of their client hands to the other
+  // workers while it is falling behind.
+  std::shared_ptr<SharedUnwindingQueue> unwinding_queue_;
   std::vector<UnwindingWorker> unwinding_workers_;
 
   // Specific to mode_ == kChild
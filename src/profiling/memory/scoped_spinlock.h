@@ -42,6 +42,8 @@ class ScopedSpinlock {
   enum class Mode {
     // Try for a fixed number of attempts, then return an unlocked handle.
     Try,
+    // Return an unlocked handle if the lock is held.
+    TryOnce,
     // Keep spinning until successful.
     Blocking
   };
@@ -55,7 +57,8 @@ class ScopedSpinlock {
       locked_ = true;
       return;
     }
-    LockSlow(mode);
+    if (mode != Mode::TryOnce)
+      LockSlow(mode);
   }
 
   ScopedSpinlock(const ScopedSpinlock&) = delete;
@@ -19,6 +19,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/MachineArm64.h>
 #include <unwindstack/MachineMips.h>
@@ -51,6 +53,7 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/thread_task_runner.h"
 
+#include "src/profiling/common/elf_cache.h"
 #include "src/profiling/memory/unwound_messages.h"
 #include "src/profiling/memory/wire_protocol.h"
 
@@ -69,6 +72,12 @@ constexpr size_t kMaxFrames = 500;
 constexpr size_t kUnwindBatchSize = 1000;
 constexpr size_t kRecordBatchSize = 1024;
 constexpr size_t kMaxAllocRecordArenaSize = 2 * kRecordBatchSize;
+// Malloc records are put in the SharedUnwindingQueue while more than
+// 1 / kShareBacklogDivisor of the shared memory buffer of the client is unread.
+constexpr size_t kShareBacklogDivisor = 4;
+// How often to check whether the UnwindingTasks of a disconnected client have
+// been handled.
+constexpr uint32_t kPendingTasksRetryMs = 10;
 
 #pragma GCC diagnostic push
 // We do not care about deterministic destructor order.
@@ -88,6 +97,17 @@ void ReadFromRawData(unwindstack::Regs* regs, void* raw_data) {
   memcpy(regs->RawData(), raw_data, GetRegsSize(regs));
 }
 
+bool IsSkippedMap(const unwindstack::FrameData& frame) {
+  if (frame.map_info == nullptr)
+    return false;
+  const std::string& name = frame.map_info->name();
+  size_t slash = name.rfind('/');
+  std::string basename =
+      slash == std::string::npos ? name : name.substr(slash + 1);
+  return std::find(kSkipMaps.begin(), kSkipMaps.end(), basename) !=
+         kSkipMaps.end();
+}
+
 }  // namespace
 
 std::unique_ptr<unwindstack::Regs> CreateRegsFromRawData(
@@ -180,6 +200,7 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
       break;
     }
   }
+  metadata->CacheLoadedElfs(out->frames, regs->Arch());
   out->build_ids.resize(out->frames.size());
   for (size_t i = 0; i < out->frames.size(); ++i) {
     out->build_ids[i] = metadata->GetBuildId(out->frames[i]);
@@ -198,6 +219,179 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
   return true;
 }
 
+bool BuildFramesFromPcs(WireMessage* msg,
+                        UnwindingMetadata* metadata,
+                        AllocRecord* out) {
+  AllocMetadata* alloc_metadata = msg->alloc_header;
+  size_t num_pcs = std::min(msg->payload_size / sizeof(uint64_t), kMaxFrames);
+  unwindstack::JitDebug* jit_debug = nullptr;
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+  jit_debug = metadata->GetJitDebug(alloc_metadata->arch);
+#endif
+
+  out->frames.clear();
+  bool has_invalid_map = false;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (attempt > 0) {
+      if (metadata->last_maps_reparse_time + kMapsReparseInterval >
+          base::GetWallTimeMs()) {
+        PERFETTO_DLOG("Skipping reparse due to rate limit.");
+        break;
+      }
+      PERFETTO_DLOG("Reparsing maps");
+      metadata->ReparseMaps();
+      metadata->last_maps_reparse_time = base::GetWallTimeMs();
+      out->reparsed_map = true;
+      out->frames.clear();
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+      jit_debug = metadata->GetJitDebug(alloc_metadata->arch);
+#endif
+    }
+    has_invalid_map = false;
+    for (size_t i = 0; i < num_pcs; ++i) {
+      uint64_t pc;
+      memcpy(&pc, msg->payload + i * sizeof(uint64_t), sizeof(pc));
+      unwindstack::FrameData frame = unwindstack::Unwinder::BuildFrameFromPcOnly(
+          pc, alloc_metadata->arch, &metadata->fd_maps, jit_debug,
+          metadata->fd_mem, /*resolve_names=*/true);
+      if (frame.map_info == nullptr)
+        has_invalid_map = true;
+      // Same as the initial_map_names_to_skip of the unwinder.
+      if (out->frames.empty() && IsSkippedMap(frame))
+        continue;
+      frame.num = out->frames.size();
+      out->frames.emplace_back(std::move(frame));
+    }
+    if (!has_invalid_map)
+      break;
+  }
+  metadata->CacheLoadedElfs(out->frames, alloc_metadata->arch);
+  out->build_ids.resize(out->frames.size());
+  for (size_t i = 0; i < out->frames.size(); ++i) {
+    out->build_ids[i] = metadata->GetBuildId(out->frames[i]);
+  }
+
+  if (has_invalid_map) {
+    PERFETTO_DLOG("PC not in any map");
+    unwindstack::FrameData frame_data{};
+    frame_data.function_name =
+        "ERROR " + StringifyLibUnwindstackError(unwindstack::ERROR_INVALID_MAP);
+    out->frames.emplace_back(std::move(frame_data));
+    out->build_ids.emplace_back("");
+    out->error = true;
+  }
+  return true;
+}
+
+MapsSnapshot::MapsSnapshot(unwindstack::Maps* maps) {
+  for (const std::shared_ptr<unwindstack::MapInfo>& map_info : *maps)
+    maps_.push_back(map_info);
+}
+
+MapsSnapshot::~MapsSnapshot() = default;
+
+bool DoUnwindWithSnapshot(WireMessage* msg,
+                          MapsSnapshot* maps,
+                          std::shared_ptr<unwindstack::Memory> mem,
+                          AllocRecord* out) {
+  AllocMetadata* alloc_metadata = msg->alloc_header;
+  std::unique_ptr<unwindstack::Regs> regs(CreateRegsFromRawData(
+      alloc_metadata->arch, alloc_metadata->register_data));
+  if (regs == nullptr)
+    return false;
+  uint8_t* stack = reinterpret_cast<uint8_t*>(msg->payload);
+  std::shared_ptr<unwindstack::Memory> mems =
+      std::make_shared<StackOverlayMemory>(std::move(mem),
+                                           alloc_metadata->stack_pointer, stack,
+                                           msg->payload_size);
+
+  // libunwindstack synchronizes the loading and use of the Elf of a MapInfo,
+  // so this can run concurrently with other unwinds using the same MapInfos.
+  unwindstack::Unwinder unwinder(kMaxFrames, maps, regs.get(), mems);
+  out->frames.swap(unwinder.frames());  // Provide the unwinder buffer to use.
+  unwinder.Unwind(&kSkipMaps, /*map_suffixes_to_ignore=*/nullptr);
+  out->frames.swap(unwinder.frames());  // Take the buffer back.
+  unwindstack::ErrorCode error_code = unwinder.LastErrorCode();
+  if (error_code == unwindstack::ERROR_INVALID_MAP ||
+      (unwinder.warnings() & unwindstack::WARNING_DEX_PC_NOT_IN_MAP) != 0) {
+    return false;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+  // This might be JIT code, which needs the JitDebug of the client.
+  if (error_code != unwindstack::ERROR_NONE)
+    return false;
+#endif
+
+  out->build_ids.resize(out->frames.size());
+  for (size_t i = 0; i < out->frames.size(); ++i) {
+    const unwindstack::FrameData& frame = out->frames[i];
+    if (frame.map_info != nullptr && !frame.map_info->name().empty())
+      out->build_ids[i] = frame.map_info->GetBuildID();
+    else
+      out->build_ids[i].clear();
+  }
+
+  if (error_code != unwindstack::ERROR_NONE) {
+    PERFETTO_DLOG("Unwinding error %" PRIu8, error_code);
+    unwindstack::FrameData frame_data{};
+    frame_data.function_name =
+        "ERROR " + StringifyLibUnwindstackError(error_code);
+
+    out->frames.emplace_back(std::move(frame_data));
+    out->build_ids.emplace_back("");
+    out->error = true;
+  }
+  return true;
+}
+
+SharedUnwindingQueue::SharedUnwindingQueue(size_t max_tasks)
+    : max_tasks_(max_tasks) {}
+
+void SharedUnwindingQueue::AddWorker(UnwindingWorker* worker) {
+  workers_.push_back(worker);
+}
+
+bool SharedUnwindingQueue::Push(std::unique_ptr<UnwindingTask> task) {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (shut_down_ || tasks_.size() >= max_tasks_)
+    return false;
+  UnwindingWorker* owner = task->owner;
+  tasks_.emplace_back(std::move(task));
+  // Wake up the other workers in turn. The owner is busy reading the records
+  // of the client.
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    UnwindingWorker* worker = workers_[next_worker_++ % workers_.size()];
+    if (worker != owner) {
+      worker->PostUnwindSharedTasks();
+      break;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<UnwindingTask> SharedUnwindingQueue::Pop() {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (tasks_.empty())
+    return nullptr;
+  std::unique_ptr<UnwindingTask> task = std::move(tasks_.front());
+  tasks_.pop_front();
+  return task;
+}
+
+void SharedUnwindingQueue::ReturnToOwner(std::unique_ptr<UnwindingTask> task) {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (shut_down_)
+    return;
+  UnwindingWorker* owner = task->owner;
+  owner->PostReturnedTask(std::move(task));
+}
+
+void SharedUnwindingQueue::Shutdown() {
+  std::lock_guard<std::mutex> l(mutex_);
+  shut_down_ = true;
+  tasks_.clear();
+}
+
 void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
   pid_t peer_pid = self->peer_pid_linux();
   auto it = client_data_.find(peer_pid);
@@ -234,6 +428,19 @@ void UnwindingWorker::FinishDisconnect(
   ClientData& client_data = client_data_iterator->second;
   SharedRingBuffer& shmem = client_data.shmem;
 
+  // The AllocRecords of the records unwound by other workers need to be posted
+  // before the disconnect.
+  if (client_data.pending_tasks->load(std::memory_order_acquire) != 0) {
+    thread_task_runner_.get()->PostDelayedTask(
+        [this, peer_pid] {
+          auto it = client_data_.find(peer_pid);
+          if (it != client_data_.end())
+            FinishDisconnect(it);
+        },
+        kPendingTasksRetryMs);
+    return;
+  }
+
   if (!client_data.free_records.empty()) {
     delegate_->PostFreeRecord(this, std::move(client_data.free_records));
   }
@@ -384,28 +591,53 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
     return;
   }
 
-  if (msg.record_type == RecordType::Malloc) {
+  if (msg.record_type == RecordType::Malloc ||
+      msg.record_type == RecordType::MallocPcs) {
+    if (msg.record_type == RecordType::Malloc &&
+        !client_data->stream_allocations && self &&
+        self->MaybeShareRecord(msg, client_data, peer_pid)) {
+      return;
+    }
     std::unique_ptr<AllocRecord> rec = alloc_record_arena->BorrowAllocRecord();
     rec->alloc_metadata = *msg.alloc_header;
     rec->pid = peer_pid;
     rec->data_source_instance_id = data_source_instance_id;
+    const FDMaps& fd_maps = unwinding_metadata->fd_maps;
+    uint64_t elf_cache_hits = fd_maps.elf_cache_hits();
+    uint64_t elf_cache_misses = fd_maps.elf_cache_misses();
     auto start_time_us = base::GetWallTimeNs() / 1000;
-    if (!client_data->stream_allocations)
-      DoUnwind(&msg, unwinding_metadata, rec.get());
+    if (!client_data->stream_allocations) {
+      if (msg.record_type == RecordType::MallocPcs)
+        BuildFramesFromPcs(&msg, unwinding_metadata, rec.get());
+      else
+        DoUnwind(&msg, unwinding_metadata, rec.get());
+    }
     rec->unwinding_time_us = static_cast<uint64_t>(
         ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+    rec->elf_cache_hits = fd_maps.elf_cache_hits() - elf_cache_hits;
+    rec->elf_cache_misses = fd_maps.elf_cache_misses() - elf_cache_misses;
     delegate->PostAllocRecord(self, std::move(rec));
-  } else if (msg.record_type == RecordType::Free) {
-    FreeRecord rec;
-    rec.pid = peer_pid;
-    rec.data_source_instance_id = data_source_instance_id;
-    // We need to copy this, so we can return the memory to the shmem buffer.
-    memcpy(&rec.entry, msg.free_header, sizeof(*msg.free_header));
-    client_data->free_records.emplace_back(std::move(rec));
-    if (client_data->free_records.size() == kRecordBatchSize) {
-      delegate->PostFreeRecord(self, std::move(client_data->free_records));
-      client_data->free_records.clear();
-      client_data->free_records.reserve(kRecordBatchSize);
+  } else if (msg.record_type == RecordType::Free ||
+             msg.record_type == RecordType::FreeBatch) {
+    const char* entries = reinterpret_cast<const char*>(msg.free_header);
+    size_t num_entries = 1;
+    if (msg.record_type == RecordType::FreeBatch) {
+      entries = msg.payload;
+      num_entries = msg.payload_size / sizeof(FreeEntry);
+    }
+    for (size_t i = 0; i < num_entries; ++i) {
+      FreeRecord rec;
+      rec.pid = peer_pid;
+      rec.data_source_instance_id = data_source_instance_id;
+      // We need to copy this, so we can return the memory to the shmem
+      // buffer.
+      memcpy(&rec.entry, entries + i * sizeof(FreeEntry), sizeof(FreeEntry));
+      client_data->free_records.emplace_back(std::move(rec));
+      if (client_data->free_records.size() == kRecordBatchSize) {
+        delegate->PostFreeRecord(self, std::move(client_data->free_records));
+        client_data->free_records.clear();
+        client_data->free_records.reserve(kRecordBatchSize);
+      }
     }
   } else if (msg.record_type == RecordType::HeapName) {
     HeapNameRecord rec;
@@ -419,6 +651,111 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
   }
 }
 
+bool UnwindingWorker::MaybeShareRecord(const WireMessage& msg,
+                                       ClientData* client_data,
+                                       pid_t peer_pid) {
+  if (!shared_queue_ || !shared_queue_->has_other_workers())
+    return false;
+  // Copying the stack is cheaper than unwinding it, but not free. Only do it
+  // when this worker is falling behind.
+  SharedRingBuffer& shmem = client_data->shmem;
+  if (shmem.read_avail() < shmem.size() / kShareBacklogDivisor)
+    return false;
+
+  UnwindingMetadata& metadata = client_data->metadata;
+  if (!client_data->maps_snapshot ||
+      client_data->maps_snapshot_reparses != metadata.reparses) {
+    client_data->maps_snapshot.reset(new MapsSnapshot(&metadata.fd_maps));
+    client_data->maps_snapshot_reparses = metadata.reparses;
+  }
+
+  std::unique_ptr<UnwindingTask> task(new UnwindingTask());
+  task->owner = this;
+  task->pid = peer_pid;
+  task->data_source_instance_id = client_data->data_source_instance_id;
+  task->alloc_metadata = *msg.alloc_header;
+  task->stack.assign(msg.payload, msg.payload + msg.payload_size);
+  task->maps = client_data->maps_snapshot;
+  task->mem = metadata.fd_mem;
+  task->pending_tasks = client_data->pending_tasks;
+  client_data->pending_tasks->fetch_add(1, std::memory_order_acq_rel);
+  if (!shared_queue_->Push(std::move(task))) {
+    client_data->pending_tasks->fetch_sub(1, std::memory_order_acq_rel);
+    return false;
+  }
+  return true;
+}
+
+void UnwindingWorker::PostUnwindSharedTasks() {
+  if (shared_tasks_posted_->exchange(true, std::memory_order_acq_rel))
+    return;
+  thread_task_runner_.get()->PostTask([this] { UnwindSharedTasks(); });
+}
+
+void UnwindingWorker::UnwindSharedTasks() {
+  shared_tasks_posted_->store(false, std::memory_order_release);
+  for (size_t i = 0; i < kUnwindBatchSize; ++i) {
+    std::unique_ptr<UnwindingTask> task = shared_queue_->Pop();
+    if (!task)
+      return;
+    std::unique_ptr<AllocRecord> rec = alloc_record_arena_.BorrowAllocRecord();
+    rec->alloc_metadata = task->alloc_metadata;
+    rec->pid = task->pid;
+    rec->data_source_instance_id = task->data_source_instance_id;
+    WireMessage msg = {};
+    msg.record_type = RecordType::Malloc;
+    msg.alloc_header = &task->alloc_metadata;
+    msg.payload = task->stack.data();
+    msg.payload_size = task->stack.size();
+    auto start_time_us = base::GetWallTimeNs() / 1000;
+    if (!DoUnwindWithSnapshot(&msg, task->maps.get(), task->mem, rec.get())) {
+      alloc_record_arena_.ReturnAllocRecord(std::move(rec));
+      shared_queue_->ReturnToOwner(std::move(task));
+      continue;
+    }
+    rec->unwinding_time_us = static_cast<uint64_t>(
+        ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+    // The maps of the snapshot are not matched against the Elf cache.
+    rec->elf_cache_hits = 0;
+    rec->elf_cache_misses = 0;
+    delegate_->PostAllocRecord(this, std::move(rec));
+    task->pending_tasks->fetch_sub(1, std::memory_order_acq_rel);
+  }
+  // Let the other tasks of this thread run before handling more.
+  PostUnwindSharedTasks();
+}
+
+void UnwindingWorker::PostReturnedTask(std::unique_ptr<UnwindingTask> task) {
+  // Even with C++14, this cannot be moved, as std::function has to be
+  // copyable, which unique_ptr is not.
+  UnwindingTask* raw_task = task.release();
+  thread_task_runner_.get()->PostTask([this, raw_task] {
+    UnwindReturnedTask(std::unique_ptr<UnwindingTask>(raw_task));
+  });
+}
+
+void UnwindingWorker::UnwindReturnedTask(std::unique_ptr<UnwindingTask> task) {
+  auto it = client_data_.find(task->pid);
+  if (it != client_data_.end() &&
+      it->second.data_source_instance_id == task->data_source_instance_id) {
+    std::unique_ptr<AllocRecord> rec = alloc_record_arena_.BorrowAllocRecord();
+    rec->alloc_metadata = task->alloc_metadata;
+    rec->pid = task->pid;
+    rec->data_source_instance_id = task->data_source_instance_id;
+    WireMessage msg = {};
+    msg.record_type = RecordType::Malloc;
+    msg.alloc_header = &task->alloc_metadata;
+    msg.payload = task->stack.data();
+    msg.payload_size = task->stack.size();
+    auto start_time_us = base::GetWallTimeNs() / 1000;
+    DoUnwind(&msg, &it->second.metadata, rec.get());
+    rec->unwinding_time_us = static_cast<uint64_t>(
+        ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+    delegate_->PostAllocRecord(this, std::move(rec));
+  }
+  task->pending_tasks->fetch_sub(1, std::memory_order_acq_rel);
+}
+
 void UnwindingWorker::PostHandoffSocket(HandoffData handoff_data) {
   // Even with C++14, this cannot be moved, as std::function has to be
   // copyable, which HandoffData is not.
@@ -439,7 +776,8 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
   pid_t peer_pid = sock->peer_pid_linux();
 
   UnwindingMetadata metadata(std::move(handoff_data.maps_fd),
-                             std::move(handoff_data.mem_fd));
+                             std::move(handoff_data.mem_fd),
+                             ElfCache::GetInstance());
   ClientData client_data{
       handoff_data.data_source_instance_id,
       std::move(sock),
@@ -17,6 +17,13 @@
 #ifndef SRC_PROFILING_MEMORY_UNWINDING_H_
 #define SRC_PROFILING_MEMORY_UNWINDING_H_
 
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unwindstack/Maps.h>
 #include <unwindstack/Regs.h>
 
 #include "perfetto/base/time.h"
@@ -37,6 +44,31 @@ std::unique_ptr<unwindstack::Regs> CreateRegsFromRawData(
 
 bool DoUnwind(WireMessage*, UnwindingMetadata* metadata, AllocRecord* out);
 
+// Builds the frames of a MallocPcs record, for which the client has already
+// walked the stack, without running the unwinder.
+bool BuildFramesFromPcs(WireMessage*,
+                        UnwindingMetadata* metadata,
+                        AllocRecord* out);
+
+// Copy of the maps of a client, that is not modified after construction, so
+// that other threads than the one owning the client's UnwindingMetadata can
+// unwind with it. The MapInfos, and the Elfs they have loaded, are shared with
+// |maps|.
+class MapsSnapshot : public unwindstack::Maps {
+ public:
+  explicit MapsSnapshot(unwindstack::Maps* maps);
+  ~MapsSnapshot() override;
+};
+
+// Unwinds |msg| with |maps|, which does not get reparsed. Returns false if
+// the client's UnwindingMetadata is needed, because a frame is not in |maps|
+// or needs JIT or DEX information, in which case |out| should be unwound again
+// with DoUnwind.
+bool DoUnwindWithSnapshot(WireMessage* msg,
+                          MapsSnapshot* maps,
+                          std::shared_ptr<unwindstack::Memory> mem,
+                          AllocRecord* out);
+
 // AllocRecords are expensive to construct and destruct. We have seen up to
 // 10 % of total CPU of heapprofd being used to destruct them. That is why
 // we re-use them to cut CPU usage significantly.
@@ -56,6 +88,54 @@ class AllocRecordArena {
   bool enabled_ = true;
 };
 
+class UnwindingWorker;
+
+// A malloc record copied out of the shared memory buffer of a client, so that
+// it can be unwound by another UnwindingWorker than the one owning the client.
+struct UnwindingTask {
+  UnwindingWorker* owner;
+  pid_t pid;
+  DataSourceInstanceID data_source_instance_id;
+  AllocMetadata alloc_metadata;
+  std::vector<char> stack;
+  std::shared_ptr<MapsSnapshot> maps;
+  std::shared_ptr<unwindstack::Memory> mem;
+  // Number of tasks of the client not handled yet.
+  std::shared_ptr<std::atomic<uint64_t>> pending_tasks;
+};
+
+// Shared by the UnwindingWorkers of a heapprofd. A worker that reads records
+// from a client faster than it can unwind them puts some here, and wakes up
+// another worker to unwind them.
+class SharedUnwindingQueue {
+ public:
+  explicit SharedUnwindingQueue(size_t max_tasks);
+
+  // Must be called before the workers start using the queue.
+  void AddWorker(UnwindingWorker* worker);
+
+  // Returns false if the queue is full or shut down.
+  bool Push(std::unique_ptr<UnwindingTask> task);
+  std::unique_ptr<UnwindingTask> Pop();
+  // Hands a task that could not be unwound with its MapsSnapshot back to its
+  // owner.
+  void ReturnToOwner(std::unique_ptr<UnwindingTask> task);
+
+  // Drops the queued tasks. After this returns, the workers do not post
+  // anything to each other anymore, so they can be destroyed.
+  void Shutdown();
+
+  bool has_other_workers() const { return workers_.size() > 1; }
+
+ private:
+  const size_t max_tasks_;
+  std::vector<UnwindingWorker*> workers_;
+  std::mutex mutex_;
+  std::deque<std::unique_ptr<UnwindingTask>> tasks_;
+  size_t next_worker_ = 0;
+  bool shut_down_ = false;
+};
+
 class UnwindingWorker : public base::UnixSocket::EventListener {
  public:
   class Delegate {
@@ -85,7 +165,14 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
       : delegate_(delegate),
         thread_task_runner_(std::move(thread_task_runner)) {}
 
+  // Must be called before the first PostHandoffSocket.
+  void SetSharedQueue(std::shared_ptr<SharedUnwindingQueue> queue) {
+    shared_queue_ = std::move(queue);
+  }
+
   // Public API safe to call from other threads.
+  void PostUnwindSharedTasks();
+  void PostReturnedTask(std::unique_ptr<UnwindingTask> task);
   void PostDisconnectSocket(pid_t pid);
   void PostPurgeProcess(pid_t pid);
   void PostHandoffSocket(HandoffData);
@@ -113,6 +200,12 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     bool stream_allocations = false;
     size_t drain_bytes = 0;
     std::vector<FreeRecord> free_records;
+    // Snapshot of metadata.fd_maps for the UnwindingTasks, made when the first
+    // task is created after each reparse.
+    std::shared_ptr<MapsSnapshot> maps_snapshot;
+    uint64_t maps_snapshot_reparses = 0;
+    std::shared_ptr<std::atomic<uint64_t>> pending_tasks =
+        std::make_shared<std::atomic<uint64_t>>(0);
   };
 
   // public for testing/fuzzing
@@ -145,9 +238,22 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   void BatchUnwindJob(pid_t);
   void DrainJob(pid_t);
 
+  // Copies the malloc record |msg| into the shared queue if this worker is
+  // behind with the client. Returns false if it wasn't.
+  bool MaybeShareRecord(const WireMessage& msg,
+                        ClientData* client_data,
+                        pid_t peer_pid);
+  void UnwindSharedTasks();
+  void UnwindReturnedTask(std::unique_ptr<UnwindingTask> task);
+
   AllocRecordArena alloc_record_arena_;
   std::map<pid_t, ClientData> client_data_;
   Delegate* delegate_;
+  std::shared_ptr<SharedUnwindingQueue> shared_queue_;
+  // Whether an UnwindSharedTasks task is posted and has not started yet.
+  // unique_ptr as UnwindingWorker needs to be movable.
+  std::unique_ptr<std::atomic<bool>> shared_tasks_posted_{
+      new std::atomic<bool>(false)};
 
   // Task runner with a dedicated thread. Keep last as instances this class are
   // currently (incorrectly) being destroyed on the main thread, instead of the
@@ -20,10 +20,16 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <unwindstack/RegsGetLocal.h>
 
+#include <functional>
+#include <mutex>
+
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/unix_socket.h"
 #include "src/profiling/common/unwind_support.h"
 #include "src/profiling/memory/client.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -182,6 +188,262 @@ TEST(UnwindingTest, DoUnwindReparse) {
                "namespace)::GetRecord(perfetto::profiling::WireMessage*)");
 }
 
+TEST(UnwindingTest, DoUnwindWithSnapshot) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(std::move(proc_maps), std::move(proc_mem));
+  MapsSnapshot snapshot(&metadata.fd_maps);
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  AllocRecord out;
+  ASSERT_TRUE(DoUnwindWithSnapshot(&msg, &snapshot, metadata.fd_mem, &out));
+  ASSERT_GT(out.frames.size(), 0u);
+  int st;
+  std::unique_ptr<char, base::FreeDeleter> demangled(abi::__cxa_demangle(
+      out.frames[0].function_name.c_str(), nullptr, nullptr, &st));
+  ASSERT_EQ(st, 0) << "mangled: " << demangled.get()
+                   << ", frames: " << out.frames.size();
+  ASSERT_STREQ(demangled.get(),
+               "perfetto::profiling::(anonymous "
+               "namespace)::GetRecord(perfetto::profiling::WireMessage*)");
+}
+
+TEST(UnwindingTest, DoUnwindWithSnapshotNeedsReparse) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(std::move(proc_maps), std::move(proc_mem));
+  metadata.fd_maps.Reset();
+  MapsSnapshot snapshot(&metadata.fd_maps);
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  AllocRecord out;
+  EXPECT_FALSE(DoUnwindWithSnapshot(&msg, &snapshot, metadata.fd_mem, &out));
+}
+
+TEST(UnwindingTest, BuildFramesFromPcs) {
+  if (!kFramePointerUnwindingSupported)
+    GTEST_SKIP();
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(std::move(proc_maps), std::move(proc_mem));
+
+  AllocMetadata alloc_metadata = {};
+  alloc_metadata.arch = unwindstack::Regs::CurrentArch();
+  const char* stackend = GetThreadStackRange().end;
+  const char* stackptr = reinterpret_cast<char*>(__builtin_frame_address(0));
+  uint64_t pcs[64];
+  size_t num_pcs = UnwindFramePointers(stackptr, stackptr, stackend, pcs, 64);
+  ASSERT_GT(num_pcs, 0u);
+
+  WireMessage msg = {};
+  msg.record_type = RecordType::MallocPcs;
+  msg.alloc_header = &alloc_metadata;
+  msg.payload = reinterpret_cast<char*>(pcs);
+  msg.payload_size = num_pcs * sizeof(uint64_t);
+  AllocRecord out;
+  ASSERT_TRUE(BuildFramesFromPcs(&msg, &metadata, &out));
+  ASSERT_GE(out.frames.size(), 1u);
+  ASSERT_EQ(out.build_ids.size(), out.frames.size());
+  // The first frame is the caller of this test body, which is in the test
+  // binary.
+  EXPECT_NE(out.frames[0].map_info, nullptr);
+  EXPECT_FALSE(out.frames[0].function_name.empty());
+}
+
+constexpr DataSourceInstanceID kDataSourceId = 1;
+
+class RecordingDelegate : public UnwindingWorker::Delegate {
+ public:
+  void PostAllocRecord(UnwindingWorker* worker,
+                       std::unique_ptr<AllocRecord> rec) override {
+    std::lock_guard<std::mutex> l(mutex_);
+    alloc_records_.emplace_back(worker, std::move(rec));
+  }
+  void PostFreeRecord(UnwindingWorker*, std::vector<FreeRecord>) override {}
+  void PostHeapNameRecord(UnwindingWorker*, HeapNameRecord) override {}
+  void PostSocketDisconnected(UnwindingWorker*,
+                              DataSourceInstanceID,
+                              pid_t,
+                              SharedRingBuffer::Stats) override {
+    std::lock_guard<std::mutex> l(mutex_);
+    disconnected_ = true;
+    alloc_records_at_disconnect_ = alloc_records_.size();
+  }
+
+  size_t num_alloc_records() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return alloc_records_.size();
+  }
+  // Returns the number of AllocRecords posted by |worker|, checking that they
+  // were unwound correctly.
+  size_t NumUnwoundBy(UnwindingWorker* worker) {
+    std::lock_guard<std::mutex> l(mutex_);
+    size_t n = 0;
+    for (const auto& worker_and_rec : alloc_records_) {
+      if (worker_and_rec.first != worker)
+        continue;
+      const AllocRecord& rec = *worker_and_rec.second;
+      EXPECT_FALSE(rec.frames.empty());
+      if (!rec.frames.empty()) {
+        EXPECT_NE(rec.frames[0].function_name.find("GetRecord"),
+                  std::string::npos);
+      }
+      n++;
+    }
+    return n;
+  }
+  bool disconnected() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return disconnected_;
+  }
+  size_t alloc_records_at_disconnect() {
+    std::lock_guard<std::mutex> l(mutex_);
+    return alloc_records_at_disconnect_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::pair<UnwindingWorker*, std::unique_ptr<AllocRecord>>>
+      alloc_records_;
+  bool disconnected_ = false;
+  size_t alloc_records_at_disconnect_ = 0;
+};
+
+bool WaitUntil(std::function<bool()> condition) {
+  for (int i = 0; i < 10000; ++i) {
+    if (condition())
+      return true;
+    usleep(1000);
+  }
+  return condition();
+}
+
+// The client side of a connection handed off to an UnwindingWorker.
+struct TestClient {
+  base::UnixSocketRaw sock;
+  base::Optional<SharedRingBuffer> shmem;
+};
+
+class UnwindingWorkerSharingTest : public ::testing::Test {
+ protected:
+  static constexpr size_t kShmemSize = 1048576;
+
+  UnwindingWorkerSharingTest()
+      : queue_(new SharedUnwindingQueue(/*max_tasks=*/1024)),
+        worker_a_(&delegate_,
+                  base::ThreadTaskRunner::CreateAndStart("unwind_a")),
+        worker_b_(&delegate_,
+                  base::ThreadTaskRunner::CreateAndStart("unwind_b")) {
+    queue_->AddWorker(&worker_a_);
+    queue_->AddWorker(&worker_b_);
+    worker_a_.SetSharedQueue(queue_);
+    worker_b_.SetSharedQueue(queue_);
+  }
+
+  ~UnwindingWorkerSharingTest() override { queue_->Shutdown(); }
+
+  TestClient HandoffToWorkerA() {
+    TestClient client;
+    base::UnixSocketRaw srv_sock;
+    std::tie(client.sock, srv_sock) = base::UnixSocketRaw::CreatePairPosix(
+        base::SockFamily::kUnix, base::SockType::kStream);
+    PERFETTO_CHECK(client.sock && srv_sock);
+    auto shmem = SharedRingBuffer::Create(kShmemSize);
+    PERFETTO_CHECK(shmem);
+    client.shmem = SharedRingBuffer::Attach(base::ScopedFile(dup(shmem->fd())));
+    PERFETTO_CHECK(client.shmem);
+
+    UnwindingWorker::HandoffData handoff_data;
+    handoff_data.data_source_instance_id = kDataSourceId;
+    handoff_data.sock = std::move(srv_sock);
+    handoff_data.maps_fd = base::OpenFile("/proc/self/maps", O_RDONLY);
+    handoff_data.mem_fd = base::OpenFile("/proc/self/mem", O_RDONLY);
+    handoff_data.shmem = std::move(*shmem);
+    handoff_data.client_config = {};
+    handoff_data.stream_allocations = false;
+    worker_a_.PostHandoffSocket(std::move(handoff_data));
+    return client;
+  }
+
+  // Fills half of the shared memory buffer of |client| with malloc records,
+  // so that worker A falls behind, and wakes up worker A. Returns the number
+  // of records.
+  size_t WriteMallocRecords(TestClient* client) {
+    WireMessage msg;
+    auto record = GetRecord(&msg);
+    msg.record_type = RecordType::Malloc;
+    size_t written = 0;
+    size_t records = 0;
+    while (written < kShmemSize / 2) {
+      record.metadata->sequence_number = ++records;
+      int64_t res = SendWireMessage(&*client->shmem, msg);
+      PERFETTO_CHECK(res > 0);
+      written += static_cast<size_t>(res);
+    }
+    char notify = 'x';
+    PERFETTO_CHECK(client->sock.Send(&notify, sizeof(notify)) == 1);
+    return records;
+  }
+
+  RecordingDelegate delegate_;
+  std::shared_ptr<SharedUnwindingQueue> queue_;
+  UnwindingWorker worker_a_;
+  UnwindingWorker worker_b_;
+};
+
+TEST_F(UnwindingWorkerSharingTest, SharesRecordsWithOtherWorker) {
+  TestClient client = HandoffToWorkerA();
+  size_t records = WriteMallocRecords(&client);
+  ASSERT_TRUE(
+      WaitUntil([&] { return delegate_.num_alloc_records() == records; }));
+  // Worker A shares the records it reads while it's behind, and unwinds the
+  // rest itself.
+  EXPECT_GT(delegate_.NumUnwoundBy(&worker_b_), 0u);
+  EXPECT_GT(delegate_.NumUnwoundBy(&worker_a_), 0u);
+  EXPECT_EQ(delegate_.NumUnwoundBy(&worker_a_) +
+                delegate_.NumUnwoundBy(&worker_b_),
+            records);
+}
+
+TEST_F(UnwindingWorkerSharingTest, ReturnsTaskToOwner) {
+  TestClient client = HandoffToWorkerA();
+
+  // A snapshot of no maps cannot unwind anything, so worker B has to hand the
+  // task back to worker A.
+  UnwindingMetadata metadata(base::OpenFile("/proc/self/maps", O_RDONLY),
+                             base::OpenFile("/proc/self/mem", O_RDONLY));
+  metadata.fd_maps.Reset();
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  std::unique_ptr<UnwindingTask> task(new UnwindingTask());
+  task->owner = &worker_a_;
+  task->pid = getpid();
+  task->data_source_instance_id = kDataSourceId;
+  task->alloc_metadata = *msg.alloc_header;
+  task->stack.assign(msg.payload, msg.payload + msg.payload_size);
+  task->maps.reset(new MapsSnapshot(&metadata.fd_maps));
+  task->mem = metadata.fd_mem;
+  task->pending_tasks = std::make_shared<std::atomic<uint64_t>>(1);
+  std::shared_ptr<std::atomic<uint64_t>> pending_tasks = task->pending_tasks;
+  ASSERT_TRUE(queue_->Push(std::move(task)));
+
+  ASSERT_TRUE(WaitUntil([&] { return pending_tasks->load() == 0; }));
+  EXPECT_EQ(delegate_.num_alloc_records(), 1u);
+  EXPECT_EQ(delegate_.NumUnwoundBy(&worker_a_), 1u);
+}
+
+TEST_F(UnwindingWorkerSharingTest, DisconnectWaitsForSharedRecords) {
+  TestClient client = HandoffToWorkerA();
+  size_t records = WriteMallocRecords(&client);
+  client.sock.Shutdown();
+
+  ASSERT_TRUE(WaitUntil([&] { return delegate_.disconnected(); }));
+  // All the records, including the ones unwound by worker B, are posted before
+  // the disconnect.
+  EXPECT_EQ(delegate_.alloc_records_at_disconnect(), records);
+  EXPECT_EQ(delegate_.num_alloc_records(), records);
+}
+
 TEST(AllocRecordArenaTest, Smoke) {
   AllocRecordArena a;
   auto borrowed = a.BorrowAllocRecord();
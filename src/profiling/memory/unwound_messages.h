@@ -32,6 +32,8 @@ struct AllocRecord {
   bool error = false;
   bool reparsed_map = false;
   uint64_t unwinding_time_us = 0;
+  uint64_t elf_cache_hits = 0;
+  uint64_t elf_cache_misses = 0;
   uint64_t data_source_instance_id;
   uint64_t timestamp;
   AllocMetadata alloc_metadata;
@@ -90,7 +90,8 @@ int64_t WithBuffer(SharedRingBuffer* shmem, size_t total_size, F fn) {
 
 int64_t SendWireMessage(SharedRingBuffer* shmem, const WireMessage& msg) {
   switch (msg.record_type) {
-    case RecordType::Malloc: {
+    case RecordType::Malloc:
+    case RecordType::MallocPcs: {
       size_t total_size = sizeof(msg.record_type) + sizeof(*msg.alloc_header) +
                           msg.payload_size;
       return WithBuffer(
@@ -114,6 +115,15 @@ int64_t SendWireMessage(SharedRingBuffer* shmem, const WireMessage& msg) {
                    sizeof(*msg.free_header));
           });
     }
+    case RecordType::FreeBatch: {
+      size_t total_size = sizeof(msg.record_type) + msg.payload_size;
+      return WithBuffer(
+          shmem, total_size, [msg](SharedRingBuffer::Buffer* buf) {
+            memcpy(buf->data, &msg.record_type, sizeof(msg.record_type));
+            memcpy(buf->data + sizeof(msg.record_type), msg.payload,
+                   msg.payload_size);
+          });
+    }
     case RecordType::HeapName: {
       constexpr size_t total_size =
           sizeof(msg.record_type) + sizeof(*msg.heap_name_header);
@@ -139,7 +149,8 @@ bool ReceiveWireMessage(char* buf, size_t size, WireMessage* out) {
   out->payload_size = 0;
   out->record_type = *record_type;
 
-  if (*record_type == RecordType::Malloc) {
+  if (*record_type == RecordType::Malloc ||
+      *record_type == RecordType::MallocPcs) {
     if (!ViewAndAdvance<AllocMetadata>(&buf, &out->alloc_header, end)) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read alloc header.");
       return false;
@@ -150,11 +161,23 @@ bool ReceiveWireMessage(char* buf, size_t size, WireMessage* out) {
       return false;
     }
     out->payload_size = static_cast<size_t>(end - buf);
+    if (*record_type == RecordType::MallocPcs &&
+        out->payload_size % sizeof(uint64_t) != 0) {
+      PERFETTO_DFATAL_OR_ELOG("Invalid PCs payload.");
+      return false;
+    }
   } else if (*record_type == RecordType::Free) {
     if (!ViewAndAdvance<FreeEntry>(&buf, &out->free_header, end)) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
       return false;
     }
+  } else if (*record_type == RecordType::FreeBatch) {
+    out->payload = buf;
+    out->payload_size = static_cast<size_t>(end - buf);
+    if (out->payload_size == 0 || out->payload_size % sizeof(FreeEntry) != 0) {
+      PERFETTO_DFATAL_OR_ELOG("Invalid free batch.");
+      return false;
+    }
   } else if (*record_type == RecordType::HeapName) {
     if (!ViewAndAdvance<HeapName>(&buf, &out->heap_name_header, end)) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
@@ -68,7 +68,10 @@ constexpr size_t kMaxRegisterDataSize =
 // and heapprofd. The basic format of a record sent by the client is
 // record size (uint64_t) | record type (RecordType = uint64_t) | record
 // If record type is Malloc, the record format is AllocMetdata | raw stack.
+// If record type is MallocPcs, the record format is AllocMetadata | uint64_t
+// return addresses, innermost first. The register_data is not set.
 // If the record type is Free, the record is a FreeEntry.
+// If the record type is FreeBatch, the record is one or more FreeEntry.
 // If record type is HeapName, the record is a HeapName.
 // On connect, heapprofd sends one ClientConfiguration struct over the control
 // socket.
@@ -96,6 +99,10 @@ struct ClientConfiguration {
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_fork_teardown;
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_vfork_detection;
   PERFETTO_CROSS_ABI_ALIGNED(bool) all_heaps;
+  // Walk the frame pointers in the client and send MallocPcs records.
+  PERFETTO_CROSS_ABI_ALIGNED(bool) frame_pointer_unwinding;
+  // Buffer frees in the client and send FreeBatch records.
+  PERFETTO_CROSS_ABI_ALIGNED(bool) batch_frees;
   // Just double check that the array sizes are in correct order.
 };
 
@@ -103,6 +110,8 @@ enum class RecordType : uint64_t {
   Free = 0,
   Malloc = 1,
   HeapName = 2,
+  MallocPcs = 3,
+  FreeBatch = 4,
 };
 
 // Make the whole struct 8-aligned. This is to make sizeof(AllocMetdata)
@@ -104,6 +104,40 @@ TEST(WireProtocolTest, AllocMessage) {
   shmem_server->EndRead(std::move(buf));
 }
 
+TEST(WireProtocolTest, MallocPcsMessage) {
+  uint64_t pcs[] = {0x1000, 0x2000, 0x3000};
+  WireMessage msg = {};
+  msg.record_type = RecordType::MallocPcs;
+  AllocMetadata metadata = {};
+  metadata.sequence_number = 0xA1A2A3A4A5A6A7A8;
+  metadata.alloc_size = 0xB1B2B3B4B5B6B7B8;
+  metadata.alloc_address = 0xC1C2C3C4C5C6C7C8;
+  metadata.arch = unwindstack::ARCH_ARM64;
+  msg.alloc_header = &metadata;
+  msg.payload = reinterpret_cast<char*>(pcs);
+  msg.payload_size = sizeof(pcs);
+
+  auto shmem_client = SharedRingBuffer::Create(kShmemSize);
+  ASSERT_TRUE(shmem_client);
+  ASSERT_TRUE(shmem_client->is_valid());
+  auto shmem_server = SharedRingBuffer::Attach(CopyFD(shmem_client->fd()));
+
+  ASSERT_GE(SendWireMessage(&shmem_client.value(), msg), 0);
+
+  auto buf = shmem_server->BeginRead();
+  ASSERT_TRUE(buf);
+  WireMessage recv_msg;
+  ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                                 &recv_msg));
+
+  ASSERT_EQ(recv_msg.record_type, msg.record_type);
+  ASSERT_EQ(*recv_msg.alloc_header, *msg.alloc_header);
+  ASSERT_EQ(recv_msg.payload_size, sizeof(pcs));
+  ASSERT_EQ(memcmp(recv_msg.payload, pcs, sizeof(pcs)), 0);
+
+  shmem_server->EndRead(std::move(buf));
+}
+
 TEST(WireProtocolTest, FreeMessage) {
   WireMessage msg = {};
   msg.record_type = RecordType::Free;
@@ -132,6 +166,40 @@ TEST(WireProtocolTest, FreeMessage) {
   shmem_server->EndRead(std::move(buf));
 }
 
+TEST(WireProtocolTest, FreeBatchMessage) {
+  FreeEntry entries[2] = {};
+  entries[0].sequence_number = 0x111111111111111;
+  entries[0].addr = 0x222222222222222;
+  entries[1].sequence_number = 0x333333333333333;
+  entries[1].addr = 0x444444444444444;
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.payload = reinterpret_cast<char*>(entries);
+  msg.payload_size = sizeof(entries);
+
+  auto shmem_client = SharedRingBuffer::Create(kShmemSize);
+  ASSERT_TRUE(shmem_client);
+  ASSERT_TRUE(shmem_client->is_valid());
+  auto shmem_server = SharedRingBuffer::Attach(CopyFD(shmem_client->fd()));
+
+  ASSERT_GE(SendWireMessage(&shmem_client.value(), msg), 0);
+
+  auto buf = shmem_server->BeginRead();
+  ASSERT_TRUE(buf);
+  WireMessage recv_msg;
+  ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                                 &recv_msg));
+
+  ASSERT_EQ(recv_msg.record_type, msg.record_type);
+  ASSERT_EQ(recv_msg.payload_size, sizeof(entries));
+  FreeEntry recv_entries[2];
+  memcpy(recv_entries, recv_msg.payload, sizeof(recv_entries));
+  ASSERT_EQ(recv_entries[0], entries[0]);
+  ASSERT_EQ(recv_entries[1], entries[1]);
+
+  shmem_server->EndRead(std::move(buf));
+}
+
 TEST(GetHeapSamplingInterval, Default) {
   ClientConfiguration cli_config{};
   cli_config.all_heaps = true;
@@ -88,6 +88,9 @@ struct CompletedSample {
   std::vector<unwindstack::FrameData> frames;
   std::vector<std::string> build_ids;
   unwindstack::ErrorCode unwind_error = unwindstack::ERROR_NONE;
+  // See FDMaps::elf_cache_hits.
+  uint64_t elf_cache_hits = 0;
+  uint64_t elf_cache_misses = 0;
 };
 
 }  // namespace profiling
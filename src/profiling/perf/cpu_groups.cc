@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/cpu_groups.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_splitter.h"
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kNodeDir[] = "/sys/devices/system/node";
+
+// Parses a cpulist such as "0-3,8,10-11", calling |fn| for each cpu.
+template <typename F>
+void ForEachCpuInList(const std::string& cpulist, F fn) {
+  for (base::StringSplitter ss(base::StripSuffix(cpulist, "\n"), ',');
+       ss.Next();) {
+    std::string range = ss.cur_token();
+    size_t dash = range.find('-');
+    base::Optional<uint32_t> first = base::StringToUInt32(range.substr(0, dash));
+    base::Optional<uint32_t> last =
+        dash == std::string::npos ? first
+                                  : base::StringToUInt32(range.substr(dash + 1));
+    if (!first || !last)
+      continue;
+    for (uint32_t cpu = *first; cpu <= *last; cpu++)
+      fn(cpu);
+  }
+}
+
+}  // namespace
+
+std::vector<uint32_t> ReadCpuNodes(size_t num_cpus) {
+  std::vector<uint32_t> cpu_nodes(num_cpus, 0);
+  base::ScopedDir dir(opendir(kNodeDir));
+  if (!dir)
+    return cpu_nodes;
+  while (struct dirent* entry = readdir(*dir)) {
+    if (strncmp(entry->d_name, "node", 4) != 0)
+      continue;
+    base::Optional<uint32_t> node = base::CStringToUInt32(entry->d_name + 4);
+    if (!node)
+      continue;
+    std::string cpulist;
+    if (!base::ReadFile(std::string(kNodeDir) + "/" + entry->d_name +
+                            "/cpulist",
+                        &cpulist)) {
+      continue;
+    }
+    ForEachCpuInList(cpulist, [&cpu_nodes, &node](uint32_t cpu) {
+      if (cpu < cpu_nodes.size())
+        cpu_nodes[cpu] = *node;
+    });
+  }
+  return cpu_nodes;
+}
+
+std::vector<std::vector<uint32_t>> GroupCpusByNode(
+    const std::vector<uint32_t>& cpu_nodes,
+    size_t max_groups) {
+  std::vector<std::vector<uint32_t>> groups;
+  if (max_groups == 0 || cpu_nodes.empty())
+    return groups;
+
+  std::map<uint32_t, std::vector<uint32_t>> node_cpus;
+  for (uint32_t cpu = 0; cpu < cpu_nodes.size(); cpu++)
+    node_cpus[cpu_nodes[cpu]].push_back(cpu);
+
+  // Fewer groups than nodes: spread whole nodes over the groups.
+  if (max_groups <= node_cpus.size()) {
+    groups.resize(max_groups);
+    size_t i = 0;
+    for (const auto& node_and_cpus : node_cpus) {
+      std::vector<uint32_t>& group = groups[i++ % max_groups];
+      group.insert(group.end(), node_and_cpus.second.begin(),
+                   node_and_cpus.second.end());
+    }
+    for (std::vector<uint32_t>& group : groups)
+      std::sort(group.begin(), group.end());
+    return groups;
+  }
+
+  // Otherwise every node gets a group, and the remaining ones go to the nodes
+  // with the most cpus per group.
+  std::vector<const std::vector<uint32_t>*> nodes;
+  for (const auto& node_and_cpus : node_cpus)
+    nodes.push_back(&node_and_cpus.second);
+  std::vector<size_t> splits(nodes.size(), 1);
+  for (size_t extra = max_groups - nodes.size(); extra > 0; extra--) {
+    size_t best = nodes.size();
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (splits[i] >= nodes[i]->size())
+        continue;
+      if (best == nodes.size() ||
+          nodes[i]->size() * splits[best] > nodes[best]->size() * splits[i]) {
+        best = i;
+      }
+    }
+    if (best == nodes.size())
+      break;  // one cpu per group already
+    splits[best]++;
+  }
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const std::vector<uint32_t>& cpus = *nodes[i];
+    for (size_t k = 0; k < splits[i]; k++) {
+      groups.emplace_back(cpus.begin() + static_cast<ptrdiff_t>(
+                                             k * cpus.size() / splits[i]),
+                          cpus.begin() + static_cast<ptrdiff_t>(
+                                             (k + 1) * cpus.size() / splits[i]));
+    }
+  }
+  return groups;
+}
+
+void PinCurrentThreadToCpus(const std::vector<uint32_t>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (uint32_t cpu : cpus) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  if (sched_setaffinity(0 /* calling thread */, sizeof(set), &set) != 0)
+    PERFETTO_PLOG("sched_setaffinity");
+}
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_PERF_CPU_GROUPS_H_
+#define SRC_PROFILING_PERF_CPU_GROUPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace perfetto {
+namespace profiling {
+
+// Returns the NUMA node of each of the first |num_cpus| cpus, as listed under
+// /sys/devices/system/node. Cpus that aren't listed there (e.g. on kernels
+// without NUMA support) are reported to be on node 0.
+std::vector<uint32_t> ReadCpuNodes(size_t num_cpus);
+
+// Splits the cpus, given as the node of each cpu, into at most |max_groups|
+// groups, none of which spans more than one node unless there are fewer groups
+// than nodes. The groups are balanced by number of cpus, and a node with more
+// cpus is split into more groups.
+std::vector<std::vector<uint32_t>> GroupCpusByNode(
+    const std::vector<uint32_t>& cpu_nodes,
+    size_t max_groups);
+
+// Restricts the calling thread to running on the given cpus.
+void PinCurrentThreadToCpus(const std::vector<uint32_t>& cpus);
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_PERF_CPU_GROUPS_H_
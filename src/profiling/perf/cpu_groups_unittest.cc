@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/cpu_groups.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(CpuGroupsTest, SingleNode) {
+  std::vector<uint32_t> nodes(6, 0);
+  EXPECT_THAT(GroupCpusByNode(nodes, 0), IsEmpty());
+  EXPECT_THAT(GroupCpusByNode(nodes, 1),
+              ElementsAre(ElementsAre(0, 1, 2, 3, 4, 5)));
+  EXPECT_THAT(GroupCpusByNode(nodes, 4),
+              ElementsAre(ElementsAre(0), ElementsAre(1, 2), ElementsAre(3),
+                          ElementsAre(4, 5)));
+  // At most one group per cpu.
+  EXPECT_EQ(GroupCpusByNode(nodes, 100).size(), 6u);
+}
+
+TEST(CpuGroupsTest, FewerGroupsThanNodes) {
+  std::vector<uint32_t> nodes = {0, 1, 2, 0, 1, 2};
+  EXPECT_THAT(GroupCpusByNode(nodes, 1),
+              ElementsAre(ElementsAre(0, 1, 2, 3, 4, 5)));
+  EXPECT_THAT(GroupCpusByNode(nodes, 2),
+              ElementsAre(ElementsAre(0, 2, 3, 5), ElementsAre(1, 4)));
+}
+
+TEST(CpuGroupsTest, GroupsDontSpanNodes) {
+  // Two interleaved nodes.
+  std::vector<uint32_t> nodes = {0, 1, 0, 1, 0, 1, 0, 1};
+  EXPECT_THAT(GroupCpusByNode(nodes, 2),
+              ElementsAre(ElementsAre(0, 2, 4, 6), ElementsAre(1, 3, 5, 7)));
+  EXPECT_THAT(GroupCpusByNode(nodes, 4),
+              ElementsAre(ElementsAre(0, 2), ElementsAre(4, 6),
+                          ElementsAre(1, 3), ElementsAre(5, 7)));
+}
+
+TEST(CpuGroupsTest, BiggerNodesGetMoreGroups) {
+  std::vector<uint32_t> nodes = {0, 0, 0, 0, 0, 0, 1, 1};
+  EXPECT_THAT(GroupCpusByNode(nodes, 3),
+              ElementsAre(ElementsAre(0, 1, 2), ElementsAre(3, 4, 5),
+                          ElementsAre(6, 7)));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -478,7 +478,7 @@ base::Optional<EventConfig> EventConfig::Create(
       std::move(target_filter), ring_buffer_pages.value(), read_tick_period_ms,
       samples_per_tick_limit, remote_descriptor_timeout_ms,
       pb_config.unwind_state_clear_period_ms(), max_enqueued_footprint_bytes,
-      pb_config.target_installed_by());
+      pb_config.max_timebase_backoff(), pb_config.target_installed_by());
 }
 
 EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
@@ -493,6 +493,7 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
                          uint32_t remote_descriptor_timeout_ms,
                          uint32_t unwind_state_clear_period_ms,
                          uint64_t max_enqueued_footprint_bytes,
+                         uint32_t max_timebase_backoff,
                          std::vector<std::string> target_installed_by)
     : perf_event_attr_(pe),
       timebase_event_(timebase_event),
@@ -505,6 +506,7 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
       remote_descriptor_timeout_ms_(remote_descriptor_timeout_ms),
       unwind_state_clear_period_ms_(unwind_state_clear_period_ms),
       max_enqueued_footprint_bytes_(max_enqueued_footprint_bytes),
+      max_timebase_backoff_(max_timebase_backoff),
       target_installed_by_(std::move(target_installed_by)),
       raw_ds_config_(raw_ds_config) /* full copy */ {}
 
@@ -136,6 +136,7 @@ class EventConfig {
   uint64_t max_enqueued_footprint_bytes() const {
     return max_enqueued_footprint_bytes_;
   }
+  uint32_t max_timebase_backoff() const { return max_timebase_backoff_; }
   bool sample_callstacks() const { return user_frames_ || kernel_frames_; }
   bool user_frames() const { return user_frames_; }
   bool kernel_frames() const { return kernel_frames_; }
@@ -162,6 +163,7 @@ class EventConfig {
               uint32_t remote_descriptor_timeout_ms,
               uint32_t unwind_state_clear_period_ms,
               uint64_t max_enqueued_footprint_bytes,
+              uint32_t max_timebase_backoff,
               std::vector<std::string> target_installed_by);
 
   // Parameter struct for the leader (timebase) perf_event_open syscall.
@@ -200,6 +202,10 @@ class EventConfig {
 
   const uint64_t max_enqueued_footprint_bytes_;
 
+  // Upper bound for the factor by which the sampling rate is lowered when the
+  // unwinder can't keep up. Disabled if zero or one.
+  const uint32_t max_timebase_backoff_;
+
   // Only profile target if it was installed by one of the packages given.
   // Special values are:
   // * "@system": installed on the system partition
@@ -384,5 +384,13 @@ void EventReader::DisableEvents() {
   PERFETTO_CHECK(ret == 0);
 }
 
+bool EventReader::SetTimebasePeriod(uint64_t period_or_frequency) {
+  if (ioctl(perf_fd_.get(), PERF_EVENT_IOC_PERIOD, &period_or_frequency) != 0) {
+    PERFETTO_DPLOG("Failed PERF_EVENT_IOC_PERIOD");
+    return false;
+  }
+  return true;
+}
+
 }  // namespace profiling
 }  // namespace perfetto
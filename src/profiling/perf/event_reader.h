@@ -88,6 +88,10 @@ class EventReader {
   void EnableEvents();
   // Pauses the event counting, without invalidating existing samples.
   void DisableEvents();
+  // Changes the sampling period of the timebase, or its frequency if the event
+  // was configured with one. Safe to call while another thread is reading the
+  // samples.
+  bool SetTimebasePeriod(uint64_t period_or_frequency);
 
   uint32_t cpu() const { return cpu_; }
 
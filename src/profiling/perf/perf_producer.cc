@@ -16,6 +16,7 @@
 
 #include "src/profiling/perf/perf_producer.h"
 
+#include <algorithm>
 #include <random>
 #include <utility>
 
@@ -41,6 +42,7 @@
 #include "src/profiling/common/profiler_guardrails.h"
 #include "src/profiling/common/unwind_support.h"
 #include "src/profiling/perf/common_types.h"
+#include "src/profiling/perf/cpu_groups.h"
 #include "src/profiling/perf/event_reader.h"
 
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
@@ -70,6 +72,13 @@ constexpr uint32_t kProcDescriptorsAndroidDelayMs = 50;
 
 constexpr uint32_t kMemoryLimitCheckPeriodMs = 1000;
 
+// Occupancy of an unwinder queue above which the sampling rate is lowered, and
+// how many ticks the occupancy has to stay below the low mark before the rate
+// is raised again (see |AdaptTimebaseBackoff|).
+constexpr uint64_t kTimebaseBackoffHighMark = kUnwindQueueCapacity / 2;
+constexpr uint64_t kTimebaseBackoffLowMark = kUnwindQueueCapacity / 8;
+constexpr uint32_t kTimebaseRestoreIdleTicks = 10;
+
 constexpr uint32_t kInitialConnectionBackoffMs = 100;
 constexpr uint32_t kMaxConnectionBackoffMs = 30 * 1000;
 
@@ -331,12 +340,32 @@ bool PerfProducer::ShouldRejectDueToFilter(
 }
 
 PerfProducer::PerfProducer(ProcDescriptorGetter* proc_fd_getter,
-                           base::TaskRunner* task_runner)
+                           base::TaskRunner* task_runner,
+                           uint32_t reader_threads,
+                           uint32_t unwinder_threads)
     : task_runner_(task_runner),
+      reader_thread_count_(reader_threads),
+      unwinder_thread_count_(std::max(unwinder_threads, 1u)),
       proc_fd_getter_(proc_fd_getter),
-      unwinding_worker_(this),
       weak_factory_(this) {
   proc_fd_getter->SetDelegate(this);
+
+  for (uint32_t i = 0; i < unwinder_thread_count_; i++) {
+    unwinding_workers_.emplace_back(
+        new UnwinderHandle(this, /*clears_elf_cache=*/i == 0));
+  }
+
+  if (reader_thread_count_ > 0) {
+    reader_cpus_ =
+        GroupCpusByNode(ReadCpuNodes(NumberOfCpus()), reader_thread_count_);
+    for (const std::vector<uint32_t>& cpus : reader_cpus_) {
+      reader_threads_.emplace_back(
+          base::ThreadTaskRunner::CreateAndStart("perf-reader"));
+      // The kernel allocates each ring buffer on the node of its cpu, read it
+      // from there.
+      reader_threads_.back().PostTask([cpus] { PinCurrentThreadToCpus(cpus); });
+    }
+  }
 }
 
 void PerfProducer::SetupDataSource(DataSourceInstanceID,
@@ -420,7 +449,7 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
   DataSourceState& ds = ds_it->second;
 
   // Start the configured events.
-  for (auto& per_cpu_reader : ds.per_cpu_readers) {
+  for (auto& per_cpu_reader : *ds.per_cpu_readers) {
     per_cpu_reader.EnableEvents();
   }
 
@@ -430,13 +459,14 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
       ds_it->second.trace_writer.get(),
       protos::pbzero::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
 
-  // Inform unwinder of the new data source instance, and optionally start a
-  // periodic task to clear its cached state.
-  unwinding_worker_->PostStartDataSource(ds_id,
-                                         ds.event_config.kernel_frames());
-  if (ds.event_config.unwind_state_clear_period_ms()) {
-    unwinding_worker_->PostClearCachedStatePeriodic(
-        ds_id, ds.event_config.unwind_state_clear_period_ms());
+  // Inform the unwinders of the new data source instance, and optionally start
+  // a periodic task to clear their cached state.
+  for (auto& worker : unwinding_workers_) {
+    (*worker)->PostStartDataSource(ds_id, ds.event_config.kernel_frames());
+    if (ds.event_config.unwind_state_clear_period_ms()) {
+      (*worker)->PostClearCachedStatePeriodic(
+          ds_id, ds.event_config.unwind_state_clear_period_ms());
+    }
   }
 
   // Kick off periodic read task.
@@ -583,26 +613,39 @@ void PerfProducer::TickDataSourceRead(DataSourceInstanceID ds_id) {
   }
   DataSourceState& ds = it->second;
 
+  if (!reader_threads_.empty())
+    return PostReaderGroupReads(ds_id, &ds);
+
   PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_READ_TICK);
 
   // Make a pass over all per-cpu readers.
   uint64_t max_samples = ds.event_config.samples_per_tick_limit();
   bool more_records_available = false;
-  for (EventReader& reader : ds.per_cpu_readers) {
+  for (EventReader& reader : *ds.per_cpu_readers) {
     if (ReadAndParsePerCpuBuffer(&reader, max_samples, ds_id, &ds)) {
       more_records_available = true;
     }
   }
+  FinishReadTick(ds_id, &ds, more_records_available);
+}
 
-  // Wake up the unwinder as we've (likely) pushed samples into its queue.
-  unwinding_worker_->PostProcessQueue();
+void PerfProducer::FinishReadTick(DataSourceInstanceID ds_id,
+                                  DataSourceState* ds,
+                                  bool more_records_available) {
+  // Wake up the unwinders as we've (likely) pushed samples into their queues.
+  for (auto& worker : unwinding_workers_)
+    (*worker)->PostProcessQueue();
 
-  if (PERFETTO_UNLIKELY(ds.status == DataSourceState::Status::kShuttingDown) &&
+  AdaptTimebaseBackoff(ds_id, ds);
+
+  if (PERFETTO_UNLIKELY(ds->status == DataSourceState::Status::kShuttingDown) &&
       !more_records_available) {
-    unwinding_worker_->PostInitiateDataSourceStop(ds_id);
+    ds->unwinders_stopping = unwinding_workers_.size();
+    for (auto& worker : unwinding_workers_)
+      (*worker)->PostInitiateDataSourceStop(ds_id);
   } else {
     // otherwise, keep reading
-    auto tick_period_ms = it->second.event_config.read_tick_period_ms();
+    auto tick_period_ms = ds->event_config.read_tick_period_ms();
     auto weak_this = weak_factory_.GetWeakPtr();
     task_runner_->PostDelayedTask(
         [weak_this, ds_id] {
@@ -635,132 +678,273 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
     if (!sample) {
       return false;  // caught up to the writer
     }
+    HandleSample(ds_id, ds, std::move(sample.value()));
+  }
 
-    // Counter-only mode: skip the unwinding stage, serialise the sample
-    // immediately.
-    const EventConfig& event_config = ds->event_config;
-    if (!event_config.sample_callstacks()) {
-      CompletedSample output;
-      output.common = sample->common;
-      EmitSample(ds_id, std::move(output));
-      continue;
-    }
+  // Most likely more events in the kernel buffer. Though we might be exactly on
+  // the boundary due to |max_samples|.
+  return true;
+}
 
-    // Sampling either or both of userspace and kernel callstacks.
-    pid_t pid = sample->common.pid;
-    auto& process_state = ds->process_states[pid];  // insert if new
+void PerfProducer::PostReaderGroupReads(DataSourceInstanceID ds_id,
+                                        DataSourceState* ds) {
+  // The next tick is scheduled only once all the groups are done.
+  PERFETTO_DCHECK(ds->pending_reader_groups == 0);
+  ds->pending_reader_groups = reader_threads_.size();
+  ds->more_records_available = false;
 
-    // Asynchronous proc-fd lookup timed out.
-    if (process_state == ProcessTrackingStatus::kFdsTimedOut) {
-      PERFETTO_DLOG("Skipping sample for pid [%d]: kFdsTimedOut",
-                    static_cast<int>(pid));
-      EmitSkippedSample(ds_id, std::move(sample.value()),
-                        SampleSkipReason::kReadStage);
-      continue;
-    }
+  uint64_t max_samples = ds->event_config.samples_per_tick_limit();
+  std::shared_ptr<std::vector<EventReader>> readers = ds->per_cpu_readers;
+  base::TaskRunner* task_runner = task_runner_;
+  auto weak_this = weak_factory_.GetWeakPtr();
+  for (size_t i = 0; i < reader_threads_.size(); i++) {
+    std::vector<uint32_t> cpus = reader_cpus_[i];
+    reader_threads_[i].PostTask([readers, cpus, max_samples, task_runner,
+                                 weak_this, ds_id] {
+      PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_READ_TICK);
+
+      // hack: c++11 lambdas can't be moved into, so stash the samples on the
+      // heap.
+      std::vector<ParsedSample>* samples = new std::vector<ParsedSample>();
+      bool more_records_available = false;
+      for (uint32_t cpu : cpus) {
+        if (cpu >= readers->size())
+          continue;
+        PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_READ_CPU);
+        auto records_lost_callback = [task_runner, weak_this, ds_id,
+                                      cpu](uint64_t records_lost) {
+          task_runner->PostTask([weak_this, ds_id, cpu, records_lost] {
+            if (weak_this)
+              weak_this->EmitRingBufferLoss(ds_id, cpu, records_lost);
+          });
+        };
+        EventReader& reader = (*readers)[cpu];
+        uint64_t read = 0;
+        for (; read < max_samples; read++) {
+          base::Optional<ParsedSample> sample =
+              reader.ReadUntilSample(records_lost_callback);
+          if (!sample)
+            break;  // caught up to the writer
+          samples->emplace_back(std::move(sample.value()));
+        }
+        if (read == max_samples)
+          more_records_available = true;
+      }
 
-    // Previously excluded, e.g. due to failing the target filter check.
-    if (process_state == ProcessTrackingStatus::kRejected) {
-      PERFETTO_DLOG("Skipping sample for pid [%d]: kRejected",
-                    static_cast<int>(pid));
-      continue;
-    }
+      task_runner->PostTask(
+          [weak_this, ds_id, samples, more_records_available] {
+            if (weak_this) {
+              weak_this->OnReaderGroupDone(ds_id, std::move(*samples),
+                                           more_records_available);
+            }
+            delete samples;
+          });
+    });
+  }
+}
 
-    // Seeing pid for the first time. We need to consider whether the process
-    // is a kernel thread, and which callstacks we're recording.
-    //
-    // {user} stacks -> user processes: signal for proc-fd lookup
-    //               -> kthreads: reject
-    //
-    // {kernel} stacks -> user processes: accept without proc-fds
-    //                 -> kthreads: accept without proc-fds
-    //
-    // {kernel+user} stacks -> user processes: signal for proc-fd lookup
-    //                      -> kthreads: accept without proc-fds
-    //
-    if (process_state == ProcessTrackingStatus::kInitial) {
-      PERFETTO_DLOG("New pid: [%d]", static_cast<int>(pid));
-
-      // Kernel threads (which have no userspace state) are never relevant if
-      // we're not recording kernel callchains.
-      bool is_kthread = !sample->regs;  // no userspace regs
-      if (is_kthread && !event_config.kernel_frames()) {
-        process_state = ProcessTrackingStatus::kRejected;
-        continue;
-      }
+void PerfProducer::OnReaderGroupDone(DataSourceInstanceID ds_id,
+                                     std::vector<ParsedSample> samples,
+                                     bool more_records_available) {
+  auto it = data_sources_.find(ds_id);
+  if (it == data_sources_.end())
+    return;
+  DataSourceState& ds = it->second;
 
-      // Check whether samples for this new process should be dropped due to
-      // the target filtering. Kernel threads don't have a cmdline, but we
-      // still check against pid inclusion/exclusion.
-      if (ShouldRejectDueToFilter(
-              pid, event_config.filter(), is_kthread, &ds->additional_cmdlines,
-              [pid](std::string* cmdline) {
-                return glob_aware::ReadProcCmdlineForPID(pid, cmdline);
-              })) {
-        process_state = ProcessTrackingStatus::kRejected;
-        continue;
-      }
+  for (ParsedSample& sample : samples)
+    HandleSample(ds_id, &ds, std::move(sample));
+  ds.more_records_available |= more_records_available;
 
-      // At this point, sampled process is known to be of interest.
-      if (!is_kthread && event_config.user_frames()) {
-        // Start resolving the proc-fds. Response is async.
-        process_state = ProcessTrackingStatus::kFdsResolving;
-        InitiateDescriptorLookup(ds_id, pid,
-                                 event_config.remote_descriptor_timeout_ms());
-        // note: fallthrough
-      } else {
-        // Either a kernel thread (no need to obtain proc-fds), or a userspace
-        // process but we're not recording userspace callstacks.
-        process_state = ProcessTrackingStatus::kAccepted;
-        unwinding_worker_->PostRecordNoUserspaceProcess(ds_id, pid);
-        // note: fallthrough
-      }
-    }
+  PERFETTO_DCHECK(ds.pending_reader_groups > 0);
+  if (--ds.pending_reader_groups > 0)
+    return;
+  FinishReadTick(ds_id, &ds, ds.more_records_available);
+}
+
+void PerfProducer::HandleSample(DataSourceInstanceID ds_id,
+                                DataSourceState* ds,
+                                ParsedSample sample) {
+  // Counter-only mode: skip the unwinding stage, serialise the sample
+  // immediately.
+  const EventConfig& event_config = ds->event_config;
+  if (!event_config.sample_callstacks()) {
+    CompletedSample output;
+    output.common = sample.common;
+    EmitSample(ds_id, std::move(output));
+    return;
+  }
 
-    PERFETTO_CHECK(process_state == ProcessTrackingStatus::kAccepted ||
-                   process_state == ProcessTrackingStatus::kFdsResolving);
+  // Sampling either or both of userspace and kernel callstacks.
+  pid_t pid = sample.common.pid;
+  auto& process_state = ds->process_states[pid];  // insert if new
 
-    // If we're only interested in the kernel callchains, then userspace
-    // process samples are relevant only if they were sampled during kernel
-    // context.
-    if (!event_config.user_frames() &&
-        sample->common.cpu_mode == PERF_RECORD_MISC_USER) {
-      PERFETTO_DLOG("Skipping usermode sample for kernel-only config");
-      continue;
+  // Asynchronous proc-fd lookup timed out.
+  if (process_state == ProcessTrackingStatus::kFdsTimedOut) {
+    PERFETTO_DLOG("Skipping sample for pid [%d]: kFdsTimedOut",
+                  static_cast<int>(pid));
+    EmitSkippedSample(ds_id, std::move(sample), SampleSkipReason::kReadStage);
+    return;
+  }
+
+  // Previously excluded, e.g. due to failing the target filter check.
+  if (process_state == ProcessTrackingStatus::kRejected) {
+    PERFETTO_DLOG("Skipping sample for pid [%d]: kRejected",
+                  static_cast<int>(pid));
+    return;
+  }
+
+  // Seeing pid for the first time. We need to consider whether the process
+  // is a kernel thread, and which callstacks we're recording.
+  //
+  // {user} stacks -> user processes: signal for proc-fd lookup
+  //               -> kthreads: reject
+  //
+  // {kernel} stacks -> user processes: accept without proc-fds
+  //                 -> kthreads: accept without proc-fds
+  //
+  // {kernel+user} stacks -> user processes: signal for proc-fd lookup
+  //                      -> kthreads: accept without proc-fds
+  //
+  if (process_state == ProcessTrackingStatus::kInitial) {
+    PERFETTO_DLOG("New pid: [%d]", static_cast<int>(pid));
+
+    // Kernel threads (which have no userspace state) are never relevant if
+    // we're not recording kernel callchains.
+    bool is_kthread = !sample.regs;  // no userspace regs
+    if (is_kthread && !event_config.kernel_frames()) {
+      process_state = ProcessTrackingStatus::kRejected;
+      return;
     }
 
-    // Optionally: drop sample if above a given threshold of sampled stacks
-    // that are waiting in the unwinding queue.
-    uint64_t max_footprint_bytes = event_config.max_enqueued_footprint_bytes();
-    uint64_t sample_stack_size = sample->stack.size();
-    if (max_footprint_bytes) {
-      uint64_t footprint_bytes = unwinding_worker_->GetEnqueuedFootprint();
-      if (footprint_bytes + sample_stack_size >= max_footprint_bytes) {
-        PERFETTO_DLOG("Skipping sample enqueueing due to footprint limit.");
-        EmitSkippedSample(ds_id, std::move(sample.value()),
-                          SampleSkipReason::kUnwindEnqueue);
-        continue;
-      }
+    // Check whether samples for this new process should be dropped due to
+    // the target filtering. Kernel threads don't have a cmdline, but we
+    // still check against pid inclusion/exclusion.
+    if (ShouldRejectDueToFilter(
+            pid, event_config.filter(), is_kthread, &ds->additional_cmdlines,
+            [pid](std::string* cmdline) {
+              return glob_aware::ReadProcCmdlineForPID(pid, cmdline);
+            })) {
+      process_state = ProcessTrackingStatus::kRejected;
+      return;
     }
 
-    // Push the sample into the unwinding queue if there is room.
-    auto& queue = unwinding_worker_->unwind_queue();
-    WriteView write_view = queue.BeginWrite();
-    if (write_view.valid) {
-      queue.at(write_view.write_pos) =
-          UnwindEntry{ds_id, std::move(sample.value())};
-      queue.CommitWrite();
-      unwinding_worker_->IncrementEnqueuedFootprint(sample_stack_size);
+    // At this point, sampled process is known to be of interest.
+    if (!is_kthread && event_config.user_frames()) {
+      // Start resolving the proc-fds. Response is async.
+      process_state = ProcessTrackingStatus::kFdsResolving;
+      InitiateDescriptorLookup(ds_id, pid,
+                               event_config.remote_descriptor_timeout_ms());
+      // note: fallthrough
     } else {
-      PERFETTO_DLOG("Unwinder queue full, skipping sample");
-      EmitSkippedSample(ds_id, std::move(sample.value()),
+      // Either a kernel thread (no need to obtain proc-fds), or a userspace
+      // process but we're not recording userspace callstacks.
+      process_state = ProcessTrackingStatus::kAccepted;
+      UnwinderForPid(pid)->PostRecordNoUserspaceProcess(ds_id, pid);
+      // note: fallthrough
+    }
+  }
+
+  PERFETTO_CHECK(process_state == ProcessTrackingStatus::kAccepted ||
+                 process_state == ProcessTrackingStatus::kFdsResolving);
+
+  // If we're only interested in the kernel callchains, then userspace
+  // process samples are relevant only if they were sampled during kernel
+  // context.
+  if (!event_config.user_frames() &&
+      sample.common.cpu_mode == PERF_RECORD_MISC_USER) {
+    PERFETTO_DLOG("Skipping usermode sample for kernel-only config");
+    return;
+  }
+
+  // Optionally: drop sample if above a given threshold of sampled stacks
+  // that are waiting in the unwinding queue.
+  uint64_t max_footprint_bytes = event_config.max_enqueued_footprint_bytes();
+  uint64_t sample_stack_size = sample.stack.size();
+  if (max_footprint_bytes) {
+    uint64_t footprint_bytes = GetEnqueuedFootprint();
+    if (footprint_bytes + sample_stack_size >= max_footprint_bytes) {
+      PERFETTO_DLOG("Skipping sample enqueueing due to footprint limit.");
+      ds->unwinder_overloaded = true;
+      EmitSkippedSample(ds_id, std::move(sample),
                         SampleSkipReason::kUnwindEnqueue);
+      return;
     }
-  }  // for (i < max_samples)
+  }
 
-  // Most likely more events in the kernel buffer. Though we might be exactly on
-  // the boundary due to |max_samples|.
-  return true;
+  // Push the sample into the unwinding queue of the process' unwinder if there
+  // is room.
+  Unwinder* unwinder = UnwinderForPid(pid);
+  auto& queue = unwinder->unwind_queue();
+  WriteView write_view = queue.BeginWrite();
+  if (write_view.valid) {
+    queue.at(write_view.write_pos) = UnwindEntry{ds_id, std::move(sample)};
+    queue.CommitWrite();
+    unwinder->IncrementEnqueuedFootprint(sample_stack_size);
+  } else {
+    PERFETTO_DLOG("Unwinder queue full, skipping sample");
+    ds->unwinder_overloaded = true;
+    EmitSkippedSample(ds_id, std::move(sample),
+                      SampleSkipReason::kUnwindEnqueue);
+  }
+}
+
+uint64_t PerfProducer::GetEnqueuedFootprint() {
+  uint64_t footprint_bytes = 0;
+  for (auto& worker : unwinding_workers_)
+    footprint_bytes += (*worker)->GetEnqueuedFootprint();
+  return footprint_bytes;
+}
+
+// The unwinders' queues are shared by all the data sources, so this lowers the
+// rate of every data source that allows it while the unwinders are behind. The
+// rate is restored gradually, after the queues have stayed nearly empty for a
+// while, to avoid oscillating around the unwinders' capacity.
+void PerfProducer::AdaptTimebaseBackoff(DataSourceInstanceID ds_id,
+                                        DataSourceState* ds) {
+  uint32_t max_backoff = ds->event_config.max_timebase_backoff();
+  if (max_backoff <= 1 || ds->status != DataSourceState::Status::kActive)
+    return;
+
+  uint64_t max_queue_size = 0;
+  for (auto& worker : unwinding_workers_)
+    max_queue_size = std::max(max_queue_size, (*worker)->unwind_queue().size());
+
+  bool overloaded =
+      ds->unwinder_overloaded || max_queue_size >= kTimebaseBackoffHighMark;
+  ds->unwinder_overloaded = false;
+  if (max_queue_size <= kTimebaseBackoffLowMark && !overloaded) {
+    ds->unwinder_idle_ticks++;
+  } else {
+    ds->unwinder_idle_ticks = 0;
+  }
+
+  uint32_t backoff = ds->timebase_backoff;
+  if (overloaded && backoff < max_backoff) {
+    backoff = std::min(backoff * 2, max_backoff);
+  } else if (ds->unwinder_idle_ticks >= kTimebaseRestoreIdleTicks &&
+             backoff > 1) {
+    backoff /= 2;
+    ds->unwinder_idle_ticks = 0;
+  } else {
+    return;
+  }
+
+  PERFETTO_DLOG("DataSource(%zu): timebase backoff %" PRIu32 " -> %" PRIu32,
+                static_cast<size_t>(ds_id), ds->timebase_backoff, backoff);
+  const perf_event_attr* attr = ds->event_config.perf_attr();
+  uint64_t period_or_frequency =
+      attr->freq ? std::max<uint64_t>(attr->sample_freq / backoff, 1)
+                 : attr->sample_period * backoff;
+  for (EventReader& reader : *ds->per_cpu_readers)
+    reader.SetTimebasePeriod(period_or_frequency);
+  ds->timebase_backoff = backoff;
+
+  auto packet = StartTracePacket(ds->trace_writer.get());
+  packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
+  packet->set_timestamp_clock_id(
+      protos::pbzero::BuiltinClock::BUILTIN_CLOCK_BOOTTIME);
+  auto* perf_sample = packet->set_perf_sample();
+  perf_sample->set_producer_event()->set_timebase_backoff(backoff);
 }
 
 // Note: first-fit makes descriptor request fulfillment not true FIFO. But the
@@ -796,7 +980,7 @@ void PerfProducer::OnProcDescriptors(pid_t pid,
                     static_cast<int>(pid), static_cast<size_t>(it.first));
 
       proc_status_it->second = ProcessTrackingStatus::kAccepted;
-      unwinding_worker_->PostAdoptProcDescriptors(
+      UnwinderForPid(pid)->PostAdoptProcDescriptors(
           it.first, pid, std::move(maps_fd), std::move(mem_fd));
       return;  // done
     }
@@ -859,7 +1043,7 @@ void PerfProducer::EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id,
     proc_status_it->second = ProcessTrackingStatus::kFdsTimedOut;
     // Also inform the unwinder of the state change (so that it can discard any
     // of the already-enqueued samples).
-    unwinding_worker_->PostRecordTimedOutProcDescriptors(ds_id, pid);
+    UnwinderForPid(pid)->PostRecordTimedOutProcDescriptors(ds_id, pid);
   }
 }
 
@@ -884,6 +1068,8 @@ void PerfProducer::EmitSample(DataSourceInstanceID ds_id,
     return;
   }
   DataSourceState& ds = ds_it->second;
+  ds.elf_cache_hits += sample.elf_cache_hits;
+  ds.elf_cache_misses += sample.elf_cache_misses;
 
   // intern callsite
   GlobalCallstackTrie::Node* callstack_root =
@@ -997,7 +1183,7 @@ void PerfProducer::InitiateReaderStop(DataSourceState* ds) {
   PERFETTO_CHECK(ds->status != DataSourceState::Status::kShuttingDown);
 
   ds->status = DataSourceState::Status::kShuttingDown;
-  for (auto& event_reader : ds->per_cpu_readers) {
+  for (auto& event_reader : *ds->per_cpu_readers) {
     event_reader.DisableEvents();
   }
 }
@@ -1021,6 +1207,21 @@ void PerfProducer::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   DataSourceState& ds = ds_it->second;
   PERFETTO_CHECK(ds.status == DataSourceState::Status::kShuttingDown);
 
+  // Wait for all the unwinders to be done with the source.
+  PERFETTO_DCHECK(ds.unwinders_stopping > 0);
+  if (--ds.unwinders_stopping > 0)
+    return;
+
+  if (ds.elf_cache_hits || ds.elf_cache_misses) {
+    auto packet = StartTracePacket(ds.trace_writer.get());
+    packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
+    packet->set_timestamp_clock_id(
+        protos::pbzero::BuiltinClock::BUILTIN_CLOCK_BOOTTIME);
+    auto* producer_event = packet->set_perf_sample()->set_producer_event();
+    producer_event->set_elf_cache_hits(ds.elf_cache_hits);
+    producer_event->set_elf_cache_misses(ds.elf_cache_misses);
+  }
+
   ds.trace_writer->Flush();
   data_sources_.erase(ds_it);
 
@@ -1051,7 +1252,8 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   PERFETTO_LOG("Stopping DataSource(%zu) prematurely",
                static_cast<size_t>(ds_id));
 
-  unwinding_worker_->PostPurgeDataSource(ds_id);
+  for (auto& worker : unwinding_workers_)
+    (*worker)->PostPurgeDataSource(ds_id);
 
   // Write a packet indicating the abrupt stop.
   {
@@ -1208,10 +1410,13 @@ void PerfProducer::Restart() {
   base::TaskRunner* task_runner = task_runner_;
   const char* socket_name = producer_socket_name_;
   ProcDescriptorGetter* proc_fd_getter = proc_fd_getter_;
+  uint32_t reader_threads = reader_thread_count_;
+  uint32_t unwinder_threads = unwinder_thread_count_;
 
   // Invoke destructor and then the constructor again.
   this->~PerfProducer();
-  new (this) PerfProducer(proc_fd_getter, task_runner);
+  new (this) PerfProducer(proc_fd_getter, task_runner, reader_threads,
+                          unwinder_threads);
 
   ConnectWithRetries(socket_name);
 }
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <memory>
+#include <vector>
 
 #include <unistd.h>
 
@@ -28,6 +29,7 @@
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
@@ -54,12 +56,22 @@ namespace profiling {
 // the samples -> (2) callstack unwinder -> (3) interning and serialization of
 // samples. This class handles stages (1) and (3) on the main thread. Unwinding
 // is done by |Unwinder| on a dedicated thread.
+//
+// On machines with many cpus, the producer can be configured with:
+// * |reader_threads|: the kernel buffers are read and parsed on this many
+//   threads, each pinned to a group of cpus on the same NUMA node and reading
+//   the buffers of those cpus. The parsed samples are handed back to the main
+//   thread in batches, which still decides what to do with them.
+// * |unwinder_threads|: samples are unwound by this many |Unwinder|s, sharded
+//   by pid, each with its own queue.
 class PerfProducer : public Producer,
                      public ProcDescriptorDelegate,
                      public Unwinder::Delegate {
  public:
   PerfProducer(ProcDescriptorGetter* proc_fd_getter,
-               base::TaskRunner* task_runner);
+               base::TaskRunner* task_runner,
+               uint32_t reader_threads = 0,
+               uint32_t unwinder_threads = 1);
   ~PerfProducer() override = default;
 
   PerfProducer(const PerfProducer&) = delete;
@@ -110,6 +122,8 @@ class PerfProducer : public Producer,
       std::function<bool(std::string*)> read_proc_pid_cmdline);
 
  private:
+  friend class PerfProducerTest;
+
   // State of the producer's connection to tracing service (traced).
   enum State {
     kNotStarted = 0,
@@ -150,14 +164,31 @@ class PerfProducer : public Producer,
         : event_config(std::move(_event_config)),
           tracing_session_id(_tracing_session_id),
           trace_writer(std::move(_trace_writer)),
-          per_cpu_readers(std::move(_per_cpu_readers)) {}
+          per_cpu_readers(std::make_shared<std::vector<EventReader>>(
+              std::move(_per_cpu_readers))) {}
 
     Status status = Status::kActive;
     const EventConfig event_config;
     uint64_t tracing_session_id;
     std::unique_ptr<TraceWriter> trace_writer;
-    // Indexed by cpu, vector never resized.
-    std::vector<EventReader> per_cpu_readers;
+    // Indexed by cpu, vector never resized. Shared with the tasks running on
+    // the reader threads, which might outlive the data source.
+    std::shared_ptr<std::vector<EventReader>> per_cpu_readers;
+    // State of the read tick while the reader threads are reading the buffers.
+    size_t pending_reader_groups = 0;
+    bool more_records_available = false;
+    // Number of unwinders that haven't yet finished stopping this source.
+    size_t unwinders_stopping = 0;
+    // Factor applied to the configured sampling period, see
+    // EventConfig::max_timebase_backoff().
+    uint32_t timebase_backoff = 1;
+    // Whether the unwinders couldn't take all the samples since the last
+    // backoff evaluation, and for how many ticks they have been keeping up.
+    bool unwinder_overloaded = false;
+    uint32_t unwinder_idle_ticks = 0;
+    // Sum of the |ElfCache| stats of the unwound samples, written at the end.
+    uint64_t elf_cache_hits = 0;
+    uint64_t elf_cache_misses = 0;
     // Tracks the incremental state for interned entries.
     InterningOutputTracker interning_output;
     // Producer thread's view of sampled processes. This is the primary tracking
@@ -194,6 +225,33 @@ class PerfProducer : public Producer,
                                 uint64_t max_samples,
                                 DataSourceInstanceID ds_id,
                                 DataSourceState* ds);
+  // Reads the buffers of the data source on the reader threads, one task per
+  // group of cpus, which hand the samples back via |OnReaderGroupDone|.
+  void PostReaderGroupReads(DataSourceInstanceID ds_id, DataSourceState* ds);
+  void OnReaderGroupDone(DataSourceInstanceID ds_id,
+                         std::vector<ParsedSample> samples,
+                         bool more_records_available);
+  // Completes a read tick once all buffers have been read: wakes up the
+  // unwinders, and either schedules the next tick or continues the stop.
+  void FinishReadTick(DataSourceInstanceID ds_id,
+                      DataSourceState* ds,
+                      bool more_records_available);
+  // Filters a sample read from the kernel buffer, and either passes it to the
+  // unwinders, or writes it out right away.
+  void HandleSample(DataSourceInstanceID ds_id,
+                    DataSourceState* ds,
+                    ParsedSample sample);
+
+  // Lowers the sampling rate of the data source if the unwinders can't keep
+  // up with the samples, and restores it once they can.
+  void AdaptTimebaseBackoff(DataSourceInstanceID ds_id, DataSourceState* ds);
+
+  Unwinder* UnwinderForPid(pid_t pid) {
+    size_t shard = static_cast<size_t>(pid) % unwinding_workers_.size();
+    return unwinding_workers_[shard]->get();
+  }
+  // Heap memory held by the samples in the queues of all the unwinders.
+  uint64_t GetEnqueuedFootprint();
 
   void InitiateDescriptorLookup(DataSourceInstanceID ds_id,
                                 pid_t pid,
@@ -248,6 +306,8 @@ class PerfProducer : public Producer,
 
   // Task runner owned by the main thread.
   base::TaskRunner* const task_runner_;
+  const uint32_t reader_thread_count_;
+  const uint32_t unwinder_thread_count_;
   State state_ = kNotStarted;
   const char* producer_socket_name_ = nullptr;
   uint32_t connection_backoff_ms_ = 0;
@@ -275,8 +335,13 @@ class PerfProducer : public Producer,
   // State associated with perf-sampling data sources.
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
 
-  // Unwinding stage, running on a dedicated thread.
-  UnwinderHandle unwinding_worker_;
+  // Threads reading the kernel buffers of a group of cpus each, and the cpus of
+  // each group. If empty, the buffers are read on the main thread.
+  std::vector<base::ThreadTaskRunner> reader_threads_;
+  std::vector<std::vector<uint32_t>> reader_cpus_;
+
+  // Unwinding stage, each running on a dedicated thread, see |UnwinderForPid|.
+  std::vector<std::unique_ptr<UnwinderHandle>> unwinding_workers_;
 
   // Used for tracepoint name -> id lookups. Initialized lazily, and in general
   // best effort - can be null if tracefs isn't accessible.
@@ -18,10 +18,23 @@
 
 #include <stdint.h>
 
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+#include "src/tracing/test/mock_producer_endpoint.h"
 #include "test/gtest_and_gmock.h"
 
+#include "protos/perfetto/config/data_source_config.gen.h"
+#include "protos/perfetto/config/profiling/perf_event_config.gen.h"
+#include "protos/perfetto/trace/profiling/profile_packet.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
 namespace perfetto {
 namespace profiling {
 namespace {
@@ -198,5 +211,190 @@ TEST(TargetFilterTest, AdditionalCmdlines) {
 }
 
 }  // namespace
+
+// Drives the read tick and stop paths of a producer with real reader and
+// unwinder threads, against a data source without any kernel buffers.
+class PerfProducerTest : public ::testing::Test {
+ protected:
+  static constexpr DataSourceInstanceID kDsId = 1;
+
+  void CreateProducer(uint32_t reader_threads, uint32_t unwinder_threads) {
+    producer_.reset(new PerfProducer(&proc_fd_getter_, &task_runner_,
+                                     reader_threads, unwinder_threads));
+    endpoint_ = new MockProducerEndpoint();
+    producer_->endpoint_.reset(endpoint_);
+  }
+
+  // Adds the data source as if it had been started by the service, and returns
+  // its trace writer.
+  TraceWriterForTesting* AddDataSource(uint32_t max_timebase_backoff) {
+    protos::gen::PerfEventConfig cfg;
+    cfg.set_max_timebase_backoff(max_timebase_backoff);
+    protos::gen::DataSourceConfig ds_cfg;
+    ds_cfg.set_perf_event_config_raw(cfg.SerializeAsString());
+    base::Optional<EventConfig> event_config = EventConfig::Create(
+        cfg, ds_cfg, /*process_sharding=*/base::nullopt,
+        [](const std::string&, const std::string&) { return 0; });
+    PERFETTO_CHECK(event_config.has_value());
+
+    TraceWriterForTesting* writer = new TraceWriterForTesting();
+    producer_->data_sources_.emplace(
+        std::piecewise_construct, std::forward_as_tuple(kDsId),
+        std::forward_as_tuple(event_config.value(), /*tracing_session_id=*/0,
+                              std::unique_ptr<TraceWriter>(writer),
+                              std::vector<EventReader>()));
+    for (auto& worker : producer_->unwinding_workers_)
+      (*worker)->PostStartDataSource(kDsId, /*kernel_frames=*/false);
+    return writer;
+  }
+
+  PerfProducer::DataSourceState* GetDataSource() {
+    auto it = producer_->data_sources_.find(kDsId);
+    return it == producer_->data_sources_.end() ? nullptr : &it->second;
+  }
+
+  void AdaptTimebaseBackoff() {
+    producer_->AdaptTimebaseBackoff(kDsId, GetDataSource());
+  }
+  void TickDataSourceRead() { producer_->TickDataSourceRead(kDsId); }
+  void StopDataSource() { producer_->StopDataSource(kDsId); }
+  void FinishDataSourceStop() { producer_->FinishDataSourceStop(kDsId); }
+  void PurgeDataSource() { producer_->PurgeDataSource(kDsId); }
+  size_t ReaderGroupCount() { return producer_->reader_threads_.size(); }
+
+  // Returns once the reader threads have handed back the results of all the
+  // reads posted so far.
+  void WaitForReaderGroups() {
+    for (base::ThreadTaskRunner& reader : producer_->reader_threads_) {
+      std::string name = "readers_flushed_" + std::to_string(flush_count_++);
+      std::function<void()> flushed = task_runner_.CreateCheckpoint(name);
+      base::TestTaskRunner* task_runner = &task_runner_;
+      reader.PostTask(
+          [task_runner, flushed] { task_runner->PostTask(flushed); });
+      task_runner_.RunUntilCheckpoint(name);
+    }
+  }
+
+  static std::vector<uint32_t> GetTimebaseBackoffs(
+      TraceWriterForTesting* writer) {
+    std::vector<uint32_t> backoffs;
+    for (const auto& packet : writer->GetAllTracePackets()) {
+      const auto& event = packet.perf_sample().producer_event();
+      if (event.has_timebase_backoff())
+        backoffs.push_back(event.timebase_backoff());
+    }
+    return backoffs;
+  }
+
+  base::TestTaskRunner task_runner_;
+  DirectDescriptorGetter proc_fd_getter_;
+  MockProducerEndpoint* endpoint_ = nullptr;  // owned by |producer_|
+  std::unique_ptr<PerfProducer> producer_;
+  int flush_count_ = 0;
+};
+
+constexpr DataSourceInstanceID PerfProducerTest::kDsId;
+
+TEST_F(PerfProducerTest, TimebaseBackoffRaisedAndRestored) {
+  CreateProducer(/*reader_threads=*/0, /*unwinder_threads=*/1);
+  TraceWriterForTesting* writer = AddDataSource(/*max_timebase_backoff=*/4);
+  auto* ds = GetDataSource();
+
+  // Doubled on every overloaded tick, up to the configured maximum.
+  for (int i = 0; i < 3; i++) {
+    ds->unwinder_overloaded = true;
+    AdaptTimebaseBackoff();
+  }
+  EXPECT_EQ(ds->timebase_backoff, 4u);
+  EXPECT_FALSE(ds->unwinder_overloaded);
+  EXPECT_THAT(GetTimebaseBackoffs(writer), ::testing::ElementsAre(2u, 4u));
+
+  // Halved only after enough consecutive idle ticks, an overloaded tick in
+  // between resets the count.
+  for (int i = 0; i < 9; i++)
+    AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 4u);
+  ds->unwinder_overloaded = true;
+  AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 4u);
+  EXPECT_EQ(ds->unwinder_idle_ticks, 0u);
+
+  for (int i = 0; i < 10; i++)
+    AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 2u);
+  for (int i = 0; i < 10; i++)
+    AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 1u);
+  for (int i = 0; i < 10; i++)
+    AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 1u);
+
+  EXPECT_THAT(GetTimebaseBackoffs(writer),
+              ::testing::ElementsAre(2u, 4u, 2u, 1u));
+}
+
+TEST_F(PerfProducerTest, TimebaseBackoffDisabled) {
+  CreateProducer(/*reader_threads=*/0, /*unwinder_threads=*/1);
+  TraceWriterForTesting* writer = AddDataSource(/*max_timebase_backoff=*/0);
+  auto* ds = GetDataSource();
+
+  ds->unwinder_overloaded = true;
+  AdaptTimebaseBackoff();
+  EXPECT_EQ(ds->timebase_backoff, 1u);
+  EXPECT_TRUE(GetTimebaseBackoffs(writer).empty());
+}
+
+TEST_F(PerfProducerTest, StopWaitsForAllUnwinders) {
+  CreateProducer(/*reader_threads=*/0, /*unwinder_threads=*/3);
+  AddDataSource(/*max_timebase_backoff=*/0);
+  auto* ds = GetDataSource();
+  StopDataSource();
+  ds->unwinders_stopping = 3;
+
+  EXPECT_CALL(*endpoint_, NotifyDataSourceStopped(kDsId)).Times(0);
+  FinishDataSourceStop();
+  FinishDataSourceStop();
+  EXPECT_EQ(GetDataSource(), ds);
+  EXPECT_EQ(ds->unwinders_stopping, 1u);
+  ::testing::Mock::VerifyAndClearExpectations(endpoint_);
+
+  EXPECT_CALL(*endpoint_, NotifyDataSourceStopped(kDsId)).Times(1);
+  FinishDataSourceStop();
+  EXPECT_EQ(GetDataSource(), nullptr);
+}
+
+TEST_F(PerfProducerTest, ReaderGroupsStopMidTick) {
+  CreateProducer(/*reader_threads=*/2, /*unwinder_threads=*/2);
+  AddDataSource(/*max_timebase_backoff=*/0);
+  ASSERT_GT(ReaderGroupCount(), 0u);
+
+  // The stop arrives while the reader threads are busy with the tick, and is
+  // acted upon once the last of them is done: all unwinders are asked to stop
+  // the source, and the service is told once they all have.
+  TickDataSourceRead();
+  EXPECT_EQ(GetDataSource()->pending_reader_groups, ReaderGroupCount());
+  StopDataSource();
+
+  auto stopped = task_runner_.CreateCheckpoint("stopped");
+  EXPECT_CALL(*endpoint_, NotifyDataSourceStopped(kDsId))
+      .WillOnce(::testing::InvokeWithoutArgs(stopped));
+  task_runner_.RunUntilCheckpoint("stopped");
+  EXPECT_EQ(GetDataSource(), nullptr);
+}
+
+TEST_F(PerfProducerTest, ReaderGroupsPurgedMidTick) {
+  CreateProducer(/*reader_threads=*/2, /*unwinder_threads=*/1);
+  AddDataSource(/*max_timebase_backoff=*/0);
+
+  // The results of the reads are dropped, and no further tick is scheduled.
+  TickDataSourceRead();
+  PurgeDataSource();
+  WaitForReaderGroups();
+  EXPECT_EQ(GetDataSource(), nullptr);
+
+  EXPECT_CALL(*endpoint_, NotifyDataSourceStopped(kDsId)).Times(1);
+  StopDataSource();
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -15,9 +15,15 @@
  */
 
 #include "src/profiling/perf/traced_perf.h"
+
+#include <stdio.h>
+
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/getopt.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/tracing/ipc/default_socket.h"
+#include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/profiling/perf/perf_producer.h"
 #include "src/profiling/perf/proc_descriptors.h"
 
@@ -41,7 +47,51 @@ int GetRawInheritedListeningSocket() {
 }  // namespace
 
 // TODO(rsavitski): watchdog.
-int TracedPerfMain(int, char**) {
+int TracedPerfMain(int argc, char** argv) {
+  enum LongOption {
+    OPT_KALLSYMS_CACHE = 1000,
+    OPT_READER_THREADS,
+    OPT_UNWINDER_THREADS,
+  };
+
+  static const option long_options[] = {
+      {"kallsyms-cache", required_argument, nullptr, OPT_KALLSYMS_CACHE},
+      {"reader-threads", required_argument, nullptr, OPT_READER_THREADS},
+      {"unwinder-threads", required_argument, nullptr, OPT_UNWINDER_THREADS},
+      {nullptr, 0, nullptr, 0}};
+
+  // By default, the kernel buffers are read on the main thread, and there is a
+  // single unwinding thread.
+  base::Optional<uint32_t> reader_threads = 0;
+  base::Optional<uint32_t> unwinder_threads = 1;
+  bool valid_options = true;
+  for (;;) {
+    int option = getopt_long(argc, argv, "", long_options, nullptr);
+    if (option == -1)
+      break;
+    switch (option) {
+      case OPT_KALLSYMS_CACHE:
+        LazyKernelSymbolizer::SetCacheDir(optarg);
+        break;
+      case OPT_READER_THREADS:
+        reader_threads = base::CStringToUInt32(optarg);
+        break;
+      case OPT_UNWINDER_THREADS:
+        unwinder_threads = base::CStringToUInt32(optarg);
+        break;
+      default:
+        valid_options = false;
+        break;
+    }
+  }
+  if (!valid_options || !reader_threads || !unwinder_threads) {
+    fprintf(stderr,
+            "Usage: %s [--kallsyms-cache=DIR] [--reader-threads=N] "
+            "[--unwinder-threads=N]\n",
+            argv[0]);
+    return 1;
+  }
+
   base::UnixTaskRunner task_runner;
 
 // TODO(rsavitski): support standalone --root or similar on android.
@@ -52,7 +102,8 @@ int TracedPerfMain(int, char**) {
   DirectDescriptorGetter proc_fd_getter;
 #endif
 
-  profiling::PerfProducer producer(&proc_fd_getter, &task_runner);
+  profiling::PerfProducer producer(&proc_fd_getter, &task_runner,
+                                   *reader_threads, *unwinder_threads);
   const char* env_notif = getenv("TRACED_PERF_NOTIFY_FD");
   if (env_notif) {
     int notif_fd = atoi(env_notif);
@@ -82,6 +82,15 @@ class UnwindQueue {
     rd_pos_.store(pos, std::memory_order_release);
   }
 
+  // Number of entries not yet released by the reader. Can be called from
+  // either side, but is only a snapshot if the other side is active.
+  uint64_t size() {
+    // Load the read position first, so that it can't overtake the write one.
+    uint64_t rd = rd_pos_.load(std::memory_order_acquire);
+    uint64_t wr = wr_pos_.load(std::memory_order_acquire);
+    return wr - rd;
+  }
+
  private:
   std::array<T, QueueSize> data_;
   std::atomic<uint64_t> wr_pos_{0};
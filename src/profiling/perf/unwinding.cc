@@ -25,6 +25,7 @@
 #include "perfetto/ext/base/no_destructor.h"
 #include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
+#include "src/profiling/common/elf_cache.h"
 
 namespace {
 constexpr size_t kUnwindingMaxFrames = 1000;
@@ -36,9 +37,12 @@ namespace profiling {
 
 Unwinder::Delegate::~Delegate() = default;
 
-Unwinder::Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner)
-    : task_runner_(task_runner), delegate_(delegate) {
-  ResetAndEnableUnwindstackCache();
+Unwinder::Unwinder(Delegate* delegate,
+                   base::UnixTaskRunner* task_runner,
+                   bool clears_elf_cache)
+    : task_runner_(task_runner),
+      delegate_(delegate),
+      clears_elf_cache_(clears_elf_cache) {
   base::MaybeSetThreadName("stack-unwinding");
 }
 
@@ -113,7 +117,8 @@ void Unwinder::AdoptProcDescriptors(DataSourceInstanceID ds_id,
 
   proc_state.status = ProcessState::Status::kFdsResolved;
   proc_state.unwind_state =
-      UnwindingMetadata{std::move(maps_fd), std::move(mem_fd)};
+      UnwindingMetadata{std::move(maps_fd), std::move(mem_fd),
+                        ElfCache::GetInstance()};
 }
 
 void Unwinder::PostRecordTimedOutProcDescriptors(DataSourceInstanceID ds_id,
@@ -403,6 +408,13 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
     unwind = attempt_unwind();
   }
 
+  uint64_t elf_cache_hits = unwind_state->fd_maps.elf_cache_hits();
+  uint64_t elf_cache_misses = unwind_state->fd_maps.elf_cache_misses();
+  unwind_state->CacheLoadedElfs(unwind.frames, sample.regs->Arch());
+  ret.elf_cache_hits = unwind_state->fd_maps.elf_cache_hits() - elf_cache_hits;
+  ret.elf_cache_misses =
+      unwind_state->fd_maps.elf_cache_misses() - elf_cache_misses;
+
   ret.build_ids.reserve(kernel_frames_size + unwind.frames.size());
   ret.frames.reserve(kernel_frames_size + unwind.frames.size());
   for (unwindstack::FrameData& frame : unwind.frames) {
@@ -501,7 +513,7 @@ void Unwinder::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   // Clean up state if there are no more active sources.
   if (data_sources_.empty()) {
     kernel_symbolizer_.Destroy();
-    ResetAndEnableUnwindstackCache();
+    ClearElfCache();
   }
 
   // Inform service thread that the unwinder is done with the source.
@@ -525,7 +537,7 @@ void Unwinder::PurgeDataSource(DataSourceInstanceID ds_id) {
   // Clean up state if there are no more active sources.
   if (data_sources_.empty()) {
     kernel_symbolizer_.Destroy();
-    ResetAndEnableUnwindstackCache();
+    ClearElfCache();
     // Also purge scudo on Android, which would normally be done by the service
     // thread in |FinishDataSourceStop|. This is important as most of the scudo
     // overhead comes from libunwindstack.
@@ -558,24 +570,19 @@ void Unwinder::ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
     if (pid_and_process.second.status == ProcessState::Status::kFdsResolved)
       pid_and_process.second.unwind_state->fd_maps.Reset();
   }
-  ResetAndEnableUnwindstackCache();
+  ClearElfCache();
   base::MaybeReleaseAllocatorMemToOS();
 
   PostClearCachedStatePeriodic(ds_id, period_ms);  // repost
 }
 
-void Unwinder::ResetAndEnableUnwindstackCache() {
-  PERFETTO_DLOG("Resetting unwindstack cache");
-  // Libunwindstack uses an unsynchronized variable for setting/checking whether
-  // the cache is enabled. Therefore unwinding and cache toggling should stay on
-  // the same thread, but we might be moving unwinding across threads if we're
-  // recreating |Unwinder| instances (during a reconnect to traced). Therefore,
-  // use our own static lock to synchronize the cache toggling.
-  // TODO(rsavitski): consider fixing this in libunwindstack itself.
-  static std::mutex* lock = new std::mutex{};
-  std::lock_guard<std::mutex> guard{*lock};
-  unwindstack::Elf::SetCachingEnabled(false);  // free any existing state
-  unwindstack::Elf::SetCachingEnabled(true);   // reallocate a fresh cache
+void Unwinder::ClearElfCache() {
+  if (!clears_elf_cache_)
+    return;
+  PERFETTO_DLOG("Clearing the Elf cache");
+  // The cache is shared with the other |Unwinder| threads. Their parsed maps
+  // keep the Elf objects that they are using alive.
+  ElfCache::GetInstance()->Clear();
 }
 
 }  // namespace profiling
@@ -47,7 +47,9 @@ constexpr static uint32_t kUnwindQueueCapacity = 1024;
 // and register state (see |ParsedSample|). For kernelspace, the kernel itself
 // unwinds the stack (recording a list of instruction pointers), so only
 // symbolisation using /proc/kallsyms is necessary. Has a single unwinding ring
-// queue, shared across all data sources.
+// queue, shared across all data sources. The producer can run several
+// unwinders, each handling the samples of a subset of the processes (sharded
+// by pid), in which case each of them tracks only the state of its processes.
 //
 // Userspace samples cannot be unwound without having /proc/<pid>/{maps,mem}
 // file descriptors for that process. This lookup can be asynchronous (e.g. on
@@ -160,7 +162,9 @@ class Unwinder {
   };
 
   // Must be instantiated via the |UnwinderHandle|.
-  Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner);
+  Unwinder(Delegate* delegate,
+           base::UnixTaskRunner* task_runner,
+           bool clears_elf_cache);
 
   // Marks the data source as valid and active at the unwinding stage.
   // Initializes kernel address symbolization if needed.
@@ -210,18 +214,19 @@ class Unwinder {
                                                    std::memory_order_relaxed);
   }
 
-  // Clears the parsed maps for all previously-sampled processes, and resets the
-  // libunwindstack cache. This has the effect of deallocating the cached Elf
-  // objects within libunwindstack, which take up non-trivial amounts of memory.
+  // Clears the parsed maps for all previously-sampled processes, and, if
+  // |clears_elf_cache_|, the |ElfCache|. This has the effect of
+  // deallocating the cached Elf objects, which take up non-trivial amounts
+  // of memory.
   //
   // There are two reasons for having this operation:
   // * over a longer trace, it's desireable to drop heavy state for processes
   //   that haven't been sampled recently.
-  // * since libunwindstack's cache is not bounded, it'll tend towards having
-  //   state for all processes that are targeted by the profiling config.
-  //   Clearing the cache periodically helps keep its footprint closer to the
-  //   actual working set (NB: which might still be arbitrarily big, depending
-  //   on the profiling config).
+  // * the |ElfCache| is bounded by its number of entries rather than by their
+  //   size, and tends towards holding the libraries of all processes that are
+  //   targeted by the profiling config. Clearing the cache periodically helps
+  //   keep its footprint closer to the actual working set (NB: which might
+  //   still be arbitrarily big, depending on the profiling config).
   //
   // After this function completes, the next unwind for each process will
   // therefore incur a guaranteed maps reparse.
@@ -236,14 +241,16 @@ class Unwinder {
   // TODO(rsavitski): dropping the full parsed maps is somewhat excessive, could
   // instead clear just the |MapInfo.elf| shared_ptr, but that's considered too
   // brittle as it's an implementation detail of libunwindstack.
-  // TODO(rsavitski): improve libunwindstack cache's architecture (it is still
-  // worth having at the moment to speed up unwinds across map reparses).
   void ClearCachedStatePeriodic(DataSourceInstanceID ds_id, uint32_t period_ms);
 
-  void ResetAndEnableUnwindstackCache();
+  // No-op unless |clears_elf_cache_|.
+  void ClearElfCache();
 
   base::UnixTaskRunner* const task_runner_;
   Delegate* const delegate_;
+  // The ElfCache is shared by all the |Unwinder|s of the process, so only one
+  // of them clears it, periodically and once it has no data sources left.
+  const bool clears_elf_cache_;
   UnwindQueue<UnwindEntry, kUnwindQueueCapacity> unwind_queue_;
   QueueFootprintTracker footprint_tracker_;
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
@@ -258,7 +265,10 @@ class Unwinder {
 // owned state, and consolidate.
 class UnwinderHandle {
  public:
-  explicit UnwinderHandle(Unwinder::Delegate* delegate) {
+  // |clears_elf_cache| must be set for exactly one of the handles of a
+  // producer, see |Unwinder::clears_elf_cache_|.
+  explicit UnwinderHandle(Unwinder::Delegate* delegate,
+                          bool clears_elf_cache = true) {
     std::mutex init_lock;
     std::condition_variable init_cv;
 
@@ -276,7 +286,7 @@ class UnwinderHandle {
         };
 
     thread_ = std::thread(&UnwinderHandle::RunTaskThread, this,
-                          std::move(initializer), delegate);
+                          std::move(initializer), delegate, clears_elf_cache);
 
     std::unique_lock<std::mutex> lock(init_lock);
     init_cv.wait(lock, [this] { return !!task_runner_ && !!unwinder_; });
@@ -294,13 +304,15 @@ class UnwinderHandle {
   }
 
   Unwinder* operator->() { return unwinder_; }
+  Unwinder* get() { return unwinder_; }
 
  private:
   void RunTaskThread(
       std::function<void(base::UnixTaskRunner*, Unwinder*)> initializer,
-      Unwinder::Delegate* delegate) {
+      Unwinder::Delegate* delegate,
+      bool clears_elf_cache) {
     base::UnixTaskRunner task_runner;
-    Unwinder unwinder(delegate, &task_runner);
+    Unwinder unwinder(delegate, &task_runner, clears_elf_cache);
     task_runner.PostTask(
         std::bind(std::move(initializer), &task_runner, &unwinder));
     task_runner.Run();
@@ -0,0 +1,1348 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/dwarf_symbolizer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/trace_processor/demangle.h"
+#include "src/profiling/symbolizer/elf.h"
+
+namespace perfetto {
+namespace profiling {
+
+struct DwarfSymbolizer::Abbrev {
+  struct Attr {
+    uint64_t name;
+    uint64_t form;
+    int64_t implicit_const;
+  };
+  uint64_t tag = 0;
+  bool has_children = false;
+  std::vector<Attr> attrs;
+};
+
+struct DwarfSymbolizer::CompileUnit {
+  const DebugSections* sections = nullptr;
+  const std::map<uint64_t, Abbrev>* abbrevs = nullptr;
+  uint64_t offset = 0;  // Of the unit header in .debug_info.
+  uint64_t end = 0;
+  uint64_t die_offset = 0;  // Of the compile unit DIE.
+  uint16_t version = 0;
+  uint8_t addr_size = 0;
+  bool dwarf64 = false;
+  uint64_t base_address = 0;
+  uint64_t str_offsets_base = 0;
+  uint64_t addr_base = 0;
+  uint64_t rnglists_base = 0;
+  bool has_stmt_list = false;
+  uint64_t stmt_list = 0;
+  std::string comp_dir;
+  std::unique_ptr<CompileUnitData> data;
+};
+
+namespace {
+
+using AttrValue = DwarfSymbolizer::AttrValue;
+using CompileUnit = DwarfSymbolizer::CompileUnit;
+using Section = DwarfSymbolizer::Section;
+
+// See the DWARF 5 specification, section 7.
+constexpr uint64_t DW_TAG_subprogram = 0x2e;
+constexpr uint64_t DW_TAG_inlined_subroutine = 0x1d;
+constexpr uint64_t DW_TAG_compile_unit = 0x11;
+constexpr uint64_t DW_TAG_partial_unit = 0x3c;
+
+constexpr uint64_t DW_AT_name = 0x03;
+constexpr uint64_t DW_AT_stmt_list = 0x10;
+constexpr uint64_t DW_AT_low_pc = 0x11;
+constexpr uint64_t DW_AT_high_pc = 0x12;
+constexpr uint64_t DW_AT_comp_dir = 0x1b;
+constexpr uint64_t DW_AT_abstract_origin = 0x31;
+constexpr uint64_t DW_AT_specification = 0x47;
+constexpr uint64_t DW_AT_ranges = 0x55;
+constexpr uint64_t DW_AT_call_file = 0x58;
+constexpr uint64_t DW_AT_call_line = 0x59;
+constexpr uint64_t DW_AT_linkage_name = 0x6e;
+constexpr uint64_t DW_AT_str_offsets_base = 0x72;
+constexpr uint64_t DW_AT_addr_base = 0x73;
+constexpr uint64_t DW_AT_rnglists_base = 0x74;
+constexpr uint64_t DW_AT_MIPS_linkage_name = 0x2007;
+constexpr uint64_t DW_AT_GNU_addr_base = 0x2133;
+
+constexpr uint64_t DW_FORM_addr = 0x01;
+constexpr uint64_t DW_FORM_block2 = 0x03;
+constexpr uint64_t DW_FORM_block4 = 0x04;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_block1 = 0x0a;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_flag = 0x0c;
+constexpr uint64_t DW_FORM_sdata = 0x0d;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+constexpr uint64_t DW_FORM_ref_addr = 0x10;
+constexpr uint64_t DW_FORM_ref1 = 0x11;
+constexpr uint64_t DW_FORM_ref2 = 0x12;
+constexpr uint64_t DW_FORM_ref4 = 0x13;
+constexpr uint64_t DW_FORM_ref8 = 0x14;
+constexpr uint64_t DW_FORM_ref_udata = 0x15;
+constexpr uint64_t DW_FORM_indirect = 0x16;
+constexpr uint64_t DW_FORM_sec_offset = 0x17;
+constexpr uint64_t DW_FORM_exprloc = 0x18;
+constexpr uint64_t DW_FORM_flag_present = 0x19;
+constexpr uint64_t DW_FORM_strx = 0x1a;
+constexpr uint64_t DW_FORM_addrx = 0x1b;
+constexpr uint64_t DW_FORM_ref_sup4 = 0x1c;
+constexpr uint64_t DW_FORM_strp_sup = 0x1d;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+constexpr uint64_t DW_FORM_ref_sig8 = 0x20;
+constexpr uint64_t DW_FORM_implicit_const = 0x21;
+constexpr uint64_t DW_FORM_loclistx = 0x22;
+constexpr uint64_t DW_FORM_rnglistx = 0x23;
+constexpr uint64_t DW_FORM_ref_sup8 = 0x24;
+constexpr uint64_t DW_FORM_strx1 = 0x25;
+constexpr uint64_t DW_FORM_strx2 = 0x26;
+constexpr uint64_t DW_FORM_strx3 = 0x27;
+constexpr uint64_t DW_FORM_strx4 = 0x28;
+constexpr uint64_t DW_FORM_addrx1 = 0x29;
+constexpr uint64_t DW_FORM_addrx2 = 0x2a;
+constexpr uint64_t DW_FORM_addrx3 = 0x2b;
+constexpr uint64_t DW_FORM_addrx4 = 0x2c;
+constexpr uint64_t DW_FORM_GNU_addr_index = 0x1f01;
+constexpr uint64_t DW_FORM_GNU_str_index = 0x1f02;
+constexpr uint64_t DW_FORM_GNU_ref_alt = 0x1f20;
+constexpr uint64_t DW_FORM_GNU_strp_alt = 0x1f21;
+
+constexpr uint8_t DW_UT_compile = 0x01;
+constexpr uint8_t DW_UT_partial = 0x03;
+
+constexpr uint8_t DW_LNS_copy = 0x01;
+constexpr uint8_t DW_LNS_advance_pc = 0x02;
+constexpr uint8_t DW_LNS_advance_line = 0x03;
+constexpr uint8_t DW_LNS_set_file = 0x04;
+constexpr uint8_t DW_LNS_const_add_pc = 0x08;
+constexpr uint8_t DW_LNS_fixed_advance_pc = 0x09;
+
+constexpr uint8_t DW_LNE_end_sequence = 0x01;
+constexpr uint8_t DW_LNE_set_address = 0x02;
+
+constexpr uint64_t DW_LNCT_path = 0x1;
+constexpr uint64_t DW_LNCT_directory_index = 0x2;
+
+constexpr uint8_t DW_RLE_end_of_list = 0x00;
+constexpr uint8_t DW_RLE_base_addressx = 0x01;
+constexpr uint8_t DW_RLE_startx_endx = 0x02;
+constexpr uint8_t DW_RLE_startx_length = 0x03;
+constexpr uint8_t DW_RLE_offset_pair = 0x04;
+constexpr uint8_t DW_RLE_base_address = 0x05;
+constexpr uint8_t DW_RLE_start_end = 0x06;
+constexpr uint8_t DW_RLE_start_length = 0x07;
+
+constexpr uint16_t kEmArm = 40;
+
+// Bounds-checked little-endian reader. Reading past the end returns zeros and
+// sets a sticky error, so that callers only need to check ok() once they are
+// done with a record.
+class Reader {
+ public:
+  Reader(const Section& section, uint64_t offset, uint64_t end)
+      : begin_(section.data),
+        pos_(section.data),
+        end_(section.data + std::min<uint64_t>(end, section.size)) {
+    if (offset > section.size || !section.data) {
+      pos_ = end_;
+      ok_ = false;
+    } else {
+      pos_ += offset;
+    }
+  }
+
+  Reader(const Section& section, uint64_t offset)
+      : Reader(section, offset, section.size) {}
+
+  bool ok() const { return ok_; }
+  bool AtEnd() const { return pos_ >= end_; }
+  uint64_t offset() const { return static_cast<uint64_t>(pos_ - begin_); }
+  uint64_t end_offset() const { return static_cast<uint64_t>(end_ - begin_); }
+
+  // Narrows the readable range to |length| bytes from the current position.
+  void SetLength(uint64_t length) {
+    if (length > static_cast<uint64_t>(end_ - pos_)) {
+      ok_ = false;
+      return;
+    }
+    end_ = pos_ + length;
+  }
+
+  void Seek(uint64_t offset) {
+    if (offset > static_cast<uint64_t>(end_ - begin_)) {
+      pos_ = end_;
+      ok_ = false;
+      return;
+    }
+    pos_ = begin_ + offset;
+  }
+
+  void Skip(uint64_t n) {
+    if (n > static_cast<uint64_t>(end_ - pos_)) {
+      pos_ = end_;
+      ok_ = false;
+      return;
+    }
+    pos_ += n;
+  }
+
+  uint64_t ReadSized(size_t n) {
+    if (n > 8 || n > static_cast<size_t>(end_ - pos_)) {
+      pos_ = end_;
+      ok_ = false;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; ++i)
+      value |= static_cast<uint64_t>(pos_[i]) << (8 * i);
+    pos_ += n;
+    return value;
+  }
+
+  uint8_t U8() { return static_cast<uint8_t>(ReadSized(1)); }
+  uint16_t U16() { return static_cast<uint16_t>(ReadSized(2)); }
+  uint32_t U32() { return static_cast<uint32_t>(ReadSized(4)); }
+  uint64_t U64() { return ReadSized(8); }
+
+  uint64_t Uleb() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+      if (pos_ >= end_) {
+        ok_ = false;
+        return 0;
+      }
+      uint8_t byte = *pos_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+  }
+
+  int64_t Sleb() {
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    uint8_t byte = 0;
+    do {
+      if (pos_ >= end_) {
+        ok_ = false;
+        return 0;
+      }
+      byte = *pos_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40))
+      value |= ~uint64_t(0) << shift;
+    return static_cast<int64_t>(value);
+  }
+
+  uint64_t Offset(bool dwarf64) { return dwarf64 ? U64() : U32(); }
+
+  const char* CStr() {
+    const void* nul = memchr(pos_, 0, static_cast<size_t>(end_ - pos_));
+    if (!nul) {
+      pos_ = end_;
+      ok_ = false;
+      return "";
+    }
+    const char* str = reinterpret_cast<const char*>(pos_);
+    pos_ = static_cast<const uint8_t*>(nul) + 1;
+    return str;
+  }
+
+  // Reads the initial length of a unit, and narrows the reader to the unit.
+  bool UnitLength(bool* dwarf64) {
+    uint64_t length = U32();
+    *dwarf64 = length == 0xffffffff;
+    if (*dwarf64)
+      length = U64();
+    else if (length >= 0xfffffff0)
+      ok_ = false;
+    SetLength(length);
+    return ok_;
+  }
+
+ private:
+  const uint8_t* begin_;
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+const char* CStrAt(const Section& section, uint64_t offset) {
+  if (offset >= section.size)
+    return nullptr;
+  const char* str = reinterpret_cast<const char*>(section.data + offset);
+  if (!memchr(str, 0, static_cast<size_t>(section.size - offset)))
+    return nullptr;
+  return str;
+}
+
+bool IsTombstone(uint64_t address, uint8_t addr_size) {
+  // Linkers resolve the addresses of discarded sections (e.g. functions that
+  // were dropped by --gc-sections) to 0, or to -1 / -2 for lld.
+  uint64_t max = addr_size == 4 ? 0xffffffffull : ~uint64_t(0);
+  return address == 0 || address >= max - 1;
+}
+
+bool ReadAttrValue(Reader* r,
+                   const CompileUnit& cu,
+                   uint64_t form,
+                   int64_t implicit_const,
+                   AttrValue* out) {
+  out->form = form;
+  out->value = 0;
+  out->str = nullptr;
+  switch (form) {
+    case DW_FORM_addr:
+      out->value = r->ReadSized(cu.addr_size);
+      break;
+    case DW_FORM_block1:
+      r->Skip(r->U8());
+      break;
+    case DW_FORM_block2:
+      r->Skip(r->U16());
+      break;
+    case DW_FORM_block4:
+      r->Skip(r->U32());
+      break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+      r->Skip(r->Uleb());
+      break;
+    case DW_FORM_data1:
+    case DW_FORM_flag:
+    case DW_FORM_ref1:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      out->value = r->U8();
+      break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      out->value = r->U16();
+      break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      out->value = r->ReadSized(3);
+      break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+      out->value = r->U32();
+      break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+      out->value = r->U64();
+      break;
+    case DW_FORM_data16:
+      r->Skip(16);
+      break;
+    case DW_FORM_string:
+      out->str = r->CStr();
+      break;
+    case DW_FORM_sdata:
+      out->value = static_cast<uint64_t>(r->Sleb());
+      break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+      out->value = r->Uleb();
+      break;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+      out->value = r->Offset(cu.dwarf64);
+      break;
+    case DW_FORM_ref_addr:
+      out->value =
+          cu.version <= 2 ? r->ReadSized(cu.addr_size) : r->Offset(cu.dwarf64);
+      break;
+    case DW_FORM_flag_present:
+      out->value = 1;
+      break;
+    case DW_FORM_implicit_const:
+      out->value = static_cast<uint64_t>(implicit_const);
+      break;
+    case DW_FORM_indirect:
+      return ReadAttrValue(r, cu, r->Uleb(), 0, out);
+    default:
+      return false;
+  }
+  return r->ok();
+}
+
+// The attributes of a DIE that the symbolizer cares about.
+struct Die {
+  uint64_t offset = 0;
+  uint64_t tag = 0;  // 0 for the null entry that ends a list of children.
+  bool has_children = false;
+  AttrValue name;
+  AttrValue linkage_name;
+  AttrValue low_pc;
+  AttrValue high_pc;
+  AttrValue ranges;
+  AttrValue abstract_origin;
+  AttrValue specification;
+  AttrValue call_file;
+  AttrValue call_line;
+  AttrValue stmt_list;
+  AttrValue comp_dir;
+  AttrValue str_offsets_base;
+  AttrValue addr_base;
+  AttrValue rnglists_base;
+};
+
+bool ReadDie(Reader* r, const CompileUnit& cu, Die* die) {
+  *die = Die();
+  die->offset = r->offset();
+  uint64_t code = r->Uleb();
+  if (!r->ok())
+    return false;
+  if (code == 0)
+    return true;
+  auto it = cu.abbrevs->find(code);
+  if (it == cu.abbrevs->end())
+    return false;
+  const DwarfSymbolizer::Abbrev& abbrev = it->second;
+  die->tag = abbrev.tag;
+  die->has_children = abbrev.has_children;
+  for (const DwarfSymbolizer::Abbrev::Attr& attr : abbrev.attrs) {
+    AttrValue value;
+    if (!ReadAttrValue(r, cu, attr.form, attr.implicit_const, &value))
+      return false;
+    switch (attr.name) {
+      case DW_AT_name:
+        die->name = value;
+        break;
+      case DW_AT_linkage_name:
+      case DW_AT_MIPS_linkage_name:
+        die->linkage_name = value;
+        break;
+      case DW_AT_low_pc:
+        die->low_pc = value;
+        break;
+      case DW_AT_high_pc:
+        die->high_pc = value;
+        break;
+      case DW_AT_ranges:
+        die->ranges = value;
+        break;
+      case DW_AT_abstract_origin:
+        die->abstract_origin = value;
+        break;
+      case DW_AT_specification:
+        die->specification = value;
+        break;
+      case DW_AT_call_file:
+        die->call_file = value;
+        break;
+      case DW_AT_call_line:
+        die->call_line = value;
+        break;
+      case DW_AT_stmt_list:
+        die->stmt_list = value;
+        break;
+      case DW_AT_comp_dir:
+        die->comp_dir = value;
+        break;
+      case DW_AT_str_offsets_base:
+        die->str_offsets_base = value;
+        break;
+      case DW_AT_addr_base:
+      case DW_AT_GNU_addr_base:
+        die->addr_base = value;
+        break;
+      case DW_AT_rnglists_base:
+        die->rnglists_base = value;
+        break;
+    }
+  }
+  return true;
+}
+
+const char* GetString(const CompileUnit& cu, const AttrValue& value) {
+  const DwarfSymbolizer::DebugSections& sections = *cu.sections;
+  switch (value.form) {
+    case DW_FORM_string:
+      return value.str;
+    case DW_FORM_strp:
+      return CStrAt(sections.str, value.value);
+    case DW_FORM_line_strp:
+      return CStrAt(sections.line_str, value.value);
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+    case DW_FORM_GNU_str_index: {
+      uint64_t entry_size = cu.dwarf64 ? 8 : 4;
+      Reader r(sections.str_offsets,
+               cu.str_offsets_base + value.value * entry_size);
+      uint64_t offset = r.Offset(cu.dwarf64);
+      return r.ok() ? CStrAt(sections.str, offset) : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+base::Optional<uint64_t> GetAddress(const CompileUnit& cu,
+                                    const AttrValue& value) {
+  switch (value.form) {
+    case DW_FORM_addr:
+      return value.value;
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+    case DW_FORM_GNU_addr_index: {
+      Reader r(cu.sections->addr, cu.addr_base + value.value * cu.addr_size);
+      uint64_t address = r.ReadSized(cu.addr_size);
+      if (r.ok())
+        return address;
+      return base::nullopt;
+    }
+  }
+  return base::nullopt;
+}
+
+// Returns the offset in .debug_info that a reference attribute points to.
+base::Optional<uint64_t> GetReference(const CompileUnit& cu,
+                                      const AttrValue& value) {
+  switch (value.form) {
+    case DW_FORM_ref1:
+    case DW_FORM_ref2:
+    case DW_FORM_ref4:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_udata:
+      return cu.offset + value.value;
+    case DW_FORM_ref_addr:
+      return value.value;
+  }
+  // References to type units or to a supplementary file are not supported.
+  return base::nullopt;
+}
+
+using AddressRanges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+void ReadRangeList(const CompileUnit& cu,
+                   uint64_t offset,
+                   AddressRanges* ranges) {
+  uint64_t base_address = cu.base_address;
+  if (cu.version < 5) {
+    Reader r(cu.sections->ranges, offset);
+    uint64_t base_selector =
+        cu.addr_size == 4 ? 0xffffffffull : ~uint64_t(0);
+    while (r.ok()) {
+      uint64_t begin = r.ReadSized(cu.addr_size);
+      uint64_t end = r.ReadSized(cu.addr_size);
+      if (!r.ok() || (begin == 0 && end == 0))
+        break;
+      if (begin == base_selector)
+        base_address = end;
+      else
+        ranges->emplace_back(base_address + begin, base_address + end);
+    }
+    return;
+  }
+
+  Reader r(cu.sections->rnglists, offset);
+  auto addrx = [&cu](uint64_t index) {
+    AttrValue value;
+    value.form = DW_FORM_addrx;
+    value.value = index;
+    return GetAddress(cu, value).value_or(0);
+  };
+  while (r.ok()) {
+    uint8_t kind = r.U8();
+    switch (kind) {
+      case DW_RLE_end_of_list:
+        return;
+      case DW_RLE_base_addressx:
+        base_address = addrx(r.Uleb());
+        break;
+      case DW_RLE_startx_endx: {
+        uint64_t begin = addrx(r.Uleb());
+        uint64_t end = addrx(r.Uleb());
+        ranges->emplace_back(begin, end);
+        break;
+      }
+      case DW_RLE_startx_length: {
+        uint64_t begin = addrx(r.Uleb());
+        ranges->emplace_back(begin, begin + r.Uleb());
+        break;
+      }
+      case DW_RLE_offset_pair: {
+        uint64_t begin = r.Uleb();
+        uint64_t end = r.Uleb();
+        ranges->emplace_back(base_address + begin, base_address + end);
+        break;
+      }
+      case DW_RLE_base_address:
+        base_address = r.ReadSized(cu.addr_size);
+        break;
+      case DW_RLE_start_end: {
+        uint64_t begin = r.ReadSized(cu.addr_size);
+        uint64_t end = r.ReadSized(cu.addr_size);
+        ranges->emplace_back(begin, end);
+        break;
+      }
+      case DW_RLE_start_length: {
+        uint64_t begin = r.ReadSized(cu.addr_size);
+        ranges->emplace_back(begin, begin + r.Uleb());
+        break;
+      }
+      default:
+        return;
+    }
+  }
+}
+
+// Returns the address ranges covered by |die|, without the empty ones.
+AddressRanges GetRanges(const CompileUnit& cu, const Die& die) {
+  AddressRanges ranges;
+  // A compile unit can have both DW_AT_ranges and a DW_AT_low_pc, which is
+  // then the base address of the ranges.
+  if (die.low_pc.form && die.high_pc.form) {
+    base::Optional<uint64_t> low = GetAddress(cu, die.low_pc);
+    if (!low)
+      return ranges;
+    uint64_t high = *low + die.high_pc.value;
+    if (die.high_pc.form == DW_FORM_addr || die.high_pc.form == DW_FORM_addrx ||
+        (die.high_pc.form >= DW_FORM_addrx1 &&
+         die.high_pc.form <= DW_FORM_addrx4)) {
+      high = GetAddress(cu, die.high_pc).value_or(0);
+    }
+    ranges.emplace_back(*low, high);
+  } else if (die.ranges.form) {
+    uint64_t offset = die.ranges.value;
+    if (die.ranges.form == DW_FORM_rnglistx) {
+      uint64_t entry_size = cu.dwarf64 ? 8 : 4;
+      Reader r(cu.sections->rnglists,
+               cu.rnglists_base + die.ranges.value * entry_size);
+      offset = cu.rnglists_base + r.Offset(cu.dwarf64);
+      if (!r.ok())
+        return ranges;
+    }
+    ReadRangeList(cu, offset, &ranges);
+  }
+  ranges.erase(std::remove_if(ranges.begin(), ranges.end(),
+                              [](const std::pair<uint64_t, uint64_t>& range) {
+                                return range.first >= range.second;
+                              }),
+               ranges.end());
+  return ranges;
+}
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+  if (dir.empty() || name.empty() || name[0] == '/')
+    return name;
+  if (dir.back() == '/')
+    return dir + name;
+  return dir + "/" + name;
+}
+
+SymbolizedFrame MakeFrame(std::string function_name,
+                          std::string file_name,
+                          uint32_t line) {
+  SymbolizedFrame frame;
+  frame.function_name = std::move(function_name);
+  frame.file_name = std::move(file_name);
+  frame.line = line;
+  return frame;
+}
+
+template <typename T>
+bool ByLow(const T& a, const T& b) {
+  return a.low < b.low;
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t DwarfSymbolizer::kEndSequence;
+
+// static
+std::unique_ptr<DwarfSymbolizer> DwarfSymbolizer::Create(
+    const std::string& file_name) {
+  base::Optional<size_t> size = base::GetFileSize(file_name);
+  if (!size.has_value()) {
+    PERFETTO_PLOG("Failed to get file size %s", file_name.c_str());
+    return nullptr;
+  }
+  static_assert(EI_DATA > EI_CLASS, "EI_DATA is the last byte we check.");
+  if (*size <= EI_DATA)
+    return nullptr;
+  std::unique_ptr<ScopedReadMmap> map(
+      new ScopedReadMmap(file_name.c_str(), *size));
+  if (!map->IsValid()) {
+    PERFETTO_PLOG("mmap");
+    return nullptr;
+  }
+  const char* mem = static_cast<const char*>(**map);
+  if (mem[EI_MAG0] != ELFMAG0 || mem[EI_MAG1] != ELFMAG1 ||
+      mem[EI_MAG2] != ELFMAG2 || mem[EI_MAG3] != ELFMAG3) {
+    return nullptr;
+  }
+  if (mem[EI_DATA] != ELFDATA2LSB) {
+    PERFETTO_ELOG("Big endian ELF files are not supported: %s",
+                  file_name.c_str());
+    return nullptr;
+  }
+
+  std::unique_ptr<DwarfSymbolizer> symbolizer(
+      new DwarfSymbolizer(std::move(map)));
+  bool parsed = false;
+  switch (mem[EI_CLASS]) {
+    case ELFCLASS32:
+      parsed = symbolizer->ParseElf<Elf32>(*size);
+      break;
+    case ELFCLASS64:
+      parsed = symbolizer->ParseElf<Elf64>(*size);
+      break;
+  }
+  if (!parsed)
+    return nullptr;
+  symbolizer->IndexCompileUnits();
+  return symbolizer;
+}
+
+DwarfSymbolizer::DwarfSymbolizer(std::unique_ptr<ScopedReadMmap> map)
+    : map_(std::move(map)), sections_() {}
+
+DwarfSymbolizer::~DwarfSymbolizer() = default;
+
+template <typename E>
+bool DwarfSymbolizer::ParseElf(size_t size) {
+  const uint8_t* mem = static_cast<const uint8_t*>(**map_);
+  auto in_range = [mem, size](const void* ptr, uint64_t length) {
+    const uint8_t* p = static_cast<const uint8_t*>(ptr);
+    return p >= mem && p <= mem + size &&
+           length <= static_cast<uint64_t>(mem + size - p);
+  };
+
+  const typename E::Ehdr* ehdr =
+      reinterpret_cast<const typename E::Ehdr*>(mem);
+  if (!in_range(ehdr, sizeof(typename E::Ehdr)))
+    return false;
+  if (ehdr->e_shoff > size || ehdr->e_shstrndx >= ehdr->e_shnum)
+    return false;
+  void* base = **map_;
+  const typename E::Shdr* shstrtab = GetShdr<E>(base, ehdr, ehdr->e_shstrndx);
+  if (!in_range(shstrtab, sizeof(typename E::Shdr)) ||
+      !in_range(mem + shstrtab->sh_offset, shstrtab->sh_size)) {
+    return false;
+  }
+  Section names{mem + shstrtab->sh_offset,
+                static_cast<size_t>(shstrtab->sh_size)};
+
+  const std::pair<const char*, Section*> kDebugSections[] = {
+      {".debug_info", &sections_.info},
+      {".debug_abbrev", &sections_.abbrev},
+      {".debug_line", &sections_.line},
+      {".debug_str", &sections_.str},
+      {".debug_line_str", &sections_.line_str},
+      {".debug_str_offsets", &sections_.str_offsets},
+      {".debug_addr", &sections_.addr},
+      {".debug_ranges", &sections_.ranges},
+      {".debug_rnglists", &sections_.rnglists},
+  };
+
+  const typename E::Shdr* symtab = nullptr;
+  const typename E::Shdr* dynsym = nullptr;
+  bool compressed = false;
+  for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+    const typename E::Shdr* shdr = GetShdr<E>(base, ehdr, i);
+    if (!in_range(shdr, sizeof(typename E::Shdr)))
+      return false;
+    if (shdr->sh_type == SHT_SYMTAB)
+      symtab = shdr;
+    else if (shdr->sh_type == SHT_DYNSYM)
+      dynsym = shdr;
+    const char* name = CStrAt(names, shdr->sh_name);
+    if (!name || strncmp(name, ".debug_", 7) != 0)
+      continue;
+    if (shdr->sh_type == SHT_NOBITS ||
+        !in_range(mem + shdr->sh_offset, shdr->sh_size)) {
+      continue;
+    }
+    if (shdr->sh_flags & SHF_COMPRESSED) {
+      compressed = true;
+      continue;
+    }
+    for (const auto& debug_section : kDebugSections) {
+      if (strcmp(name, debug_section.first) == 0) {
+        *debug_section.second = Section{mem + shdr->sh_offset,
+                                        static_cast<size_t>(shdr->sh_size)};
+      }
+    }
+  }
+  if (compressed) {
+    PERFETTO_ELOG(
+        "Compressed debug sections are not supported, only using the symbol "
+        "table.");
+    sections_ = DebugSections();
+  }
+
+  if (!symtab)
+    symtab = dynsym;
+  if (symtab && symtab->sh_link < ehdr->e_shnum) {
+    const typename E::Shdr* strtab = GetShdr<E>(base, ehdr, symtab->sh_link);
+    if (in_range(strtab, sizeof(typename E::Shdr)))
+      ParseSymbols<E>(ehdr, symtab, strtab, size);
+  }
+  return true;
+}
+
+template <typename E>
+void DwarfSymbolizer::ParseSymbols(const typename E::Ehdr* ehdr,
+                                   const typename E::Shdr* symtab,
+                                   const typename E::Shdr* strtab,
+                                   size_t size) {
+  const uint8_t* mem = static_cast<const uint8_t*>(**map_);
+  if (symtab->sh_offset > size ||
+      symtab->sh_size > size - symtab->sh_offset ||
+      strtab->sh_offset > size || strtab->sh_size > size - strtab->sh_offset) {
+    return;
+  }
+  Section strings{mem + strtab->sh_offset,
+                  static_cast<size_t>(strtab->sh_size)};
+  const typename E::Sym* syms =
+      reinterpret_cast<const typename E::Sym*>(mem + symtab->sh_offset);
+  size_t count = static_cast<size_t>(symtab->sh_size / sizeof(typename E::Sym));
+  for (size_t i = 0; i < count; ++i) {
+    const typename E::Sym& sym = syms[i];
+    if ((sym.st_info & 0xf) != STT_FUNC || sym.st_shndx == 0 ||
+        sym.st_value == 0) {
+      continue;
+    }
+    const char* name = CStrAt(strings, sym.st_name);
+    if (!name || !*name)
+      continue;
+    uint64_t address = sym.st_value;
+    // The lowest bit of Thumb functions is set.
+    if (ehdr->e_machine == kEmArm)
+      address &= ~uint64_t(1);
+    symbols_.push_back(ElfSymbol{address, sym.st_size, name});
+  }
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const ElfSymbol& a, const ElfSymbol& b) {
+              return a.address < b.address;
+            });
+  // Like llvm-symbolizer, assume that symbols without a size (e.g. the ones
+  // defined in assembly) extend up to the next symbol.
+  for (size_t i = 0; i + 1 < symbols_.size(); ++i) {
+    if (symbols_[i].size == 0)
+      symbols_[i].size = symbols_[i + 1].address - symbols_[i].address;
+  }
+}
+
+void DwarfSymbolizer::IndexCompileUnits() {
+  uint64_t offset = 0;
+  while (offset < sections_.info.size) {
+    std::unique_ptr<CompileUnit> cu(new CompileUnit());
+    cu->sections = &sections_;
+    cu->offset = offset;
+    Reader r(sections_.info, offset);
+    if (!r.UnitLength(&cu->dwarf64))
+      break;
+    cu->end = r.end_offset();
+    offset = cu->end;
+
+    cu->version = r.U16();
+    uint64_t abbrev_offset;
+    if (cu->version >= 5) {
+      uint8_t unit_type = r.U8();
+      cu->addr_size = r.U8();
+      abbrev_offset = r.Offset(cu->dwarf64);
+      // Type units and split units don't describe any code.
+      if (unit_type != DW_UT_compile && unit_type != DW_UT_partial)
+        continue;
+    } else {
+      abbrev_offset = r.Offset(cu->dwarf64);
+      cu->addr_size = r.U8();
+    }
+    if (!r.ok() || cu->version < 2 || cu->version > 5 ||
+        (cu->addr_size != 4 && cu->addr_size != 8)) {
+      continue;
+    }
+
+    auto abbrevs_it = abbrevs_.find(abbrev_offset);
+    if (abbrevs_it == abbrevs_.end()) {
+      abbrevs_it =
+          abbrevs_.emplace(abbrev_offset, std::map<uint64_t, Abbrev>()).first;
+      Reader ar(sections_.abbrev, abbrev_offset);
+      while (ar.ok()) {
+        uint64_t code = ar.Uleb();
+        if (code == 0)
+          break;
+        Abbrev abbrev;
+        abbrev.tag = ar.Uleb();
+        abbrev.has_children = ar.U8() != 0;
+        while (ar.ok()) {
+          Abbrev::Attr attr{ar.Uleb(), ar.Uleb(), 0};
+          if (attr.name == 0 && attr.form == 0)
+            break;
+          if (attr.form == DW_FORM_implicit_const)
+            attr.implicit_const = ar.Sleb();
+          abbrev.attrs.push_back(attr);
+        }
+        abbrevs_it->second.emplace(code, std::move(abbrev));
+      }
+    }
+    cu->abbrevs = &abbrevs_it->second;
+
+    cu->die_offset = r.offset();
+    Die die;
+    if (!ReadDie(&r, *cu, &die) ||
+        (die.tag != DW_TAG_compile_unit && die.tag != DW_TAG_partial_unit)) {
+      continue;
+    }
+    // The bases need to be known before the other attributes can be resolved.
+    cu->str_offsets_base = die.str_offsets_base.value;
+    cu->addr_base = die.addr_base.value;
+    cu->rnglists_base = die.rnglists_base.value;
+    if (die.low_pc.form)
+      cu->base_address = GetAddress(*cu, die.low_pc).value_or(0);
+    if (die.stmt_list.form) {
+      cu->has_stmt_list = true;
+      cu->stmt_list = die.stmt_list.value;
+    }
+    const char* comp_dir = GetString(*cu, die.comp_dir);
+    if (comp_dir)
+      cu->comp_dir = comp_dir;
+
+    size_t index = compile_units_.size();
+    for (const auto& range : GetRanges(*cu, die)) {
+      if (!IsTombstone(range.first, cu->addr_size))
+        compile_unit_ranges_.push_back({range.first, range.second, index});
+    }
+    compile_units_.emplace_back(std::move(cu));
+  }
+  std::sort(compile_unit_ranges_.begin(), compile_unit_ranges_.end(),
+            ByLow<CompileUnitRange>);
+}
+
+DwarfSymbolizer::CompileUnitData* DwarfSymbolizer::GetCompileUnitData(
+    size_t index) {
+  CompileUnit& cu = *compile_units_[index];
+  if (!cu.data) {
+    cu.data.reset(new CompileUnitData());
+    ParseLineTable(cu, cu.data.get());
+    ParseFunctions(cu, cu.data.get());
+  }
+  return cu.data.get();
+}
+
+void DwarfSymbolizer::ParseLineTable(const CompileUnit& cu,
+                                     CompileUnitData* data) {
+  if (!cu.has_stmt_list)
+    return;
+  Reader r(sections_.line, cu.stmt_list);
+  bool dwarf64;
+  if (!r.UnitLength(&dwarf64))
+    return;
+  uint16_t version = r.U16();
+  if (version < 2 || version > 5)
+    return;
+  if (version >= 5) {
+    r.U8();  // address_size
+    r.U8();  // segment_selector_size
+  }
+  uint64_t header_length = r.Offset(dwarf64);
+  uint64_t program_offset = r.offset() + header_length;
+  uint8_t min_inst_length = r.U8();
+  if (version >= 4)
+    r.U8();  // maximum_operations_per_instruction, only used for VLIW.
+  r.U8();    // default_is_stmt
+  int8_t line_base = static_cast<int8_t>(r.U8());
+  uint8_t line_range = r.U8();
+  uint8_t opcode_base = r.U8();
+  if (!r.ok() || line_range == 0 || opcode_base == 0)
+    return;
+  std::vector<uint8_t> standard_opcode_lengths(opcode_base);
+  for (uint8_t i = 1; i < opcode_base; ++i)
+    standard_opcode_lengths[i] = r.U8();
+
+  // Relative directories are relative to the compilation directory.
+  auto make_dir = [&cu](const char* dir) {
+    return JoinPath(cu.comp_dir, dir ? dir : "");
+  };
+  std::vector<std::string> dirs;
+  std::vector<std::string>& files = data->files;
+  if (version < 5) {
+    // Indices start at 1, 0 is the compilation directory / unit.
+    dirs.push_back(cu.comp_dir);
+    for (const char* dir = r.CStr(); r.ok() && *dir; dir = r.CStr())
+      dirs.push_back(make_dir(dir));
+    files.emplace_back();
+    for (const char* file = r.CStr(); r.ok() && *file; file = r.CStr()) {
+      uint64_t dir = r.Uleb();
+      r.Uleb();  // Modification time.
+      r.Uleb();  // Length.
+      files.push_back(JoinPath(dir < dirs.size() ? dirs[dir] : "", file));
+    }
+  } else {
+    // Each entry is a list of (content type, form) pairs.
+    auto read_entries = [&r, &cu](
+                            const std::function<void(const char*, uint64_t)>&
+                                add_entry) {
+      std::vector<std::pair<uint64_t, uint64_t>> format;
+      uint8_t format_count = r.U8();
+      for (uint8_t i = 0; i < format_count; ++i) {
+        uint64_t content_type = r.Uleb();
+        format.emplace_back(content_type, r.Uleb());
+      }
+      uint64_t count = r.Uleb();
+      for (uint64_t i = 0; i < count && r.ok(); ++i) {
+        const char* path = nullptr;
+        uint64_t dir_index = 0;
+        for (const auto& field : format) {
+          AttrValue value;
+          if (!ReadAttrValue(&r, cu, field.second, 0, &value))
+            return false;
+          if (field.first == DW_LNCT_path)
+            path = GetString(cu, value);
+          else if (field.first == DW_LNCT_directory_index)
+            dir_index = value.value;
+        }
+        add_entry(path, dir_index);
+      }
+      return r.ok();
+    };
+    if (!read_entries([&dirs, &make_dir](const char* dir, uint64_t) {
+          dirs.push_back(make_dir(dir));
+        })) {
+      return;
+    }
+    if (!read_entries([&dirs, &files](const char* file, uint64_t dir) {
+          files.push_back(
+              JoinPath(dir < dirs.size() ? dirs[dir] : "", file ? file : ""));
+        })) {
+      return;
+    }
+  }
+
+  r.Seek(program_offset);
+  std::vector<std::vector<LineRow>> sequences;
+  std::vector<LineRow> sequence;
+  uint64_t address = 0;
+  uint32_t file = 1;
+  uint32_t line = 1;
+  auto reset = [&] {
+    address = 0;
+    file = 1;
+    line = 1;
+  };
+  auto emit_row = [&] { sequence.push_back(LineRow{address, file, line}); };
+  while (r.ok() && !r.AtEnd()) {
+    uint8_t opcode = r.U8();
+    if (opcode >= opcode_base) {
+      uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+      address += static_cast<uint64_t>(adjusted / line_range) * min_inst_length;
+      line += static_cast<uint32_t>(line_base + adjusted % line_range);
+      emit_row();
+      continue;
+    }
+    switch (opcode) {
+      case 0: {  // Extended opcode.
+        uint64_t length = r.Uleb();
+        uint64_t next = r.offset() + length;
+        if (length == 0)
+          break;
+        uint8_t extended = r.U8();
+        if (extended == DW_LNE_end_sequence) {
+          sequence.push_back(LineRow{address, kEndSequence, 0});
+          if (!IsTombstone(sequence.front().address, cu.addr_size))
+            sequences.emplace_back(std::move(sequence));
+          sequence.clear();
+          reset();
+        } else if (extended == DW_LNE_set_address) {
+          address = r.ReadSized(static_cast<size_t>(length - 1));
+        }
+        r.Seek(next);
+        break;
+      }
+      case DW_LNS_copy:
+        emit_row();
+        break;
+      case DW_LNS_advance_pc:
+        address += r.Uleb() * min_inst_length;
+        break;
+      case DW_LNS_advance_line:
+        line += static_cast<uint32_t>(r.Sleb());
+        break;
+      case DW_LNS_set_file:
+        file = static_cast<uint32_t>(r.Uleb());
+        break;
+      case DW_LNS_const_add_pc:
+        address +=
+            static_cast<uint64_t>((255 - opcode_base) / line_range) *
+            min_inst_length;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += r.U16();
+        break;
+      default:
+        // Skip the ULEB128 arguments of the opcodes we don't care about.
+        for (uint8_t i = 0; i < standard_opcode_lengths[opcode]; ++i)
+          r.Uleb();
+        break;
+    }
+  }
+
+  std::sort(sequences.begin(), sequences.end(),
+            [](const std::vector<LineRow>& a, const std::vector<LineRow>& b) {
+              return a.front().address < b.front().address;
+            });
+  for (const std::vector<LineRow>& seq : sequences)
+    data->rows.insert(data->rows.end(), seq.begin(), seq.end());
+}
+
+void DwarfSymbolizer::ParseFunctions(const CompileUnit& cu,
+                                     CompileUnitData* data) {
+  // What the children of a DIE are nested in.
+  struct Scope {
+    bool in_function;
+    uint32_t inline_depth;
+    // Range in |data->functions| of the function that this DIE defines.
+    size_t functions_begin;
+    size_t functions_end;
+  };
+  Reader r(sections_.info, cu.die_offset, cu.end);
+  std::vector<Scope> scopes;
+  Die die;
+  if (!ReadDie(&r, cu, &die) || !die.has_children)
+    return;
+  scopes.push_back(Scope{false, 0, 0, 0});
+  while (!scopes.empty() && !r.AtEnd()) {
+    if (!ReadDie(&r, cu, &die))
+      break;
+    if (die.tag == 0) {
+      const Scope& scope = scopes.back();
+      for (size_t i = scope.functions_begin; i < scope.functions_end; ++i)
+        data->functions[i].inlines_end = data->inlines.size();
+      scopes.pop_back();
+      continue;
+    }
+    const Scope& parent = scopes.back();
+    Scope scope{parent.in_function, parent.inline_depth, 0, 0};
+    // Subprograms can be nested, e.g. the member functions of a local class
+    // like a lambda. Their code doesn't overlap with the enclosing function.
+    if (die.tag == DW_TAG_subprogram) {
+      AddressRanges ranges = GetRanges(cu, die);
+      if (!ranges.empty()) {
+        scope = Scope{true, 0, data->functions.size(), 0};
+        for (const auto& range : ranges) {
+          if (IsTombstone(range.first, cu.addr_size))
+            continue;
+          data->functions.push_back(Function{range.first, range.second,
+                                             die.offset, data->inlines.size(),
+                                             data->inlines.size()});
+        }
+        scope.functions_end = data->functions.size();
+      }
+    } else if (die.tag == DW_TAG_inlined_subroutine && parent.in_function) {
+      AddressRanges ranges = GetRanges(cu, die);
+      if (!ranges.empty()) {
+        base::Optional<uint64_t> origin =
+            GetReference(cu, die.abstract_origin);
+        for (const auto& range : ranges) {
+          data->inlines.push_back(InlinedCall{
+              range.first, range.second, origin.value_or(die.offset),
+              parent.inline_depth, static_cast<uint32_t>(die.call_file.value),
+              static_cast<uint32_t>(die.call_line.value)});
+        }
+        scope.inline_depth = parent.inline_depth + 1;
+      }
+    }
+    if (die.has_children)
+      scopes.push_back(scope);
+  }
+  std::stable_sort(data->functions.begin(), data->functions.end(),
+                   ByLow<Function>);
+}
+
+const std::string& DwarfSymbolizer::GetFunctionName(uint64_t die_offset) {
+  auto it = function_names_.find(die_offset);
+  if (it != function_names_.end())
+    return it->second;
+
+  std::string name;
+  // Definitions and inlined instances usually only refer to the declaration
+  // that has the names. Don't follow reference loops in broken files.
+  uint64_t offset = die_offset;
+  for (int i = 0; i < 8; ++i) {
+    auto cu_it = std::upper_bound(
+        compile_units_.begin(), compile_units_.end(), offset,
+        [](uint64_t off, const std::unique_ptr<CompileUnit>& cu) {
+          return off < cu->offset;
+        });
+    if (cu_it == compile_units_.begin())
+      break;
+    const CompileUnit& cu = **(cu_it - 1);
+    if (offset >= cu.end)
+      break;
+    Reader r(sections_.info, offset, cu.end);
+    Die die;
+    if (!ReadDie(&r, cu, &die) || die.tag == 0)
+      break;
+    const char* linkage_name = GetString(cu, die.linkage_name);
+    if (linkage_name && *linkage_name) {
+      std::unique_ptr<char, base::FreeDeleter> demangled =
+          trace_processor::demangle::Demangle(linkage_name);
+      name = demangled ? demangled.get() : linkage_name;
+      break;
+    }
+    const char* plain_name = GetString(cu, die.name);
+    if (plain_name && name.empty())
+      name = plain_name;
+    base::Optional<uint64_t> next = GetReference(
+        cu, die.abstract_origin.form ? die.abstract_origin : die.specification);
+    if (!next)
+      break;
+    offset = *next;
+  }
+  return function_names_.emplace(die_offset, std::move(name)).first->second;
+}
+
+const DwarfSymbolizer::ElfSymbol* DwarfSymbolizer::FindSymbol(
+    uint64_t address) {
+  auto it = std::upper_bound(symbols_.begin(), symbols_.end(), address,
+                             [](uint64_t addr, const ElfSymbol& sym) {
+                               return addr < sym.address;
+                             });
+  if (it == symbols_.begin())
+    return nullptr;
+  const ElfSymbol& sym = *(it - 1);
+  if (address - sym.address >= std::max<uint64_t>(sym.size, 1))
+    return nullptr;
+  return &sym;
+}
+
+std::vector<SymbolizedFrame> DwarfSymbolizer::Symbolize(uint64_t address) {
+  std::vector<SymbolizedFrame> frames;
+  auto symbol_name = [this, address]() -> std::string {
+    const ElfSymbol* sym = FindSymbol(address);
+    if (!sym)
+      return "";
+    std::unique_ptr<char, base::FreeDeleter> demangled =
+        trace_processor::demangle::Demangle(sym->name);
+    return demangled ? demangled.get() : sym->name;
+  };
+
+  auto cu_it = std::upper_bound(
+      compile_unit_ranges_.begin(), compile_unit_ranges_.end(), address,
+      [](uint64_t addr, const CompileUnitRange& range) {
+        return addr < range.low;
+      });
+  if (cu_it == compile_unit_ranges_.begin() || address >= (cu_it - 1)->high) {
+    std::string name = symbol_name();
+    if (!name.empty())
+      frames.push_back(MakeFrame(std::move(name), "", 0));
+    return frames;
+  }
+  const CompileUnitData& data = *GetCompileUnitData((cu_it - 1)->cu);
+  auto file_name = [&data](uint32_t file) -> std::string {
+    return file < data.files.size() ? data.files[file] : "";
+  };
+
+  std::string file;
+  uint32_t line = 0;
+  auto row_it = std::upper_bound(data.rows.begin(), data.rows.end(), address,
+                                 [](uint64_t addr, const LineRow& row) {
+                                   return addr < row.address;
+                                 });
+  if (row_it != data.rows.begin() && (row_it - 1)->file != kEndSequence) {
+    file = file_name((row_it - 1)->file);
+    line = (row_it - 1)->line;
+  }
+
+  auto fn_it = std::upper_bound(data.functions.begin(), data.functions.end(),
+                                address, [](uint64_t addr, const Function& f) {
+                                  return addr < f.low;
+                                });
+  if (fn_it == data.functions.begin() || address >= (fn_it - 1)->high) {
+    std::string name = symbol_name();
+    if (!name.empty() || !file.empty())
+      frames.push_back(MakeFrame(std::move(name), std::move(file), line));
+    return frames;
+  }
+  const Function& function = *(fn_it - 1);
+
+  // The chain of inlined calls that contain |address|, outermost first.
+  std::vector<const InlinedCall*> chain;
+  for (size_t i = function.inlines_begin; i < function.inlines_end; ++i) {
+    const InlinedCall& call = data.inlines[i];
+    if (call.depth == chain.size() && address >= call.low &&
+        address < call.high) {
+      chain.push_back(&call);
+    }
+  }
+
+  // The innermost frame is at the line of |address|, each caller is at the
+  // call site of its callee.
+  for (auto call_it = chain.rbegin(); call_it != chain.rend(); ++call_it) {
+    const InlinedCall& call = **call_it;
+    frames.push_back(MakeFrame(GetFunctionName(call.die_offset), file, line));
+    file = file_name(call.call_file);
+    line = call.call_line;
+  }
+  // As llvm-symbolizer does, prefer the symbol table for the outermost
+  // function: it tells apart the parts that the compiler split off, e.g.
+  // "main.cold".
+  std::string name = symbol_name();
+  if (name.empty())
+    name = GetFunctionName(function.die_offset);
+  frames.push_back(MakeFrame(std::move(name), std::move(file), line));
+  return frames;
+}
+
+}  // namespace profiling
+}  // namespace perfetto
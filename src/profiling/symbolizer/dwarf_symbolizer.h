@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_DWARF_SYMBOLIZER_H_
+#define SRC_PROFILING_SYMBOLIZER_DWARF_SYMBOLIZER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/profiling/symbolizer/scoped_read_mmap.h"
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Symbolizes the addresses of one ELF file in-process, using its DWARF debug
+// info (.debug_info and .debug_line, versions 2 to 5), including the inlined
+// functions. Addresses without debug info fall back to the function symbols
+// of .symtab (or .dynsym).
+//
+// The file stays mmap-ed, and the debug info of a compilation unit is only
+// parsed when one of its addresses is first looked up.
+//
+// Not thread-safe: the lazily parsed state is cached without locking.
+class DwarfSymbolizer {
+ public:
+  // Returns nullptr if |file_name| can't be read or is not an ELF file.
+  static std::unique_ptr<DwarfSymbolizer> Create(const std::string& file_name);
+
+  ~DwarfSymbolizer();
+
+  // |address| is a virtual address in the file, i.e. a relative pc plus the
+  // load bias. Returns the innermost inlined function first, like
+  // llvm-symbolizer, or an empty vector if nothing is known about |address|.
+  std::vector<SymbolizedFrame> Symbolize(uint64_t address);
+
+  struct Section {
+    const uint8_t* data;
+    size_t size;
+  };
+
+  struct DebugSections {
+    Section info;
+    Section abbrev;
+    Section line;
+    Section str;
+    Section line_str;
+    Section str_offsets;
+    Section addr;
+    Section ranges;
+    Section rnglists;
+  };
+
+  struct AttrValue {
+    uint64_t form = 0;  // 0 if the attribute is absent.
+    uint64_t value = 0;
+    const char* str = nullptr;  // Only for DW_FORM_string.
+  };
+
+  struct Abbrev;
+  struct CompileUnit;
+
+ private:
+  struct LineRow {
+    uint64_t address;
+    uint32_t file;  // kEndSequence after the last row of a sequence.
+    uint32_t line;
+  };
+
+  struct Function {
+    uint64_t low;
+    uint64_t high;
+    uint64_t die_offset;
+    // Range in |CompileUnitData.inlines| of the inlined calls.
+    size_t inlines_begin;
+    size_t inlines_end;
+  };
+
+  struct InlinedCall {
+    uint64_t low;
+    uint64_t high;
+    uint64_t die_offset;
+    // Nesting level within the function, starting at 0.
+    uint32_t depth;
+    uint32_t call_file;
+    uint32_t call_line;
+  };
+
+  struct CompileUnitData {
+    std::vector<std::string> files;
+    std::vector<LineRow> rows;  // Sorted by address.
+    std::vector<Function> functions;  // Sorted by |low|.
+    std::vector<InlinedCall> inlines;  // In DIE order.
+  };
+
+  struct CompileUnitRange {
+    uint64_t low;
+    uint64_t high;
+    size_t cu;
+  };
+
+  struct ElfSymbol {
+    uint64_t address;
+    uint64_t size;
+    const char* name;  // Mangled, points into |map_|.
+  };
+
+  static constexpr uint32_t kEndSequence = UINT32_MAX;
+
+  explicit DwarfSymbolizer(std::unique_ptr<ScopedReadMmap> map);
+
+  template <typename E>
+  bool ParseElf(size_t size);
+  template <typename E>
+  void ParseSymbols(const typename E::Ehdr* ehdr,
+                    const typename E::Shdr* symtab,
+                    const typename E::Shdr* strtab,
+                    size_t size);
+
+  void IndexCompileUnits();
+  CompileUnitData* GetCompileUnitData(size_t cu);
+  void ParseLineTable(const CompileUnit& cu, CompileUnitData* data);
+  void ParseFunctions(const CompileUnit& cu, CompileUnitData* data);
+  const std::string& GetFunctionName(uint64_t die_offset);
+  const ElfSymbol* FindSymbol(uint64_t address);
+
+  std::unique_ptr<ScopedReadMmap> map_;
+  DebugSections sections_;
+  // By offset in .debug_abbrev, then by abbreviation code.
+  std::map<uint64_t, std::map<uint64_t, Abbrev>> abbrevs_;
+  std::vector<std::unique_ptr<CompileUnit>> compile_units_;  // By offset.
+  std::vector<CompileUnitRange> compile_unit_ranges_;  // Sorted by |low|.
+  std::unordered_map<uint64_t, std::string> function_names_;
+  std::vector<ElfSymbol> symbols_;  // Sorted by address.
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_DWARF_SYMBOLIZER_H_
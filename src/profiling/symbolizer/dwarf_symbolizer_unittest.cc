@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/build_config.h"
+#include "test/gtest_and_gmock.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "src/base/test/utils.h"
+#include "src/profiling/symbolizer/dwarf_symbolizer.h"
+#include "src/profiling/symbolizer/elf.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <link.h>
+#endif
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+
+// x86-64 binaries built from test/data/dwarf_fixture.c, see there. The
+// addresses below are the same in both of them.
+constexpr const char* kFixtures[] = {
+    "src/profiling/symbolizer/test/data/dwarf4.elf",
+    "src/profiling/symbolizer/test/data/dwarf5.elf",
+};
+constexpr const char* kDwarf5Fixture = kFixtures[1];
+
+constexpr uint64_t kColdAddress = 0x401005;
+// Within the inlined call of Inlined() in Outer().
+constexpr uint64_t kInlinedAddress = 0x401016;
+constexpr uint64_t kOuterAddress = 0x401020;
+constexpr uint64_t kStartAddress = 0x401030;
+
+std::vector<std::string> Symbolize(DwarfSymbolizer* symbolizer,
+                                   uint64_t address) {
+  std::vector<std::string> frames;
+  for (const SymbolizedFrame& frame : symbolizer->Symbolize(address)) {
+    frames.push_back(frame.function_name + " " + frame.file_name + ":" +
+                     std::to_string(frame.line));
+  }
+  return frames;
+}
+
+// Writes a copy of |fixture| with |bytes| written at |offset| in the section
+// |section_name| (or filling the section, if |bytes| is empty).
+base::TempFile CorruptSection(const char* fixture,
+                              const char* section_name,
+                              size_t offset,
+                              const std::string& bytes) {
+  std::string elf;
+  PERFETTO_CHECK(base::ReadFile(base::GetTestDataPath(fixture), &elf));
+  const auto* ehdr = reinterpret_cast<const Elf64::Ehdr*>(elf.data());
+  const auto* shdrs =
+      reinterpret_cast<const Elf64::Shdr*>(elf.data() + ehdr->e_shoff);
+  const char* shstrtab = elf.data() + shdrs[ehdr->e_shstrndx].sh_offset;
+  bool found = false;
+  for (size_t i = 0; i < ehdr->e_shnum; i++) {
+    if (strcmp(shstrtab + shdrs[i].sh_name, section_name) != 0)
+      continue;
+    size_t section_offset = static_cast<size_t>(shdrs[i].sh_offset);
+    if (bytes.empty()) {
+      elf.replace(section_offset, static_cast<size_t>(shdrs[i].sh_size),
+                  static_cast<size_t>(shdrs[i].sh_size), '\xff');
+    } else {
+      PERFETTO_CHECK(offset + bytes.size() <= shdrs[i].sh_size);
+      elf.replace(section_offset + offset, bytes.size(), bytes);
+    }
+    found = true;
+  }
+  PERFETTO_CHECK(found);
+  base::TempFile tmp = base::TempFile::Create();
+  PERFETTO_CHECK(base::WriteAll(tmp.fd(), elf.data(), elf.size()) ==
+                 static_cast<ssize_t>(elf.size()));
+  return tmp;
+}
+
+TEST(DwarfSymbolizerTest, Fixtures) {
+  for (const char* fixture : kFixtures) {
+    SCOPED_TRACE(fixture);
+    std::unique_ptr<DwarfSymbolizer> symbolizer =
+        DwarfSymbolizer::Create(base::GetTestDataPath(fixture));
+    ASSERT_TRUE(symbolizer);
+
+    // Cold() is in .text.unlikely, away from the rest of the compile unit.
+    EXPECT_THAT(Symbolize(symbolizer.get(), kColdAddress),
+                ElementsAre("Cold /fixture/dwarf_fixture.c:42"));
+    // Innermost inlined function first.
+    EXPECT_THAT(Symbolize(symbolizer.get(), kInlinedAddress),
+                ElementsAre("Inlined /fixture/dwarf_fixture.c:32",
+                            "Outer /fixture/dwarf_fixture.c:36"));
+    EXPECT_THAT(Symbolize(symbolizer.get(), kOuterAddress),
+                ElementsAre("Outer /fixture/dwarf_fixture.c:37"));
+    EXPECT_THAT(Symbolize(symbolizer.get(), kStartAddress),
+                ElementsAre("_start /fixture/dwarf_fixture.c:47"));
+    EXPECT_TRUE(Symbolize(symbolizer.get(), 0x500000).empty());
+  }
+}
+
+TEST(DwarfSymbolizerTest, TruncatedDebugInfo) {
+  // The unit length runs past the end of .debug_info: only the symbols are
+  // left.
+  base::TempFile tmp = CorruptSection(kDwarf5Fixture, ".debug_info", 0,
+                                      std::string("\xf0\xff\xff\xff", 4));
+  std::unique_ptr<DwarfSymbolizer> symbolizer =
+      DwarfSymbolizer::Create(tmp.path());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_THAT(Symbolize(symbolizer.get(), kColdAddress),
+              ElementsAre("Cold :0"));
+  EXPECT_THAT(Symbolize(symbolizer.get(), kInlinedAddress),
+              ElementsAre("Outer :0"));
+}
+
+TEST(DwarfSymbolizerTest, TruncatedDebugLine) {
+  // The functions are still known, but none of the lines within them.
+  base::TempFile tmp = CorruptSection(kDwarf5Fixture, ".debug_line", 0,
+                                      std::string("\xf0\xff\xff\xff", 4));
+  std::unique_ptr<DwarfSymbolizer> symbolizer =
+      DwarfSymbolizer::Create(tmp.path());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_THAT(Symbolize(symbolizer.get(), kInlinedAddress),
+              ElementsAre("Inlined :0", "Outer :36"));
+}
+
+TEST(DwarfSymbolizerTest, GarbageDebugAbbrev) {
+  // Every abbreviation code is an unterminated LEB128 running to the end of
+  // the section.
+  base::TempFile tmp = CorruptSection(kDwarf5Fixture, ".debug_abbrev", 0, "");
+  std::unique_ptr<DwarfSymbolizer> symbolizer =
+      DwarfSymbolizer::Create(tmp.path());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_THAT(Symbolize(symbolizer.get(), kColdAddress),
+              ElementsAre("Cold :0"));
+}
+
+TEST(DwarfSymbolizerTest, NotElf) {
+  base::TempFile tmp = base::TempFile::Create();
+  ASSERT_EQ(base::WriteAll(tmp.fd(), "not an elf", 10), 10);
+  EXPECT_FALSE(DwarfSymbolizer::Create(tmp.path()));
+}
+
+// Symbolizes the test binary itself, which is only found at /proc/self/exe on
+// Linux and Android.
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+
+PERFETTO_NO_INLINE int DwarfSymbolizerTestFunction(int x) {
+  // Keep the compiler from folding this into another identical function.
+  static volatile int counter = 0;
+  counter = counter + x;
+  return counter;
+}
+
+int GetMainProgramLoadBias(struct dl_phdr_info* info, size_t, void* data) {
+  // The first object is the main program.
+  *static_cast<uint64_t*>(data) = static_cast<uint64_t>(info->dlpi_addr);
+  return 1;
+}
+
+// Returns the address of |fn| as a virtual address in the binary.
+uint64_t FileAddress(int (*fn)(int)) {
+  uint64_t load_bias = 0;
+  dl_iterate_phdr(GetMainProgramLoadBias, &load_bias);
+  return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(fn)) - load_bias;
+}
+
+// The test binary might be built without debug info, so this only checks the
+// symbol table lookup. The DWARF is covered by the fixtures above.
+TEST(DwarfSymbolizerTest, SymbolizesOwnFunction) {
+  std::unique_ptr<DwarfSymbolizer> symbolizer =
+      DwarfSymbolizer::Create("/proc/self/exe");
+  ASSERT_TRUE(symbolizer);
+  std::vector<SymbolizedFrame> frames =
+      symbolizer->Symbolize(FileAddress(DwarfSymbolizerTestFunction) + 1);
+  ASSERT_FALSE(frames.empty());
+  EXPECT_TRUE(base::Contains(frames.back().function_name,
+                             "DwarfSymbolizerTestFunction"));
+}
+
+TEST(DwarfSymbolizerTest, UnknownAddress) {
+  std::unique_ptr<DwarfSymbolizer> symbolizer =
+      DwarfSymbolizer::Create("/proc/self/exe");
+  ASSERT_TRUE(symbolizer);
+  EXPECT_TRUE(symbolizer->Symbolize(0).empty());
+}
+
+#endif
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif
@@ -31,7 +31,12 @@ namespace profiling {
 
 constexpr auto PT_LOAD = 1;
 constexpr auto PF_X = 1;
+constexpr auto SHT_SYMTAB = 2;
 constexpr auto SHT_NOTE = 7;
+constexpr auto SHT_NOBITS = 8;
+constexpr auto SHT_DYNSYM = 11;
+constexpr auto SHF_COMPRESSED = 0x800;
+constexpr auto STT_FUNC = 2;
 constexpr auto NT_GNU_BUILD_ID = 3;
 constexpr auto ELFCLASS32 = 1;
 constexpr auto ELFCLASS64 = 2;
@@ -98,6 +103,14 @@ struct Elf32 {
     uint32_t p_flags;
     uint32_t p_align;
   };
+  struct Sym {
+    Word st_name;
+    Addr st_value;
+    Word st_size;
+    unsigned char st_info;
+    unsigned char st_other;
+    Half st_shndx;
+  };
 };
 
 struct Elf64 {
@@ -152,6 +165,14 @@ struct Elf64 {
     uint64_t p_memsz;
     uint64_t p_align;
   };
+  struct Sym {
+    Word st_name;
+    unsigned char st_info;
+    unsigned char st_other;
+    Half st_shndx;
+    Addr st_value;
+    Xword st_size;
+  };
 };
 
 template <typename E>
@@ -16,7 +16,9 @@
 
 #include "src/profiling/symbolizer/local_symbolizer.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 
 #include <cinttypes>
 #include <memory>
@@ -37,6 +39,24 @@
 namespace perfetto {
 namespace profiling {
 
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+namespace {
+
+// The index of the build ids is kept in the symbol cache directory, if any.
+std::string GetBinaryIndexCachePath() {
+  const char* dir = getenv("PERFETTO_SYMBOL_CACHE_DIR");
+  if (!dir || !*dir)
+    return "";
+  if (!base::Mkdir(dir) && errno != EEXIST) {
+    PERFETTO_PLOG("Failed to create symbol cache directory %s", dir);
+    return "";
+  }
+  return std::string(dir) + "/binary_index";
+}
+
+}  // namespace
+#endif
+
 // TODO(fmayer): Fix up name. This suggests it always returns a symbolizer or
 // dies, which isn't the case.
 std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
@@ -50,10 +70,19 @@ std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
     if (!mode || strncmp(mode, "find", 4) == 0)
       finder.reset(new LocalBinaryFinder(std::move(binary_path)));
     else if (strncmp(mode, "index", 5) == 0)
-      finder.reset(new LocalBinaryIndexer(std::move(binary_path)));
+      finder.reset(new LocalBinaryIndexer(std::move(binary_path),
+                                          GetBinaryIndexCachePath()));
     else
       PERFETTO_FATAL("Invalid symbolizer mode [find | index]: %s", mode);
-    symbolizer.reset(new LocalSymbolizer(std::move(finder)));
+    // The debug info is read in-process, unless an llvm-symbolizer binary is
+    // explicitly requested.
+    const char* llvm_symbolizer = getenv("PERFETTO_LLVM_SYMBOLIZER");
+    if (llvm_symbolizer && *llvm_symbolizer) {
+      symbolizer.reset(
+          new LocalSymbolizer(llvm_symbolizer, std::move(finder)));
+    } else {
+      symbolizer.reset(new LocalSymbolizer(std::move(finder)));
+    }
 #else
     base::ignore_result(mode);
     PERFETTO_FATAL("This build does not support local symbolization.");
@@ -69,16 +98,18 @@ std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/uuid.h"
+
+#include "src/profiling/symbolizer/dwarf_symbolizer.h"
 
 #include <signal.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-constexpr const char* kDefaultSymbolizer = "llvm-symbolizer.exe";
-#else
-constexpr const char* kDefaultSymbolizer = "llvm-symbolizer";
-#endif
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 namespace perfetto {
 namespace profiling {
@@ -256,6 +287,32 @@ base::Optional<BuildIdAndLoadBias> GetBuildIdAndLoadBias(
   return base::nullopt;
 }
 
+// On Android 10, there was a bug in libunwindstack that would incorrectly
+// calculate the load_bias, and thus the relative PC. This would end up in
+// frames that made no sense. We can fix this up after the fact if we detect
+// this situation.
+uint64_t LoadBiasCorrection(const FoundBinary& binary,
+                            const std::string& mapping_name,
+                            uint64_t load_bias) {
+  if (binary.load_bias <= load_bias)
+    return 0;
+  uint64_t correction = binary.load_bias - load_bias;
+  PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s", correction,
+               mapping_name.c_str());
+  return correction;
+}
+
+std::vector<std::vector<SymbolizedFrame>> SymbolizeWithDwarf(
+    DwarfSymbolizer* symbolizer,
+    const std::vector<uint64_t>& addresses,
+    uint64_t load_bias_correction) {
+  std::vector<std::vector<SymbolizedFrame>> result;
+  result.reserve(addresses.size());
+  for (uint64_t address : addresses)
+    result.emplace_back(symbolizer->Symbolize(address + load_bias_correction));
+  return result;
+}
+
 bool StartsWithElfMagic(const std::string& fname) {
   base::ScopedFile fd(base::OpenFile(fname, O_RDONLY));
   char magic[EI_MAG3 + 1];
@@ -275,7 +332,158 @@ bool StartsWithElfMagic(const std::string& fname) {
   return true;
 }
 
-std::map<std::string, FoundBinary> BuildIdIndex(std::vector<std::string> dirs) {
+constexpr char kIndexCacheHeader[] = "# perfetto binary index v2";
+
+// What is known about one file under the indexed directories. Files that are
+// not ELF files, or don't have a build id, are remembered too, so that they
+// are not opened again.
+struct IndexedFile {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  base::Optional<BuildIdAndLoadBias> build_id_and_load_bias;
+};
+
+// A file rewritten within the same second with the same size must not match,
+// so the modification time is compared with the full precision of the
+// filesystem.
+bool StatFile(const std::string& fname, uint64_t* size, int64_t* mtime_ns) {
+  struct stat st;
+  if (stat(fname.c_str(), &st) != 0)
+    return false;
+  *size = static_cast<uint64_t>(st.st_size);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_MAC)
+  *mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+              static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  *mtime_ns = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#else
+  *mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+              static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+  return true;
+}
+
+base::Optional<std::string> BuildIdFromHex(const std::string& hex) {
+  if (hex.size() % 2)
+    return base::nullopt;
+  std::string result;
+  result.reserve(hex.size() / 2);
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    base::Optional<uint32_t> byte =
+        base::CStringToUInt32(hex.substr(i, 2).c_str(), 16);
+    if (!byte)
+      return base::nullopt;
+    result.push_back(static_cast<char>(*byte));
+  }
+  return result;
+}
+
+// The cache has one line per file:
+// <size> <mtime in ns> <hex build id, or - if none> <load bias> <path>
+std::map<std::string, IndexedFile> ReadIndexCache(const std::string& path) {
+  std::map<std::string, IndexedFile> result;
+  std::string contents;
+  if (!base::ReadFile(path, &contents) || contents.empty())
+    return result;
+  std::vector<std::string> lines = base::SplitString(contents, "\n");
+  if (lines.empty() || lines[0] != kIndexCacheHeader) {
+    PERFETTO_ELOG("Ignoring binary index cache %s with unknown format.",
+                  path.c_str());
+    return result;
+  }
+  for (size_t i = 1; i < lines.size(); ++i) {
+    const std::string& line = lines[i];
+    // The path is the rest of the line, and can contain spaces.
+    size_t fields_end = 0;
+    for (int field = 0; field < 4 && fields_end != std::string::npos; ++field)
+      fields_end = line.find(' ', fields_end + (field ? 1 : 0));
+    if (fields_end == std::string::npos)
+      continue;
+    std::vector<std::string> fields =
+        base::SplitString(line.substr(0, fields_end), " ");
+    if (fields.size() != 4)
+      continue;
+    base::Optional<uint64_t> size = base::StringToUInt64(fields[0]);
+    base::Optional<int64_t> mtime_ns = base::StringToInt64(fields[1]);
+    base::Optional<uint64_t> load_bias = base::StringToUInt64(fields[3], 16);
+    if (!size || !mtime_ns || !load_bias)
+      continue;
+    IndexedFile file;
+    file.size = *size;
+    file.mtime_ns = *mtime_ns;
+    if (fields[2] != "-") {
+      base::Optional<std::string> build_id = BuildIdFromHex(fields[2]);
+      if (!build_id)
+        continue;
+      file.build_id_and_load_bias = BuildIdAndLoadBias{*build_id, *load_bias};
+    }
+    result[line.substr(fields_end + 1)] = std::move(file);
+  }
+  return result;
+}
+
+void WriteIndexCache(const std::string& path,
+                     const std::map<std::string, IndexedFile>& files) {
+  std::string contents = kIndexCacheHeader;
+  contents += "\n";
+  for (const auto& fname_and_file : files) {
+    const IndexedFile& file = fname_and_file.second;
+    contents += std::to_string(file.size) + " " + std::to_string(file.mtime_ns);
+    if (file.build_id_and_load_bias) {
+      contents += " " + base::ToHex(file.build_id_and_load_bias->build_id) +
+                  " " +
+                  base::Uint64ToHexStringNoPrefix(
+                      file.build_id_and_load_bias->load_bias);
+    } else {
+      contents += " - 0";
+    }
+    contents += " " + fname_and_file.first + "\n";
+  }
+
+  // Write to a temporary file first, so that a concurrent run never reads a
+  // partially written cache. Concurrent runs each write their own.
+  std::string tmp_path = path + "." + base::Uuidv4().ToPrettyString() + ".tmp";
+  {
+    base::ScopedFile fd(
+        base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (!fd || base::WriteAll(*fd, contents.data(), contents.size()) !=
+                   static_cast<ssize_t>(contents.size())) {
+      PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+      return;
+    }
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    // rename() does not replace an existing file on Windows.
+    remove(path.c_str());
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+      PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+      remove(tmp_path.c_str());
+    }
+  }
+}
+
+IndexedFile IndexFile(const std::string& fname,
+                      uint64_t size,
+                      int64_t mtime_ns) {
+  IndexedFile file;
+  file.size = size;
+  file.mtime_ns = mtime_ns;
+  if (StartsWithElfMagic(fname))
+    file.build_id_and_load_bias = GetBuildIdAndLoadBias(fname);
+  return file;
+}
+
+// If |cache_path| is not empty, the build ids of the files whose size and
+// modification time did not change since the previous run are taken from it,
+// instead of reading the files again.
+std::map<std::string, FoundBinary> BuildIdIndex(std::vector<std::string> dirs,
+                                                const std::string& cache_path) {
+  std::map<std::string, IndexedFile> cached;
+  if (!cache_path.empty())
+    cached = ReadIndexCache(cache_path);
+  std::map<std::string, IndexedFile> indexed;
+  size_t reused = 0;
+
   std::map<std::string, FoundBinary> result;
   for (const std::string& dir : dirs) {
     std::vector<std::string> files;
@@ -286,18 +494,35 @@ std::map<std::string, FoundBinary> BuildIdIndex(std::vector<std::string> dirs) {
     }
     for (const std::string& basename : files) {
       std::string fname = dir + "/" + basename;
-      if (!StartsWithElfMagic(fname)) {
+      uint64_t size = 0;
+      int64_t mtime_ns = 0;
+      if (!StatFile(fname, &size, &mtime_ns)) {
+        PERFETTO_PLOG("Failed to stat %s", fname.c_str());
         continue;
       }
-      base::Optional<BuildIdAndLoadBias> build_id_and_load_bias =
-          GetBuildIdAndLoadBias(fname);
-      if (build_id_and_load_bias) {
-        result.emplace(build_id_and_load_bias->build_id,
-                       FoundBinary{fname, build_id_and_load_bias->load_bias});
+      IndexedFile& file = indexed[fname];
+      auto cached_it = cached.find(fname);
+      if (cached_it != cached.end() && cached_it->second.size == size &&
+          cached_it->second.mtime_ns == mtime_ns) {
+        file = std::move(cached_it->second);
+        reused++;
+      } else {
+        file = IndexFile(fname, size, mtime_ns);
+      }
+      if (file.build_id_and_load_bias) {
+        result.emplace(
+            file.build_id_and_load_bias->build_id,
+            FoundBinary{fname, file.build_id_and_load_bias->load_bias});
       }
     }
   }
 
+  if (!cache_path.empty()) {
+    PERFETTO_LOG("Indexed %zu files, reused %zu from %s.", indexed.size(),
+                 reused, cache_path.c_str());
+    if (reused != indexed.size() || reused != cached.size())
+      WriteIndexCache(cache_path, indexed);
+  }
   return result;
 }
 
@@ -324,8 +549,9 @@ bool ParseLlvmSymbolizerLine(const std::string& line,
 
 BinaryFinder::~BinaryFinder() = default;
 
-LocalBinaryIndexer::LocalBinaryIndexer(std::vector<std::string> roots)
-    : buildid_to_file_(BuildIdIndex(std::move(roots))) {}
+LocalBinaryIndexer::LocalBinaryIndexer(std::vector<std::string> roots,
+                                       const std::string& index_cache_path)
+    : buildid_to_file_(BuildIdIndex(std::move(roots), index_cache_path)) {}
 
 base::Optional<FoundBinary> LocalBinaryIndexer::FindBinary(
     const std::string& abspath,
@@ -521,30 +747,88 @@ std::vector<std::vector<SymbolizedFrame>> LocalSymbolizer::Symbolize(
       finder_->FindBinary(mapping_name, build_id);
   if (!binary)
     return {};
-  uint64_t load_bias_correction = 0;
-  if (binary->load_bias > load_bias) {
-    // On Android 10, there was a bug in libunwindstack that would incorrectly
-    // calculate the load_bias, and thus the relative PC. This would end up in
-    // frames that made no sense. We can fix this up after the fact if we
-    // detect this situation.
-    load_bias_correction = binary->load_bias - load_bias;
-    PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s",
-                 load_bias_correction, mapping_name.c_str());
+  uint64_t load_bias_correction =
+      LoadBiasCorrection(*binary, mapping_name, load_bias);
+  if (!llvm_symbolizer_) {
+    std::unique_ptr<DwarfSymbolizer> symbolizer =
+        DwarfSymbolizer::Create(binary->file_name);
+    if (!symbolizer)
+      return {};
+    return SymbolizeWithDwarf(symbolizer.get(), addresses,
+                              load_bias_correction);
   }
   std::vector<std::vector<SymbolizedFrame>> result;
   result.reserve(addresses.size());
   for (uint64_t address : addresses)
-    result.emplace_back(llvm_symbolizer_.Symbolize(
+    result.emplace_back(llvm_symbolizer_->Symbolize(
         binary->file_name, address + load_bias_correction));
   return result;
 }
 
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+LocalSymbolizer::SymbolizeBatch(
+    const std::vector<SymbolizationRequest>& requests) {
+  // There is only one llvm-symbolizer process to talk to.
+  if (llvm_symbolizer_)
+    return Symbolizer::SymbolizeBatch(requests);
+
+  struct FileRequest {
+    size_t index;
+    uint64_t load_bias_correction;
+  };
+  // The finder is not thread-safe: look up all the binaries upfront, and group
+  // the requests by file so that each file is only parsed once.
+  std::map<std::string, std::vector<FileRequest>> requests_by_file;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const SymbolizationRequest& request = requests[i];
+    base::Optional<FoundBinary> binary =
+        finder_->FindBinary(request.mapping_name, request.build_id);
+    if (!binary)
+      continue;
+    requests_by_file[binary->file_name].push_back(FileRequest{
+        i, LoadBiasCorrection(*binary, request.mapping_name,
+                              request.load_bias)});
+  }
+  std::vector<const std::pair<const std::string, std::vector<FileRequest>>*>
+      files;
+  for (const auto& file_and_requests : requests_by_file)
+    files.push_back(&file_and_requests);
+
+  // Each result is only written by the thread that handles its file.
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> results(
+      requests.size());
+  std::atomic<size_t> next_file{0};
+  auto symbolize_files = [&] {
+    for (size_t i = next_file++; i < files.size(); i = next_file++) {
+      std::unique_ptr<DwarfSymbolizer> symbolizer =
+          DwarfSymbolizer::Create(files[i]->first);
+      if (!symbolizer)
+        continue;
+      for (const FileRequest& file_request : files[i]->second) {
+        results[file_request.index] = SymbolizeWithDwarf(
+            symbolizer.get(), requests[file_request.index].addresses,
+            file_request.load_bias_correction);
+      }
+    }
+  };
+  size_t num_threads = std::min<size_t>(
+      files.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(symbolize_files);
+  symbolize_files();
+  for (std::thread& thread : threads)
+    thread.join();
+  return results;
+}
+
 LocalSymbolizer::LocalSymbolizer(const std::string& symbolizer_path,
                                  std::unique_ptr<BinaryFinder> finder)
-    : llvm_symbolizer_(symbolizer_path), finder_(std::move(finder)) {}
+    : llvm_symbolizer_(new LLVMSymbolizerProcess(symbolizer_path)),
+      finder_(std::move(finder)) {}
 
 LocalSymbolizer::LocalSymbolizer(std::unique_ptr<BinaryFinder> finder)
-    : LocalSymbolizer(kDefaultSymbolizer, std::move(finder)) {}
+    : finder_(std::move(finder)) {}
 
 LocalSymbolizer::~LocalSymbolizer() = default;
 
@@ -51,7 +51,10 @@ class BinaryFinder {
 
 class LocalBinaryIndexer : public BinaryFinder {
  public:
-  explicit LocalBinaryIndexer(std::vector<std::string> roots);
+  // If |index_cache_path| is not empty, the index is saved there, and only
+  // the files that changed since are read again by the next indexer using it.
+  explicit LocalBinaryIndexer(std::vector<std::string> roots,
+                              const std::string& index_cache_path = "");
 
   base::Optional<FoundBinary> FindBinary(const std::string& abspath,
                                          const std::string& build_id) override;
@@ -94,6 +97,9 @@ class LLVMSymbolizerProcess {
   Subprocess subprocess_;
 };
 
+// Symbolizes the binaries found by a BinaryFinder. By default their debug info
+// is read in-process by DwarfSymbolizer; an llvm-symbolizer subprocess can be
+// used instead by passing its path.
 class LocalSymbolizer : public Symbolizer {
  public:
   LocalSymbolizer(const std::string& symbolizer_path,
@@ -107,12 +113,18 @@ class LocalSymbolizer : public Symbolizer {
       uint64_t load_bias,
       const std::vector<uint64_t>& address) override;
 
+  // Symbolizes the binaries in parallel, one thread per binary, up to the
+  // number of CPUs. Requests for the same binary share one parsed copy of it.
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> SymbolizeBatch(
+      const std::vector<SymbolizationRequest>& requests) override;
+
   bool BuildIdNeedsHexConversion() override { return true; }
 
   ~LocalSymbolizer() override;
 
  private:
-  LLVMSymbolizerProcess llvm_symbolizer_;
+  // Null unless an llvm-symbolizer path was given.
+  std::unique_ptr<LLVMSymbolizerProcess> llvm_symbolizer_;
   std::unique_ptr<BinaryFinder> finder_;
 };
 
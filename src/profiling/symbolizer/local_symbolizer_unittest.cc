@@ -20,8 +20,15 @@
 // This translation unit is built only on Linux and MacOS. See //gn/BUILD.gn.
 #if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #include <cstddef>
 
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "src/base/test/tmp_dir_tree.h"
 #include "src/base/test/utils.h"
 #include "src/profiling/symbolizer/elf.h"
@@ -162,6 +169,86 @@ TEST(LocalBinaryIndexerTest, SimpleTree) {
   EXPECT_EQ(bin2.value().file_name, tmp.path() + "/dir2/elf1");
 }
 
+void OverwriteFile(const std::string& path, const std::string& content) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_TRUNC));
+  ASSERT_EQ(base::WriteAll(*fd, content.data(), content.size()),
+            static_cast<ssize_t>(content.size()));
+}
+
+TEST(LocalBinaryIndexerTest, IndexCache) {
+  base::TmpDirTree tmp;
+  tmp.AddDir("dir1");
+  tmp.AddFile("dir1/elf1", CreateElfWithBuildId("AAAAAAAAAAAAAAAAAAAA"));
+  tmp.AddFile("dir1/nonelf1", "OTHERDATA");
+  tmp.AddDir("cache");
+  tmp.AddFile("cache/binary_index", "");
+  std::string cache_path = tmp.AbsolutePath("cache/binary_index");
+
+  {
+    LocalBinaryIndexer indexer({tmp.path() + "/dir1"}, cache_path);
+    EXPECT_TRUE(indexer.FindBinary("", "AAAAAAAAAAAAAAAAAAAA").has_value());
+  }
+
+  // The files that did not change are not read again: fake a different build
+  // id in the cache to check that it is used.
+  std::string cache;
+  ASSERT_TRUE(base::ReadFile(cache_path, &cache));
+  std::string hex_build_id = base::ToHex("AAAAAAAAAAAAAAAAAAAA");
+  size_t pos = cache.find(hex_build_id);
+  ASSERT_NE(pos, std::string::npos);
+  cache.replace(pos, hex_build_id.size(), base::ToHex("CCCCCCCCCCCCCCCCCCCC"));
+  OverwriteFile(cache_path, cache);
+  {
+    LocalBinaryIndexer indexer({tmp.path() + "/dir1"}, cache_path);
+    base::Optional<FoundBinary> bin =
+        indexer.FindBinary("", "CCCCCCCCCCCCCCCCCCCC");
+    ASSERT_TRUE(bin.has_value());
+    EXPECT_EQ(bin.value().file_name, tmp.path() + "/dir1/elf1");
+  }
+
+  // A file whose size changed is indexed again.
+  OverwriteFile(tmp.AbsolutePath("dir1/elf1"),
+                CreateElfWithBuildId("BBBBBBBBBBBBBBBBBBBB") + "X");
+  {
+    LocalBinaryIndexer indexer({tmp.path() + "/dir1"}, cache_path);
+    EXPECT_TRUE(indexer.FindBinary("", "BBBBBBBBBBBBBBBBBBBB").has_value());
+    EXPECT_FALSE(indexer.FindBinary("", "CCCCCCCCCCCCCCCCCCCC").has_value());
+  }
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+void SetMtime(const std::string& path, time_t sec, long nsec) {
+  struct timespec times[2] = {{sec, nsec}, {sec, nsec}};
+  ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+}
+
+TEST(LocalBinaryIndexerTest, IndexCacheSubSecondMtime) {
+  base::TmpDirTree tmp;
+  tmp.AddDir("dir1");
+  tmp.AddFile("dir1/elf1", CreateElfWithBuildId("AAAAAAAAAAAAAAAAAAAA"));
+  tmp.AddDir("cache");
+  tmp.AddFile("cache/binary_index", "");
+  std::string cache_path = tmp.AbsolutePath("cache/binary_index");
+  std::string elf_path = tmp.AbsolutePath("dir1/elf1");
+
+  SetMtime(elf_path, 1000, 1);
+  {
+    LocalBinaryIndexer indexer({tmp.path() + "/dir1"}, cache_path);
+    EXPECT_TRUE(indexer.FindBinary("", "AAAAAAAAAAAAAAAAAAAA").has_value());
+  }
+
+  // Rewritten with the same size within the same second.
+  OverwriteFile(elf_path, CreateElfWithBuildId("BBBBBBBBBBBBBBBBBBBB"));
+  SetMtime(elf_path, 1000, 2);
+  {
+    LocalBinaryIndexer indexer({tmp.path() + "/dir1"}, cache_path);
+    EXPECT_TRUE(indexer.FindBinary("", "BBBBBBBBBBBBBBBBBBBB").has_value());
+    EXPECT_FALSE(indexer.FindBinary("", "AAAAAAAAAAAAAAAAAAAA").has_value());
+  }
+}
+#endif
+
 TEST(LocalBinaryFinderTest, AbsolutePath) {
   base::TmpDirTree tmp;
   tmp.AddDir("root");
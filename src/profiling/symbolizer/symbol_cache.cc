@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/symbol_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+bool TruncateFile(const std::string& path, size_t size) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY));
+  if (!fd)
+    return false;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  return _chsize_s(*fd, static_cast<__int64>(size)) == 0;
+#else
+  return ftruncate(*fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+}  // namespace
+
+std::string SerializeModuleSymbols(
+    const std::string& path,
+    const std::string& build_id,
+    const std::vector<uint64_t>& addresses,
+    const std::vector<std::vector<SymbolizedFrame>>& frames) {
+  PERFETTO_DCHECK(frames.size() == addresses.size());
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  auto* packet = trace->add_packet();
+  auto* module_symbols = packet->set_module_symbols();
+  module_symbols->set_path(path);
+  module_symbols->set_build_id(build_id);
+  for (size_t i = 0; i < frames.size(); ++i) {
+    auto* address_symbols = module_symbols->add_address_symbols();
+    address_symbols->set_address(addresses[i]);
+    for (const SymbolizedFrame& frame : frames[i]) {
+      auto* line = address_symbols->add_lines();
+      line->set_function_name(frame.function_name);
+      line->set_source_file_name(frame.file_name);
+      line->set_line_number(frame.line);
+    }
+  }
+  return trace.SerializeAsString();
+}
+
+SymbolCache::SymbolCache(std::string dir) : dir_(std::move(dir)) {
+  if (!base::Mkdir(dir_) && errno != EEXIST)
+    PERFETTO_PLOG("Failed to create symbol cache directory %s", dir_.c_str());
+}
+
+SymbolCache::~SymbolCache() = default;
+
+bool SymbolCache::Lookup(const std::string& build_id,
+                         uint64_t load_bias,
+                         uint64_t address,
+                         std::vector<SymbolizedFrame>* frames) {
+  Module* module = GetModule(build_id, load_bias);
+  auto it = module->find(address);
+  if (it == module->end()) {
+    stats_.misses++;
+    return false;
+  }
+  stats_.hits++;
+  *frames = it->second;
+  return true;
+}
+
+void SymbolCache::Store(
+    const std::string& build_id,
+    uint64_t load_bias,
+    const std::vector<uint64_t>& addresses,
+    const std::vector<std::vector<SymbolizedFrame>>& frames) {
+  std::vector<uint64_t> symbolized_addresses;
+  std::vector<std::vector<SymbolizedFrame>> symbolized_frames;
+  for (size_t i = 0; i < addresses.size(); ++i) {
+    if (frames[i].empty() ||
+        std::any_of(frames[i].begin(), frames[i].end(),
+                    [](const SymbolizedFrame& frame) {
+                      return frame.file_name.empty();
+                    })) {
+      continue;
+    }
+    symbolized_addresses.push_back(addresses[i]);
+    symbolized_frames.push_back(frames[i]);
+  }
+  if (symbolized_addresses.empty())
+    return;
+  Module* module = GetModule(build_id, load_bias);
+  for (size_t i = 0; i < symbolized_addresses.size(); ++i)
+    (*module)[symbolized_addresses[i]] = symbolized_frames[i];
+
+  // Only whole packets are appended, so that the file can always be parsed
+  // even if another process appends to it at the same time.
+  std::string file_name = GetFileName(build_id, load_bias);
+  std::string data = SerializeModuleSymbols("", build_id, symbolized_addresses,
+                                            symbolized_frames);
+  base::ScopedFile fd(
+      base::OpenFile(file_name, O_WRONLY | O_CREAT | O_APPEND, 0644));
+  if (!fd || base::WriteAll(*fd, data.data(), data.size()) !=
+                 static_cast<ssize_t>(data.size())) {
+    PERFETTO_PLOG("Failed to write symbol cache %s", file_name.c_str());
+  }
+}
+
+std::string SymbolCache::GetFileName(const std::string& build_id,
+                                     uint64_t load_bias) const {
+  return dir_ + "/" + base::ToHex(build_id) + "_" +
+         base::Uint64ToHexStringNoPrefix(load_bias);
+}
+
+SymbolCache::Module* SymbolCache::GetModule(const std::string& build_id,
+                                            uint64_t load_bias) {
+  auto it_and_inserted =
+      modules_.emplace(std::make_pair(build_id, load_bias), Module());
+  Module* module = &it_and_inserted.first->second;
+  if (!it_and_inserted.second)
+    return module;
+
+  std::string file_name = GetFileName(build_id, load_bias);
+  std::string data;
+  if (!base::ReadFile(file_name, &data))
+    return module;
+  protozero::ProtoDecoder trace(data);
+  size_t valid_size = 0;
+  for (auto field = trace.ReadField(); field.valid();
+       field = trace.ReadField()) {
+    valid_size = trace.read_offset();
+    if (field.id() != protos::pbzero::Trace::kPacketFieldNumber)
+      continue;
+    protos::pbzero::TracePacket::Decoder packet(field.as_bytes());
+    if (!packet.has_module_symbols())
+      continue;
+    protos::pbzero::ModuleSymbols::Decoder module_symbols(
+        packet.module_symbols());
+    for (auto addr_it = module_symbols.address_symbols(); addr_it; ++addr_it) {
+      protos::pbzero::AddressSymbols::Decoder address_symbols(*addr_it);
+      std::vector<SymbolizedFrame>& frames =
+          (*module)[address_symbols.address()];
+      frames.clear();
+      for (auto line_it = address_symbols.lines(); line_it; ++line_it) {
+        protos::pbzero::Line::Decoder line(*line_it);
+        SymbolizedFrame frame;
+        frame.function_name = line.function_name().ToStdString();
+        frame.file_name = line.source_file_name().ToStdString();
+        frame.line = line.line_number();
+        frames.emplace_back(std::move(frame));
+      }
+    }
+  }
+
+  // Otherwise, the next packet appended would be read as the rest of the
+  // partial one, and so would be all the packets after it.
+  if (valid_size < data.size()) {
+    PERFETTO_ELOG("Dropping %zu trailing bytes of symbol cache %s",
+                  data.size() - valid_size, file_name.c_str());
+    if (!TruncateFile(file_name, valid_size))
+      PERFETTO_PLOG("Failed to truncate symbol cache %s", file_name.c_str());
+  }
+  return module;
+}
+
+}  // namespace profiling
+}  // namespace perfetto
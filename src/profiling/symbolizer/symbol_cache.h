@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_SYMBOL_CACHE_H_
+#define SRC_PROFILING_SYMBOLIZER_SYMBOL_CACHE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Returns a proto-encoded Trace with one TracePacket, holding the ModuleSymbols
+// of |addresses| in the module |path|. |frames| is indexed like |addresses|.
+std::string SerializeModuleSymbols(
+    const std::string& path,
+    const std::string& build_id,
+    const std::vector<uint64_t>& addresses,
+    const std::vector<std::vector<SymbolizedFrame>>& frames);
+
+// Keeps the symbolization results of previous runs on disk, so that the
+// addresses of the same binaries don't need to be symbolized again.
+//
+// There is one file in the cache directory per build id and load bias, made
+// of ModuleSymbols packets in the same format as the output of
+// `traceconv symbolize`. New results are appended to it. Addresses that could
+// not be symbolized are not cached, as the binary or its debug info might be
+// found by a later run. Neither are the ones symbolized without source
+// files, e.g. from the symbol table of a stripped binary, as a later run might
+// find the unstripped one.
+class SymbolCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  // |dir| is created if it does not exist.
+  explicit SymbolCache(std::string dir);
+  ~SymbolCache();
+
+  // Returns false if |address| is not in the cache.
+  bool Lookup(const std::string& build_id,
+              uint64_t load_bias,
+              uint64_t address,
+              std::vector<SymbolizedFrame>* frames);
+
+  // Stores the frames of the addresses that were symbolized from debug info,
+  // i.e. that have frames and all of them have a source file.
+  void Store(const std::string& build_id,
+             uint64_t load_bias,
+             const std::vector<uint64_t>& addresses,
+             const std::vector<std::vector<SymbolizedFrame>>& frames);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  using Module = std::unordered_map<uint64_t, std::vector<SymbolizedFrame>>;
+
+  std::string GetFileName(const std::string& build_id,
+                          uint64_t load_bias) const;
+  // Reads the file of the module the first time it is used, dropping the
+  // partial packet a crashed writer might have left at its end.
+  Module* GetModule(const std::string& build_id, uint64_t load_bias);
+
+  const std::string dir_;
+  std::map<std::pair<std::string, uint64_t>, Module> modules_;
+  Stats stats_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_SYMBOL_CACHE_H_
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/symbol_cache.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kBuildId[] = "\x01\x02";
+// The cache file of kBuildId with load bias 0.
+constexpr char kCacheFile[] = "cache/0102_0";
+
+std::vector<SymbolizedFrame> Frames(const std::string& function_name,
+                                    uint32_t line) {
+  SymbolizedFrame frame;
+  frame.function_name = function_name;
+  frame.file_name = "foo.cc";
+  frame.line = line;
+  return {frame};
+}
+
+std::vector<std::string> Lookup(SymbolCache* cache, uint64_t address) {
+  std::vector<SymbolizedFrame> frames;
+  if (!cache->Lookup(kBuildId, 0, address, &frames))
+    return {"miss"};
+  std::vector<std::string> result;
+  for (const SymbolizedFrame& frame : frames) {
+    result.push_back(frame.function_name + " " + frame.file_name + ":" +
+                     std::to_string(frame.line));
+  }
+  return result;
+}
+
+void Append(const std::string& path, const std::string& data) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_APPEND));
+  ASSERT_TRUE(fd);
+  ASSERT_EQ(base::WriteAll(*fd, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+}
+
+class SymbolCacheTest : public ::testing::Test {
+ protected:
+  SymbolCacheTest() {
+    // Created upfront so that the directory tree removes it.
+    tmp_.AddDir("cache");
+    tmp_.AddFile(kCacheFile, "");
+  }
+
+  std::string cache_dir() const { return tmp_.AbsolutePath("cache"); }
+  std::string cache_file() const { return tmp_.AbsolutePath(kCacheFile); }
+
+  base::TmpDirTree tmp_;
+};
+
+TEST_F(SymbolCacheTest, Lookup) {
+  SymbolCache cache(cache_dir());
+  EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("miss"));
+
+  cache.Store(kBuildId, 0, {0x10, 0x20}, {Frames("Foo", 1), {}});
+  EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+  // Addresses that couldn't be symbolized are not cached.
+  EXPECT_THAT(Lookup(&cache, 0x20), ::testing::ElementsAre("miss"));
+
+  std::vector<SymbolizedFrame> frames;
+  EXPECT_FALSE(cache.Lookup(kBuildId, 1, 0x10, &frames));
+  EXPECT_FALSE(cache.Lookup("\x03", 0, 0x10, &frames));
+
+  EXPECT_EQ(cache.stats().hits, 1u);
+  EXPECT_EQ(cache.stats().misses, 4u);
+}
+
+TEST_F(SymbolCacheTest, FramesWithoutSourceFileAreNotCached) {
+  // What the symbol table of a stripped binary yields.
+  SymbolizedFrame symtab_frame;
+  symtab_frame.function_name = "Foo";
+  std::vector<SymbolizedFrame> inlined = Frames("Bar", 2);
+  inlined.push_back(symtab_frame);
+  {
+    SymbolCache cache(cache_dir());
+    cache.Store(kBuildId, 0, {0x10, 0x20}, {{symtab_frame}, inlined});
+    EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("miss"));
+    EXPECT_THAT(Lookup(&cache, 0x20), ::testing::ElementsAre("miss"));
+
+    // A later run with the debug info.
+    cache.Store(kBuildId, 0, {0x10}, {Frames("Foo", 1)});
+  }
+  SymbolCache cache(cache_dir());
+  EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+  EXPECT_THAT(Lookup(&cache, 0x20), ::testing::ElementsAre("miss"));
+}
+
+TEST_F(SymbolCacheTest, AppendAndReload) {
+  {
+    SymbolCache cache(cache_dir());
+    cache.Store(kBuildId, 0, {0x10}, {Frames("Foo", 1)});
+  }
+  {
+    SymbolCache cache(cache_dir());
+    EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+    cache.Store(kBuildId, 0, {0x20, 0x30}, {Frames("Bar", 2), {}});
+  }
+  SymbolCache cache(cache_dir());
+  EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+  EXPECT_THAT(Lookup(&cache, 0x20), ::testing::ElementsAre("Bar foo.cc:2"));
+  EXPECT_THAT(Lookup(&cache, 0x30), ::testing::ElementsAre("miss"));
+}
+
+TEST_F(SymbolCacheTest, TruncatedFile) {
+  {
+    SymbolCache cache(cache_dir());
+    cache.Store(kBuildId, 0, {0x10}, {Frames("Foo", 1)});
+  }
+  base::Optional<size_t> valid_size = base::GetFileSize(cache_file());
+  ASSERT_TRUE(valid_size);
+
+  // A writer crashed in the middle of an append.
+  std::string packet =
+      SerializeModuleSymbols("", kBuildId, {0x20}, {Frames("Bar", 2)});
+  Append(cache_file(), packet.substr(0, packet.size() - 3));
+
+  {
+    SymbolCache cache(cache_dir());
+    EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+    EXPECT_THAT(Lookup(&cache, 0x20), ::testing::ElementsAre("miss"));
+    EXPECT_EQ(*base::GetFileSize(cache_file()), *valid_size);
+    cache.Store(kBuildId, 0, {0x30}, {Frames("Baz", 3)});
+  }
+
+  // The packets appended after the partial one are still read.
+  SymbolCache cache(cache_dir());
+  EXPECT_THAT(Lookup(&cache, 0x10), ::testing::ElementsAre("Foo foo.cc:1"));
+  EXPECT_THAT(Lookup(&cache, 0x30), ::testing::ElementsAre("Baz foo.cc:3"));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -16,19 +16,18 @@
 
 #include "src/profiling/symbolizer/symbolize_database.h"
 
+#include <stdlib.h>
+
+#include <cinttypes>
 #include <map>
 #include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
-#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_processor.h"
 
-#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
-#include "protos/perfetto/trace/trace.pbzero.h"
-#include "protos/perfetto/trace/trace_packet.pbzero.h"
-
+#include "src/profiling/symbolizer/symbol_cache.h"
 #include "src/trace_processor/util/stack_traces_util.h"
 
 namespace perfetto {
@@ -117,35 +116,102 @@ std::map<UnsymbolizedMapping, std::vector<uint64_t>> GetUnsymbolizedFrames(
 void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
                        Symbolizer* symbolizer,
                        std::function<void(const std::string&)> callback) {
+  std::string cache_dir = GetPerfettoSymbolCacheDir();
+  if (cache_dir.empty()) {
+    SymbolizeDatabase(tp, symbolizer, nullptr, std::move(callback));
+    return;
+  }
+  SymbolCache cache(std::move(cache_dir));
+  SymbolizeDatabase(tp, symbolizer, &cache, std::move(callback));
+}
+
+void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
+                       Symbolizer* symbolizer,
+                       SymbolCache* cache,
+                       std::function<void(const std::string&)> callback) {
   PERFETTO_CHECK(symbolizer);
   auto unsymbolized =
       GetUnsymbolizedFrames(tp, symbolizer->BuildIdNeedsHexConversion());
-  for (auto it = unsymbolized.cbegin(); it != unsymbolized.cend(); ++it) {
-    const auto& unsymbolized_mapping = it->first;
-    const std::vector<uint64_t>& rel_pcs = it->second;
-    auto res = symbolizer->Symbolize(unsymbolized_mapping.name,
-                                     unsymbolized_mapping.build_id,
-                                     unsymbolized_mapping.load_bias, rel_pcs);
+
+  struct Mapping {
+    const UnsymbolizedMapping* mapping;
+    const std::vector<uint64_t>* rel_pcs;
+    // Indexed like |rel_pcs|, only valid where |known| is set.
+    std::vector<std::vector<SymbolizedFrame>> frames;
+    std::vector<bool> known;
+  };
+  std::vector<Mapping> mappings;
+  mappings.reserve(unsymbolized.size());
+  // Only the frames that are not in the cache are symbolized.
+  std::vector<SymbolizationRequest> requests;
+  std::vector<size_t> request_mappings;
+  for (const auto& mapping_and_rel_pcs : unsymbolized) {
+    const UnsymbolizedMapping& mapping = mapping_and_rel_pcs.first;
+    const std::vector<uint64_t>& rel_pcs = mapping_and_rel_pcs.second;
+    mappings.emplace_back(Mapping{&mapping, &rel_pcs, {}, {}});
+    Mapping& m = mappings.back();
+    m.frames.resize(rel_pcs.size());
+    m.known.resize(rel_pcs.size());
+    SymbolizationRequest request;
+    for (size_t i = 0; i < rel_pcs.size(); ++i) {
+      m.known[i] = cache && cache->Lookup(mapping.build_id, mapping.load_bias,
+                                          rel_pcs[i], &m.frames[i]);
+      if (!m.known[i])
+        request.addresses.push_back(rel_pcs[i]);
+    }
+    if (request.addresses.empty())
+      continue;
+    request.mapping_name = mapping.name;
+    request.build_id = mapping.build_id;
+    request.load_bias = mapping.load_bias;
+    requests.emplace_back(std::move(request));
+    request_mappings.push_back(mappings.size() - 1);
+  }
+
+  // Symbolizing all the mappings at once lets the symbolizer work on several
+  // binaries in parallel.
+  auto results = symbolizer->SymbolizeBatch(requests);
+  PERFETTO_CHECK(results.size() == requests.size());
+  for (size_t r = 0; r < requests.size(); ++r) {
+    const SymbolizationRequest& request = requests[r];
+    auto& res = results[r];
+    // An empty result means that the binary was not found. This is not
+    // cached, as it might be available the next time.
     if (res.empty())
       continue;
+    PERFETTO_DCHECK(res.size() == request.addresses.size());
+    if (cache) {
+      cache->Store(request.build_id, request.load_bias, request.addresses,
+                   res);
+    }
+    Mapping& m = mappings[request_mappings[r]];
+    size_t next = 0;
+    for (size_t i = 0; i < m.known.size(); ++i) {
+      if (m.known[i])
+        continue;
+      m.frames[i] = std::move(res[next++]);
+      m.known[i] = true;
+    }
+  }
 
-    protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
-    auto* packet = trace->add_packet();
-    auto* module_symbols = packet->set_module_symbols();
-    module_symbols->set_path(unsymbolized_mapping.name);
-    module_symbols->set_build_id(unsymbolized_mapping.build_id);
-    PERFETTO_DCHECK(res.size() == rel_pcs.size());
-    for (size_t i = 0; i < res.size(); ++i) {
-      auto* address_symbols = module_symbols->add_address_symbols();
-      address_symbols->set_address(rel_pcs[i]);
-      for (const SymbolizedFrame& frame : res[i]) {
-        auto* line = address_symbols->add_lines();
-        line->set_function_name(frame.function_name);
-        line->set_source_file_name(frame.file_name);
-        line->set_line_number(frame.line);
-      }
+  for (Mapping& m : mappings) {
+    std::vector<uint64_t> rel_pcs;
+    std::vector<std::vector<SymbolizedFrame>> frames;
+    for (size_t i = 0; i < m.known.size(); ++i) {
+      if (!m.known[i])
+        continue;
+      rel_pcs.push_back((*m.rel_pcs)[i]);
+      frames.emplace_back(std::move(m.frames[i]));
     }
-    callback(trace.SerializeAsString());
+    if (rel_pcs.empty())
+      continue;
+    callback(SerializeModuleSymbols(m.mapping->name, m.mapping->build_id,
+                                    rel_pcs, frames));
+  }
+
+  if (cache) {
+    PERFETTO_LOG("Symbol cache: %" PRIu64 " hits, %" PRIu64 " misses.",
+                 cache->stats().hits, cache->stats().misses);
   }
 }
 
@@ -156,5 +222,10 @@ std::vector<std::string> GetPerfettoBinaryPath() {
   return {};
 }
 
+std::string GetPerfettoSymbolCacheDir() {
+  const char* dir = getenv("PERFETTO_SYMBOL_CACHE_DIR");
+  return dir ? dir : "";
+}
+
 }  // namespace profiling
 }  // namespace perfetto
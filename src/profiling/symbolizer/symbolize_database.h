@@ -28,11 +28,22 @@ namespace trace_processor {
 class TraceProcessor;
 }
 namespace profiling {
+class SymbolCache;
+
 std::vector<std::string> GetPerfettoBinaryPath();
+// Returns the value of PERFETTO_SYMBOL_CACHE_DIR, or an empty string.
+std::string GetPerfettoSymbolCacheDir();
 // Generate ModuleSymbol protos for all unsymbolized frames in the database.
 // Wrap them in proto-encoded TracePackets messages and call callback.
+// Uses the symbol cache in GetPerfettoSymbolCacheDir(), if set.
+void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
+                       Symbolizer* symbolizer,
+                       std::function<void(const std::string&)> callback);
+// Same as above, but frames found in |cache| are not passed to |symbolizer|,
+// and the new results are added to it. |cache| can be null.
 void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
                        Symbolizer* symbolizer,
+                       SymbolCache* cache,
                        std::function<void(const std::string&)> callback);
 }  // namespace profiling
 }  // namespace perfetto
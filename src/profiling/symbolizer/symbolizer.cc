@@ -21,5 +21,16 @@ namespace profiling {
 
 Symbolizer::~Symbolizer() = default;
 
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+Symbolizer::SymbolizeBatch(const std::vector<SymbolizationRequest>& requests) {
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> results;
+  results.reserve(requests.size());
+  for (const SymbolizationRequest& request : requests) {
+    results.emplace_back(Symbolize(request.mapping_name, request.build_id,
+                                   request.load_bias, request.addresses));
+  }
+  return results;
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -17,6 +17,8 @@
 #ifndef SRC_PROFILING_SYMBOLIZER_SYMBOLIZER_H_
 #define SRC_PROFILING_SYMBOLIZER_SYMBOLIZER_H_
 
+#include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -30,6 +32,14 @@ struct SymbolizedFrame {
   uint32_t line = 0;
 };
 
+// The arguments of one Symbolizer::Symbolize() call.
+struct SymbolizationRequest {
+  std::string mapping_name;
+  std::string build_id;
+  uint64_t load_bias = 0;
+  std::vector<uint64_t> addresses;
+};
+
 class Symbolizer {
  public:
   // For each address in the input vector, output a vector of SymbolizedFrame
@@ -44,6 +54,14 @@ class Symbolizer {
       const std::vector<uint64_t>& address) = 0;
   virtual ~Symbolizer();
 
+  // Symbolizes the addresses of several mappings. Returns, for each request
+  // and in the same order, what Symbolize() would return for it.
+  //
+  // The default implementation calls Symbolize() for each request in turn.
+  // Symbolizers that can work on several binaries at once override it.
+  virtual std::vector<std::vector<std::vector<SymbolizedFrame>>>
+  SymbolizeBatch(const std::vector<SymbolizationRequest>& requests);
+
   // LocalSymbolizer uses a specific conversion of a symbol file's |build_id| to
   // bytes, but BreakpadSymbolizer requires the |build_id| as given. Return true
   // if the |build_id| passed to Symbolize() requires the conversion to bytes
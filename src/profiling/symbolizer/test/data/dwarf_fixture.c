@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Source of the dwarf4.elf and dwarf5.elf fixtures, built with GCC 12 by:
+//
+// for v in 4 5; do
+//   gcc -O2 -gdwarf-$v -ffunction-sections -fno-asynchronous-unwind-tables \
+//     -fno-pie -no-pie -nostdlib -static -Wl,--build-id=none \
+//     -fdebug-prefix-map=$PWD=/fixture -o dwarf$v.elf dwarf_fixture.c
+// done
+//
+// Outer() inlines Inlined(), and Cold() is placed in .text.unlikely, so the
+// compile unit has DW_AT_ranges instead of a single address range.
+
+volatile int g_value;
+
+static inline __attribute__((always_inline)) int Inlined(int x) {
+  g_value = x;
+  return g_value * 3;
+}
+
+__attribute__((noinline)) int Outer(int x) {
+  int y = Inlined(x);
+  g_value = y;
+  return g_value + 2;
+}
+
+__attribute__((noinline, cold)) int Cold(int x) {
+  g_value = x;
+  return g_value - 1;
+}
+
+void _start(void) {
+  Outer(g_value);
+  Cold(g_value);
+  for (;;) {
+  }
+}
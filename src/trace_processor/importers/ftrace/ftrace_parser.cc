@@ -481,6 +481,17 @@ void FtraceParser::ParseFtraceStats(ConstBytes blob) {
     context_->metadata_tracker->SetMetadata(metadata::ftrace_setup_errors,
                                             Variadic::String(error_str_id));
   }
+
+  if (evt.has_cpu_buffer_size_kb()) {
+    storage->SetStats(stats::ftrace_cpu_buffer_size_kb,
+                      static_cast<int64_t>(evt.cpu_buffer_size_kb()));
+  }
+  if (is_end) {
+    int64_t changes = 0;
+    for (auto it = evt.drain_period_changes(); it; ++it)
+      changes++;
+    storage->SetStats(stats::ftrace_drain_period_changes, changes);
+  }
 }
 
 PERFETTO_ALWAYS_INLINE
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/ftrace/ftrace_tokenizer.h"
 
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -31,6 +33,7 @@ namespace perfetto {
 namespace trace_processor {
 
 using protozero::ProtoDecoder;
+using protozero::proto_utils::MakeTagLengthDelimited;
 using protozero::proto_utils::MakeTagVarInt;
 using protozero::proto_utils::ParseVarInt;
 
@@ -95,6 +98,10 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(
     TokenizeFtraceCompactSched(cpu, clock_id, decoder.compact_sched());
   }
 
+  for (auto it = decoder.compact_events(); it; ++it) {
+    TokenizeFtraceCompactEvents(cpu, clock_id, *it, state);
+  }
+
   for (auto it = decoder.event(); it; ++it) {
     TokenizeFtraceEvent(cpu, clock_id, bundle.slice(it->data(), it->size()),
                         state);
@@ -261,6 +268,94 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedWaking(
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
 
+void FtraceTokenizer::TokenizeFtraceCompactEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::ConstBytes packet,
+    PacketSequenceState* state) {
+  using protos::pbzero::FtraceEvent;
+  FtraceEventBundle::CompactEvents::Decoder compact(packet);
+  const uint32_t event_field_id = compact.event_field_id();
+
+  bool parse_error = false;
+  std::vector<uint32_t> field_ids;
+  for (auto it = compact.field_id(&parse_error); it; ++it)
+    field_ids.push_back(*it);
+
+  // Each event is re-encoded as the FtraceEvent proto that traced_probes would
+  // have written without the compact encoding, so that it goes through the
+  // same parsing as all the other events. All the events of the batch share
+  // the same TraceBlob.
+  struct EncodedEvent {
+    int64_t timestamp;
+    size_t offset;
+    size_t size;
+  };
+  std::vector<EncodedEvent> events;
+  std::vector<uint8_t> buf;
+  std::vector<uint8_t> nested;
+  auto append_varint = [](std::vector<uint8_t>* out, uint64_t value) {
+    uint8_t varint[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* end = protozero::proto_utils::WriteVarInt(value, varint);
+    out->insert(out->end(), varint, end);
+  };
+
+  // Accumulator for timestamp deltas.
+  int64_t timestamp_acc = 0;
+
+  // The events' fields are stored in a structure-of-arrays style, using packed
+  // repeated fields. Walk the repeated fields in step to recover individual
+  // events, consuming one row of |field_ids| size values per event.
+  auto timestamp_it = compact.timestamp(&parse_error);
+  auto pid_it = compact.pid(&parse_error);
+  auto value_it = compact.field_value(&parse_error);
+  bool values_match = true;
+  for (; timestamp_it && pid_it; ++timestamp_it, ++pid_it) {
+    nested.clear();
+    for (uint32_t field_id : field_ids) {
+      if (!value_it) {
+        values_match = false;
+        break;
+      }
+      append_varint(&nested, MakeTagVarInt(field_id));
+      append_varint(&nested, *value_it);
+      ++value_it;
+    }
+    if (!values_match)
+      break;
+
+    // delta-encoded timestamp
+    timestamp_acc += static_cast<int64_t>(*timestamp_it);
+
+    size_t offset = buf.size();
+    append_varint(&buf, MakeTagVarInt(FtraceEvent::kTimestampFieldNumber));
+    append_varint(&buf, static_cast<uint64_t>(timestamp_acc));
+    append_varint(&buf, MakeTagVarInt(FtraceEvent::kPidFieldNumber));
+    append_varint(&buf, *pid_it);
+    append_varint(&buf, MakeTagLengthDelimited(event_field_id));
+    append_varint(&buf, nested.size());
+    buf.insert(buf.end(), nested.begin(), nested.end());
+    events.push_back(EncodedEvent{timestamp_acc, offset, buf.size() - offset});
+  }
+
+  // Check that all packed buffers were decoded correctly, and fully.
+  bool sizes_match = values_match && !timestamp_it && !pid_it && !value_it;
+  if (parse_error || !sizes_match)
+    context_->storage->IncrementStats(stats::compact_events_has_parse_errors);
+
+  if (events.empty())
+    return;
+  TraceBlobView blob(TraceBlob::CopyFrom(buf.data(), buf.size()));
+  for (const EncodedEvent& event : events) {
+    base::Optional<int64_t> timestamp =
+        ResolveTraceTime(context_, clock_id, event.timestamp);
+    if (!timestamp)
+      return;
+    context_->sorter->PushFtraceEvent(
+        cpu, *timestamp, blob.slice_off(event.offset, event.size), state);
+  }
+}
+
 void FtraceTokenizer::HandleFtraceClockSnapshot(int64_t ftrace_ts,
                                                 int64_t boot_ts,
                                                 uint32_t packet_sequence_id) {
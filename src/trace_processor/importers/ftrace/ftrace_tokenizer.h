@@ -57,6 +57,11 @@ class FtraceTokenizer {
       const protos::pbzero::FtraceEventBundle::CompactSched::Decoder& compact,
       const std::vector<StringId>& string_table);
 
+  void TokenizeFtraceCompactEvents(uint32_t cpu,
+                                   ClockTracker::ClockId,
+                                   protozero::ConstBytes,
+                                   PacketSequenceState* state);
+
   void HandleFtraceClockSnapshot(int64_t ftrace_ts,
                                  int64_t boot_ts,
                                  uint32_t packet_sequence_id);
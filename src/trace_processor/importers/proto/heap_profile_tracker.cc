@@ -55,10 +55,26 @@ void HeapProfileTracker::SetProfilePacketIndex(uint32_t seq_id,
     }
 
     context_->storage->IncrementStats(stats::heapprofd_missing_packet);
+    sequence_state.full_dumps.clear();
   }
   sequence_state.prev_index = index;
 }
 
+void HeapProfileTracker::AddProcessDump(uint32_t seq_id,
+                                        uint64_t pid,
+                                        StringPool::Id heap_name,
+                                        bool incremental) {
+  SequenceState& sequence_state = sequence_state_[seq_id];
+  if (!incremental) {
+    sequence_state.full_dumps.emplace(pid, heap_name);
+    return;
+  }
+  if (sequence_state.full_dumps.count(std::make_pair(pid, heap_name)) == 0) {
+    context_->storage->IncrementIndexedStats(
+        stats::heapprofd_missing_full_dump, static_cast<int>(pid));
+  }
+}
+
 void HeapProfileTracker::AddAllocation(
     uint32_t seq_id,
     SequenceStackProfileTracker* sequence_stack_profile_tracker,
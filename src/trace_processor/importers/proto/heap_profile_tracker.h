@@ -50,6 +50,15 @@ class HeapProfileTracker {
 
   void StoreAllocation(uint32_t seq_id, SourceAllocation);
 
+  // Call for every ProcessHeapSamples. The samples of an incremental dump are
+  // stored as deltas like the others, which carries the callstacks missing
+  // from it forward. That needs a full dump of the same process and heap
+  // earlier on the sequence, without packets lost since.
+  void AddProcessDump(uint32_t seq_id,
+                      uint64_t pid,
+                      StringPool::Id heap_name,
+                      bool incremental);
+
   // Call after the last profile packet of a dump to commit the allocations
   // that had been stored using StoreAllocation and clear internal indices
   // for that dump.
@@ -113,6 +122,9 @@ class HeapProfileTracker {
         free_correction;
 
     base::Optional<uint64_t> prev_index;
+
+    // The (pid, heap_name) that had a full dump since the last lost packet.
+    std::set<std::pair<uint64_t, StringPool::Id>> full_dumps;
   };
   std::map<uint32_t, SequenceState> sequence_state_;
   TraceProcessorContext* const context_;
@@ -408,17 +408,19 @@ void ProfileModule::ParseProfilePacket(
     // whether or not we are getting this data from a fixed producer or not.
     bool trustworthy_max_count = entry.orig_sampling_interval_bytes() > 0;
 
+    StringId heap_name = entry.heap_name().size != 0
+                             ? context_->storage->InternString(entry.heap_name())
+                             : context_->storage->InternString("malloc");
+    context_->heap_profile_tracker->AddProcessDump(seq_id, entry.pid(),
+                                                   heap_name,
+                                                   entry.incremental());
+
     for (auto sample_it = entry.samples(); sample_it; ++sample_it) {
       protos::pbzero::ProfilePacket::HeapSample::Decoder sample(*sample_it);
 
       HeapProfileTracker::SourceAllocation src_allocation;
       src_allocation.pid = entry.pid();
-      if (entry.heap_name().size != 0) {
-        src_allocation.heap_name =
-            context_->storage->InternString(entry.heap_name());
-      } else {
-        src_allocation.heap_name = context_->storage->InternString("malloc");
-      }
+      src_allocation.heap_name = heap_name;
       src_allocation.timestamp = timestamp;
       src_allocation.callstack_id = sample.callstack_id();
       if (sample.has_self_max()) {
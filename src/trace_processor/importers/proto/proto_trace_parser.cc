@@ -226,6 +226,25 @@ void ProtoTraceParser::ParseTraceStats(ConstBytes blob) {
         stats::traced_buf_trace_writer_packet_loss, buf_num,
         static_cast<int64_t>(buf.trace_writer_packet_loss()));
   }
+
+  for (auto it = evt.producer_stats(); it; ++it) {
+    protos::pbzero::TraceStats::ProducerStats::Decoder producer(*it);
+    int producer_id = static_cast<int>(producer.producer_id());
+    storage->SetIndexedStats(stats::traced_producer_smb_chunks_committed,
+                             producer_id,
+                             static_cast<int64_t>(producer.chunks_committed()));
+    storage->SetIndexedStats(stats::traced_producer_smb_chunks_dropped,
+                             producer_id,
+                             static_cast<int64_t>(producer.chunks_dropped()));
+    storage->SetIndexedStats(stats::traced_producer_smb_stalls, producer_id,
+                             static_cast<int64_t>(producer.stalls()));
+    storage->SetIndexedStats(
+        stats::traced_producer_chunks_overwritten, producer_id,
+        static_cast<int64_t>(producer.chunks_overwritten()));
+    storage->SetIndexedStats(stats::traced_producer_chunks_discarded,
+                             producer_id,
+                             static_cast<int64_t>(producer.chunks_discarded()));
+  }
 }
 
 void ProtoTraceParser::ParseChromeEvents(int64_t ts, ConstBytes blob) {
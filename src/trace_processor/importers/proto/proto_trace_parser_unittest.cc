@@ -18,6 +18,8 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "src/trace_processor/importers/additional_modules.h"
@@ -382,6 +384,88 @@ TEST_F(ProtoTraceParserTest, LoadEventsIntoRaw) {
   // and test here.
 }
 
+TEST_F(ProtoTraceParserTest, LoadCompactEvents) {
+  using protos::pbzero::FtraceEvent;
+  using protos::pbzero::SchedSwitchFtraceEvent;
+  using protos::pbzero::SchedWakingFtraceEvent;
+  auto* bundle = trace_->add_packet()->set_ftrace_events();
+  bundle->set_cpu(10);
+
+  // Two sched_switch events, at 1000 and 1500. The comms are strings, which
+  // can't be compacted, so they are left out.
+  auto* switches = bundle->add_compact_events();
+  switches->set_event_field_id(FtraceEvent::kSchedSwitchFieldNumber);
+  protozero::PackedVarInt switch_fields;
+  switch_fields.Append(SchedSwitchFtraceEvent::kPrevPidFieldNumber);
+  switch_fields.Append(SchedSwitchFtraceEvent::kPrevPrioFieldNumber);
+  switch_fields.Append(SchedSwitchFtraceEvent::kPrevStateFieldNumber);
+  switch_fields.Append(SchedSwitchFtraceEvent::kNextPidFieldNumber);
+  switch_fields.Append(SchedSwitchFtraceEvent::kNextPrioFieldNumber);
+  switches->set_field_id(switch_fields);
+  protozero::PackedVarInt switch_timestamps;
+  switch_timestamps.Append(1000);
+  switch_timestamps.Append(500);
+  switches->set_timestamp(switch_timestamps);
+  protozero::PackedVarInt switch_pids;
+  switch_pids.Append(10);
+  switch_pids.Append(100);
+  switches->set_pid(switch_pids);
+  protozero::PackedVarInt switch_values;
+  for (int64_t value : {10, 120, 1, 100, 110})
+    switch_values.Append(value);
+  for (int64_t value : {100, 110, 0, 10, 120})
+    switch_values.Append(value);
+  switches->set_field_value(switch_values);
+
+  // One sched_waking event at 1200, woken up by pid 10.
+  auto* wakings = bundle->add_compact_events();
+  wakings->set_event_field_id(FtraceEvent::kSchedWakingFieldNumber);
+  protozero::PackedVarInt waking_fields;
+  waking_fields.Append(SchedWakingFtraceEvent::kPidFieldNumber);
+  waking_fields.Append(SchedWakingFtraceEvent::kPrioFieldNumber);
+  waking_fields.Append(SchedWakingFtraceEvent::kSuccessFieldNumber);
+  waking_fields.Append(SchedWakingFtraceEvent::kTargetCpuFieldNumber);
+  wakings->set_field_id(waking_fields);
+  protozero::PackedVarInt waking_timestamps;
+  waking_timestamps.Append(1200);
+  wakings->set_timestamp(waking_timestamps);
+  protozero::PackedVarInt waking_pids;
+  waking_pids.Append(10);
+  wakings->set_pid(waking_pids);
+  protozero::PackedVarInt waking_values;
+  for (int64_t value : {100, 110, 1, 3})
+    waking_values.Append(value);
+  wakings->set_field_value(waking_values);
+
+  InSequence in_sequence;
+  EXPECT_CALL(*sched_, PushSchedSwitch(10, 1000, 10, base::StringView(), 120,
+                                       1, 100, base::StringView(), 110));
+  EXPECT_CALL(*process_,
+              UpdateThreadName(100, _, ThreadNamePriority::kFtrace));
+  EXPECT_CALL(*sched_, PushSchedSwitch(10, 1500, 100, base::StringView(), 110,
+                                       0, 10, base::StringView(), 120));
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  EXPECT_EQ(0, context_.storage->stats()[stats::compact_events_has_parse_errors]
+                   .value);
+
+  // sched_waking also goes in the raw table, with all of its compacted fields.
+  const auto& raw = context_.storage->raw_table();
+  ASSERT_EQ(raw.row_count(), 1u);
+  EXPECT_EQ(raw.ts()[0], 1200);
+  EXPECT_EQ(raw.cpu()[0], 10u);
+  ArgSetId arg_set_id = raw.arg_set_id()[0];
+  EXPECT_TRUE(HasArg(arg_set_id, context_.storage->InternString("pid"),
+                     Variadic::Integer(100)));
+  EXPECT_TRUE(HasArg(arg_set_id, context_.storage->InternString("prio"),
+                     Variadic::Integer(110)));
+  EXPECT_TRUE(HasArg(arg_set_id, context_.storage->InternString("success"),
+                     Variadic::Integer(1)));
+  EXPECT_TRUE(HasArg(arg_set_id, context_.storage->InternString("target_cpu"),
+                     Variadic::Integer(3)));
+}
+
 TEST_F(ProtoTraceParserTest, LoadGenericFtrace) {
   auto* packet = trace_->add_packet();
   packet->set_timestamp(100);
@@ -644,6 +728,54 @@ TEST_F(ProtoTraceParserTest, LoadVmStats) {
   EXPECT_EQ(context_.storage->track_table().row_count(), 1u);
 }
 
+TEST_F(ProtoTraceParserTest, LoadDeltaEncodedSysStats) {
+  using protos::pbzero::TracePacket;
+  using protozero::proto_utils::ZigZagEncode;
+  {
+    // Keyframe: the deltas are relative to 0.
+    auto* packet = trace_->add_packet();
+    packet->set_timestamp(1000);
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_sequence_flags(TracePacket::SEQ_INCREMENTAL_STATE_CLEARED |
+                               TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+    auto* sys_stats = packet->set_sys_stats();
+    protozero::PackedVarInt keys;
+    protozero::PackedVarInt values;
+    keys.Append(protos::pbzero::MEMINFO_MEM_TOTAL);
+    values.Append(ZigZagEncode(int64_t(100)));
+    sys_stats->set_meminfo_delta_keys(keys);
+    sys_stats->set_meminfo_delta_values(values);
+    keys.Reset();
+    values.Reset();
+    keys.Append(protos::pbzero::VMSTAT_COMPACT_SUCCESS);
+    values.Append(ZigZagEncode(int64_t(5)));
+    sys_stats->set_vmstat_delta_keys(keys);
+    sys_stats->set_vmstat_delta_values(values);
+  }
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_timestamp(1010);
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_sequence_flags(TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+    auto* sys_stats = packet->set_sys_stats();
+    protozero::PackedVarInt keys;
+    protozero::PackedVarInt values;
+    keys.Append(protos::pbzero::MEMINFO_MEM_TOTAL);
+    values.Append(ZigZagEncode(int64_t(-10)));
+    sys_stats->set_meminfo_delta_keys(keys);
+    sys_stats->set_meminfo_delta_values(values);
+  }
+
+  InSequence in_sequence;
+  EXPECT_CALL(*event_, PushCounter(1000, DoubleEq(100 * 1024.0), TrackId{0u}));
+  EXPECT_CALL(*event_, PushCounter(1000, DoubleEq(5), TrackId{1u}));
+  EXPECT_CALL(*event_, PushCounter(1010, DoubleEq(90 * 1024.0), TrackId{0u}));
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  EXPECT_EQ(context_.storage->track_table().row_count(), 2u);
+}
+
 TEST_F(ProtoTraceParserTest, LoadProcessPacket) {
   auto* tree = trace_->add_packet()->set_process_tree();
   auto* process = tree->add_processes();
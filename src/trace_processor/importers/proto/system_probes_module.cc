@@ -63,7 +63,12 @@ void SystemProbesModule::ParsePacket(const TracePacket::Decoder& decoder,
       parser_.ParseProcessStats(ttp.timestamp, decoder.process_stats());
       return;
     case TracePacket::kSysStatsFieldNumber:
-      parser_.ParseSysStats(ttp.timestamp, decoder.sys_stats());
+      parser_.ParseSysStats(
+          ttp.timestamp, decoder.sys_stats(),
+          decoder.trusted_packet_sequence_id(),
+          decoder.incremental_state_cleared() ||
+              (decoder.sequence_flags() &
+               TracePacket::SEQ_INCREMENTAL_STATE_CLEARED));
       return;
   }
 }
@@ -22,6 +22,7 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/traced/sys_stats_counters.h"
 #include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/system_info_tracker.h"
@@ -148,22 +149,59 @@ SystemProbesParser::SystemProbesParser(TraceProcessorContext* context)
       oom_score_adj_id_;
 }
 
-void SystemProbesParser::ParseSysStats(int64_t ts, ConstBytes blob) {
+void SystemProbesParser::ParseSysStats(int64_t ts,
+                                       ConstBytes blob,
+                                       uint32_t sequence_id,
+                                       bool state_cleared) {
   protos::pbzero::SysStats::Decoder sys_stats(blob.data, blob.size);
 
   for (auto it = sys_stats.meminfo(); it; ++it) {
     protos::pbzero::SysStats::MeminfoValue::Decoder mi(*it);
-    auto key = static_cast<size_t>(mi.key());
-    if (PERFETTO_UNLIKELY(key >= meminfo_strs_id_.size())) {
-      PERFETTO_ELOG("MemInfo key %zu is not recognized.", key);
-      context_->storage->IncrementStats(stats::meminfo_unknown_keys);
-      continue;
+    PushMeminfoCounter(ts, static_cast<uint32_t>(mi.key()), mi.value());
+  }
+
+  if (sys_stats.has_meminfo_delta_keys() ||
+      sys_stats.has_vmstat_delta_keys() || state_cleared) {
+    SysStatsSequenceState& state = sys_stats_sequences_[sequence_id];
+    if (state_cleared || state.meminfo.empty()) {
+      state.meminfo.assign(meminfo_strs_id_.size(), 0);
+      state.vmstat.assign(vmstat_strs_id_.size(), 0);
     }
-    // /proc/meminfo counters are in kB, convert to bytes
-    TrackId track = context_->track_tracker->InternGlobalCounterTrack(
-        meminfo_strs_id_[key]);
-    context_->event_tracker->PushCounter(
-        ts, static_cast<double>(mi.value()) * 1024., track);
+
+    // The keys of the counters are validated by Push*Counter(), which also
+    // keeps track of the unknown ones.
+    using protozero::proto_utils::ZigZagDecode;
+    bool parse_error = false;
+    bool mismatch = false;
+    {
+      auto key = sys_stats.meminfo_delta_keys(&parse_error);
+      auto delta = sys_stats.meminfo_delta_values(&parse_error);
+      for (; key && delta; ++key, ++delta) {
+        uint64_t value = 0;
+        if (*key < state.meminfo.size()) {
+          state.meminfo[*key] += static_cast<uint64_t>(ZigZagDecode(*delta));
+          value = state.meminfo[*key];
+        }
+        PushMeminfoCounter(ts, *key, value);
+      }
+      mismatch |= key || delta;
+    }
+    {
+      auto key = sys_stats.vmstat_delta_keys(&parse_error);
+      auto delta = sys_stats.vmstat_delta_values(&parse_error);
+      for (; key && delta; ++key, ++delta) {
+        uint64_t value = 0;
+        if (*key < state.vmstat.size()) {
+          state.vmstat[*key] += static_cast<uint64_t>(ZigZagDecode(*delta));
+          value = state.vmstat[*key];
+        }
+        PushVmstatCounter(ts, *key, value);
+      }
+      mismatch |= key || delta;
+    }
+
+    if (mismatch || parse_error)
+      context_->storage->IncrementStats(stats::sys_stats_delta_mismatch);
   }
 
   for (auto it = sys_stats.devfreq(); it; ++it) {
@@ -191,16 +229,7 @@ void SystemProbesParser::ParseSysStats(int64_t ts, ConstBytes blob) {
 
   for (auto it = sys_stats.vmstat(); it; ++it) {
     protos::pbzero::SysStats::VmstatValue::Decoder vm(*it);
-    auto key = static_cast<size_t>(vm.key());
-    if (PERFETTO_UNLIKELY(key >= vmstat_strs_id_.size())) {
-      PERFETTO_ELOG("VmStat key %zu is not recognized.", key);
-      context_->storage->IncrementStats(stats::vmstat_unknown_keys);
-      continue;
-    }
-    TrackId track =
-        context_->track_tracker->InternGlobalCounterTrack(vmstat_strs_id_[key]);
-    context_->event_tracker->PushCounter(ts, static_cast<double>(vm.value()),
-                                         track);
+    PushVmstatCounter(ts, static_cast<uint32_t>(vm.key()), vm.value());
   }
 
   for (auto it = sys_stats.cpu_stat(); it; ++it) {
@@ -306,6 +335,34 @@ void SystemProbesParser::ParseSysStats(int64_t ts, ConstBytes blob) {
   }
 }
 
+void SystemProbesParser::PushMeminfoCounter(int64_t ts,
+                                            uint32_t key,
+                                            uint64_t value) {
+  if (PERFETTO_UNLIKELY(key >= meminfo_strs_id_.size())) {
+    PERFETTO_ELOG("MemInfo key %u is not recognized.", key);
+    context_->storage->IncrementStats(stats::meminfo_unknown_keys);
+    return;
+  }
+  // /proc/meminfo counters are in kB, convert to bytes
+  TrackId track =
+      context_->track_tracker->InternGlobalCounterTrack(meminfo_strs_id_[key]);
+  context_->event_tracker->PushCounter(ts, static_cast<double>(value) * 1024.,
+                                       track);
+}
+
+void SystemProbesParser::PushVmstatCounter(int64_t ts,
+                                           uint32_t key,
+                                           uint64_t value) {
+  if (PERFETTO_UNLIKELY(key >= vmstat_strs_id_.size())) {
+    PERFETTO_ELOG("VmStat key %u is not recognized.", key);
+    context_->storage->IncrementStats(stats::vmstat_unknown_keys);
+    return;
+  }
+  TrackId track =
+      context_->track_tracker->InternGlobalCounterTrack(vmstat_strs_id_[key]);
+  context_->event_tracker->PushCounter(ts, static_cast<double>(value), track);
+}
+
 void SystemProbesParser::ParseProcessTree(ConstBytes blob) {
   protos::pbzero::ProcessTree::Decoder ps(blob.data, blob.size);
 
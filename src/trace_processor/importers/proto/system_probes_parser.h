@@ -19,6 +19,7 @@
 
 #include <array>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "perfetto/protozero/field.h"
@@ -38,12 +39,27 @@ class SystemProbesParser {
 
   void ParseProcessTree(ConstBytes);
   void ParseProcessStats(int64_t timestamp, ConstBytes);
-  void ParseSysStats(int64_t ts, ConstBytes);
+  // |sequence_id| and |state_cleared| are the trusted_packet_sequence_id and
+  // the SEQ_INCREMENTAL_STATE_CLEARED flag of the packet. They are needed to
+  // decode the delta encoded meminfo and vmstat counters.
+  void ParseSysStats(int64_t ts,
+                     ConstBytes,
+                     uint32_t sequence_id = 0,
+                     bool state_cleared = false);
   void ParseSystemInfo(ConstBytes);
   void ParseCpuInfo(ConstBytes);
 
  private:
+  // The values of the counters in the previous SysStats packet of a sequence,
+  // indexed by MeminfoCounters and VmstatCounters.
+  struct SysStatsSequenceState {
+    std::vector<uint64_t> meminfo;
+    std::vector<uint64_t> vmstat;
+  };
+
   void ParseThreadStats(int64_t timestamp, uint32_t pid, ConstBytes);
+  void PushMeminfoCounter(int64_t ts, uint32_t key, uint64_t value);
+  void PushVmstatCounter(int64_t ts, uint32_t key, uint64_t value);
 
   TraceProcessorContext* const context_;
 
@@ -64,6 +80,7 @@ class SystemProbesParser {
   const StringId cpu_freq_id_;
   std::vector<StringId> meminfo_strs_id_;
   std::vector<StringId> vmstat_strs_id_;
+  std::unordered_map<uint32_t, SysStatsSequenceState> sys_stats_sequences_;
 
   // Maps a proto field number for memcounters in ProcessStats::Process to
   // their StringId. Keep kProcStatsProcessSize equal to 1 + max proto field
@@ -59,6 +59,10 @@ namespace stats {
   F(ftrace_cpu_read_events_begin,       kIndexed, kInfo,     kTrace,    ""),   \
   F(ftrace_cpu_read_events_end,         kIndexed, kInfo,     kTrace,    ""),   \
   F(ftrace_cpu_read_events_delta,       kIndexed, kInfo,     kTrace,    ""),   \
+  F(ftrace_drain_period_changes,        kSingle,  kInfo,     kTrace,           \
+      "Number of times traced_probes changed the ftrace drain period, "        \
+      "because FtraceConfig.adaptive_drain_period was set."),                  \
+  F(ftrace_cpu_buffer_size_kb,          kSingle,  kInfo,     kTrace,    ""),   \
   F(ftrace_setup_errors,                kSingle,  kError,    kTrace,           \
   "One or more atrace/ftrace categories were not found or failed to enable. "  \
   "See ftrace_setup_errors in the metadata table for more details."),          \
@@ -95,6 +99,10 @@ namespace stats {
   F(stackprofile_invalid_frame_id,      kSingle,  kError,    kTrace,    ""),   \
   F(stackprofile_invalid_callstack_id,  kSingle,  kError,    kTrace,    ""),   \
   F(stackprofile_parser_error,          kSingle,  kError,    kTrace,    ""),   \
+  F(sys_stats_delta_mismatch,           kSingle,  kError,    kAnalysis,        \
+      "A SysStats packet had a different number of delta encoded counter "    \
+      "keys and values. The counters were still pushed for the pairs up to "  \
+      "the shorter of the two, the unpaired trailing entries were dropped."), \
   F(systrace_parse_failure,             kSingle,  kError,    kAnalysis, ""),   \
   F(task_state_invalid,                 kSingle,  kError,    kAnalysis, ""),   \
   F(traced_buf_abi_violations,          kIndexed, kDataLoss, kTrace,    ""),   \
@@ -126,6 +134,21 @@ namespace stats {
   F(traced_flushes_requested,           kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_flushes_succeeded,           kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_patches_discarded,           kSingle,  kInfo,     kTrace,    ""),   \
+  F(traced_producer_chunks_discarded,   kIndexed, kDataLoss, kTrace,           \
+      "Number of chunks of the producer (indexed by producer id) discarded "   \
+      "because a DISCARD trace buffer was full or the producer exceeded its "  \
+      "max_kb_per_producer quota."),                                           \
+  F(traced_producer_chunks_overwritten, kIndexed, kDataLoss, kTrace,           \
+      "Number of chunks of the producer (indexed by producer id) overwritten " \
+      "in a RING_BUFFER trace buffer before being read."),                     \
+  F(traced_producer_smb_chunks_committed,                                      \
+                                        kIndexed, kInfo,     kTrace,    ""),   \
+  F(traced_producer_smb_chunks_dropped, kIndexed, kDataLoss, kTrace,           \
+      "Number of times a TraceWriter of the producer (indexed by producer "    \
+      "id) dropped data because its shared memory buffer was full."),          \
+  F(traced_producer_smb_stalls,         kIndexed, kInfo,     kTrace,           \
+      "Number of times a TraceWriter of the producer (indexed by producer "    \
+      "id) stalled because its shared memory buffer was full."),               \
   F(traced_producers_connected,         kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_producers_seen,              kSingle,  kInfo,     kTrace,    ""),   \
   F(traced_total_buffers,               kSingle,  kInfo,     kTrace,    ""),   \
@@ -171,6 +194,10 @@ namespace stats {
   F(heapprofd_client_disconnected,      kIndexed, kInfo,     kTrace,    ""),   \
   F(heapprofd_malformed_packet,         kIndexed, kError,    kTrace,    ""),   \
   F(heapprofd_missing_packet,           kSingle,  kError,    kTrace,    ""),   \
+  F(heapprofd_missing_full_dump,        kIndexed, kDataLoss, kTrace,           \
+      "An incremental heap dump had no full dump of the process before it "    \
+      "in the trace. Callstacks that did not change since the full dump are "  \
+      "missing until the next one. Indexed by target pid."),                   \
   F(heapprofd_rejected_concurrent,      kIndexed, kError,    kTrace,           \
       "The target was already profiled by another tracing session, so the "    \
       "profile was not taken. Indexed by target upid."),                       \
@@ -201,6 +228,7 @@ namespace stats {
        "The file to be parsed can't be opened. This can happend when "         \
        "the file name is not found or no permission to access the file"),      \
   F(compact_sched_has_parse_errors,     kSingle,  kError,    kTrace,    ""),   \
+  F(compact_events_has_parse_errors,    kSingle,  kError,    kTrace,    ""),   \
   F(misplaced_end_event,                kSingle,  kDataLoss, kAnalysis, ""),   \
   F(sched_waking_out_of_order,          kSingle,  kError,    kAnalysis, ""),   \
   F(compact_sched_switch_skipped,       kSingle,  kInfo,     kAnalysis, ""),   \
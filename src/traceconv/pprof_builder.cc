@@ -22,8 +22,17 @@
 #include <cxxabi.h>
 #endif
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
 #include <algorithm>
+#include <array>
 #include <cinttypes>
+#include <deque>
+#include <functional>
 #include <map>
 #include <set>
 #include <unordered_map>
@@ -50,12 +59,15 @@
 // Conversions for both perf and heap profiles start with |TraceToPprof|.
 // Non-shared logic is in the |heap_profile| and |perf_profile| namespaces.
 //
-// To build one or more profiles, first the callstack information is queried
+// To build one or more profiles, first the callstack information is read
 // from the SQL tables, and converted into an in-memory representation by
-// |PreprocessLocations|. Then an instance of |GProfileBuilder| is used to
-// accumulate samples for that profile, and emit all additional information as a
-// serialized proto. Only the entities referenced by that particular
-// |GProfileBuilder| instance are emitted.
+// |PreprocessLocations|. The samples of all the profiles are then read with a
+// single scan of the samples table. Finally, an instance of |GProfileBuilder|
+// is used to accumulate samples for each profile, and emit all additional
+// information as a serialized proto. Only the entities referenced by that
+// particular |GProfileBuilder| instance are emitted. The profiles are built in
+// parallel by |ProfileSerializer| while the samples are being read, as they
+// only read the shared in-memory state.
 //
 // See protos/third_party/pprof/profile.proto for the meaning of terms like
 // function/location/line.
@@ -148,17 +160,6 @@ uint64_t ToPprofId(int64_t id) {
   return static_cast<uint64_t>(id) + 1;
 }
 
-std::string AsCsvString(std::vector<uint64_t> vals) {
-  std::string ret;
-  for (size_t i = 0; i < vals.size(); i++) {
-    if (i != 0) {
-      ret += ",";
-    }
-    ret += std::to_string(vals[i]);
-  }
-  return ret;
-}
-
 base::Optional<int64_t> GetStatsEntry(
     trace_processor::TraceProcessor* tp,
     const std::string& name,
@@ -183,12 +184,8 @@ base::Optional<int64_t> GetStatsEntry(
 // Interns Locations, Lines, and Functions. Interning is done by the entity's
 // contents, and has no relation to the row ids in the SQL tables.
 // Contains all data for the trace, so can be reused when emitting multiple
-// profiles.
-//
-// TODO(rsavitski): consider moving mappings into here as well. For now, they're
-// still emitted in a single scan during profile building. Mappings should be
-// unique-enough already in the SQL tables, with only incremental state clearing
-// duplicating entries.
+// profiles. It is read-only once built, so that the profiles can be emitted
+// in parallel.
 class LocationTracker {
  public:
   int64_t InternLocation(Location loc) {
@@ -198,6 +195,8 @@ class LocationTracker {
       std::tie(it, inserted) = locations_.emplace(
           std::move(loc), static_cast<int64_t>(locations_.size()));
       PERFETTO_DCHECK(inserted);
+      // Pointers to the elements of an unordered_map stay valid on rehash.
+      locations_by_id_.push_back(&it->first);
     }
     return it->second;
   }
@@ -209,6 +208,7 @@ class LocationTracker {
       std::tie(it, inserted) =
           functions_.emplace(func, static_cast<int64_t>(functions_.size()));
       PERFETTO_DCHECK(inserted);
+      functions_by_id_.push_back(&it->first);
     }
     return it->second;
   }
@@ -224,18 +224,20 @@ class LocationTracker {
     callsite_to_locations_.emplace(callstack_id, locs);
   }
 
-  const std::vector<int64_t>& LocationsForCallstack(
+  // Returns nullptr if |callstack_id| is unknown.
+  const std::vector<int64_t>* LocationsForCallstack(
       int64_t callstack_id) const {
     auto it = callsite_to_locations_.find(callstack_id);
-    PERFETTO_CHECK(callstack_id >= 0 && it != callsite_to_locations_.end());
-    return it->second;
+    if (it == callsite_to_locations_.end())
+      return nullptr;
+    return &it->second;
   }
 
-  const std::unordered_map<Location, int64_t>& AllLocations() const {
-    return locations_;
+  const Location& GetLocation(int64_t id) const {
+    return *locations_by_id_[static_cast<size_t>(id)];
   }
-  const std::unordered_map<Function, int64_t>& AllFunctions() const {
-    return functions_;
+  const Function& GetFunction(int64_t id) const {
+    return *functions_by_id_[static_cast<size_t>(id)];
   }
 
  private:
@@ -243,6 +245,9 @@ class LocationTracker {
   std::unordered_map<int64_t, std::vector<int64_t>> callsite_to_locations_;
   std::unordered_map<Location, int64_t> locations_;
   std::unordered_map<Function, int64_t> functions_;
+  // Indexed by the interned ids.
+  std::vector<const Location*> locations_by_id_;
+  std::vector<const Function*> functions_by_id_;
 };
 
 struct PreprocessedInline {
@@ -284,10 +289,188 @@ PreprocessInliningInfo(trace_processor::TraceProcessor* tp,
   return inlines;
 }
 
+// The columns of a stack_profile_frame row needed to build its Location.
+struct FrameInfo {
+  int64_t mapping_id;
+  const char* func_sysname;
+  const char* func_name;
+  base::Optional<int64_t> symbol_set_id;
+};
+
+// Interns the location and function(s) of a frame, with the optional
+// |annotation| as a function name suffix. Returns base::nullopt on error.
+base::Optional<int64_t> InternFrameLocation(
+    const FrameInfo& frame,
+    const std::string& annotation,
+    const std::unordered_map<int64_t, std::vector<PreprocessedInline>>&
+        inlining_info,
+    bool annotate_frames,
+    trace_processor::StringPool* interner,
+    LocationTracker* tracker) {
+  Location loc(frame.mapping_id, /*single_function_id=*/-1, {});
+
+  auto intern_function = [interner, tracker, annotate_frames](
+                             StringId func_sysname_id,
+                             StringId original_func_name_id,
+                             StringId filename_id, const std::string& anno) {
+    std::string fname = interner->Get(original_func_name_id).ToStdString();
+    if (annotate_frames && !anno.empty() && !fname.empty())
+      fname = fname + " [" + anno + "]";
+    StringId func_name_id = interner->InternString(base::StringView(fname));
+    Function func(func_name_id, func_sysname_id, filename_id);
+    return tracker->InternFunction(func);
+  };
+
+  // Inlining information available
+  if (frame.symbol_set_id.has_value()) {
+    auto it = inlining_info.find(*frame.symbol_set_id);
+    if (it == inlining_info.end()) {
+      PERFETTO_DFATAL_OR_ELOG(
+          "Failed to find stack_profile_symbol entry for symbol_set_id "
+          "%" PRIi64 "",
+          *frame.symbol_set_id);
+      return base::nullopt;
+    }
+
+    // N inlined functions
+    // The symbolised packets currently assume pre-demangled data (as that's
+    // the default of llvm-symbolizer), so we don't have a system name for
+    // each deinlined frame. Set the human-readable name for both fields. We
+    // can change this, but there's no demand for accurate system names in
+    // pprofs.
+    for (const auto& line : it->second) {
+      int64_t func_id = intern_function(line.name_id, line.name_id,
+                                        line.filename_id, annotation);
+
+      loc.inlined_functions.emplace_back(func_id, line.line_no);
+    }
+  } else {
+    // Otherwise - single function
+    int64_t func_id =
+        intern_function(interner->InternString(frame.func_sysname),
+                        interner->InternString(frame.func_name),
+                        /*filename_id=*/StringId::Null(), annotation);
+    loc.single_function_id = func_id;
+  }
+
+  return tracker->InternLocation(std::move(loc));
+}
+
 // Extracts and interns the unique frames and locations (as defined by the proto
-// format) from the callstack SQL tables.
-//
-// Approach:
+// format) from the callstack SQL tables, with one scan of each table:
+//   * intern the location and function(s) of every frame.
+//   * for each callsite, the locations of its callstack are the ones of its
+//     parent, followed by the location of its frame.
+LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
+                                    trace_processor::StringPool* interner) {
+  LocationTracker tracker;
+
+  // Keyed by symbol_set_id, discarded once this function converts the inlines
+  // into Line and Function entries.
+  std::unordered_map<int64_t, std::vector<PreprocessedInline>> inlining_info =
+      PreprocessInliningInfo(tp, interner);
+
+  std::unordered_map<int64_t, int64_t> frame_to_location;
+  Iterator frame_it = tp->ExecuteQuery(
+      "select id, mapping, name, "
+      "coalesce(deobfuscated_name, demangle(name), name), symbol_set_id "
+      "from stack_profile_frame;");
+  while (frame_it.Next()) {
+    FrameInfo frame;
+    frame.mapping_id = frame_it.Get(1).AsLong();
+    frame.func_sysname =
+        frame_it.Get(2).is_null() ? "" : frame_it.Get(2).AsString();
+    frame.func_name =
+        frame_it.Get(3).is_null() ? "" : frame_it.Get(3).AsString();
+    frame.symbol_set_id = frame_it.Get(4).is_null()
+                              ? base::nullopt
+                              : base::make_optional(frame_it.Get(4).AsLong());
+    base::Optional<int64_t> loc_id =
+        InternFrameLocation(frame, /*annotation=*/"", inlining_info,
+                            /*annotate_frames=*/false, interner, &tracker);
+    if (!loc_id)
+      return {};
+    frame_to_location[frame_it.Get(0).AsLong()] = *loc_id;
+  }
+  if (!frame_it.Status().ok()) {
+    PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
+                            frame_it.Status().message().c_str());
+    return {};
+  }
+
+  struct Callsite {
+    base::Optional<int64_t> parent_id;
+    int64_t frame_id;
+  };
+  std::vector<std::pair<int64_t, Callsite>> callsites;
+  std::unordered_map<int64_t, Callsite> callsites_by_id;
+  Iterator cs_it = tp->ExecuteQuery(
+      "select id, parent_id, frame_id from stack_profile_callsite;");
+  while (cs_it.Next()) {
+    Callsite callsite{cs_it.Get(1).is_null()
+                          ? base::nullopt
+                          : base::make_optional(cs_it.Get(1).AsLong()),
+                      cs_it.Get(2).AsLong()};
+    callsites.emplace_back(cs_it.Get(0).AsLong(), callsite);
+    callsites_by_id.emplace(cs_it.Get(0).AsLong(), callsite);
+  }
+  if (!cs_it.Status().ok()) {
+    PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
+                            cs_it.Status().message().c_str());
+    return {};
+  }
+
+  // Parents usually come before their children, but walk up to the first
+  // processed ancestor rather than rely on it.
+  std::vector<int64_t> unprocessed;
+  for (const auto& id_and_callsite : callsites) {
+    int64_t cid = id_and_callsite.first;
+    while (!tracker.IsCallsiteProcessed(cid)) {
+      unprocessed.push_back(cid);
+      auto parent_it = callsites_by_id.find(cid);
+      if (parent_it == callsites_by_id.end() ||
+          !parent_it->second.parent_id.has_value()) {
+        break;
+      }
+      cid = *parent_it->second.parent_id;
+    }
+    for (auto it = unprocessed.rbegin(); it != unprocessed.rend(); ++it) {
+      auto callsite_it = callsites_by_id.find(*it);
+      if (callsite_it == callsites_by_id.end()) {
+        PERFETTO_DFATAL_OR_ELOG("Failed to find callsite %" PRIi64 "", *it);
+        return {};
+      }
+      const Callsite& callsite = callsite_it->second;
+      auto loc_it = frame_to_location.find(callsite.frame_id);
+      if (loc_it == frame_to_location.end()) {
+        PERFETTO_DFATAL_OR_ELOG("Failed to find frame %" PRIi64 "",
+                                callsite.frame_id);
+        return {};
+      }
+      std::vector<int64_t> callstack_loc_ids;
+      if (callsite.parent_id.has_value()) {
+        const std::vector<int64_t>* parent_locs =
+            tracker.LocationsForCallstack(*callsite.parent_id);
+        if (!parent_locs) {
+          PERFETTO_DFATAL_OR_ELOG("Failed to find callsite %" PRIi64 "",
+                                  *callsite.parent_id);
+          return {};
+        }
+        callstack_loc_ids = *parent_locs;
+      }
+      callstack_loc_ids.push_back(loc_it->second);
+      tracker.MaybeSetCallsiteLocations(*it, callstack_loc_ids);
+    }
+    unprocessed.clear();
+  }
+
+  return tracker;
+}
+
+// Same as |PreprocessLocations|, but mixes in the annotations as a frame name
+// suffix (since there's no good way to attach extra info to locations in the
+// proto format). As the annotations are only known through
+// experimental_annotated_callstack, this queries each callstack separately:
 //   * for each callstack (callsite ids of the leaves):
 //     * use experimental_annotated_callstack to build the full list of
 //       constituent frames
@@ -296,13 +479,12 @@ PreprocessInliningInfo(trace_processor::TraceProcessor* tp,
 //         * remember the mapping from callsite_id to the callstack so far (from
 //            the root and including the frame being considered)
 //
-// Optionally mixes in the annotations as a frame name suffix (since there's no
-// good way to attach extra info to locations in the proto format). This relies
-// on the annotations (produced by experimental_annotated_callstack) to be
-// stable for a given callsite (equivalently: dependent only on their parents).
-LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
-                                    trace_processor::StringPool* interner,
-                                    bool annotate_frames) {
+// This relies on the annotations (produced by experimental_annotated_callstack)
+// to be stable for a given callsite (equivalently: dependent only on their
+// parents).
+LocationTracker PreprocessAnnotatedLocations(
+    trace_processor::TraceProcessor* tp,
+    trace_processor::StringPool* interner) {
   LocationTracker tracker;
 
   // Keyed by symbol_set_id, discarded once this function converts the inlines
@@ -337,65 +519,23 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
     while (c_it.Next()) {
       int64_t cid = c_it.Get(0).AsLong();
       auto annotation = c_it.Get(1).is_null() ? "" : c_it.Get(1).AsString();
-      int64_t mapping_id = c_it.Get(2).AsLong();
-      auto func_sysname = c_it.Get(3).is_null() ? "" : c_it.Get(3).AsString();
-      auto func_name = c_it.Get(4).is_null() ? "" : c_it.Get(4).AsString();
-      base::Optional<int64_t> symbol_set_id =
-          c_it.Get(5).is_null() ? base::nullopt
+      FrameInfo frame;
+      frame.mapping_id = c_it.Get(2).AsLong();
+      frame.func_sysname = c_it.Get(3).is_null() ? "" : c_it.Get(3).AsString();
+      frame.func_name = c_it.Get(4).is_null() ? "" : c_it.Get(4).AsString();
+      frame.symbol_set_id = c_it.Get(5).is_null()
+                                ? base::nullopt
                                 : base::make_optional(c_it.Get(5).AsLong());
 
-      Location loc(mapping_id, /*single_function_id=*/-1, {});
-
-      auto intern_function = [interner, &tracker, annotate_frames](
-                                 StringId func_sysname_id,
-                                 StringId original_func_name_id,
-                                 StringId filename_id,
-                                 const std::string& anno) {
-        std::string fname = interner->Get(original_func_name_id).ToStdString();
-        if (annotate_frames && !anno.empty() && !fname.empty())
-          fname = fname + " [" + anno + "]";
-        StringId func_name_id = interner->InternString(base::StringView(fname));
-        Function func(func_name_id, func_sysname_id, filename_id);
-        return tracker.InternFunction(func);
-      };
-
-      // Inlining information available
-      if (symbol_set_id.has_value()) {
-        auto it = inlining_info.find(*symbol_set_id);
-        if (it == inlining_info.end()) {
-          PERFETTO_DFATAL_OR_ELOG(
-              "Failed to find stack_profile_symbol entry for symbol_set_id "
-              "%" PRIi64 "",
-              *symbol_set_id);
-          return {};
-        }
-
-        // N inlined functions
-        // The symbolised packets currently assume pre-demangled data (as that's
-        // the default of llvm-symbolizer), so we don't have a system name for
-        // each deinlined frame. Set the human-readable name for both fields. We
-        // can change this, but there's no demand for accurate system names in
-        // pprofs.
-        for (const auto& line : it->second) {
-          int64_t func_id = intern_function(line.name_id, line.name_id,
-                                            line.filename_id, annotation);
-
-          loc.inlined_functions.emplace_back(func_id, line.line_no);
-        }
-      } else {
-        // Otherwise - single function
-        int64_t func_id =
-            intern_function(interner->InternString(func_sysname),
-                            interner->InternString(func_name),
-                            /*filename_id=*/StringId::Null(), annotation);
-        loc.single_function_id = func_id;
-      }
-
-      int64_t loc_id = tracker.InternLocation(std::move(loc));
+      base::Optional<int64_t> loc_id =
+          InternFrameLocation(frame, annotation, inlining_info,
+                              /*annotate_frames=*/true, interner, &tracker);
+      if (!loc_id)
+        return {};
 
       // Update the tracker with the locations so far (for example, at depth 2,
       // we'll have 3 root-most locations in |callstack_loc_ids|).
-      callstack_loc_ids.push_back(loc_id);
+      callstack_loc_ids.push_back(*loc_id);
       tracker.MaybeSetCallsiteLocations(cid, callstack_loc_ids);
     }
 
@@ -415,12 +555,48 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
   return tracker;
 }
 
+// In-memory representation of a Profile.Mapping.
+struct Mapping {
+  uint64_t file_offset;
+  uint64_t memory_start;
+  uint64_t memory_limit;
+  StringId filename_id;
+};
+
+// Reads all the mappings, so that the profiles can be emitted without
+// querying the trace processor.
+std::map<int64_t, Mapping> PreprocessMappings(
+    trace_processor::TraceProcessor* tp,
+    trace_processor::StringPool* interner) {
+  std::map<int64_t, Mapping> mappings;
+  Iterator mapping_it = tp->ExecuteQuery(
+      "SELECT id, exact_offset, start, end, name "
+      "FROM stack_profile_mapping;");
+  while (mapping_it.Next()) {
+    Mapping mapping;
+    mapping.file_offset = static_cast<uint64_t>(mapping_it.Get(1).AsLong());
+    mapping.memory_start = static_cast<uint64_t>(mapping_it.Get(2).AsLong());
+    mapping.memory_limit = static_cast<uint64_t>(mapping_it.Get(3).AsLong());
+    mapping.filename_id = interner->InternString(mapping_it.Get(4).AsString());
+    mappings.emplace(mapping_it.Get(0).AsLong(), mapping);
+  }
+  if (!mapping_it.Status().ok()) {
+    PERFETTO_DFATAL_OR_ELOG("Invalid mapping iterator: %s",
+                            mapping_it.Status().message().c_str());
+    return {};
+  }
+  return mappings;
+}
+
 // Builds the |perftools.profiles.Profile| proto.
+// Only reads the shared |locations|, |mappings| and |interner|, so several
+// profiles can be built at the same time.
 class GProfileBuilder {
  public:
   GProfileBuilder(const LocationTracker& locations,
-                  trace_processor::StringPool* interner)
-      : locations_(locations), interner_(interner) {
+                  const std::map<int64_t, Mapping>& mappings,
+                  const trace_processor::StringPool& interner)
+      : locations_(locations), mappings_(mappings), interner_(interner) {
     // The pprof format requires the first entry in the string table to be the
     // empty string.
     int64_t empty_id = ToStringTableId(StringId::Null());
@@ -428,19 +604,18 @@ class GProfileBuilder {
   }
 
   void WriteSampleTypes(
-      const std::vector<std::pair<std::string, std::string>>& sample_types) {
+      const std::vector<std::pair<StringId, StringId>>& sample_types) {
     for (const auto& st : sample_types) {
       auto* sample_type = result_->add_sample_type();
-      sample_type->set_type(
-          ToStringTableId(interner_->InternString(base::StringView(st.first))));
-      sample_type->set_unit(ToStringTableId(
-          interner_->InternString(base::StringView(st.second))));
+      sample_type->set_type(ToStringTableId(st.first));
+      sample_type->set_unit(ToStringTableId(st.second));
     }
   }
 
   bool AddSample(const protozero::PackedVarInt& values, int64_t callstack_id) {
-    const auto& location_ids = locations_.LocationsForCallstack(callstack_id);
-    if (location_ids.empty()) {
+    const std::vector<int64_t>* location_ids =
+        locations_.LocationsForCallstack(callstack_id);
+    if (!location_ids || location_ids->empty()) {
       PERFETTO_DFATAL_OR_ELOG(
           "Failed to find frames for callstack id %" PRIi64 "", callstack_id);
       return false;
@@ -449,7 +624,7 @@ class GProfileBuilder {
     // LocationTracker stores location lists root-first, but the pprof format
     // requires leaf-first.
     protozero::PackedVarInt packed_locs;
-    for (auto it = location_ids.rbegin(); it != location_ids.rend(); ++it)
+    for (auto it = location_ids->rbegin(); it != location_ids->rend(); ++it)
       packed_locs.Append(ToPprofId(*it));
 
     auto* gsample = result_->add_sample();
@@ -457,19 +632,17 @@ class GProfileBuilder {
     gsample->set_location_id(packed_locs);
 
     // Remember the locations s.t. we only serialize the referenced ones.
-    seen_locations_.insert(location_ids.cbegin(), location_ids.cend());
+    seen_locations_.insert(location_ids->cbegin(), location_ids->cend());
     return true;
   }
 
-  std::string CompleteProfile(trace_processor::TraceProcessor* tp) {
+  std::string CompleteProfile() {
     std::set<int64_t> seen_mappings;
     std::set<int64_t> seen_functions;
 
-    if (!WriteLocations(&seen_mappings, &seen_functions))
-      return {};
-    if (!WriteFunctions(seen_functions))
-      return {};
-    if (!WriteMappings(tp, seen_mappings))
+    WriteLocations(&seen_mappings, &seen_functions);
+    WriteFunctions(seen_functions);
+    if (!WriteMappings(seen_mappings))
       return {};
 
     WriteStringTable();
@@ -478,20 +651,10 @@ class GProfileBuilder {
 
  private:
   // Serializes the Profile.Location entries referenced by this profile.
-  bool WriteLocations(std::set<int64_t>* seen_mappings,
+  void WriteLocations(std::set<int64_t>* seen_mappings,
                       std::set<int64_t>* seen_functions) {
-    const std::unordered_map<Location, int64_t>& locations =
-        locations_.AllLocations();
-
-    size_t written_locations = 0;
-    for (const auto& loc_and_id : locations) {
-      const auto& loc = loc_and_id.first;
-      int64_t id = loc_and_id.second;
-
-      if (seen_locations_.find(id) == seen_locations_.end())
-        continue;
-
-      written_locations += 1;
+    for (int64_t id : seen_locations_) {
+      const Location& loc = locations_.GetLocation(id);
       seen_mappings->emplace(loc.mapping_id);
 
       auto* glocation = result_->add_location();
@@ -513,31 +676,12 @@ class GProfileBuilder {
             ToPprofId(loc.single_function_id));
       }
     }
-
-    if (written_locations != seen_locations_.size()) {
-      PERFETTO_DFATAL_OR_ELOG(
-          "Found only %zu/%zu locations during serialization.",
-          written_locations, seen_locations_.size());
-      return false;
-    }
-    return true;
   }
 
   // Serializes the Profile.Function entries referenced by this profile.
-  bool WriteFunctions(const std::set<int64_t>& seen_functions) {
-    const std::unordered_map<Function, int64_t>& functions =
-        locations_.AllFunctions();
-
-    size_t written_functions = 0;
-    for (const auto& func_and_id : functions) {
-      const auto& func = func_and_id.first;
-      int64_t id = func_and_id.second;
-
-      if (seen_functions.find(id) == seen_functions.end())
-        continue;
-
-      written_functions += 1;
-
+  void WriteFunctions(const std::set<int64_t>& seen_functions) {
+    for (int64_t id : seen_functions) {
+      const Function& func = locations_.GetFunction(id);
       auto* gfunction = result_->add_function();
       gfunction->set_id(ToPprofId(id));
       gfunction->set_name(ToStringTableId(func.name_id));
@@ -545,57 +689,32 @@ class GProfileBuilder {
       if (!func.filename_id.is_null())
         gfunction->set_filename(ToStringTableId(func.filename_id));
     }
-
-    if (written_functions != seen_functions.size()) {
-      PERFETTO_DFATAL_OR_ELOG(
-          "Found only %zu/%zu functions during serialization.",
-          written_functions, seen_functions.size());
-      return false;
-    }
-    return true;
   }
 
   // Serializes the Profile.Mapping entries referenced by this profile.
-  bool WriteMappings(trace_processor::TraceProcessor* tp,
-                     const std::set<int64_t>& seen_mappings) {
-    Iterator mapping_it = tp->ExecuteQuery(
-        "SELECT id, exact_offset, start, end, name "
-        "FROM stack_profile_mapping;");
-    size_t mappings_no = 0;
-    while (mapping_it.Next()) {
-      int64_t id = mapping_it.Get(0).AsLong();
-      if (seen_mappings.find(id) == seen_mappings.end())
-        continue;
-      ++mappings_no;
-      auto interned_filename = ToStringTableId(
-          interner_->InternString(mapping_it.Get(4).AsString()));
+  bool WriteMappings(const std::set<int64_t>& seen_mappings) {
+    for (int64_t id : seen_mappings) {
+      auto it = mappings_.find(id);
+      if (it == mappings_.end()) {
+        PERFETTO_DFATAL_OR_ELOG("Missing mappings.");
+        return false;
+      }
+      const Mapping& mapping = it->second;
       auto* gmapping = result_->add_mapping();
       gmapping->set_id(ToPprofId(id));
       // Do not set the build_id here to avoid downstream services
       // trying to symbolize (e.g. b/141735056)
-      gmapping->set_file_offset(
-          static_cast<uint64_t>(mapping_it.Get(1).AsLong()));
-      gmapping->set_memory_start(
-          static_cast<uint64_t>(mapping_it.Get(2).AsLong()));
-      gmapping->set_memory_limit(
-          static_cast<uint64_t>(mapping_it.Get(3).AsLong()));
-      gmapping->set_filename(interned_filename);
-    }
-    if (!mapping_it.Status().ok()) {
-      PERFETTO_DFATAL_OR_ELOG("Invalid mapping iterator: %s",
-                              mapping_it.Status().message().c_str());
-      return false;
-    }
-    if (mappings_no != seen_mappings.size()) {
-      PERFETTO_DFATAL_OR_ELOG("Missing mappings.");
-      return false;
+      gmapping->set_file_offset(mapping.file_offset);
+      gmapping->set_memory_start(mapping.memory_start);
+      gmapping->set_memory_limit(mapping.memory_limit);
+      gmapping->set_filename(ToStringTableId(mapping.filename_id));
     }
     return true;
   }
 
   void WriteStringTable() {
     for (StringId id : string_table_) {
-      trace_processor::NullTermStringView s = interner_->Get(id);
+      trace_processor::NullTermStringView s = interner_.Get(id);
       result_->add_string_table(s.data(), s.size());
     }
   }
@@ -616,9 +735,12 @@ class GProfileBuilder {
   // Contains all locations, lines, functions (in memory):
   const LocationTracker& locations_;
 
-  // String interner, strings referenced by LocationTracker are already
-  // interned. The new internings will come from mappings, and sample types.
-  trace_processor::StringPool* interner_;
+  // All the mappings, by sqlite row id.
+  const std::map<int64_t, Mapping>& mappings_;
+
+  // String interner. All the strings referenced by this builder, including
+  // the sample types, are already interned.
+  const trace_processor::StringPool& interner_;
 
   // The profile format uses the repeated string_table field's index as an
   // implicit id, so these structures remap the interned strings into sequential
@@ -635,6 +757,150 @@ class GProfileBuilder {
   std::set<int64_t> seen_locations_;
 };
 
+// The samples of one profile, read from the trace processor.
+struct ProfileSamples {
+  uint64_t pid = 0;
+  std::string heap_name;
+  // One entry per sample: the callsite, and |num_values| values.
+  std::vector<int64_t> callstack_ids;
+  std::vector<int64_t> values;
+  size_t num_values = 0;
+};
+
+std::string BuildProfile(
+    const ProfileSamples& samples,
+    const std::vector<std::pair<StringId, StringId>>& sample_types,
+    const LocationTracker& locations,
+    const std::map<int64_t, Mapping>& mappings,
+    const trace_processor::StringPool& interner) {
+  PERFETTO_DCHECK(samples.num_values == sample_types.size());
+  GProfileBuilder builder(locations, mappings, interner);
+  builder.WriteSampleTypes(sample_types);
+  for (size_t i = 0; i < samples.callstack_ids.size(); ++i) {
+    protozero::PackedVarInt sample_values;
+    for (size_t v = 0; v < samples.num_values; ++v)
+      sample_values.Append(samples.values[i * samples.num_values + v]);
+    if (!builder.AddSample(sample_values, samples.callstack_ids[i]))
+      return {};
+  }
+  return builder.CompleteProfile();
+}
+
+// Serializes profiles as they are produced, on worker threads. The samples
+// of the pending profiles are kept in a bounded queue, and freed as soon as
+// they are serialized: a trace with many heap dumps only holds a few
+// snapshots in memory at a time.
+class ProfileSerializer {
+ public:
+  ProfileSerializer(
+      const std::vector<std::pair<StringId, StringId>>& sample_types,
+      const LocationTracker& locations,
+      const std::map<int64_t, Mapping>& mappings,
+      const trace_processor::StringPool& interner)
+      : sample_types_(sample_types),
+        locations_(locations),
+        mappings_(mappings),
+        interner_(interner) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+    max_threads_ = std::max(1u, std::thread::hardware_concurrency());
+    max_queued_ = 2 * max_threads_;
+#endif
+  }
+
+  ~ProfileSerializer() { Finish(); }
+
+  // Queues |samples| for serialization. Blocks while the queue is full.
+  void Add(ProfileSamples samples) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+    // The wasm build has no threads.
+    results_.push_back(BuildProfile(samples, sample_types_, locations_,
+                                    mappings_, interner_));
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_not_full_.wait(lock, [this] { return queue_.size() < max_queued_; });
+    queue_.emplace_back(results_.size(), std::move(samples));
+    results_.emplace_back();
+    if (threads_.size() < max_threads_)
+      threads_.emplace_back(&ProfileSerializer::SerializeQueued, this);
+    queue_not_empty_.notify_one();
+#endif
+  }
+
+  // Waits for all the queued profiles to be serialized. Returns them in the
+  // order they were added.
+  std::vector<std::string> Finish() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_ = true;
+    }
+    queue_not_empty_.notify_all();
+    for (std::thread& thread : threads_)
+      thread.join();
+    threads_.clear();
+#endif
+    return std::move(results_);
+  }
+
+ private:
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  // Body of the worker threads.
+  void SerializeQueued() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      queue_not_empty_.wait(lock,
+                            [this] { return !queue_.empty() || finished_; });
+      if (queue_.empty())
+        return;
+      size_t index = queue_.front().first;
+      ProfileSamples samples = std::move(queue_.front().second);
+      queue_.pop_front();
+      queue_not_full_.notify_one();
+
+      lock.unlock();
+      std::string serialized = BuildProfile(samples, sample_types_, locations_,
+                                            mappings_, interner_);
+      // Free the snapshot before waiting for the lock.
+      samples = ProfileSamples();
+      lock.lock();
+      results_[index] = std::move(serialized);
+    }
+  }
+#endif
+
+  const std::vector<std::pair<StringId, StringId>>& sample_types_;
+  const LocationTracker& locations_;
+  const std::map<int64_t, Mapping>& mappings_;
+  const trace_processor::StringPool& interner_;
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  size_t max_threads_ = 1;
+  size_t max_queued_ = 2;
+
+  std::mutex mutex_;
+  std::condition_variable queue_not_full_;
+  std::condition_variable queue_not_empty_;
+  // The profiles waiting for a worker, with their index in |results_|.
+  std::deque<std::pair<size_t, ProfileSamples>> queue_;
+  bool finished_ = false;
+  std::vector<std::thread> threads_;
+#endif
+
+  std::vector<std::string> results_;
+};
+
+// Interns the names and units of the sample types.
+std::vector<std::pair<StringId, StringId>> InternSampleTypes(
+    const std::vector<std::pair<std::string, std::string>>& sample_types,
+    trace_processor::StringPool* interner) {
+  std::vector<std::pair<StringId, StringId>> result;
+  for (const auto& st : sample_types) {
+    result.emplace_back(interner->InternString(base::StringView(st.first)),
+                        interner->InternString(base::StringView(st.second)));
+  }
+  return result;
+}
+
 namespace heap_profile {
 struct View {
   const char* type;
@@ -688,67 +954,95 @@ static bool VerifyPIDStats(trace_processor::TraceProcessor* tp, uint64_t pid) {
   return success;
 }
 
-static std::vector<Iterator> BuildViewIterators(
+// Heap profiles are cumulative: the profile of (upid, heap_name, ts) is
+// made of all the allocations of that heap of the process up to ts. They
+// are all built with one scan of the allocations, in timestamp order,
+// snapshotting the totals of each callsite at every dump. Each snapshot is
+// passed to |on_profile| as soon as it is complete. Returns false if the scan
+// failed.
+static bool GetHeapProfiles(
     trace_processor::TraceProcessor* tp,
-    uint64_t upid,
-    uint64_t ts,
-    const char* heap_name) {
-  std::vector<Iterator> view_its;
-  for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
-    const View& v = kViews[i];
-    std::string query = "SELECT hpa.callsite_id ";
-    query +=
-        ", " + std::string(v.aggregator) + " FROM heap_profile_allocation hpa ";
-    // TODO(fmayer): Figure out where negative callsite_id comes from.
-    query += "WHERE hpa.callsite_id >= 0 ";
-    query += "AND hpa.upid = " + std::to_string(upid) + " ";
-    query += "AND hpa.ts <= " + std::to_string(ts) + " ";
-    query += "AND hpa.heap_name = '" + std::string(heap_name) + "' ";
-    if (v.filter)
-      query += "AND " + std::string(v.filter) + " ";
-    query += "GROUP BY hpa.callsite_id;";
-    view_its.emplace_back(tp->ExecuteQuery(query));
-  }
-  return view_its;
-}
-
-static bool WriteAllocations(GProfileBuilder* builder,
-                             std::vector<Iterator>* view_its) {
-  for (;;) {
-    bool all_next = true;
-    bool any_next = false;
-    for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
-      Iterator& it = (*view_its)[i];
-      bool next = it.Next();
-      if (!it.Status().ok()) {
-        PERFETTO_DFATAL_OR_ELOG("Invalid view iterator: %s",
-                                it.Status().message().c_str());
-        return false;
-      }
-      all_next = all_next && next;
-      any_next = any_next || next;
+    uint64_t target_pid,
+    const std::vector<uint64_t>& target_timestamps,
+    const std::function<void(ProfileSamples)>& on_profile) {
+  Iterator it = tp->ExecuteQuery(
+      "select hpa.upid, p.pid, hpa.heap_name, hpa.ts, hpa.callsite_id, "
+      "hpa.size, hpa.count "
+      "from heap_profile_allocation hpa, process p where p.upid = hpa.upid "
+      "order by hpa.upid, hpa.heap_name, hpa.ts;");
+
+  // Totals of each view, by callsite, of the current heap.
+  std::map<int64_t, std::array<int64_t, base::ArraySize(kViews)>> totals;
+  bool has_profile = false;
+  int64_t upid = 0;
+  uint64_t pid = 0;
+  std::string heap_name;
+  int64_t ts = 0;
+
+  auto maybe_add_profile = [&] {
+    if (!has_profile)
+      return;
+    if ((target_pid > 0 && pid != target_pid) ||
+        (!target_timestamps.empty() &&
+         std::find(target_timestamps.begin(), target_timestamps.end(),
+                   static_cast<uint64_t>(ts)) == target_timestamps.end())) {
+      return;
     }
-
-    if (!all_next) {
-      PERFETTO_CHECK(!any_next);
-      break;
+    ProfileSamples profile;
+    profile.pid = pid;
+    profile.heap_name = heap_name;
+    profile.num_values = base::ArraySize(kViews);
+    profile.callstack_ids.reserve(totals.size());
+    profile.values.reserve(totals.size() * profile.num_values);
+    for (const auto& callsite_and_totals : totals) {
+      profile.callstack_ids.push_back(callsite_and_totals.first);
+      profile.values.insert(profile.values.end(),
+                            callsite_and_totals.second.begin(),
+                            callsite_and_totals.second.end());
     }
+    on_profile(std::move(profile));
+  };
 
-    protozero::PackedVarInt sample_values;
-    int64_t callstack_id = -1;
-    for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
-      if (i == 0) {
-        callstack_id = (*view_its)[i].Get(0).AsLong();
-      } else if (callstack_id != (*view_its)[i].Get(0).AsLong()) {
-        PERFETTO_DFATAL_OR_ELOG("Wrong callstack.");
-        return false;
+  while (it.Next()) {
+    int64_t row_upid = it.Get(0).AsLong();
+    const char* row_heap_name = it.Get(2).AsString();
+    int64_t row_ts = it.Get(3).AsLong();
+    bool same_heap =
+        has_profile && row_upid == upid && heap_name == row_heap_name;
+    if (!same_heap || row_ts != ts) {
+      maybe_add_profile();
+      if (!same_heap) {
+        totals.clear();
+        upid = row_upid;
+        pid = static_cast<uint64_t>(it.Get(1).AsLong());
+        heap_name = row_heap_name;
       }
-      sample_values.Append((*view_its)[i].Get(1).AsLong());
+      ts = row_ts;
+      has_profile = true;
     }
 
-    if (!builder->AddSample(sample_values, callstack_id))
-      return false;
+    // TODO(fmayer): Figure out where negative callsite_id comes from.
+    int64_t callsite_id = it.Get(4).AsLong();
+    if (callsite_id < 0)
+      continue;
+    int64_t size = it.Get(5).AsLong();
+    int64_t count = it.Get(6).AsLong();
+    // Same order as kViews.
+    auto& callsite_totals = totals[callsite_id];
+    if (size >= 0) {
+      callsite_totals[0] += count;
+      callsite_totals[2] += size;
+    }
+    callsite_totals[1] += count;
+    callsite_totals[3] += size;
+  }
+  // The last snapshot is incomplete if the scan failed.
+  if (!it.Status().ok()) {
+    PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
+                            it.Status().message().c_str());
+    return false;
   }
+  maybe_add_profile();
   return true;
 }
 
@@ -758,90 +1052,83 @@ static bool TraceToHeapPprof(trace_processor::TraceProcessor* tp,
                              uint64_t target_pid,
                              const std::vector<uint64_t>& target_timestamps) {
   trace_processor::StringPool interner;
-  LocationTracker locations =
-      PreprocessLocations(tp, &interner, annotate_frames);
+  LocationTracker locations = annotate_frames
+                                  ? PreprocessAnnotatedLocations(tp, &interner)
+                                  : PreprocessLocations(tp, &interner);
+  std::map<int64_t, Mapping> mappings = PreprocessMappings(tp, &interner);
 
-  bool any_fail = false;
-  Iterator it = tp->ExecuteQuery(
-      "select distinct hpa.upid, hpa.ts, p.pid, hpa.heap_name "
-      "from heap_profile_allocation hpa, "
-      "process p where p.upid = hpa.upid;");
-  while (it.Next()) {
-    GProfileBuilder builder(locations, &interner);
-    uint64_t upid = static_cast<uint64_t>(it.Get(0).AsLong());
-    uint64_t ts = static_cast<uint64_t>(it.Get(1).AsLong());
-    uint64_t profile_pid = static_cast<uint64_t>(it.Get(2).AsLong());
-    const char* heap_name = it.Get(3).AsString();
-    if ((target_pid > 0 && profile_pid != target_pid) ||
-        (!target_timestamps.empty() &&
-         std::find(target_timestamps.begin(), target_timestamps.end(), ts) ==
-             target_timestamps.end())) {
-      continue;
-    }
+  std::vector<std::pair<std::string, std::string>> sample_types;
+  for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
+    sample_types.emplace_back(std::string(kViews[i].type),
+                              std::string(kViews[i].unit));
+  }
+  std::vector<std::pair<StringId, StringId>> sample_type_ids =
+      InternSampleTypes(sample_types, &interner);
+
+  // The snapshots are serialized while the scan goes on. Only their pid and
+  // heap name are kept here.
+  ProfileSerializer serializer(sample_type_ids, locations, mappings, interner);
+  std::vector<std::pair<uint64_t, std::string>> profiles;
+  bool scan_ok = GetHeapProfiles(
+      tp, target_pid, target_timestamps, [&](ProfileSamples profile) {
+        profiles.emplace_back(profile.pid, profile.heap_name);
+        serializer.Add(std::move(profile));
+      });
+  std::vector<std::string> serialized = serializer.Finish();
 
-    if (!VerifyPIDStats(tp, profile_pid))
+  bool any_fail = false;
+  std::set<uint64_t> verified_pids;
+  for (const auto& pid_and_heap_name : profiles) {
+    if (verified_pids.insert(pid_and_heap_name.first).second &&
+        !VerifyPIDStats(tp, pid_and_heap_name.first)) {
       any_fail = true;
-
-    std::vector<std::pair<std::string, std::string>> sample_types;
-    for (size_t i = 0; i < base::ArraySize(kViews); ++i) {
-      sample_types.emplace_back(std::string(kViews[i].type),
-                                std::string(kViews[i].unit));
     }
-    builder.WriteSampleTypes(sample_types);
-
-    std::vector<Iterator> view_its =
-        BuildViewIterators(tp, upid, ts, heap_name);
-    std::string profile_proto;
-    if (WriteAllocations(&builder, &view_its)) {
-      profile_proto = builder.CompleteProfile(tp);
-    }
-    output->emplace_back(
-        SerializedProfile{ProfileType::kHeapProfile, profile_pid,
-                          std::move(profile_proto), heap_name});
   }
 
-  if (!it.Status().ok()) {
-    PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
-                            it.Status().message().c_str());
-    return false;
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    output->emplace_back(SerializedProfile{
+        ProfileType::kHeapProfile, profiles[i].first, std::move(serialized[i]),
+        std::move(profiles[i].second)});
   }
+
   if (any_fail) {
     PERFETTO_ELOG(
         "One or more of your profiles had an issue. Please consult "
         "https://perfetto.dev/docs/data-sources/"
         "native-heap-profiler#troubleshooting");
   }
-  return true;
+  // The snapshots completed before a failed scan are still emitted.
+  return scan_ok;
 }
 }  // namespace heap_profile
 
 namespace perf_profile {
-struct ProcessInfo {
-  uint64_t pid;
-  std::vector<uint64_t> utids;
-};
-
-// Returns a map of upid -> {pid, utids[]} for sampled processes.
-static std::map<uint64_t, ProcessInfo> GetProcessMap(
-    trace_processor::TraceProcessor* tp) {
+// Collects the samples of each sampled process, by upid, with one scan of the
+// samples. Returns false if the scan failed.
+static bool GetPerfProfiles(trace_processor::TraceProcessor* tp,
+                            uint64_t target_pid,
+                            std::map<uint64_t, ProfileSamples>* profiles) {
   Iterator it = tp->ExecuteQuery(
-      "select distinct process.upid, process.pid, thread.utid from perf_sample "
-      "join thread using (utid) join process using (upid) where callsite_id is "
-      "not null order by process.upid asc");
-  std::map<uint64_t, ProcessInfo> process_map;
+      "select process.upid, process.pid, perf_sample.callsite_id "
+      "from perf_sample join thread using (utid) join process using (upid) "
+      "where callsite_id is not null order by ts asc");
   while (it.Next()) {
-    uint64_t upid = static_cast<uint64_t>(it.Get(0).AsLong());
     uint64_t pid = static_cast<uint64_t>(it.Get(1).AsLong());
-    uint64_t utid = static_cast<uint64_t>(it.Get(2).AsLong());
-    process_map[upid].pid = pid;
-    process_map[upid].utids.push_back(utid);
+    if (target_pid != 0 && pid != target_pid)
+      continue;
+    ProfileSamples& profile =
+        (*profiles)[static_cast<uint64_t>(it.Get(0).AsLong())];
+    profile.pid = pid;
+    profile.num_values = 1;
+    profile.callstack_ids.push_back(it.Get(2).AsLong());
+    profile.values.push_back(1);
   }
   if (!it.Status().ok()) {
-    PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
-                            it.Status().message().c_str());
-    return {};
+    PERFETTO_DFATAL_OR_ELOG("Failed to iterate over samples: %s",
+                            it.Status().c_message());
+    return false;
   }
-  return process_map;
+  return true;
 }
 
 static void LogTracePerfEventIssues(trace_processor::TraceProcessor* tp) {
@@ -898,43 +1185,31 @@ static bool TraceToPerfPprof(trace_processor::TraceProcessor* tp,
                              bool annotate_frames,
                              uint64_t target_pid) {
   trace_processor::StringPool interner;
-  LocationTracker locations =
-      PreprocessLocations(tp, &interner, annotate_frames);
+  LocationTracker locations = annotate_frames
+                                  ? PreprocessAnnotatedLocations(tp, &interner)
+                                  : PreprocessLocations(tp, &interner);
+  std::map<int64_t, Mapping> mappings = PreprocessMappings(tp, &interner);
+  std::vector<std::pair<StringId, StringId>> sample_type_ids =
+      InternSampleTypes({{"samples", "count"}}, &interner);
 
   LogTracePerfEventIssues(tp);
 
   // Aggregate samples by upid when building profiles.
-  std::map<uint64_t, ProcessInfo> process_map = GetProcessMap(tp);
-  for (const auto& p : process_map) {
-    const ProcessInfo& process = p.second;
-
-    if (target_pid != 0 && process.pid != target_pid)
-      continue;
-
-    GProfileBuilder builder(locations, &interner);
-    builder.WriteSampleTypes({{"samples", "count"}});
-
-    std::string query = "select callsite_id from perf_sample where utid in (" +
-                        AsCsvString(process.utids) +
-                        ") and callsite_id is not null order by ts asc;";
-
-    protozero::PackedVarInt single_count_value;
-    single_count_value.Append(1);
+  std::map<uint64_t, ProfileSamples> profiles;
+  if (!GetPerfProfiles(tp, target_pid, &profiles))
+    return false;
 
-    Iterator it = tp->ExecuteQuery(query);
-    while (it.Next()) {
-      int64_t callsite_id = static_cast<int64_t>(it.Get(0).AsLong());
-      builder.AddSample(single_count_value, callsite_id);
-    }
-    if (!it.Status().ok()) {
-      PERFETTO_DFATAL_OR_ELOG("Failed to iterate over samples: %s",
-                              it.Status().c_message());
-      return false;
-    }
+  ProfileSerializer serializer(sample_type_ids, locations, mappings, interner);
+  std::vector<uint64_t> pids;
+  for (auto& upid_and_profile : profiles) {
+    pids.push_back(upid_and_profile.second.pid);
+    serializer.Add(std::move(upid_and_profile.second));
+  }
 
-    std::string profile_proto = builder.CompleteProfile(tp);
-    output->emplace_back(SerializedProfile{
-        ProfileType::kPerfProfile, process.pid, std::move(profile_proto), ""});
+  std::vector<std::string> serialized = serializer.Finish();
+  for (size_t i = 0; i < pids.size(); ++i) {
+    output->emplace_back(SerializedProfile{ProfileType::kPerfProfile, pids[i],
+                                           std::move(serialized[i]), ""});
   }
   return true;
 }
@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/profiling/pprof_builder.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/clock_snapshot.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/third_party/pprof/profile.pbzero.h"
+
+namespace perfetto {
+namespace trace_to_text {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+using trace_processor::Iterator;
+namespace pprof = third_party::perftools::profiles::pbzero;
+
+// Cumulative allocations of one callstack, as written in a heapprofd dump.
+struct FixtureSample {
+  uint64_t callstack_id;
+  uint64_t self_allocated;
+  uint64_t alloc_count;
+  uint64_t self_freed;
+  uint64_t free_count;
+};
+
+struct FixtureDump {
+  uint32_t sequence_id;
+  uint64_t pid;
+  const char* heap_name;
+  uint64_t ts;
+  std::vector<FixtureSample> samples;
+};
+
+// A perf sample of one callstack.
+struct FixturePerfSample {
+  uint64_t ts;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t callstack_id;
+};
+
+const char* const kFixtureStrings[] = {"main",    "Foo",       "Bar",
+                                       "malloc",  "libc.so",   "libfoo.so",
+                                       "build-id"};
+
+// Callstacks of the fixture, root first:
+//   1: main -> Foo -> malloc
+//   2: main -> Bar -> malloc
+//   3: main -> Foo -> Bar -> malloc
+// The string ids are the 1-based indices in |kFixtureStrings|.
+template <typename Message>
+void AddMappingsFramesAndCallstacks(Message* profile) {
+  auto* libc = profile->add_mappings();
+  libc->set_iid(1);
+  libc->set_build_id(7);
+  libc->set_start(0x1000);
+  libc->set_end(0x2000);
+  libc->add_path_string_ids(5);
+  auto* libfoo = profile->add_mappings();
+  libfoo->set_iid(2);
+  libfoo->set_build_id(7);
+  libfoo->set_exact_offset(0x1000);
+  libfoo->set_start(0x7000);
+  libfoo->set_end(0x9000);
+  libfoo->add_path_string_ids(6);
+
+  struct {
+    uint64_t function_name_id;
+    uint64_t mapping_id;
+    uint64_t rel_pc;
+  } const kFrames[] = {{1, 2, 0x100}, {2, 2, 0x200}, {3, 2, 0x300},
+                       {4, 1, 0x10}};
+  for (size_t i = 0; i < base::ArraySize(kFrames); ++i) {
+    auto* frame = profile->add_frames();
+    frame->set_iid(i + 1);
+    frame->set_function_name_id(kFrames[i].function_name_id);
+    frame->set_mapping_id(kFrames[i].mapping_id);
+    frame->set_rel_pc(kFrames[i].rel_pc);
+  }
+
+  const std::vector<uint64_t> kCallstacks[] = {
+      {1, 2, 4}, {1, 3, 4}, {1, 2, 3, 4}};
+  for (size_t i = 0; i < base::ArraySize(kCallstacks); ++i) {
+    auto* callstack = profile->add_callstacks();
+    callstack->set_iid(i + 1);
+    for (uint64_t frame_id : kCallstacks[i])
+      callstack->add_frame_ids(frame_id);
+  }
+}
+
+void SetFixtureString(protos::pbzero::InternedString* str, size_t i) {
+  str->set_iid(i + 1);
+  str->set_str(kFixtureStrings[i]);
+}
+
+void AddInternedData(protos::pbzero::ProfilePacket* profile) {
+  for (size_t i = 0; i < base::ArraySize(kFixtureStrings); ++i)
+    SetFixtureString(profile->add_strings(), i);
+  AddMappingsFramesAndCallstacks(profile);
+}
+
+// Perf samples intern their strings in separate tables, which all get the
+// same ids here.
+void AddInternedData(protos::pbzero::InternedData* interned) {
+  for (size_t i = 0; i < base::ArraySize(kFixtureStrings); ++i) {
+    SetFixtureString(interned->add_function_names(), i);
+    SetFixtureString(interned->add_build_ids(), i);
+    SetFixtureString(interned->add_mapping_paths(), i);
+  }
+  AddMappingsFramesAndCallstacks(interned);
+}
+
+std::string FixtureTrace(const std::vector<FixtureDump>& dumps,
+                         const std::vector<FixturePerfSample>& perf_samples) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  {
+    auto* clock_snapshot = trace->add_packet()->set_clock_snapshot();
+    auto* clock_boot = clock_snapshot->add_clocks();
+    clock_boot->set_clock_id(protos::pbzero::BUILTIN_CLOCK_BOOTTIME);
+    clock_boot->set_timestamp(0);
+    auto* clock_coarse = clock_snapshot->add_clocks();
+    clock_coarse->set_clock_id(protos::pbzero::BUILTIN_CLOCK_MONOTONIC_COARSE);
+    clock_coarse->set_timestamp(0);
+  }
+
+  std::map<uint32_t, uint64_t> next_index;
+  for (const FixtureDump& dump : dumps) {
+    auto* packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(dump.sequence_id);
+    packet->set_timestamp(dump.ts);
+    uint64_t index = next_index[dump.sequence_id]++;
+    if (index == 0)
+      packet->set_incremental_state_cleared(true);
+
+    auto* profile = packet->set_profile_packet();
+    profile->set_index(index);
+    AddInternedData(profile);
+    auto* process_dump = profile->add_process_dumps();
+    process_dump->set_pid(dump.pid);
+    process_dump->set_heap_name(dump.heap_name);
+    process_dump->set_timestamp(dump.ts);
+    for (const FixtureSample& s : dump.samples) {
+      auto* sample = process_dump->add_samples();
+      sample->set_callstack_id(s.callstack_id);
+      sample->set_self_allocated(s.self_allocated);
+      sample->set_alloc_count(s.alloc_count);
+      sample->set_self_freed(s.self_freed);
+      sample->set_free_count(s.free_count);
+    }
+  }
+
+  const uint32_t kPerfSequenceId = 4;
+  for (size_t i = 0; i < perf_samples.size(); ++i) {
+    auto* packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(kPerfSequenceId);
+    packet->set_timestamp(perf_samples[i].ts);
+    if (i == 0) {
+      packet->set_incremental_state_cleared(true);
+      AddInternedData(packet->set_interned_data());
+    }
+    auto* sample = packet->set_perf_sample();
+    sample->set_cpu(0);
+    sample->set_pid(perf_samples[i].pid);
+    sample->set_tid(perf_samples[i].tid);
+    sample->set_callstack_iid(perf_samples[i].callstack_id);
+  }
+  return trace.SerializeAsString();
+}
+
+std::vector<FixtureDump> FixtureDumps() {
+  std::vector<FixtureDump> dumps = {
+      {1, 10, "malloc", 100, {{1, 100, 1, 0, 0}, {2, 200, 2, 50, 1}}},
+      {1,
+       10,
+       "malloc",
+       200,
+       {{1, 300, 3, 100, 1}, {2, 200, 2, 200, 2}, {3, 64, 1, 0, 0}}},
+      {2, 20, "malloc", 150, {{3, 1000, 10, 500, 5}}},
+      {2, 20, "custom", 150, {{1, 8, 1, 0, 0}}},
+  };
+  // Many more dumps than worker threads, so that the snapshots wait for
+  // the serialization to catch up.
+  for (uint64_t i = 0; i < 40; ++i) {
+    FixtureDump dump{3, 30, "malloc", 1000 + i * 10, {}};
+    for (uint64_t cs = 1; cs <= 3; ++cs)
+      dump.samples.push_back({cs, 16 * (i + 1) * cs, i + 1, 8 * i * cs, i});
+    dumps.push_back(dump);
+  }
+  return dumps;
+}
+
+// After all the dumps, so that the processes keep their order.
+std::vector<FixturePerfSample> FixturePerfSamples() {
+  return {
+      {2000, 10, 10, 1}, {2010, 10, 11, 1}, {2020, 20, 20, 3},
+      {2030, 10, 10, 2}, {2040, 20, 21, 3}, {2050, 20, 20, 1},
+  };
+}
+
+std::string MappingToString(const std::string& name,
+                            uint64_t start,
+                            uint64_t limit,
+                            uint64_t offset) {
+  return name + " " + base::Uint64ToHexString(start) + "-" +
+         base::Uint64ToHexString(limit) + " @" +
+         base::Uint64ToHexString(offset);
+}
+
+// A profile with the ids resolved, so that profiles that only differ in the
+// choice of ids compare equal.
+struct ProfileContents {
+  std::vector<std::string> sample_types;
+  // "leaf location, ..., root location: value, ...", sorted.
+  std::vector<std::string> samples;
+  // "function@mapping name", sorted.
+  std::vector<std::string> locations;
+  std::vector<std::string> functions;
+  std::vector<std::string> mappings;
+};
+
+// Decodes |serialized|, and checks that its tables only contain (all) the
+// entries the samples reference.
+ProfileContents DecodeProfile(const std::string& serialized) {
+  ProfileContents contents;
+  pprof::Profile::Decoder profile(serialized);
+
+  std::vector<std::string> strings;
+  for (auto it = profile.string_table(); it; ++it)
+    strings.push_back(it->as_std_string());
+  EXPECT_FALSE(strings.empty());
+  if (strings.empty())
+    return contents;
+  EXPECT_EQ(strings[0], "");
+  auto get_string = [&strings](int64_t id) {
+    EXPECT_GE(id, 0);
+    EXPECT_LT(static_cast<size_t>(id), strings.size());
+    return strings[static_cast<size_t>(id)];
+  };
+
+  for (auto it = profile.sample_type(); it; ++it) {
+    pprof::ValueType::Decoder sample_type(*it);
+    contents.sample_types.push_back(get_string(sample_type.type()) + "/" +
+                                    get_string(sample_type.unit()));
+  }
+
+  std::map<uint64_t, std::string> mappings;
+  for (auto it = profile.mapping(); it; ++it) {
+    pprof::Mapping::Decoder mapping(*it);
+    EXPECT_NE(mapping.id(), 0u);
+    bool inserted =
+        mappings
+            .emplace(mapping.id(),
+                     MappingToString(get_string(mapping.filename()),
+                                     mapping.memory_start(),
+                                     mapping.memory_limit(),
+                                     mapping.file_offset()))
+            .second;
+    EXPECT_TRUE(inserted) << "duplicate mapping " << mapping.id();
+  }
+
+  std::map<uint64_t, std::string> functions;
+  for (auto it = profile.function(); it; ++it) {
+    pprof::Function::Decoder function(*it);
+    EXPECT_NE(function.id(), 0u);
+    bool inserted =
+        functions.emplace(function.id(), get_string(function.name())).second;
+    EXPECT_TRUE(inserted) << "duplicate function " << function.id();
+  }
+
+  std::set<uint64_t> seen_mappings;
+  std::set<uint64_t> seen_functions;
+  std::map<uint64_t, std::string> locations;
+  for (auto it = profile.location(); it; ++it) {
+    pprof::Location::Decoder location(*it);
+    EXPECT_NE(location.id(), 0u);
+    EXPECT_EQ(mappings.count(location.mapping_id()), 1u);
+    seen_mappings.insert(location.mapping_id());
+    std::string location_str;
+    for (auto line_it = location.line(); line_it; ++line_it) {
+      pprof::Line::Decoder line(*line_it);
+      EXPECT_EQ(functions.count(line.function_id()), 1u);
+      seen_functions.insert(line.function_id());
+      if (!location_str.empty())
+        location_str += ";";
+      location_str += functions[line.function_id()];
+    }
+    location_str += "@" + mappings[location.mapping_id()];
+    bool inserted = locations.emplace(location.id(), location_str).second;
+    EXPECT_TRUE(inserted) << "duplicate location " << location.id();
+  }
+
+  std::set<uint64_t> seen_locations;
+  for (auto it = profile.sample(); it; ++it) {
+    pprof::Sample::Decoder sample(*it);
+    bool parse_error = false;
+    std::string sample_str;
+    for (auto loc_it = sample.location_id(&parse_error); loc_it; ++loc_it) {
+      EXPECT_EQ(locations.count(*loc_it), 1u);
+      seen_locations.insert(*loc_it);
+      if (!sample_str.empty())
+        sample_str += ", ";
+      sample_str += locations[*loc_it];
+    }
+    sample_str += ":";
+    for (auto value_it = sample.value(&parse_error); value_it; ++value_it)
+      sample_str += " " + std::to_string(*value_it);
+    EXPECT_FALSE(parse_error);
+    contents.samples.push_back(sample_str);
+  }
+
+  EXPECT_EQ(seen_locations.size(), locations.size());
+  EXPECT_EQ(seen_functions.size(), functions.size());
+  EXPECT_EQ(seen_mappings.size(), mappings.size());
+  for (const auto& id_and_location : locations)
+    contents.locations.push_back(id_and_location.second);
+  for (const auto& id_and_function : functions)
+    contents.functions.push_back(id_and_function.second);
+  for (const auto& id_and_mapping : mappings)
+    contents.mappings.push_back(id_and_mapping.second);
+
+  std::sort(contents.samples.begin(), contents.samples.end());
+  std::sort(contents.locations.begin(), contents.locations.end());
+  std::sort(contents.functions.begin(), contents.functions.end());
+  std::sort(contents.mappings.begin(), contents.mappings.end());
+  return contents;
+}
+
+struct ExpectedProfile {
+  uint64_t pid;
+  std::string heap_name;
+  ProfileContents contents;
+};
+
+// Returns the profiles traceconv used to emit, computed with the queries it
+// used to run for each dump: one GROUP BY query per view over the
+// allocations up to the dump, and the frames of each callsite.
+std::vector<ExpectedProfile> PerDumpQueryProfiles(
+    trace_processor::TraceProcessor* tp) {
+  struct Frame {
+    std::string location;
+    std::string mapping;
+    std::string function;
+  };
+  std::map<int64_t, Frame> frames;
+  Iterator frame_it = tp->ExecuteQuery(
+      "select f.id, f.name, m.name, m.start, m.end, m.exact_offset "
+      "from stack_profile_frame f "
+      "join stack_profile_mapping m on f.mapping = m.id;");
+  while (frame_it.Next()) {
+    Frame frame;
+    frame.function = frame_it.Get(1).AsString();
+    frame.mapping = MappingToString(
+        frame_it.Get(2).AsString(),
+        static_cast<uint64_t>(frame_it.Get(3).AsLong()),
+        static_cast<uint64_t>(frame_it.Get(4).AsLong()),
+        static_cast<uint64_t>(frame_it.Get(5).AsLong()));
+    frame.location = frame.function + "@" + frame.mapping;
+    frames[frame_it.Get(0).AsLong()] = frame;
+  }
+  EXPECT_TRUE(frame_it.Status().ok());
+
+  std::map<int64_t, std::pair<int64_t, int64_t>> callsites;
+  Iterator cs_it = tp->ExecuteQuery(
+      "select id, coalesce(parent_id, -1), frame_id "
+      "from stack_profile_callsite;");
+  while (cs_it.Next()) {
+    callsites[cs_it.Get(0).AsLong()] = {cs_it.Get(1).AsLong(),
+                                        cs_it.Get(2).AsLong()};
+  }
+  EXPECT_TRUE(cs_it.Status().ok());
+
+  const char* const kViews[][3] = {
+      {"alloc_objects/count", "sum(count)", "AND size >= 0 "},
+      {"objects/count", "SUM(count)", ""},
+      {"alloc_space/bytes", "SUM(size)", "AND size >= 0 "},
+      {"space/bytes", "SUM(size)", ""},
+  };
+
+  std::vector<ExpectedProfile> profiles;
+  Iterator dump_it = tp->ExecuteQuery(
+      "select distinct hpa.upid, hpa.ts, p.pid, hpa.heap_name "
+      "from heap_profile_allocation hpa, process p where p.upid = hpa.upid "
+      "order by hpa.upid, hpa.heap_name, hpa.ts;");
+  while (dump_it.Next()) {
+    ExpectedProfile profile;
+    profile.pid = static_cast<uint64_t>(dump_it.Get(2).AsLong());
+    profile.heap_name = dump_it.Get(3).AsString();
+    ProfileContents& contents = profile.contents;
+
+    std::map<int64_t, std::vector<int64_t>> values;
+    for (const auto& view : kViews) {
+      contents.sample_types.push_back(view[0]);
+      std::string query =
+          std::string("SELECT callsite_id, ") + view[1] +
+          " FROM heap_profile_allocation WHERE callsite_id >= 0 "
+          "AND upid = " +
+          std::to_string(dump_it.Get(0).AsLong()) +
+          " AND ts <= " + std::to_string(dump_it.Get(1).AsLong()) +
+          " AND heap_name = '" + profile.heap_name + "' " + view[2] +
+          "GROUP BY callsite_id;";
+      Iterator it = tp->ExecuteQuery(query);
+      while (it.Next())
+        values[it.Get(0).AsLong()].push_back(it.Get(1).AsLong());
+      EXPECT_TRUE(it.Status().ok());
+    }
+
+    std::set<std::string> locations;
+    std::set<std::string> functions;
+    std::set<std::string> mappings;
+    for (const auto& callsite_and_values : values) {
+      std::string sample_str;
+      for (int64_t cs = callsite_and_values.first; cs >= 0;
+           cs = callsites[cs].first) {
+        const Frame& frame = frames[callsites[cs].second];
+        locations.insert(frame.location);
+        functions.insert(frame.function);
+        mappings.insert(frame.mapping);
+        if (!sample_str.empty())
+          sample_str += ", ";
+        sample_str += frame.location;
+      }
+      sample_str += ":";
+      for (int64_t value : callsite_and_values.second)
+        sample_str += " " + std::to_string(value);
+      contents.samples.push_back(sample_str);
+    }
+    std::sort(contents.samples.begin(), contents.samples.end());
+    contents.locations.assign(locations.begin(), locations.end());
+    contents.functions.assign(functions.begin(), functions.end());
+    contents.mappings.assign(mappings.begin(), mappings.end());
+    profiles.push_back(std::move(profile));
+  }
+  EXPECT_TRUE(dump_it.Status().ok());
+  return profiles;
+}
+
+class PprofBuilderTest : public ::testing::Test {
+ protected:
+  PprofBuilderTest()
+      : tp_(trace_processor::TraceProcessor::CreateInstance(
+            trace_processor::Config())) {
+    std::string trace = FixtureTrace(FixtureDumps(), FixturePerfSamples());
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+    memcpy(buf.get(), trace.data(), trace.size());
+    EXPECT_TRUE(tp_->Parse(std::move(buf), trace.size()).ok());
+    tp_->Flush();
+  }
+
+  std::vector<SerializedProfile> HeapProfiles(
+      uint64_t pid = 0,
+      const std::vector<uint64_t>& timestamps = {}) {
+    std::vector<SerializedProfile> profiles;
+    EXPECT_TRUE(TraceToPprof(tp_.get(), &profiles,
+                             ConversionMode::kHeapProfile, /*flags=*/0, pid,
+                             timestamps));
+    return profiles;
+  }
+
+  std::vector<SerializedProfile> PerfProfiles(uint64_t pid = 0) {
+    std::vector<SerializedProfile> profiles;
+    EXPECT_TRUE(TraceToPprof(tp_.get(), &profiles,
+                             ConversionMode::kPerfProfile, /*flags=*/0, pid,
+                             /*timestamps=*/{}));
+    return profiles;
+  }
+
+  std::unique_ptr<trace_processor::TraceProcessor> tp_;
+};
+
+const char kMain[] = "main@/libfoo.so 0x7000-0x9000 @0x1000";
+const char kFoo[] = "Foo@/libfoo.so 0x7000-0x9000 @0x1000";
+const char kBar[] = "Bar@/libfoo.so 0x7000-0x9000 @0x1000";
+const char kMalloc[] = "malloc@/libc.so 0x1000-0x2000 @0x0";
+
+std::string Sample(const std::vector<std::string>& leaf_first,
+                   const std::string& values) {
+  return base::Join(leaf_first, ", ") + ": " + values;
+}
+
+TEST_F(PprofBuilderTest, MatchesPerDumpQueries) {
+  std::vector<ExpectedProfile> expected = PerDumpQueryProfiles(tp_.get());
+  std::vector<SerializedProfile> profiles = HeapProfiles();
+  ASSERT_EQ(profiles.size(), 44u);
+  ASSERT_EQ(profiles.size(), expected.size());
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    SCOPED_TRACE(i);
+    EXPECT_EQ(profiles[i].profile_type, ProfileType::kHeapProfile);
+    EXPECT_EQ(profiles[i].pid, expected[i].pid);
+    EXPECT_EQ(profiles[i].heap_name, expected[i].heap_name);
+    ProfileContents contents = DecodeProfile(profiles[i].serialized);
+    EXPECT_EQ(contents.sample_types, expected[i].contents.sample_types);
+    EXPECT_EQ(contents.samples, expected[i].contents.samples);
+    EXPECT_EQ(contents.locations, expected[i].contents.locations);
+    EXPECT_EQ(contents.functions, expected[i].contents.functions);
+    EXPECT_EQ(contents.mappings, expected[i].contents.mappings);
+  }
+}
+
+TEST_F(PprofBuilderTest, ValuesPerView) {
+  std::vector<SerializedProfile> profiles = HeapProfiles(10);
+  ASSERT_EQ(profiles.size(), 2u);
+
+  // Views: alloc_objects, objects, alloc_space, space.
+  ProfileContents first = DecodeProfile(profiles[0].serialized);
+  EXPECT_THAT(first.sample_types,
+              ElementsAre("alloc_objects/count", "objects/count",
+                          "alloc_space/bytes", "space/bytes"));
+  EXPECT_THAT(first.samples,
+              UnorderedElementsAre(
+                  Sample({kMalloc, kFoo, kMain}, "1 1 100 100"),
+                  Sample({kMalloc, kBar, kMain}, "2 1 200 150")));
+
+  // The second dump covers the allocations of the first one too.
+  ProfileContents second = DecodeProfile(profiles[1].serialized);
+  EXPECT_THAT(second.samples,
+              UnorderedElementsAre(
+                  Sample({kMalloc, kFoo, kMain}, "3 2 300 200"),
+                  Sample({kMalloc, kBar, kMain}, "2 0 200 0"),
+                  Sample({kMalloc, kBar, kFoo, kMain}, "1 1 64 64")));
+}
+
+TEST_F(PprofBuilderTest, LocationMappingFunctionTables) {
+  std::vector<SerializedProfile> profiles = HeapProfiles(20);
+  ASSERT_EQ(profiles.size(), 2u);
+
+  EXPECT_EQ(profiles[0].heap_name, "custom");
+  ProfileContents custom = DecodeProfile(profiles[0].serialized);
+  EXPECT_THAT(custom.samples,
+              ElementsAre(Sample({kMalloc, kFoo, kMain}, "1 1 8 8")));
+  EXPECT_THAT(custom.locations, ElementsAre(kFoo, kMain, kMalloc));
+  EXPECT_THAT(custom.functions, ElementsAre("Foo", "main", "malloc"));
+  EXPECT_THAT(custom.mappings, ElementsAre("/libc.so 0x1000-0x2000 @0x0",
+                                           "/libfoo.so 0x7000-0x9000 @0x1000"));
+
+  EXPECT_EQ(profiles[1].heap_name, "malloc");
+  ProfileContents heap = DecodeProfile(profiles[1].serialized);
+  EXPECT_THAT(heap.samples, ElementsAre(Sample({kMalloc, kBar, kFoo, kMain},
+                                               "10 5 1000 500")));
+  EXPECT_THAT(heap.locations, ElementsAre(kBar, kFoo, kMain, kMalloc));
+  EXPECT_THAT(heap.functions, ElementsAre("Bar", "Foo", "main", "malloc"));
+  EXPECT_THAT(heap.mappings, ElementsAre("/libc.so 0x1000-0x2000 @0x0",
+                                         "/libfoo.so 0x7000-0x9000 @0x1000"));
+}
+
+TEST_F(PprofBuilderTest, PidFilter) {
+  std::vector<SerializedProfile> profiles = HeapProfiles(20);
+  ASSERT_EQ(profiles.size(), 2u);
+  for (const SerializedProfile& profile : profiles)
+    EXPECT_EQ(profile.pid, 20u);
+
+  EXPECT_EQ(HeapProfiles(30).size(), 40u);
+  EXPECT_THAT(HeapProfiles(40), IsEmpty());
+}
+
+TEST_F(PprofBuilderTest, TimestampsFilter) {
+  std::vector<SerializedProfile> profiles = HeapProfiles(0, {100, 150});
+  ASSERT_EQ(profiles.size(), 3u);
+  EXPECT_EQ(profiles[0].pid, 10u);
+  EXPECT_THAT(DecodeProfile(profiles[0].serialized).samples,
+              UnorderedElementsAre(
+                  Sample({kMalloc, kFoo, kMain}, "1 1 100 100"),
+                  Sample({kMalloc, kBar, kMain}, "2 1 200 150")));
+  EXPECT_EQ(profiles[1].pid, 20u);
+  EXPECT_EQ(profiles[1].heap_name, "custom");
+  EXPECT_EQ(profiles[2].pid, 20u);
+  EXPECT_EQ(profiles[2].heap_name, "malloc");
+
+  EXPECT_THAT(HeapProfiles(0, {123}), IsEmpty());
+}
+
+TEST_F(PprofBuilderTest, PidAndTimestampsFilter) {
+  std::vector<SerializedProfile> profiles = HeapProfiles(10, {150, 200});
+  ASSERT_EQ(profiles.size(), 1u);
+  EXPECT_EQ(profiles[0].pid, 10u);
+  EXPECT_THAT(DecodeProfile(profiles[0].serialized).samples,
+              UnorderedElementsAre(
+                  Sample({kMalloc, kFoo, kMain}, "3 2 300 200"),
+                  Sample({kMalloc, kBar, kMain}, "2 0 200 0"),
+                  Sample({kMalloc, kBar, kFoo, kMain}, "1 1 64 64")));
+}
+
+TEST_F(PprofBuilderTest, PerfProfiles) {
+  std::vector<SerializedProfile> profiles = PerfProfiles();
+  ASSERT_EQ(profiles.size(), 2u);
+
+  // One sample of count 1 per perf sample, across all the threads of the
+  // process.
+  EXPECT_EQ(profiles[0].profile_type, ProfileType::kPerfProfile);
+  EXPECT_EQ(profiles[0].pid, 10u);
+  EXPECT_EQ(profiles[0].heap_name, "");
+  ProfileContents first = DecodeProfile(profiles[0].serialized);
+  EXPECT_THAT(first.sample_types, ElementsAre("samples/count"));
+  EXPECT_THAT(first.samples,
+              UnorderedElementsAre(Sample({kMalloc, kFoo, kMain}, "1"),
+                                   Sample({kMalloc, kFoo, kMain}, "1"),
+                                   Sample({kMalloc, kBar, kMain}, "1")));
+  EXPECT_THAT(first.locations, ElementsAre(kBar, kFoo, kMain, kMalloc));
+  EXPECT_THAT(first.functions, ElementsAre("Bar", "Foo", "main", "malloc"));
+  EXPECT_THAT(first.mappings, ElementsAre("/libc.so 0x1000-0x2000 @0x0",
+                                          "/libfoo.so 0x7000-0x9000 @0x1000"));
+
+  EXPECT_EQ(profiles[1].profile_type, ProfileType::kPerfProfile);
+  EXPECT_EQ(profiles[1].pid, 20u);
+  ProfileContents second = DecodeProfile(profiles[1].serialized);
+  EXPECT_THAT(second.samples,
+              UnorderedElementsAre(Sample({kMalloc, kBar, kFoo, kMain}, "1"),
+                                   Sample({kMalloc, kBar, kFoo, kMain}, "1"),
+                                   Sample({kMalloc, kFoo, kMain}, "1")));
+}
+
+TEST_F(PprofBuilderTest, PerfPidFilter) {
+  std::vector<SerializedProfile> profiles = PerfProfiles(20);
+  ASSERT_EQ(profiles.size(), 1u);
+  EXPECT_EQ(profiles[0].pid, 20u);
+  EXPECT_EQ(DecodeProfile(profiles[0].serialized).samples.size(), 3u);
+
+  EXPECT_THAT(PerfProfiles(30), IsEmpty());
+}
+
+}  // namespace
+}  // namespace trace_to_text
+}  // namespace perfetto
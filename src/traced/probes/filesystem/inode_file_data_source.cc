@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <queue>
 #include <unordered_map>
 
@@ -38,6 +39,7 @@ namespace {
 constexpr uint32_t kScanIntervalMs = 10000;  // 10s
 constexpr uint32_t kScanDelayMs = 10000;     // 10s
 constexpr uint32_t kScanBatchSize = 15000;
+constexpr uint32_t kMaxScanThreads = 8;
 
 uint32_t OrDefault(uint32_t value, uint32_t def) {
   return value ? value : def;
@@ -113,12 +115,14 @@ InodeFileDataSource::InodeFileDataSource(
     std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
         static_file_map,
     LRUInodeCache* cache,
-    std::unique_ptr<TraceWriter> writer)
+    std::unique_ptr<TraceWriter> writer,
+    PersistentInodeCache* persistent_cache)
     : ProbesDataSource(session_id, &descriptor),
       task_runner_(task_runner),
       static_file_map_(static_file_map),
       cache_(cache),
       writer_(std::move(writer)),
+      persistent_cache_(persistent_cache),
       weak_factory_(this) {
   using protos::pbzero::InodeFileConfig;
   InodeFileConfig::Decoder cfg(ds_config.inode_file_config_raw());
@@ -135,10 +139,15 @@ InodeFileDataSource::InodeFileDataSource(
   scan_interval_ms_ = OrDefault(cfg.scan_interval_ms(), kScanIntervalMs);
   scan_delay_ms_ = OrDefault(cfg.scan_delay_ms(), kScanDelayMs);
   scan_batch_size_ = OrDefault(cfg.scan_batch_size(), kScanBatchSize);
+  scan_threads_ = std::min(cfg.scan_threads(), kMaxScanThreads);
   do_not_scan_ = cfg.do_not_scan();
 }
 
-InodeFileDataSource::~InodeFileDataSource() = default;
+InodeFileDataSource::~InodeFileDataSource() {
+  // Keep what an interrupted scan found so far.
+  if (persistent_cache_)
+    persistent_cache_->Save();
+}
 
 void InodeFileDataSource::Start() {
   // Nothing special to do, this data source is only reacting to on-demand
@@ -191,6 +200,30 @@ void InodeFileDataSource::AddInodesFromLRUCache(
     PERFETTO_DLOG("%" PRIu64 " inodes found in cache", cache_found_count);
 }
 
+void InodeFileDataSource::AddInodesFromPersistentCache(
+    BlockDeviceID block_device_id,
+    std::set<Inode>* inode_numbers) {
+  if (!persistent_cache_)
+    return;
+  uint64_t cache_found_count = 0;
+  for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
+    Inode inode_number = *it;
+    const InodeMapValue* value =
+        persistent_cache_->Get(block_device_id, inode_number);
+    if (value == nullptr) {
+      ++it;
+      continue;
+    }
+    cache_found_count++;
+    it = inode_numbers->erase(it);
+    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
+                   *value);
+  }
+  if (cache_found_count > 0)
+    PERFETTO_DLOG("%" PRIu64 " inodes found in persistent cache",
+                  cache_found_count);
+}
+
 void InodeFileDataSource::Flush(FlushRequestID,
                                 std::function<void()> callback) {
   ResetTracePacket();
@@ -222,6 +255,7 @@ void InodeFileDataSource::OnInodes(
     // paths/type
     AddInodesFromStaticMap(block_device_id, &inode_numbers);
     AddInodesFromLRUCache(block_device_id, &inode_numbers);
+    AddInodesFromPersistentCache(block_device_id, &inode_numbers);
 
     if (do_not_scan_)
       inode_numbers.clear();
@@ -327,6 +361,10 @@ bool InodeFileDataSource::OnInodeFound(BlockDeviceID block_device_id,
     FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
                    new_val);
   }
+  if (persistent_cache_) {
+    persistent_cache_->Insert(block_device_id, inode_number,
+                              InodeMapValue(inode_type, {path}));
+  }
   PERFETTO_DLOG("Filled %s", path.c_str());
   return !missing_inodes_.empty();
 }
@@ -343,6 +381,9 @@ void InodeFileDataSource::OnInodeScanDone() {
   // Finalize the accumulated trace packets.
   ResetTracePacket();
   file_scanner_.reset();
+  parallel_file_scanner_.reset();
+  if (persistent_cache_)
+    persistent_cache_->Save();
   if (!missing_inodes_.empty()) {
     // At least write mount point mapping for inodes that are not found.
     for (const auto& p : missing_inodes_) {
@@ -393,8 +434,14 @@ void InodeFileDataSource::FindMissingInodes() {
     AddRootsForBlockDevice(p.first, &roots);
 
   PERFETTO_DCHECK(file_scanner_.get() == nullptr);
-  auto weak_this = GetWeakPtr();
+  PERFETTO_DCHECK(parallel_file_scanner_.get() == nullptr);
   PERFETTO_DLOG("Starting scan of %s", DbgFmt(roots).c_str());
+  if (scan_threads_) {
+    parallel_file_scanner_ = std::unique_ptr<ParallelFileScanner>(
+        new ParallelFileScanner(std::move(roots), this, scan_threads_));
+    parallel_file_scanner_->Scan(task_runner_, missing_inodes_);
+    return;
+  }
   file_scanner_ = std::unique_ptr<FileScanner>(new FileScanner(
       std::move(roots), this, scan_interval_ms_, scan_batch_size_));
 
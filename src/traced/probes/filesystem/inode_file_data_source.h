@@ -35,6 +35,8 @@
 #include "src/traced/probes/filesystem/file_scanner.h"
 #include "src/traced/probes/filesystem/fs_mount.h"
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+#include "src/traced/probes/filesystem/persistent_inode_cache.h"
 #include "src/traced/probes/probes_data_source.h"
 
 #include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
@@ -62,7 +64,8 @@ class InodeFileDataSource : public ProbesDataSource,
       std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
           static_file_map,
       LRUInodeCache* cache,
-      std::unique_ptr<TraceWriter> writer);
+      std::unique_ptr<TraceWriter> writer,
+      PersistentInodeCache* persistent_cache = nullptr);
 
   ~InodeFileDataSource() override;
 
@@ -79,6 +82,11 @@ class InodeFileDataSource : public ProbesDataSource,
   void AddInodesFromLRUCache(BlockDeviceID block_device_id,
                              std::set<Inode>* inode_numbers);
 
+  // Search in the PersistentInodeCache, if any, and add inodes to
+  // InodeFileMap if found
+  void AddInodesFromPersistentCache(BlockDeviceID block_device_id,
+                                    std::set<Inode>* inode_numbers);
+
   virtual void FillInodeEntry(InodeFileMap* destination,
                               Inode inode_number,
                               const InodeMapValue& inode_map_value);
@@ -115,6 +123,7 @@ class InodeFileDataSource : public ProbesDataSource,
       static_file_map_;
   LRUInodeCache* cache_;
   std::unique_ptr<TraceWriter> writer_;
+  PersistentInodeCache* persistent_cache_;
   std::map<BlockDeviceID, std::set<Inode>> missing_inodes_;
   std::map<BlockDeviceID, std::set<Inode>> next_missing_inodes_;
   std::set<BlockDeviceID> seen_block_devices_;
@@ -127,7 +136,9 @@ class InodeFileDataSource : public ProbesDataSource,
   uint32_t scan_interval_ms_ = 0;
   uint32_t scan_delay_ms_ = 0;
   uint32_t scan_batch_size_ = 0;
+  uint32_t scan_threads_ = 0;
   std::unique_ptr<FileScanner> file_scanner_;
+  std::unique_ptr<ParallelFileScanner> parallel_file_scanner_;
   base::WeakPtrFactory<InodeFileDataSource> weak_factory_;  // Keep last.
 };
 
@@ -16,10 +16,12 @@
 
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/base/test/test_task_runner.h"
 #include "src/base/test/utils.h"
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/persistent_inode_cache.h"
 #include "src/tracing/core/null_trace_writer.h"
 
 #include "test/gtest_and_gmock.h"
@@ -45,13 +47,15 @@ class TestInodeFileDataSource : public InodeFileDataSource {
       std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
           static_file_map,
       LRUInodeCache* cache,
-      std::unique_ptr<TraceWriter> writer)
+      std::unique_ptr<TraceWriter> writer,
+      PersistentInodeCache* persistent_cache)
       : InodeFileDataSource(std::move(cfg),
                             task_runner,
                             tsid,
                             static_file_map,
                             cache,
-                            std::move(writer)) {
+                            std::move(writer),
+                            persistent_cache) {
     struct stat buf;
     PERFETTO_CHECK(
         lstat(base::GetTestDataPath("src/traced/probes/filesystem/testdata")
@@ -73,10 +77,12 @@ class InodeFileDataSourceTest : public ::testing::Test {
   InodeFileDataSourceTest() {}
 
   std::unique_ptr<TestInodeFileDataSource> GetInodeFileDataSource(
-      DataSourceConfig cfg) {
+      DataSourceConfig cfg,
+      PersistentInodeCache* persistent_cache = nullptr) {
     return std::unique_ptr<TestInodeFileDataSource>(new TestInodeFileDataSource(
         cfg, &task_runner_, 0, &static_file_map_, &cache_,
-        std::unique_ptr<NullTraceWriter>(new NullTraceWriter)));
+        std::unique_ptr<NullTraceWriter>(new NullTraceWriter),
+        persistent_cache));
   }
 
   LRUInodeCache cache_{100};
@@ -114,6 +120,55 @@ TEST_F(InodeFileDataSourceTest, TestFileSystemScan) {
               Pointee(Eq(value)));
 }
 
+TEST_F(InodeFileDataSourceTest, TestParallelScanAndPersistentCache) {
+  base::TempDir tmp_dir = base::TempDir::Create();
+  std::string cache_path = tmp_dir.path() + "/inode_cache";
+
+  struct stat buf;
+  PERFETTO_CHECK(
+      lstat(base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2")
+                .c_str(),
+            &buf) != -1);
+  InodeMapValue value(
+      protos::pbzero::InodeFileMap::Entry::Type::FILE,
+      {base::GetTestDataPath("src/traced/probes/filesystem/testdata/file2")});
+
+  {
+    PersistentInodeCache persistent_cache(cache_path);
+    persistent_cache.Load();
+    DataSourceConfig ds_config;
+    protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+    inode_cfg->set_scan_delay_ms(1);
+    inode_cfg->set_scan_threads(2);
+    ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+    auto data_source = GetInodeFileDataSource(ds_config, &persistent_cache);
+
+    auto done = task_runner_.CreateCheckpoint("done");
+    EXPECT_CALL(*data_source, FillInodeEntry(_, buf.st_ino, Eq(value)))
+        .WillOnce(InvokeWithoutArgs(done));
+    data_source->OnInodes({{buf.st_ino, buf.st_dev}});
+    task_runner_.RunUntilCheckpoint("done");
+  }
+
+  // A new instance, e.g. after traced_probes restarts, finds the inode in the
+  // cache file without scanning.
+  PersistentInodeCache persistent_cache(cache_path);
+  persistent_cache.Load();
+  LRUInodeCache empty_cache(100);
+  DataSourceConfig ds_config;
+  protozero::HeapBuffered<protos::pbzero::InodeFileConfig> inode_cfg;
+  inode_cfg->set_do_not_scan(true);
+  ds_config.set_inode_file_config_raw(inode_cfg.SerializeAsString());
+  TestInodeFileDataSource data_source(
+      ds_config, &task_runner_, 0, &static_file_map_, &empty_cache,
+      std::unique_ptr<NullTraceWriter>(new NullTraceWriter),
+      &persistent_cache);
+  EXPECT_CALL(data_source, FillInodeEntry(_, buf.st_ino, Eq(value)));
+  data_source.OnInodes({{buf.st_ino, buf.st_dev}});
+
+  unlink(cache_path.c_str());
+}
+
 TEST_F(InodeFileDataSourceTest, TestStaticMap) {
   DataSourceConfig config;
   auto data_source = GetInodeFileDataSource(config);
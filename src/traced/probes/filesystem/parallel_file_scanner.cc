@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace {
+
+// How many found inodes a worker accumulates before handing them over.
+constexpr size_t kBatchSize = 256;
+
+// From linux/ioprio.h, which is not available on all the toolchains.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioClassShift = 13;
+
+// Moves the calling thread to the idle IO scheduling class, so that the scan
+// only uses the disk when nothing else does.
+void SetIdleIoPriority() {
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0,
+              kIoprioClassIdle << kIoprioClassShift) != 0) {
+    PERFETTO_DPLOG("ioprio_set");
+  }
+}
+
+// Collects the inodes in |inodes| found by a FileScanner, removing them from
+// the set as they are found.
+class CollectingDelegate : public FileScanner::Delegate {
+ public:
+  using FoundCallback = std::function<void(BlockDeviceID,
+                                           Inode,
+                                           const std::string&,
+                                           InodeFileMap_Entry_Type)>;
+
+  CollectingDelegate(ParallelFileScanner::InodeSets* inodes,
+                     const std::atomic<bool>* cancelled,
+                     FoundCallback callback)
+      : inodes_(inodes), cancelled_(cancelled), callback_(std::move(callback)) {}
+  ~CollectingDelegate() override;
+
+  bool OnInodeFound(BlockDeviceID block_device_id,
+                    Inode inode,
+                    const std::string& path,
+                    InodeFileMap_Entry_Type type) override {
+    if (cancelled_->load(std::memory_order_relaxed))
+      return false;
+    auto it = inodes_->find(block_device_id);
+    if (it == inodes_->end() || it->second.erase(inode) == 0)
+      return true;
+    callback_(block_device_id, inode, path, type);
+    if (it->second.empty())
+      inodes_->erase(it);
+    return !inodes_->empty();
+  }
+
+  void OnInodeScanDone() override {}
+
+ private:
+  ParallelFileScanner::InodeSets* const inodes_;
+  const std::atomic<bool>* const cancelled_;
+  FoundCallback callback_;
+};
+
+CollectingDelegate::~CollectingDelegate() = default;
+
+}  // namespace
+
+ParallelFileScanner::ParallelFileScanner(
+    std::vector<std::string> root_directories,
+    FileScanner::Delegate* delegate,
+    uint32_t num_threads)
+    : root_directories_(std::move(root_directories)),
+      delegate_(delegate),
+      num_threads_(std::max(num_threads, 1u)),
+      cancelled_(new std::atomic<bool>(false)),
+      weak_factory_(this) {}
+
+ParallelFileScanner::~ParallelFileScanner() {
+  // The workers check this flag for every file, so that destroying them,
+  // which joins their threads, doesn't wait for the scans to complete.
+  cancelled_->store(true);
+}
+
+void ParallelFileScanner::Scan(base::TaskRunner* task_runner,
+                               const InodeSets& inodes) {
+  PERFETTO_DCHECK(workers_.empty());
+  size_t num_workers =
+      std::min(static_cast<size_t>(num_threads_), root_directories_.size());
+  if (num_workers == 0 || inodes.empty())
+    return delegate_->OnInodeScanDone();
+
+  // Spread the roots over the workers. Each of them looks for all the inodes,
+  // as it's not known in advance which root they are under.
+  std::vector<std::vector<std::string>> roots(num_workers);
+  for (size_t i = 0; i < root_directories_.size(); i++)
+    roots[i % num_workers].emplace_back(std::move(root_directories_[i]));
+  root_directories_.clear();
+
+  auto weak_this = weak_factory_.GetWeakPtr();
+  workers_running_ = num_workers;
+  workers_.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_.emplace_back(base::ThreadTaskRunner::CreateAndStart("inode_scan"));
+    std::shared_ptr<std::vector<std::string>> worker_roots(
+        new std::vector<std::string>(std::move(roots[i])));
+    auto cancelled = cancelled_;
+    workers_.back().PostTask(
+        [worker_roots, inodes, cancelled, task_runner, weak_this] {
+          ScanRoots(std::move(*worker_roots), inodes, cancelled, task_runner,
+                    weak_this);
+        });
+  }
+}
+
+// static
+void ParallelFileScanner::ScanRoots(
+    std::vector<std::string> roots,
+    InodeSets inodes,
+    std::shared_ptr<std::atomic<bool>> cancelled,
+    base::TaskRunner* task_runner,
+    base::WeakPtr<ParallelFileScanner> weak_this) {
+  SetIdleIoPriority();
+
+  std::shared_ptr<std::vector<FoundInode>> batch(new std::vector<FoundInode>());
+  auto flush_batch = [&batch, task_runner, weak_this] {
+    if (batch->empty())
+      return;
+    std::shared_ptr<std::vector<FoundInode>> found = std::move(batch);
+    batch.reset(new std::vector<FoundInode>());
+    task_runner->PostTask([weak_this, found] {
+      if (weak_this)
+        weak_this->OnInodesFound(*found);
+    });
+  };
+
+  CollectingDelegate delegate(
+      &inodes, cancelled.get(),
+      [&batch, &flush_batch](BlockDeviceID block_device_id, Inode inode,
+                             const std::string& path,
+                             InodeFileMap_Entry_Type type) {
+        batch->push_back(FoundInode{block_device_id, inode, path, type});
+        if (batch->size() >= kBatchSize)
+          flush_batch();
+      });
+  FileScanner scanner(std::move(roots), &delegate);
+  scanner.Scan();
+  flush_batch();
+
+  task_runner->PostTask([weak_this] {
+    if (weak_this)
+      weak_this->OnWorkerDone();
+  });
+}
+
+void ParallelFileScanner::OnInodesFound(const std::vector<FoundInode>& inodes) {
+  if (cancelled_->load())
+    return;
+  for (const FoundInode& found : inodes) {
+    if (!delegate_->OnInodeFound(found.block_device_id, found.inode, found.path,
+                                 found.type)) {
+      cancelled_->store(true);
+      return;
+    }
+  }
+}
+
+void ParallelFileScanner::OnWorkerDone() {
+  PERFETTO_DCHECK(workers_running_ > 0);
+  if (--workers_running_ > 0)
+    return;
+  // This might destroy |this|, don't touch any member afterwards.
+  delegate_->OnInodeScanDone();
+}
+
+}  // namespace perfetto
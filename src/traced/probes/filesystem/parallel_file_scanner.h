@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/weak_ptr.h"
+#include "perfetto/ext/traced/data_source_types.h"
+#include "src/traced/probes/filesystem/file_scanner.h"
+
+namespace perfetto {
+
+// Looks for a set of inodes by walking |root_directories| with a FileScanner
+// each, on up to |num_threads| worker threads running with idle IO priority.
+// Only the inodes that are looked for are passed to the delegate, in batches,
+// on the task runner passed to Scan(). Scanning stops once the delegate's
+// OnInodeFound() returns false or the ParallelFileScanner is destroyed.
+class ParallelFileScanner {
+ public:
+  using InodeSets = std::map<BlockDeviceID, std::set<Inode>>;
+
+  ParallelFileScanner(std::vector<std::string> root_directories,
+                      FileScanner::Delegate* delegate,
+                      uint32_t num_threads);
+  ~ParallelFileScanner();
+
+  void Scan(base::TaskRunner* task_runner, const InodeSets& inodes);
+
+ private:
+  struct FoundInode {
+    BlockDeviceID block_device_id;
+    Inode inode;
+    std::string path;
+    InodeFileMap_Entry_Type type;
+  };
+
+  ParallelFileScanner(const ParallelFileScanner&) = delete;
+  ParallelFileScanner& operator=(const ParallelFileScanner&) = delete;
+
+  // Runs on the worker threads.
+  static void ScanRoots(std::vector<std::string> roots,
+                        InodeSets inodes,
+                        std::shared_ptr<std::atomic<bool>> cancelled,
+                        base::TaskRunner* task_runner,
+                        base::WeakPtr<ParallelFileScanner> weak_this);
+
+  void OnInodesFound(const std::vector<FoundInode>& inodes);
+  void OnWorkerDone();
+
+  std::vector<std::string> root_directories_;
+  FileScanner::Delegate* const delegate_;
+  const uint32_t num_threads_;
+  size_t workers_running_ = 0;
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+  std::vector<base::ThreadTaskRunner> workers_;
+  base::WeakPtrFactory<ParallelFileScanner> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <sys/stat.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/base/test/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+class TestDelegate : public FileScanner::Delegate {
+ public:
+  TestDelegate(std::function<bool(const std::string&)> callback,
+               std::function<void()> done_callback)
+      : callback_(std::move(callback)),
+        done_callback_(std::move(done_callback)) {}
+
+  bool OnInodeFound(BlockDeviceID,
+                    Inode,
+                    const std::string& path,
+                    InodeFileMap_Entry_Type) override {
+    return callback_(path);
+  }
+
+  void OnInodeScanDone() override { done_callback_(); }
+
+ private:
+  std::function<bool(const std::string&)> callback_;
+  std::function<void()> done_callback_;
+};
+
+struct stat CheckStat(const std::string& path) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat(path.c_str(), &buf) != -1);
+  return buf;
+}
+
+TEST(ParallelFileScannerTest, FindsOnlyRequestedInodes) {
+  std::string root =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata");
+  std::string dir1 = root + "/dir1";
+  std::string file2 = root + "/file2";
+  struct stat dir1_stat = CheckStat(dir1);
+  struct stat file2_stat = CheckStat(file2);
+
+  base::TestTaskRunner task_runner;
+  auto done = task_runner.CreateCheckpoint("done");
+  std::vector<std::string> seen;
+  TestDelegate delegate(
+      [&seen](const std::string& path) {
+        seen.push_back(path);
+        return true;
+      },
+      done);
+
+  // The two roots are scanned on different threads.
+  ParallelFileScanner scanner({dir1, root}, &delegate, /*num_threads=*/2);
+  ParallelFileScanner::InodeSets inodes;
+  inodes[dir1_stat.st_dev].insert(dir1_stat.st_ino);
+  inodes[file2_stat.st_dev].insert(file2_stat.st_ino);
+  scanner.Scan(&task_runner, inodes);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(seen, UnorderedElementsAre(dir1, file2));
+}
+
+TEST(ParallelFileScannerTest, Stop) {
+  std::string root =
+      base::GetTestDataPath("src/traced/probes/filesystem/testdata");
+  struct stat dir1_stat = CheckStat(root + "/dir1");
+  struct stat file2_stat = CheckStat(root + "/file2");
+
+  base::TestTaskRunner task_runner;
+  auto done = task_runner.CreateCheckpoint("done");
+  size_t seen = 0;
+  TestDelegate delegate(
+      [&seen](const std::string&) {
+        seen++;
+        return false;
+      },
+      done);
+
+  ParallelFileScanner scanner({root}, &delegate, /*num_threads=*/4);
+  ParallelFileScanner::InodeSets inodes;
+  inodes[dir1_stat.st_dev].insert(dir1_stat.st_ino);
+  inodes[file2_stat.st_dev].insert(file2_stat.st_ino);
+  scanner.Scan(&task_runner, inodes);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(seen, 1u);
+}
+
+}  // namespace
+}  // namespace perfetto
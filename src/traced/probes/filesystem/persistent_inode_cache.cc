@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/persistent_inode_cache.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <set>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_splitter.h"
+
+namespace perfetto {
+namespace {
+
+// The file is made of lines of text:
+//   perfetto_inode_cache <version>
+//   d <block device id> <filesystem generation>
+//   i <inode> <type> <path>
+// The "i" lines belong to the block device of the "d" line preceding them.
+// An inode with more than one path (hard links) has one line per path.
+constexpr char kHeader[] = "perfetto_inode_cache 1";
+
+bool ReadFilesystemGeneration(const std::string& path, uint64_t* generation) {
+  struct statvfs buf;
+  if (statvfs(path.c_str(), &buf) != 0)
+    return false;
+  *generation = static_cast<uint64_t>(buf.f_fsid);
+  return true;
+}
+
+// Parses an unsigned integer followed by a space at |*cur| and advances it
+// past the space.
+bool ParseField(const char** cur, uint64_t* out) {
+  char* end = nullptr;
+  *out = static_cast<uint64_t>(strtoull(*cur, &end, 10));
+  if (end == *cur || *end != ' ')
+    return false;
+  *cur = end + 1;
+  return true;
+}
+
+}  // namespace
+
+PersistentInodeCache::PersistentInodeCache(std::string path,
+                                           size_t max_entries)
+    : path_(std::move(path)), max_entries_(max_entries) {}
+
+PersistentInodeCache::~PersistentInodeCache() = default;
+
+void PersistentInodeCache::Load() {
+  if (loaded_)
+    return;
+  loaded_ = true;
+
+  std::string data;
+  if (!base::ReadFile(path_, &data))
+    return;  // Not saved yet.
+  if (!Parse(data)) {
+    PERFETTO_ELOG("Discarding corrupted inode cache %s", path_.c_str());
+    devices_.clear();
+    size_ = 0;
+    dirty_ = true;
+  }
+  PERFETTO_DLOG("Loaded %zu inodes from %s", size_, path_.c_str());
+}
+
+bool PersistentInodeCache::Parse(const std::string& data) {
+  base::StringSplitter lines(data, '\n');
+  if (!lines.Next() || strcmp(lines.cur_token(), kHeader) != 0)
+    return false;
+
+  Device* device = nullptr;
+  while (lines.Next()) {
+    const char* cur = lines.cur_token();
+    if (cur[0] == 'd' && cur[1] == ' ') {
+      cur += 2;
+      uint64_t block_device_id = 0;
+      if (!ParseField(&cur, &block_device_id))
+        return false;
+      device = &devices_[static_cast<BlockDeviceID>(block_device_id)];
+      device->generation = static_cast<uint64_t>(strtoull(cur, nullptr, 10));
+      continue;
+    }
+    if (cur[0] != 'i' || cur[1] != ' ' || !device)
+      return false;
+    cur += 2;
+    uint64_t inode = 0;
+    uint64_t type = 0;
+    if (!ParseField(&cur, &inode) || !ParseField(&cur, &type) || !*cur)
+      return false;
+    auto it = device->entries.find(static_cast<Inode>(inode));
+    if (it == device->entries.end()) {
+      if (size_ >= max_entries_)
+        continue;
+      it = device->entries.emplace(static_cast<Inode>(inode), Entry()).first;
+      it->second.value.SetType(static_cast<InodeFileMap_Entry_Type>(type));
+      size_++;
+    }
+    it->second.value.AddPath(cur);
+  }
+  return true;
+}
+
+bool PersistentInodeCache::Save() {
+  if (!dirty_)
+    return true;
+
+  std::string data = kHeader;
+  data += '\n';
+  char buf[64];
+  for (const auto& device : devices_) {
+    if (device.second.entries.empty())
+      continue;
+    snprintf(buf, sizeof(buf), "d %" PRIu64 " %" PRIu64 "\n",
+             static_cast<uint64_t>(device.first), device.second.generation);
+    data += buf;
+    for (const auto& entry : device.second.entries) {
+      snprintf(buf, sizeof(buf), "i %" PRIu64 " %d ",
+               static_cast<uint64_t>(entry.first),
+               static_cast<int>(entry.second.value.type()));
+      for (const std::string& path : entry.second.value.paths()) {
+        if (path.find('\n') != std::string::npos)
+          continue;
+        data += buf;
+        data += path;
+        data += '\n';
+      }
+    }
+  }
+
+  // Write the new file next to the old one and rename it over, so that a
+  // crash doesn't leave a truncated cache behind.
+  std::string tmp_path = path_ + ".tmp";
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (!fd || base::WriteAll(*fd, data.data(), data.size()) !=
+                 static_cast<ssize_t>(data.size())) {
+    PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  dirty_ = false;
+  PERFETTO_DLOG("Saved %zu inodes to %s", size_, path_.c_str());
+  return true;
+}
+
+const InodeMapValue* PersistentInodeCache::Get(BlockDeviceID block_device_id,
+                                               Inode inode) {
+  auto device_it = devices_.find(block_device_id);
+  if (device_it == devices_.end())
+    return nullptr;
+  Device& device = device_it->second;
+  auto it = device.entries.find(inode);
+  if (it == device.entries.end())
+    return nullptr;
+  Entry& entry = it->second;
+  if (entry.verified)
+    return &entry.value;
+
+  std::set<std::string> valid_paths;
+  for (const std::string& path : entry.value.paths()) {
+    struct stat buf;
+    if (lstat(path.c_str(), &buf) != 0 ||
+        static_cast<BlockDeviceID>(buf.st_dev) != block_device_id ||
+        static_cast<Inode>(buf.st_ino) != inode) {
+      continue;
+    }
+    // The first time a path on a device is found, make sure that the
+    // filesystem is the one the entries were saved for. If it isn't, all of
+    // them are stale.
+    if (!device.generation_checked) {
+      uint64_t generation = 0;
+      if (!ReadFilesystemGeneration(path, &generation))
+        continue;
+      device.generation_checked = true;
+      if (generation != device.generation) {
+        DropDevice(device_it);
+        return nullptr;
+      }
+    }
+    valid_paths.insert(path);
+  }
+
+  if (valid_paths.size() != entry.value.paths().size())
+    dirty_ = true;
+  if (valid_paths.empty()) {
+    device.entries.erase(it);
+    size_--;
+    return nullptr;
+  }
+  entry.value.SetPaths(std::move(valid_paths));
+  entry.verified = true;
+  return &entry.value;
+}
+
+void PersistentInodeCache::Insert(BlockDeviceID block_device_id,
+                                  Inode inode,
+                                  const InodeMapValue& value) {
+  if (value.paths().empty())
+    return;
+  auto device_it = devices_.find(block_device_id);
+  if (device_it == devices_.end() || !device_it->second.generation_checked) {
+    uint64_t generation = 0;
+    if (!ReadFilesystemGeneration(*value.paths().begin(), &generation))
+      return;
+    if (device_it != devices_.end() &&
+        device_it->second.generation != generation) {
+      DropDevice(device_it);
+      device_it = devices_.end();
+    }
+    if (device_it == devices_.end())
+      device_it = devices_.emplace(block_device_id, Device()).first;
+    device_it->second.generation = generation;
+    device_it->second.generation_checked = true;
+  }
+  Device& device = device_it->second;
+
+  auto it = device.entries.find(inode);
+  if (it == device.entries.end()) {
+    if (size_ >= max_entries_)
+      return;
+    it = device.entries.emplace(inode, Entry()).first;
+    size_++;
+  }
+  Entry& entry = it->second;
+  entry.value.SetType(value.type());
+  for (const std::string& path : value.paths())
+    entry.value.AddPath(path);
+  entry.verified = true;
+  dirty_ = true;
+}
+
+void PersistentInodeCache::DropDevice(
+    std::map<BlockDeviceID, Device>::iterator it) {
+  PERFETTO_DLOG("Filesystem on block device %" PRIu64
+                " changed, dropping %zu cached inodes",
+                static_cast<uint64_t>(it->first), it->second.entries.size());
+  size_ -= it->second.entries.size();
+  devices_.erase(it);
+  dirty_ = true;
+}
+
+}  // namespace perfetto
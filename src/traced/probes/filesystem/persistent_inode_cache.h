@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_PERSISTENT_INODE_CACHE_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_PERSISTENT_INODE_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "perfetto/ext/traced/data_source_types.h"
+
+namespace perfetto {
+
+// Keeps the inodes resolved by the filesystem scans of InodeFileDataSource in
+// a file, so that a new traced_probes instance doesn't have to walk the whole
+// filesystem again to resolve them.
+//
+// The entries are grouped by block device, together with the generation of
+// the filesystem on it (its statvfs() f_fsid, which changes when the device
+// is reformatted). Entries are revalidated lazily, when they are first
+// looked up: a path is kept only if it still refers to the same inode.
+class PersistentInodeCache {
+ public:
+  static constexpr size_t kDefaultMaxEntries = 100000;
+
+  explicit PersistentInodeCache(std::string path,
+                                size_t max_entries = kDefaultMaxEntries);
+  ~PersistentInodeCache();
+
+  // Reads the cache file. Only the first call has any effect.
+  void Load();
+
+  // Rewrites the cache file, if any entry changed since it was last loaded or
+  // saved. Returns false if the file couldn't be written.
+  bool Save();
+
+  // Returns the entry for |inode|, after dropping its paths that don't refer
+  // to it any more. Returns nullptr if there's no such entry or none of its
+  // paths is still valid.
+  const InodeMapValue* Get(BlockDeviceID, Inode);
+
+  // Adds the paths and type of |value| to the entry for |inode|. Ignored if
+  // the cache is full.
+  void Insert(BlockDeviceID, Inode, const InodeMapValue& value);
+
+  size_t size() const { return size_; }
+
+ private:
+  struct Entry {
+    InodeMapValue value;
+    // True once the paths have been checked against the filesystem, either
+    // by Get() or because the entry was found by a scan.
+    bool verified = false;
+  };
+
+  struct Device {
+    uint64_t generation = 0;
+    // False for the devices read by Load() until a path on them is seen.
+    bool generation_checked = false;
+    std::unordered_map<Inode, Entry> entries;
+  };
+
+  PersistentInodeCache(const PersistentInodeCache&) = delete;
+  PersistentInodeCache& operator=(const PersistentInodeCache&) = delete;
+
+  bool Parse(const std::string& data);
+  void DropDevice(std::map<BlockDeviceID, Device>::iterator);
+
+  const std::string path_;
+  const size_t max_entries_;
+  std::map<BlockDeviceID, Device> devices_;
+  size_t size_ = 0;
+  bool loaded_ = false;
+  bool dirty_ = false;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_PERSISTENT_INODE_CACHE_H_
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/persistent_inode_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr InodeFileMap_Entry_Type kFile = 1;
+
+class PersistentInodeCacheTest : public ::testing::Test {
+ protected:
+  PersistentInodeCacheTest() : tmp_dir_(base::TempDir::Create()) {
+    cache_path_ = tmp_dir_.path() + "/inode_cache";
+  }
+
+  ~PersistentInodeCacheTest() override {
+    for (const std::string& path : files_)
+      unlink(path.c_str());
+    unlink(cache_path_.c_str());
+  }
+
+  // Creates a file in the temp dir and returns its stat().
+  struct stat CreateFile(const std::string& name) {
+    std::string path = tmp_dir_.path() + "/" + name;
+    base::ScopedFile fd = base::OpenFile(path, O_WRONLY | O_CREAT, 0600);
+    PERFETTO_CHECK(fd);
+    files_.push_back(path);
+    struct stat buf;
+    PERFETTO_CHECK(lstat(path.c_str(), &buf) == 0);
+    return buf;
+  }
+
+  std::string Path(const std::string& name) {
+    return tmp_dir_.path() + "/" + name;
+  }
+
+  base::TempDir tmp_dir_;
+  std::string cache_path_;
+  std::vector<std::string> files_;
+};
+
+TEST_F(PersistentInodeCacheTest, SaveAndLoad) {
+  struct stat a = CreateFile("a");
+  struct stat b = CreateFile("b with spaces");
+  {
+    PersistentInodeCache cache(cache_path_);
+    cache.Load();
+    EXPECT_EQ(cache.size(), 0u);
+    cache.Insert(a.st_dev, a.st_ino, InodeMapValue(kFile, {Path("a")}));
+    cache.Insert(b.st_dev, b.st_ino,
+                 InodeMapValue(kFile, {Path("b with spaces")}));
+    ASSERT_TRUE(cache.Save());
+  }
+
+  PersistentInodeCache cache(cache_path_);
+  cache.Load();
+  EXPECT_EQ(cache.size(), 2u);
+  const InodeMapValue* value = cache.Get(a.st_dev, a.st_ino);
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(value->type(), kFile);
+  EXPECT_THAT(value->paths(), ElementsAre(Path("a")));
+  value = cache.Get(b.st_dev, b.st_ino);
+  ASSERT_NE(value, nullptr);
+  EXPECT_THAT(value->paths(), ElementsAre(Path("b with spaces")));
+  EXPECT_EQ(cache.Get(a.st_dev, a.st_ino + 1000000), nullptr);
+}
+
+TEST_F(PersistentInodeCacheTest, DropsStalePaths) {
+  struct stat a = CreateFile("a");
+  struct stat b = CreateFile("b");
+  {
+    PersistentInodeCache cache(cache_path_);
+    cache.Load();
+    cache.Insert(a.st_dev, a.st_ino, InodeMapValue(kFile, {Path("a")}));
+    cache.Insert(b.st_dev, b.st_ino, InodeMapValue(kFile, {Path("b")}));
+    ASSERT_TRUE(cache.Save());
+  }
+
+  // Replace "a" with "b": the path of the entry for a's inode now refers to a
+  // different inode, and the one for b's inode doesn't exist any more.
+  ASSERT_EQ(rename(Path("b").c_str(), Path("a").c_str()), 0);
+  files_.pop_back();
+
+  PersistentInodeCache cache(cache_path_);
+  cache.Load();
+  EXPECT_EQ(cache.Get(b.st_dev, b.st_ino), nullptr);
+  EXPECT_EQ(cache.Get(a.st_dev, a.st_ino), nullptr);
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(PersistentInodeCacheTest, DropsCorruptedFile) {
+  {
+    base::ScopedFile fd = base::OpenFile(cache_path_, O_WRONLY | O_CREAT, 0600);
+    ASSERT_EQ(base::WriteAll(*fd, "garbage\n", 8), 8);
+  }
+  PersistentInodeCache cache(cache_path_);
+  cache.Load();
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(PersistentInodeCacheTest, MaxEntries) {
+  struct stat a = CreateFile("a");
+  struct stat b = CreateFile("b");
+  PersistentInodeCache cache(cache_path_, /*max_entries=*/1);
+  cache.Load();
+  cache.Insert(a.st_dev, a.st_ino, InodeMapValue(kFile, {Path("a")}));
+  cache.Insert(b.st_dev, b.st_ino, InodeMapValue(kFile, {Path("b")}));
+  EXPECT_EQ(cache.size(), 1u);
+  EXPECT_NE(cache.Get(a.st_dev, a.st_ino), nullptr);
+  EXPECT_EQ(cache.Get(b.st_dev, b.st_ino), nullptr);
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -24,6 +24,7 @@
 #include "protos/perfetto/trace/ftrace/sched.pbzero.h"
 #include "src/traced/probes/ftrace/event_info_constants.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
 
 namespace perfetto {
 
@@ -261,6 +262,72 @@ void CommInterner::Reset() {
   interned_comms_size_ = 0;
 }
 
+CompactEventsBuffer::CompactEventsBuffer() = default;
+CompactEventsBuffer::~CompactEventsBuffer() = default;
+
+void CompactEventsBuffer::AppendEvent(uint64_t timestamp,
+                                      const uint8_t* start,
+                                      const EventDecoder& decoder,
+                                      const FieldDecoder& common_pid,
+                                      FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(decoder.compact);
+  Batch* batch = GetOrCreateBatch(decoder);
+  batch->timestamp.Append(timestamp - batch->last_timestamp);
+  batch->last_timestamp = timestamp;
+
+  // The common pid is read first, as reading inode fields relies on it.
+  uint64_t pid = common_pid.read(start + common_pid.ftrace_offset, metadata);
+  batch->pid.Append(static_cast<uint32_t>(pid));
+  for (const FieldDecoder& field : decoder.fields) {
+    uint64_t value = field.read(start + field.ftrace_offset, metadata);
+    batch->field_value.Append(value);
+  }
+  metadata->FinishEvent();
+}
+
+CompactEventsBuffer::Batch* CompactEventsBuffer::GetOrCreateBatch(
+    const EventDecoder& decoder) {
+  for (size_t i = 0; i < batches_used_; i++) {
+    if (batches_[i]->decoder == &decoder)
+      return batches_[i].get();
+  }
+  if (batches_used_ == batches_.size())
+    batches_.emplace_back(new Batch());
+  Batch* batch = batches_[batches_used_++].get();
+  batch->decoder = &decoder;
+  return batch;
+}
+
+void CompactEventsBuffer::Write(
+    protos::pbzero::FtraceEventBundle* bundle) const {
+  for (size_t i = 0; i < batches_used_; i++) {
+    const Batch& batch = *batches_[i];
+    auto* compact_out = bundle->add_compact_events();
+    compact_out->set_event_field_id(batch.decoder->proto_field_id);
+
+    protozero::PackedVarInt field_ids;
+    for (const FieldDecoder& field : batch.decoder->fields)
+      field_ids.Append(field.proto_field_id);
+    compact_out->set_field_id(field_ids);
+
+    compact_out->set_timestamp(batch.timestamp);
+    compact_out->set_pid(batch.pid);
+    compact_out->set_field_value(batch.field_value);
+  }
+}
+
+void CompactEventsBuffer::Reset() {
+  for (size_t i = 0; i < batches_used_; i++) {
+    Batch* batch = batches_[i].get();
+    batch->decoder = nullptr;
+    batch->last_timestamp = 0;
+    batch->timestamp.Reset();
+    batch->pid.Reset();
+    batch->field_value.Reset();
+  }
+  batches_used_ = 0;
+}
+
 void CompactSchedBuffer::WriteAndReset(
     protos::pbzero::FtraceEventBundle* bundle) {
   if (switch_.size() > 0 || waking_.size() > 0) {
@@ -276,9 +343,12 @@ void CompactSchedBuffer::WriteAndReset(
       waking_.Write(compact_out);
   }
 
+  events_.Write(bundle);
+
   interner_.Reset();
   switch_.Reset();
   waking_.Reset();
+  events_.Reset();
 }
 
 }  // namespace perfetto
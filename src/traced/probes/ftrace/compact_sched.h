@@ -19,9 +19,13 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/protozero/packed_repeated_fields.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "src/traced/probes/ftrace/event_decoder.h"
 #include "src/traced/probes/ftrace/event_info_constants.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
 
@@ -212,14 +216,55 @@ class CommInterner {
   uint32_t interned_comms_size_ = 0;
 };
 
+// Collects the fields of the events written in FtraceEventBundle.compact_events
+// (see EventDecoder::compact), in one batch per type of event.
+class CompactEventsBuffer {
+ public:
+  CompactEventsBuffer();
+  ~CompactEventsBuffer();
+
+  // Buffers the fields of the event starting at |start|, which the caller must
+  // have checked to be at least |decoder.size| long. |common_pid| is the only
+  // common field, see ProtoTranslationTable::common_field_decoders().
+  void AppendEvent(uint64_t timestamp,
+                   const uint8_t* start,
+                   const EventDecoder& decoder,
+                   const FieldDecoder& common_pid,
+                   FtraceMetadata* metadata);
+
+  void Write(protos::pbzero::FtraceEventBundle* bundle) const;
+  void Reset();
+
+ private:
+  struct Batch {
+    const EventDecoder* decoder = nullptr;
+    // As for sched_switch, the first timestamp in a bundle is absolute and the
+    // rest are relative to the preceding event of the same type.
+    uint64_t last_timestamp = 0;
+    protozero::PackedVarInt timestamp;
+    protozero::PackedVarInt pid;
+    protozero::PackedVarInt field_value;
+  };
+
+  Batch* GetOrCreateBatch(const EventDecoder& decoder);
+
+  // Only the first |batches_used_| batches hold events of the current bundle,
+  // the rest are kept around to be reused by the next ones. There are only a
+  // handful of event types per bundle, so batches are looked up linearly.
+  std::vector<std::unique_ptr<Batch>> batches_;
+  size_t batches_used_ = 0;
+};
+
 // Mutable state for buffering parts of scheduling events, that can later be
 // written out in a compact format with |WriteAndReset|. Used by the ftrace
-// reader.
+// reader. Also holds the other events that are written in a compact format
+// (see |CompactEventsBuffer|).
 class CompactSchedBuffer {
  public:
   CompactSchedSwitchBuffer& sched_switch() { return switch_; }
   CompactSchedWakingBuffer& sched_waking() { return waking_; }
   CommInterner& interner() { return interner_; }
+  CompactEventsBuffer& events() { return events_; }
 
   // Writes out the currently buffered events, and starts the next batch
   // internally.
@@ -229,6 +274,7 @@ class CompactSchedBuffer {
   CommInterner interner_;
   CompactSchedSwitchBuffer switch_;
   CompactSchedWakingBuffer waking_;
+  CompactEventsBuffer events_;
 };
 
 }  // namespace perfetto
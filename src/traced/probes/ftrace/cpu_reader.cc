@@ -34,6 +34,7 @@
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/cpu_stats_parser.h"
+#include "src/traced/probes/ftrace/event_decoder.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
@@ -171,6 +172,7 @@ CpuReader::CpuReader(size_t cpu,
       trace_fd_(std::move(trace_fd)) {
   PERFETTO_CHECK(trace_fd_);
   PERFETTO_CHECK(SetBlocking(*trace_fd_, false));
+  splice_pipe_ = base::Pipe::Create(base::Pipe::kBothNonBlock);
 }
 
 CpuReader::~CpuReader() = default;
@@ -222,6 +224,17 @@ size_t CpuReader::ReadAndProcessBatch(
                                metatrace::FTRACE_CPU_READ_BATCH);
     for (; pages_read < max_pages;) {
       uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
+
+      // Fast path: grab all the fully written pages in one go. Once there are
+      // none left, fall back to read(), which also returns the events of the
+      // page that is still being written (or the remainder of a page that a
+      // previous read() consumed partially, as splice() won't return it).
+      size_t pages_spliced = SpliceFullPages(curr_page, max_pages - pages_read);
+      if (pages_spliced) {
+        pages_read += pages_spliced;
+        continue;
+      }
+
       ssize_t res =
           PERFETTO_EINTR(read(*trace_fd_, curr_page, base::kPageSize));
       if (res < 0) {
@@ -285,14 +298,19 @@ size_t CpuReader::ReadAndProcessBatch(
 
   // Parse the pages and write to the trace for all relevant data
   // sources.
-  if (pages_read == 0)
+  if (pages_read == 0 || started_data_sources.empty())
     return pages_read;
 
+  // Walk the ring buffer records only once, regardless of the number of data
+  // sources. Each data source then applies its own event filter and encoding
+  // to the decoded events.
+  DecodePages(parsing_buf, pages_read, table_, &decoded_pages_);
+
   for (FtraceDataSource* data_source : started_data_sources) {
     size_t pages_parsed_ok = ProcessPagesForDataSource(
         data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
-        data_source->parsing_config(), parsing_buf, pages_read, table_,
-        symbolizer_, ftrace_clock_snapshot_, ftrace_clock_);
+        data_source->parsing_config(), decoded_pages_, table_, symbolizer_,
+        ftrace_clock_snapshot_, ftrace_clock_);
     // If this happens, it means that we did not know how to parse the kernel
     // binary format. This is a bug in either perfetto or the kernel, and must
     // be investigated. Hence we abort instead of recording a bit in the ftrace
@@ -309,6 +327,83 @@ size_t CpuReader::ReadAndProcessBatch(
   return pages_read;
 }
 
+size_t CpuReader::SpliceFullPages(uint8_t* dst, size_t max_pages) {
+  if (!splice_pipe_.wr)
+    return 0;
+
+  // The kernel only splices out pages that are no longer being written into,
+  // so this always moves whole pages. The amount is also limited by the pipe
+  // capacity (16 pages by default).
+  ssize_t spliced = PERFETTO_EINTR(
+      splice(*trace_fd_, nullptr, *splice_pipe_.wr, nullptr,
+             max_pages * base::kPageSize, SPLICE_F_NONBLOCK));
+  if (spliced <= 0) {
+    // EINVAL: splice() is not supported for this fd (or kernel). Don't try
+    // again. Other errors are transient, see ReadAndProcessBatch().
+    if (spliced < 0 && errno == EINVAL) {
+      PERFETTO_DLOG("[cpu%zu]: splice() not supported, using read()", cpu_);
+      splice_pipe_ = base::Pipe();
+    }
+    return 0;
+  }
+
+  // |max_pages| of room in |dst| is enough for whatever was spliced.
+  size_t bytes_read = 0;
+  while (bytes_read < static_cast<size_t>(spliced)) {
+    ssize_t res = PERFETTO_EINTR(read(*splice_pipe_.rd, dst + bytes_read,
+                                      static_cast<size_t>(spliced) -
+                                          bytes_read));
+    if (res <= 0) {
+      // Shouldn't happen, the data is already in the pipe. Give up on splice()
+      // and drop whatever is left in the pipe, rather than returning it out of
+      // order on the next call.
+      PERFETTO_PLOG("[cpu%zu]: read() from the splice pipe failed", cpu_);
+      splice_pipe_ = base::Pipe();
+      break;
+    }
+    bytes_read += static_cast<size_t>(res);
+  }
+
+  // The kernel should never splice out a partial ftrace page. If it does (or
+  // |trace_fd_| isn't a ftrace buffer), the tail can't be parsed on its own:
+  // drop it and use read() from now on, which always returns whole pages.
+  if (static_cast<size_t>(spliced) % base::kPageSize != 0 && splice_pipe_.wr) {
+    PERFETTO_ELOG("[cpu%zu]: splice() returned a partial page (%zd bytes)",
+                  cpu_, spliced);
+    splice_pipe_ = base::Pipe();
+  }
+  return bytes_read / base::kPageSize;
+}
+
+// static
+void CpuReader::DecodePages(const uint8_t* parsing_buf,
+                            size_t pages_read,
+                            const ProtoTranslationTable* table,
+                            DecodedPages* decoded) {
+  decoded->Clear();
+  for (size_t i = 0; i < pages_read; i++) {
+    const uint8_t* curr_page = parsing_buf + (i * base::kPageSize);
+    const uint8_t* curr_page_end = curr_page + base::kPageSize;
+    const uint8_t* parse_pos = curr_page;
+    base::Optional<PageHeader> page_header =
+        ParsePageHeader(&parse_pos, table->page_header_size_len());
+
+    if (!page_header.has_value() || page_header->size == 0 ||
+        parse_pos >= curr_page_end ||
+        parse_pos + page_header->size > curr_page_end) {
+      break;
+    }
+
+    size_t evt_size =
+        DecodePagePayload(parse_pos, &page_header.value(), &decoded->events);
+    if (evt_size != page_header->size)
+      break;
+
+    decoded->pages.emplace_back(
+        DecodedPages::Page{page_header->lost_events, decoded->events.size()});
+  }
+}
+
 // static
 size_t CpuReader::ProcessPagesForDataSource(
     TraceWriter* trace_writer,
@@ -321,10 +416,29 @@ size_t CpuReader::ProcessPagesForDataSource(
     LazyKernelSymbolizer* symbolizer,
     const FtraceClockSnapshot* ftrace_clock_snapshot,
     protos::pbzero::FtraceClock ftrace_clock) {
+  DecodedPages decoded;
+  DecodePages(parsing_buf, pages_read, table, &decoded);
+  return ProcessPagesForDataSource(trace_writer, metadata, cpu, ds_config,
+                                   decoded, table, symbolizer,
+                                   ftrace_clock_snapshot, ftrace_clock);
+}
+
+// static
+size_t CpuReader::ProcessPagesForDataSource(
+    TraceWriter* trace_writer,
+    FtraceMetadata* metadata,
+    size_t cpu,
+    const FtraceDataSourceConfig* ds_config,
+    const DecodedPages& decoded,
+    const ProtoTranslationTable* table,
+    LazyKernelSymbolizer* symbolizer,
+    const FtraceClockSnapshot* ftrace_clock_snapshot,
+    protos::pbzero::FtraceClock ftrace_clock) {
   // Allocate the buffer for compact scheduler events (which will be unused if
   // the compact option isn't enabled).
   CompactSchedBuffer compact_sched;
   bool compact_sched_enabled = ds_config->compact_sched.enabled;
+  bool compact_enabled = compact_sched_enabled || ds_config->compact_events;
 
   TraceWriter::TracePacketHandle packet;
   protos::pbzero::FtraceEventBundle* bundle = nullptr;
@@ -332,7 +446,7 @@ size_t CpuReader::ProcessPagesForDataSource(
   // This function is called after the contents of a FtraceBundle are written.
   auto finalize_cur_packet = [&] {
     PERFETTO_DCHECK(packet);
-    if (compact_sched_enabled)
+    if (compact_enabled)
       compact_sched.WriteAndReset(bundle);
 
     bundle->Finalize();
@@ -420,18 +534,11 @@ size_t CpuReader::ProcessPagesForDataSource(
 
   start_new_packet(/*lost_events=*/false);
   size_t pages_parsed = 0;
-  for (; pages_parsed < pages_read; pages_parsed++) {
-    const uint8_t* curr_page = parsing_buf + (pages_parsed * base::kPageSize);
-    const uint8_t* curr_page_end = curr_page + base::kPageSize;
-    const uint8_t* parse_pos = curr_page;
-    base::Optional<PageHeader> page_header =
-        ParsePageHeader(&parse_pos, table->page_header_size_len());
-
-    if (!page_header.has_value() || page_header->size == 0 ||
-        parse_pos >= curr_page_end ||
-        parse_pos + page_header->size > curr_page_end) {
-      break;
-    }
+  const DecodedEvent* page_events = decoded.events.data();
+  for (; pages_parsed < decoded.pages.size(); pages_parsed++) {
+    const DecodedPages::Page& page = decoded.pages[pages_parsed];
+    const DecodedEvent* page_events_end =
+        decoded.events.data() + page.events_end;
 
     // Start a new bundle if either:
     // * The page we're about to read indicates that there was a kernel ring
@@ -445,16 +552,14 @@ size_t CpuReader::ProcessPagesForDataSource(
         compact_sched.interner().interned_comms_size() >
             kCompactSchedInternerThreshold;
 
-    if (page_header->lost_events || interner_past_threshold)
-      start_new_packet(page_header->lost_events);
+    if (page.lost_events || interner_past_threshold)
+      start_new_packet(page.lost_events);
 
-    size_t evt_size =
-        ParsePagePayload(parse_pos, &page_header.value(), table, ds_config,
-                         &compact_sched, bundle, metadata);
-
-    if (evt_size != page_header->size) {
+    if (!WriteDecodedEvents(page_events, page_events_end, table, ds_config,
+                            &compact_sched, bundle, metadata)) {
       break;
     }
+    page_events = page_events_end;
   }
   finalize_cur_packet();
 
@@ -518,13 +623,9 @@ base::Optional<CpuReader::PageHeader> CpuReader::ParsePageHeader(
 // binary ftrace events. See |ParsePageHeader| for the format of the earlier.
 //
 // This method is deliberately static so it can be tested independently.
-size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
-                                   const PageHeader* page_header,
-                                   const ProtoTranslationTable* table,
-                                   const FtraceDataSourceConfig* ds_config,
-                                   CompactSchedBuffer* compact_sched_buffer,
-                                   FtraceEventBundle* bundle,
-                                   FtraceMetadata* metadata) {
+size_t CpuReader::DecodePagePayload(const uint8_t* start_of_payload,
+                                    const PageHeader* page_header,
+                                    std::vector<DecodedEvent>* events) {
   const uint8_t* ptr = start_of_payload;
   const uint8_t* const end = ptr + page_header->size;
 
@@ -613,42 +714,8 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
         if (!ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
           return 0;
 
-        if (ds_config->event_filter.IsEventEnabled(ftrace_event_id)) {
-          // Special-cased handling of some scheduler events when compact format
-          // is enabled.
-          bool compact_sched_enabled = ds_config->compact_sched.enabled;
-          const CompactSchedSwitchFormat& sched_switch_format =
-              table->compact_sched_format().sched_switch;
-          const CompactSchedWakingFormat& sched_waking_format =
-              table->compact_sched_format().sched_waking;
-
-          // compact sched_switch
-          if (compact_sched_enabled &&
-              ftrace_event_id == sched_switch_format.event_id) {
-            if (event_size < sched_switch_format.size)
-              return 0;
-
-            ParseSchedSwitchCompact(start, timestamp, &sched_switch_format,
-                                    compact_sched_buffer, metadata);
-
-            // compact sched_waking
-          } else if (compact_sched_enabled &&
-                     ftrace_event_id == sched_waking_format.event_id) {
-            if (event_size < sched_waking_format.size)
-              return 0;
-
-            ParseSchedWakingCompact(start, timestamp, &sched_waking_format,
-                                    compact_sched_buffer, metadata);
-
-          } else {
-            // Common case: parse all other types of enabled events.
-            protos::pbzero::FtraceEvent* event = bundle->add_event();
-            event->set_timestamp(timestamp);
-            if (!ParseEvent(ftrace_event_id, start, next, table, event,
-                            metadata))
-              return 0;
-          }
-        }
+        events->push_back(
+            DecodedEvent{timestamp, start, next, ftrace_event_id});
 
         // Jump to next event.
         ptr = next;
@@ -658,6 +725,95 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
   return static_cast<size_t>(ptr - start_of_payload);
 }
 
+// static
+bool CpuReader::WriteDecodedEvents(const DecodedEvent* begin,
+                                   const DecodedEvent* end,
+                                   const ProtoTranslationTable* table,
+                                   const FtraceDataSourceConfig* ds_config,
+                                   CompactSchedBuffer* compact_sched_buffer,
+                                   FtraceEventBundle* bundle,
+                                   FtraceMetadata* metadata) {
+  // Special-cased handling of some scheduler events when compact format is
+  // enabled.
+  bool compact_sched_enabled = ds_config->compact_sched.enabled;
+  const CompactSchedSwitchFormat& sched_switch_format =
+      table->compact_sched_format().sched_switch;
+  const CompactSchedWakingFormat& sched_waking_format =
+      table->compact_sched_format().sched_waking;
+
+  // Other high frequency events, whose fields are all integers, when the
+  // generic compact format is enabled.
+  bool compact_events_enabled = ds_config->compact_events;
+
+  for (const DecodedEvent* evt = begin; evt != end; evt++) {
+    const uint16_t ftrace_event_id = evt->ftrace_event_id;
+    if (!ds_config->event_filter.IsEventEnabled(ftrace_event_id))
+      continue;
+
+    const size_t event_size = static_cast<size_t>(evt->end - evt->start);
+    const EventDecoder* compact_decoder = nullptr;
+    if (compact_events_enabled) {
+      compact_decoder = table->GetEventDecoder(ftrace_event_id);
+      if (compact_decoder && !compact_decoder->compact)
+        compact_decoder = nullptr;
+    }
+
+    // compact sched_switch
+    if (compact_sched_enabled &&
+        ftrace_event_id == sched_switch_format.event_id) {
+      if (event_size < sched_switch_format.size)
+        return false;
+
+      ParseSchedSwitchCompact(evt->start, evt->timestamp, &sched_switch_format,
+                              compact_sched_buffer, metadata);
+
+      // compact sched_waking
+    } else if (compact_sched_enabled &&
+               ftrace_event_id == sched_waking_format.event_id) {
+      if (event_size < sched_waking_format.size)
+        return false;
+
+      ParseSchedWakingCompact(evt->start, evt->timestamp, &sched_waking_format,
+                              compact_sched_buffer, metadata);
+
+      // other compact events
+    } else if (compact_decoder) {
+      if (event_size < compact_decoder->size)
+        return false;
+
+      compact_sched_buffer->events().AppendEvent(
+          evt->timestamp, evt->start, *compact_decoder,
+          table->common_field_decoders()[0], metadata);
+
+    } else {
+      // Common case: parse all other types of enabled events.
+      protos::pbzero::FtraceEvent* event = bundle->add_event();
+      event->set_timestamp(evt->timestamp);
+      if (!ParseEvent(ftrace_event_id, evt->start, evt->end, table, event,
+                      metadata))
+        return false;
+    }
+  }
+  return true;
+}
+
+// static
+size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
+                                   const PageHeader* page_header,
+                                   const ProtoTranslationTable* table,
+                                   const FtraceDataSourceConfig* ds_config,
+                                   CompactSchedBuffer* compact_sched_buffer,
+                                   FtraceEventBundle* bundle,
+                                   FtraceMetadata* metadata) {
+  std::vector<DecodedEvent> events;
+  size_t evt_size = DecodePagePayload(start_of_payload, page_header, &events);
+  if (!WriteDecodedEvents(events.data(), events.data() + events.size(), table,
+                          ds_config, compact_sched_buffer, bundle, metadata)) {
+    return 0;
+  }
+  return evt_size;
+}
+
 // |start| is the start of the current event.
 // |end| is the end of the buffer.
 bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
@@ -679,6 +835,49 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
     return false;
   }
 
+  bool success = true;
+  const EventDecoder* decoder = table->GetEventDecoder(ftrace_event_id);
+  if (PERFETTO_LIKELY(decoder)) {
+    // Fast path: all the fields are fixed size and within |info.size|, and
+    // their translation strategy has been resolved ahead of time.
+    for (const FieldDecoder& field : table->common_field_decoders()) {
+      field.decode(start + field.ftrace_offset, field.ftrace_size,
+                   field.proto_field_id, message, metadata);
+    }
+    protozero::Message* nested =
+        message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
+    for (const FieldDecoder& field : decoder->fields) {
+      field.decode(start + field.ftrace_offset, field.ftrace_size,
+                   field.proto_field_id, nested, metadata);
+    }
+  } else {
+    success = ParseEventFields(info, start, end, table, message, metadata);
+  }
+
+  if (PERFETTO_UNLIKELY(info.proto_field_id ==
+                        protos::pbzero::FtraceEvent::kTaskRenameFieldNumber)) {
+    // For task renames, we want to store that the pid was renamed. We use the
+    // common pid to reduce code complexity as in all the cases we care about,
+    // the common pid is the same as the renamed pid (the pid inside the event).
+    PERFETTO_DCHECK(metadata->last_seen_common_pid);
+    metadata->AddRenamePid(metadata->last_seen_common_pid);
+  }
+
+  // This finalizes |nested| and |proto_field| automatically.
+  message->Finalize();
+  metadata->FinishEvent();
+  return success;
+}
+
+// Slow path of ParseEvent(), for the events without an EventDecoder: switches
+// on the translation strategy of each field.
+// static
+bool CpuReader::ParseEventFields(const Event& info,
+                                 const uint8_t* start,
+                                 const uint8_t* end,
+                                 const ProtoTranslationTable* table,
+                                 protozero::Message* message,
+                                 FtraceMetadata* metadata) {
   bool success = true;
   for (const Field& field : table->common_fields())
     success &= ParseField(field, start, end, table, message, metadata);
@@ -702,19 +901,6 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
       success &= ParseField(field, start, end, table, nested, metadata);
     }
   }
-
-  if (PERFETTO_UNLIKELY(info.proto_field_id ==
-                        protos::pbzero::FtraceEvent::kTaskRenameFieldNumber)) {
-    // For task renames, we want to store that the pid was renamed. We use the
-    // common pid to reduce code complexity as in all the cases we care about,
-    // the common pid is the same as the renamed pid (the pid inside the event).
-    PERFETTO_DCHECK(metadata->last_seen_common_pid);
-    metadata->AddRenamePid(metadata->last_seen_common_pid);
-  }
-
-  // This finalizes |nested| and |proto_field| automatically.
-  message->Finalize();
-  metadata->FinishEvent();
   return success;
 }
 
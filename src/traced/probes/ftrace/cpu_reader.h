@@ -25,6 +25,7 @@
 #include <memory>
 #include <set>
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -66,6 +67,37 @@ class CpuReader {
     bool lost_events;
   };
 
+  // A data record (i.e. a single ftrace event) of a raw ftrace page, as found
+  // by DecodePagePayload(). Points into the page it was decoded from.
+  struct DecodedEvent {
+    uint64_t timestamp;
+    // Start and end of the record, |start| points to the common fields.
+    const uint8_t* start;
+    const uint8_t* end;
+    uint16_t ftrace_event_id;
+  };
+
+  // The events of a range of contiguous raw ftrace pages. The pages are
+  // decoded once and then written out for each data source that is reading
+  // from this cpu, applying the data source's own filter and encoding.
+  struct DecodedPages {
+    struct Page {
+      bool lost_events;
+      // Index, in |events|, one past the last event of this page. The first
+      // event of the page is at the previous page's |events_end| (or 0).
+      size_t events_end;
+    };
+
+    void Clear() {
+      pages.clear();
+      events.clear();
+    }
+
+    // Only the pages up until the first malformed one (if any).
+    std::vector<Page> pages;
+    std::vector<DecodedEvent> events;
+  };
+
   CpuReader(size_t cpu,
             const ProtoTranslationTable* table,
             LazyKernelSymbolizer* symbolizer,
@@ -178,6 +210,32 @@ class CpuReader {
       const uint8_t** ptr,
       uint16_t page_header_size_len);
 
+  // Walks the records of the payload of a raw ftrace page, appending its data
+  // records to |events|. Returns the number of bytes decoded, which is 0 if
+  // the page is malformed. The caller is responsible for validating that the
+  // page_header->size stays within the current page.
+  static size_t DecodePagePayload(const uint8_t* start_of_payload,
+                                  const PageHeader* page_header,
+                                  std::vector<DecodedEvent>* events);
+
+  // Decodes the range of |pages_read| contiguous tracing pages starting at
+  // |parsing_buf| into |decoded|, stopping at the first malformed page.
+  static void DecodePages(const uint8_t* parsing_buf,
+                          size_t pages_read,
+                          const ProtoTranslationTable* table,
+                          DecodedPages* decoded);
+
+  // Writes the decoded events in the range [|begin|, |end|) that are enabled
+  // in |ds_config| as protos into the provided bundle (and/or compact buffer).
+  // Returns false if any of them can't be parsed.
+  static bool WriteDecodedEvents(const DecodedEvent* begin,
+                                 const DecodedEvent* end,
+                                 const ProtoTranslationTable* table,
+                                 const FtraceDataSourceConfig* ds_config,
+                                 CompactSchedBuffer* compact_sched_buffer,
+                                 FtraceEventBundle* bundle,
+                                 FtraceMetadata* metadata);
+
   // Parse the payload of a raw ftrace page, and write the events as protos
   // into the provided bundle (and/or compact buffer).
   // |table| contains the mix of compile time (e.g. proto field ids) and
@@ -208,6 +266,16 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  // Parses the common and event specific fields of an event that has no
+  // specialized EventDecoder in |table|, switching on the translation strategy
+  // of each field. Called by ParseEvent().
+  static bool ParseEventFields(const Event& info,
+                               const uint8_t* start,
+                               const uint8_t* end,
+                               const ProtoTranslationTable* table,
+                               protozero::Message* message,
+                               FtraceMetadata* metadata);
+
   static bool ParseField(const Field& field,
                          const uint8_t* start,
                          const uint8_t* end,
@@ -231,14 +299,28 @@ class CpuReader {
                                       CompactSchedBuffer* compact_buf,
                                       FtraceMetadata* metadata);
 
-  // Parses & encodes the given range of contiguous tracing pages. Called by
-  // |ReadAndProcessBatch| for each active data source.
+  // Encodes the given decoded pages. Called by |ReadAndProcessBatch| for each
+  // active data source.
   //
   // Returns the number of correctly processed pages. If the return value is
-  // equal to |pages_read|, there was no error. Otherwise, the return value
-  // points to the first page that contains an error.
+  // equal to the number of pages in |decoded|, there was no error. Otherwise,
+  // the return value points to the first page that contains an error.
   //
   // public and static for testing
+  static size_t ProcessPagesForDataSource(
+      TraceWriter* trace_writer,
+      FtraceMetadata* metadata,
+      size_t cpu,
+      const FtraceDataSourceConfig* ds_config,
+      const DecodedPages& decoded,
+      const ProtoTranslationTable* table,
+      LazyKernelSymbolizer* symbolizer,
+      const FtraceClockSnapshot*,
+      protos::pbzero::FtraceClock);
+
+  // As above, but decodes the range of |pages_read| contiguous tracing pages
+  // starting at |parsing_buf| first. If the return value is not equal to
+  // |pages_read|, it points to the first page that contains an error.
   static size_t ProcessPagesForDataSource(
       TraceWriter* trace_writer,
       FtraceMetadata* metadata,
@@ -269,11 +351,23 @@ class CpuReader {
       bool first_batch_in_cycle,
       const std::set<FtraceDataSource*>& started_data_sources);
 
+  // Moves up to |max_pages| fully written pages from the ftrace buffer into
+  // |dst| with a single splice() into |splice_pipe_| and a single read() out of
+  // it, rather than one read() per page. Returns the number of pages moved,
+  // which is 0 if there are no full pages (i.e. only the page the kernel is
+  // currently writing into has data) or if splicing is not supported. Switches
+  // to read() for good if the spliced data isn't made of whole pages.
+  size_t SpliceFullPages(uint8_t* dst, size_t max_pages);
+
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
   LazyKernelSymbolizer* const symbolizer_;
   const FtraceClockSnapshot* const ftrace_clock_snapshot_;
   base::ScopedFile trace_fd_;
+  // Invalid if splice() is not supported, see SpliceFullPages().
+  base::Pipe splice_pipe_;
+  // Reused across batches to avoid reallocating, see ReadAndProcessBatch().
+  DecodedPages decoded_pages_;
   protos::pbzero::FtraceClock ftrace_clock_{};
 };
 
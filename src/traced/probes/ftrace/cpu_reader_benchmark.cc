@@ -321,7 +321,8 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
                                    DisabledCompactSchedConfigForTesting(),
                                    {},
                                    {},
-                                   false /*symbolize_ksyms*/};
+                                   false /*symbolize_ksyms*/,
+                                   false /*compact_events*/};
   ds_config.event_filter.AddEnabledEvent(
       table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
 
@@ -346,3 +347,49 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+// Decodes the page once and writes it out for |state.range(0)| data sources,
+// like CpuReader does when several tracing sessions use ftrace concurrently.
+static void BM_ParsePageFullOfSchedSwitchForDataSources(
+    benchmark::State& state) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  const size_t num_data_sources = static_cast<size_t>(state.range(0));
+
+  ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> writer;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/,
+                                   false /*compact_events*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceMetadata metadata{};
+  CpuReader::DecodedPages decoded;
+  while (state.KeepRunning()) {
+    CpuReader::DecodePages(page.get(), 1, table, &decoded);
+    if (decoded.pages.size() != 1)
+      return;
+
+    for (size_t i = 0; i < num_data_sources; i++) {
+      writer.Reset(&stream);
+      std::unique_ptr<CompactSchedBuffer> compact_buffer(
+          new CompactSchedBuffer());
+      const auto& events = decoded.events;
+      CpuReader::WriteDecodedEvents(events.data(),
+                                    events.data() + events.size(), table,
+                                    &ds_config, compact_buffer.get(), &writer,
+                                    &metadata);
+      metadata.Clear();
+    }
+  }
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitchForDataSources)->Arg(1)->Arg(2)->Arg(4);
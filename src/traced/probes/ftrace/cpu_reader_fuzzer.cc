@@ -59,7 +59,8 @@ void FuzzCpuReaderProcessPagesForDataSource(const uint8_t* data, size_t size) {
                                    DisabledCompactSchedConfigForTesting(),
                                    {},
                                    {},
-                                   /*symbolize_ksyms=*/false};
+                                   /*symbolize_ksyms=*/false,
+                                   /*compact_events=*/false};
   ds_config.event_filter.AddEnabledEvent(
       table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
   ds_config.event_filter.AddEnabledEvent(
@@ -18,8 +18,10 @@
 
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/pipe.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -54,7 +56,9 @@ using testing::ElementsAre;
 using testing::ElementsAreArray;
 using testing::EndsWith;
 using testing::Eq;
+using testing::IsEmpty;
 using testing::NiceMock;
+using testing::Not;
 using testing::Pair;
 using testing::Return;
 using testing::StartsWith;
@@ -69,7 +73,8 @@ FtraceDataSourceConfig EmptyConfig() {
                                 DisabledCompactSchedConfigForTesting(),
                                 {},
                                 {},
-                                false /*symbolize_ksyms*/};
+                                false /*symbolize_ksyms*/,
+                                false /*compact_events*/};
 }
 
 constexpr uint64_t kNanoInSecond = 1000 * 1000 * 1000;
@@ -867,7 +872,8 @@ TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
                                    EnabledCompactSchedConfigForTesting(),
                                    {},
                                    {},
-                                   false /* symbolize_ksyms*/};
+                                   false /* symbolize_ksyms*/,
+                                   false /*compact_events*/};
   ds_config.event_filter.AddEnabledEvent(
       table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
 
@@ -1332,6 +1338,110 @@ TEST(CpuReaderTest, ProcessPagesForDataSourceError) {
   EXPECT_EQ(processed_pages, 3u);
 }
 
+// Reads pages through splice() and read(), from a pipe standing in for the
+// per-cpu trace_pipe_raw file.
+TEST(CpuReaderTest, ReadCycleFromPipe) {
+  auto page = PageFromXxd(g_switch_page);
+  ProtoTranslationTable* table = GetTable("synthetic");
+  base::Pipe trace_pipe = base::Pipe::Create();
+  CpuReader cpu_reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                       /*ftrace_clock_snapshot=*/nullptr,
+                       std::move(trace_pipe.rd));
+
+  static constexpr size_t kTestPages = 4;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[base::kPageSize * kTestPages]());
+  auto write_to_pipe = [&trace_pipe](const void* data, size_t size) {
+    ASSERT_EQ(static_cast<ssize_t>(size), write(*trace_pipe.wr, data, size));
+  };
+
+  // Whole pages are spliced out in one go.
+  for (size_t i = 0; i < 3; i++)
+    write_to_pipe(page.get(), base::kPageSize);
+  EXPECT_EQ(3u, cpu_reader.ReadCycle(buf.get(), kTestPages, kTestPages, {}));
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(0, memcmp(buf.get() + i * base::kPageSize, page.get(),
+                        base::kPageSize));
+  }
+  EXPECT_EQ(0u, cpu_reader.ReadCycle(buf.get(), kTestPages, kTestPages, {}));
+
+  // A partial page can't come out of a real ftrace buffer. It must not crash:
+  // the whole page is returned and the tail is dropped.
+  memset(buf.get(), 0, base::kPageSize * kTestPages);
+  write_to_pipe(page.get(), base::kPageSize);
+  write_to_pipe(page.get(), 100);
+  EXPECT_EQ(1u, cpu_reader.ReadCycle(buf.get(), kTestPages, kTestPages, {}));
+  EXPECT_EQ(0, memcmp(buf.get(), page.get(), base::kPageSize));
+
+  // From then on, pages are read() one at a time.
+  memset(buf.get(), 0, base::kPageSize * kTestPages);
+  write_to_pipe(page.get(), base::kPageSize);
+  EXPECT_EQ(1u, cpu_reader.ReadCycle(buf.get(), kTestPages, kTestPages, {}));
+  EXPECT_EQ(0, memcmp(buf.get(), page.get(), base::kPageSize));
+}
+
+TEST(CpuReaderTest, ProcessDecodedPagesForMultipleDataSources) {
+  auto page_ok = PageFromXxd(g_switch_page);
+  auto page_loss = PageFromXxd(g_switch_page_lost_events);
+  auto page_err = PageFromXxd(g_invalid_page);
+
+  std::vector<const void*> test_page_order = {page_ok.get(), page_loss.get(),
+                                              page_ok.get(), page_err.get()};
+
+  static constexpr size_t kTestPages = 4;
+
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[base::kPageSize * kTestPages]());
+  for (size_t i = 0; i < kTestPages; i++) {
+    void* dest = buf.get() + (i * base::kPageSize);
+    memcpy(dest, static_cast<const void*>(test_page_order[i]), base::kPageSize);
+  }
+
+  ProtoTranslationTable* table = GetTable("synthetic");
+  CpuReader::DecodedPages decoded;
+  CpuReader::DecodePages(buf.get(), kTestPages, table, &decoded);
+
+  // Decoding stops at the first invalid page.
+  ASSERT_EQ(decoded.pages.size(), 3u);
+  EXPECT_FALSE(decoded.pages[0].lost_events);
+  EXPECT_TRUE(decoded.pages[1].lost_events);
+  EXPECT_EQ(decoded.pages[2].events_end, decoded.events.size());
+
+  // The same decoded pages are written out for both data sources, each with
+  // its own event filter.
+  FtraceMetadata switch_metadata{};
+  FtraceDataSourceConfig switch_config = EmptyConfig();
+  switch_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  TraceWriterForTesting switch_writer;
+  size_t processed_pages = CpuReader::ProcessPagesForDataSource(
+      &switch_writer, &switch_metadata, /*cpu=*/1, &switch_config, decoded,
+      table, /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+  EXPECT_EQ(processed_pages, 3u);
+
+  FtraceMetadata empty_metadata{};
+  FtraceDataSourceConfig empty_config = EmptyConfig();
+  TraceWriterForTesting empty_writer;
+  processed_pages = CpuReader::ProcessPagesForDataSource(
+      &empty_writer, &empty_metadata, /*cpu=*/1, &empty_config, decoded, table,
+      /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
+      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+  EXPECT_EQ(processed_pages, 3u);
+
+  // [1 event] [2 events], split because of the lost events.
+  auto switch_packets = switch_writer.GetAllTracePackets();
+  ASSERT_EQ(2u, switch_packets.size());
+  EXPECT_EQ(1u, switch_packets[0].ftrace_events().event().size());
+  EXPECT_TRUE(switch_packets[1].ftrace_events().lost_events());
+  EXPECT_EQ(2u, switch_packets[1].ftrace_events().event().size());
+  EXPECT_THAT(switch_metadata.pids, Not(IsEmpty()));
+
+  auto empty_packets = empty_writer.GetAllTracePackets();
+  ASSERT_EQ(2u, empty_packets.size());
+  EXPECT_EQ(0u, empty_packets[0].ftrace_events().event().size());
+  EXPECT_EQ(0u, empty_packets[1].ftrace_events().event().size());
+  EXPECT_THAT(empty_metadata.pids, IsEmpty());
+}
+
 // Page containing an absolute timestamp (RINGBUF_TYPE_TIME_STAMP).
 static char g_abs_timestamp[] =
     R"(
@@ -2566,6 +2676,65 @@ TEST(CpuReaderTest, ParseExt4WithOverwrite) {
   ASSERT_TRUE(bundle);
 }
 
+TEST(CpuReaderTest, ParseExt4CompactEvents) {
+  const ExamplePage* test_case = &g_full_page_ext4;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  // Parses the page with all the events enabled, returning the bundle.
+  auto parse_page = [&](bool compact_events) {
+    BundleProvider bundle_provider(base::kPageSize);
+    FtraceDataSourceConfig ds_config{EventFilter{},
+                                     EventFilter{},
+                                     DisabledCompactSchedConfigForTesting(),
+                                     {},
+                                     {},
+                                     false /*symbolize_ksyms*/,
+                                     compact_events};
+    for (size_t id = 1; id <= table->largest_id(); id++)
+      ds_config.event_filter.AddEnabledEvent(id);
+
+    FtraceMetadata metadata{};
+    std::unique_ptr<CompactSchedBuffer> compact_buffer(
+        new CompactSchedBuffer());
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    EXPECT_TRUE(page_header.has_value());
+
+    size_t evt_bytes = CpuReader::ParsePagePayload(
+        parse_pos, &page_header.value(), table, &ds_config,
+        compact_buffer.get(), bundle_provider.writer(), &metadata);
+    EXPECT_LT(0u, evt_bytes);
+
+    compact_buffer->WriteAndReset(bundle_provider.writer());
+    bundle_provider.writer()->Finalize();
+    return bundle_provider.ParseProto();
+  };
+
+  auto bundle = parse_page(/*compact_events=*/false);
+  ASSERT_TRUE(bundle);
+  EXPECT_EQ(0u, bundle->compact_events().size());
+  size_t num_events = bundle->event().size();
+  EXPECT_LT(0u, num_events);
+
+  auto compact_bundle = parse_page(/*compact_events=*/true);
+  ASSERT_TRUE(compact_bundle);
+  ASSERT_LT(0u, compact_bundle->compact_events().size());
+
+  // Events with non-integer fields are still written as FtraceEvent protos.
+  size_t num_compact_events = 0;
+  for (const auto& compact : compact_bundle->compact_events()) {
+    size_t batch_size = compact.timestamp().size();
+    EXPECT_LT(0u, batch_size);
+    EXPECT_EQ(batch_size, compact.pid().size());
+    EXPECT_EQ(batch_size * compact.field_id().size(),
+              compact.field_value().size());
+    num_compact_events += batch_size;
+  }
+  EXPECT_EQ(num_events, num_compact_events + compact_bundle->event().size());
+}
+
 // Page with a single event containing a __data_loc entry with value 0x0000
 //
 //            [timestamp            ] [32 byte payload next ]
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_decoder.h"
+
+#include <string.h>
+
+#include <type_traits>
+
+#include "perfetto/protozero/message.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+template <typename T>
+void DecodeVarInt(const uint8_t* field_start,
+                  uint16_t,
+                  uint32_t field_id,
+                  protozero::Message* out,
+                  FtraceMetadata*) {
+  CpuReader::ReadIntoVarInt<T>(field_start, field_id, out);
+}
+
+void DecodeFixedCString(const uint8_t* field_start,
+                        uint16_t ftrace_size,
+                        uint32_t field_id,
+                        protozero::Message* out,
+                        FtraceMetadata*) {
+  const char* str = reinterpret_cast<const char*>(field_start);
+  out->AppendBytes(field_id, str, strnlen(str, ftrace_size));
+}
+
+template <typename T>
+void DecodeInode(const uint8_t* field_start,
+                 uint16_t,
+                 uint32_t field_id,
+                 protozero::Message* out,
+                 FtraceMetadata* metadata) {
+  CpuReader::ReadInode<T>(field_start, field_id, out, metadata);
+}
+
+template <typename T>
+void DecodeDevId(const uint8_t* field_start,
+                 uint16_t,
+                 uint32_t field_id,
+                 protozero::Message* out,
+                 FtraceMetadata* metadata) {
+  CpuReader::ReadDevId<T>(field_start, field_id, out, metadata);
+}
+
+void DecodePid(const uint8_t* field_start,
+               uint16_t,
+               uint32_t field_id,
+               protozero::Message* out,
+               FtraceMetadata* metadata) {
+  CpuReader::ReadPid(field_start, field_id, out, metadata);
+}
+
+void DecodeCommonPid(const uint8_t* field_start,
+                     uint16_t,
+                     uint32_t field_id,
+                     protozero::Message* out,
+                     FtraceMetadata* metadata) {
+  CpuReader::ReadCommonPid(field_start, field_id, out, metadata);
+}
+
+void DecodeSymbolAddr(const uint8_t* field_start,
+                      uint16_t,
+                      uint32_t field_id,
+                      protozero::Message* out,
+                      FtraceMetadata* metadata) {
+  CpuReader::ReadSymbolAddr<uint64_t>(field_start, field_id, out, metadata);
+}
+
+template <typename T>
+uint64_t ReadVarInt(const uint8_t* field_start, FtraceMetadata*) {
+  T t;
+  memcpy(&t, reinterpret_cast<const void*>(field_start), sizeof(T));
+  // Same as the sign extension done by protozero::proto_utils::WriteVarInt().
+  using ExtendedType =
+      typename std::conditional<std::is_unsigned<T>::value, T, int64_t>::type;
+  return static_cast<uint64_t>(static_cast<ExtendedType>(t));
+}
+
+template <typename T>
+uint64_t ReadInode(const uint8_t* field_start, FtraceMetadata* metadata) {
+  uint64_t inode = ReadVarInt<T>(field_start, metadata);
+  metadata->AddInode(static_cast<Inode>(inode));
+  return inode;
+}
+
+template <typename T>
+uint64_t ReadDevId(const uint8_t* field_start, FtraceMetadata* metadata) {
+  T t;
+  memcpy(&t, reinterpret_cast<const void*>(field_start), sizeof(T));
+  BlockDeviceID dev_id = CpuReader::TranslateBlockDeviceIDToUserspace<T>(t);
+  metadata->AddDevice(dev_id);
+  return static_cast<uint64_t>(dev_id);
+}
+
+uint64_t ReadPid(const uint8_t* field_start, FtraceMetadata* metadata) {
+  uint64_t pid = ReadVarInt<int32_t>(field_start, metadata);
+  metadata->AddPid(static_cast<int32_t>(pid));
+  return pid;
+}
+
+uint64_t ReadCommonPid(const uint8_t* field_start, FtraceMetadata* metadata) {
+  uint64_t pid = ReadVarInt<int32_t>(field_start, metadata);
+  metadata->AddCommonPid(static_cast<int32_t>(pid));
+  return pid;
+}
+
+// Returns nullptr for the strategies that don't produce an integer, or that
+// need the per-session interning of FtraceMetadata (kFtraceSymAddr64ToUint64).
+FieldDecoder::ReadFn GetReadFn(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      return &ReadVarInt<uint8_t>;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      return &ReadVarInt<uint16_t>;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      return &ReadVarInt<uint32_t>;
+    case kUint64ToUint64:
+      return &ReadVarInt<uint64_t>;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      return &ReadVarInt<int8_t>;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      return &ReadVarInt<int16_t>;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      return &ReadVarInt<int32_t>;
+    case kInt64ToInt64:
+      return &ReadVarInt<int64_t>;
+    case kInode32ToUint64:
+      return &ReadInode<uint32_t>;
+    case kInode64ToUint64:
+      return &ReadInode<uint64_t>;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      return &ReadPid;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return &ReadCommonPid;
+    case kDevId32ToUint64:
+      return &ReadDevId<uint32_t>;
+    case kDevId64ToUint64:
+      return &ReadDevId<uint64_t>;
+    case kFixedCStringToString:
+    case kCStringToString:
+    case kStringPtrToString:
+    case kDataLocToString:
+    case kFtraceSymAddr64ToUint64:
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  return nullptr;
+}
+
+// Mirrors the switch in CpuReader::ParseField(). Returns nullptr for the
+// strategies that need the whole record (kCStringToString, kDataLocToString)
+// or the translation table (kStringPtrToString).
+FieldDecoder::DecodeFn GetDecodeFn(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      return &DecodeVarInt<uint8_t>;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      return &DecodeVarInt<uint16_t>;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      return &DecodeVarInt<uint32_t>;
+    case kUint64ToUint64:
+      return &DecodeVarInt<uint64_t>;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      return &DecodeVarInt<int8_t>;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      return &DecodeVarInt<int16_t>;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      return &DecodeVarInt<int32_t>;
+    case kInt64ToInt64:
+      return &DecodeVarInt<int64_t>;
+    case kFixedCStringToString:
+      return &DecodeFixedCString;
+    case kInode32ToUint64:
+      return &DecodeInode<uint32_t>;
+    case kInode64ToUint64:
+      return &DecodeInode<uint64_t>;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      return &DecodePid;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return &DecodeCommonPid;
+    case kDevId32ToUint64:
+      return &DecodeDevId<uint32_t>;
+    case kDevId64ToUint64:
+      return &DecodeDevId<uint64_t>;
+    case kFtraceSymAddr64ToUint64:
+      return &DecodeSymbolAddr;
+    case kCStringToString:
+    case kStringPtrToString:
+    case kDataLocToString:
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+bool CreateFieldDecoders(const std::vector<Field>& fields,
+                         std::vector<FieldDecoder>* out) {
+  out->clear();
+  out->reserve(fields.size());
+  for (const Field& field : fields) {
+    FieldDecoder::DecodeFn decode = GetDecodeFn(field.strategy);
+    if (!decode) {
+      out->clear();
+      return false;
+    }
+    out->push_back(FieldDecoder{decode, GetReadFn(field.strategy),
+                                field.ftrace_offset, field.ftrace_size,
+                                field.proto_field_id});
+  }
+  return true;
+}
+
+EventDecoder CreateEventDecoder(const Event& event) {
+  EventDecoder decoder;
+  if (!event.ftrace_event_id ||
+      event.proto_field_id ==
+          protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+    return decoder;
+  }
+  decoder.valid = CreateFieldDecoders(event.fields, &decoder.fields);
+  decoder.compact = decoder.valid;
+  for (const FieldDecoder& field : decoder.fields)
+    decoder.compact &= field.read != nullptr;
+  decoder.proto_field_id = event.proto_field_id;
+  decoder.size = event.size;
+  return decoder;
+}
+
+}  // namespace perfetto
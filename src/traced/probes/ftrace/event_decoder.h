@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_EVENT_DECODER_H_
+#define SRC_TRACED_PROBES_FTRACE_EVENT_DECODER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+struct FtraceMetadata;
+
+// A field of a raw ftrace event with its TranslationStrategy resolved, when
+// the translation table is created, into the function that decodes it. This
+// saves CpuReader::ParseField() from switching on the strategy of every field
+// of every event.
+struct FieldDecoder {
+  using DecodeFn = void (*)(const uint8_t* field_start,
+                            uint16_t ftrace_size,
+                            uint32_t proto_field_id,
+                            protozero::Message* out,
+                            FtraceMetadata* metadata);
+
+  // Returns the value that |decode| would append as a varint, for the compact
+  // encoding of events (see CompactEventsBuffer).
+  using ReadFn = uint64_t (*)(const uint8_t* field_start,
+                              FtraceMetadata* metadata);
+
+  DecodeFn decode;
+  // nullptr if the field isn't an integer.
+  ReadFn read;
+  uint16_t ftrace_offset;
+  uint16_t ftrace_size;
+  uint32_t proto_field_id;
+};
+
+// The field decoders of an event with a dedicated proto (i.e. one described
+// in event_info.cc). Events with a field that can't be decoded on its own
+// (variable length strings and printk format pointers), as well as the
+// generic events created at runtime, are not specialized and are parsed with
+// CpuReader::ParseField() instead.
+struct EventDecoder {
+  // If false, the rest of the struct is considered invalid.
+  bool valid = false;
+  // If true, all the fields have a FieldDecoder::read function and the event
+  // can be written in FtraceEventBundle.compact_events.
+  bool compact = false;
+  uint32_t proto_field_id = 0;
+  // See Event::size.
+  uint16_t size = 0;
+  std::vector<FieldDecoder> fields;
+};
+
+// Fills |out| with the decoders of |fields|, in the same order. Returns false
+// if any of them needs the generic path.
+bool CreateFieldDecoders(const std::vector<Field>& fields,
+                         std::vector<FieldDecoder>* out);
+
+EventDecoder CreateEventDecoder(const Event& event);
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_EVENT_DECODER_H_
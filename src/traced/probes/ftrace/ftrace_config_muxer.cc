@@ -659,7 +659,8 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request,
       std::piecewise_construct, std::forward_as_tuple(id),
       std::forward_as_tuple(std::move(filter), std::move(syscall_filter),
                             compact_sched, std::move(apps),
-                            std::move(categories), request.symbolize_ksyms()));
+                            std::move(categories), request.symbolize_ksyms(),
+                            request.compact_events().enabled()));
   return id;
 }
 
@@ -810,6 +811,10 @@ void FtraceConfigMuxer::SetupClock(const FtraceConfig&) {
 
 void FtraceConfigMuxer::SetupBufferSize(const FtraceConfig& request) {
   size_t pages = ComputeCpuBufferSizeInPages(request.buffer_size_kb());
+  if (request.adaptive_drain_period() && request.adaptive_buffer_size()) {
+    pages = std::min(pages * buffer_size_scale_,
+                     ComputeCpuBufferSizeInPages(kMaxPerCpuBufferSizeKb));
+  }
   ftrace_->SetCpuBufferSizeInPages(pages);
   current_state_.cpu_buffer_size_pages = pages;
 }
@@ -45,13 +45,15 @@ struct FtraceDataSourceConfig {
                          CompactSchedConfig _compact_sched,
                          std::vector<std::string> _atrace_apps,
                          std::vector<std::string> _atrace_categories,
-                         bool _symbolize_ksyms)
+                         bool _symbolize_ksyms,
+                         bool _compact_events)
       : event_filter(std::move(_event_filter)),
         syscall_filter(std::move(_syscall_filter)),
         compact_sched(_compact_sched),
         atrace_apps(std::move(_atrace_apps)),
         atrace_categories(std::move(_atrace_categories)),
-        symbolize_ksyms(_symbolize_ksyms) {}
+        symbolize_ksyms(_symbolize_ksyms),
+        compact_events(_compact_events) {}
 
   // The event filter allows to quickly check if a certain ftrace event with id
   // x is enabled for this data source.
@@ -70,6 +72,10 @@ struct FtraceDataSourceConfig {
 
   // When enabled will turn on the kallsyms symbolizer in CpuReader.
   const bool symbolize_ksyms;
+
+  // If true, the enabled events that can be compacted (see
+  // EventDecoder::compact) are written in FtraceEventBundle.compact_events.
+  const bool compact_events;
 };
 
 // Ftrace is a bunch of globally modifiable persistent state.
@@ -121,6 +127,10 @@ class FtraceConfigMuxer {
   // session's buffer size is used for all of them.
   size_t GetPerCpuBufferSizePages();
 
+  // Sets the factor applied to the buffer size of the next session, if its
+  // first config sets FtraceConfig.adaptive_buffer_size.
+  void set_buffer_size_scale(uint32_t scale) { buffer_size_scale_ = scale; }
+
   // public for testing
   void SetupClockForTesting(const FtraceConfig& request) {
     SetupClock(request);
@@ -214,6 +224,9 @@ class FtraceConfigMuxer {
   // Subset of |ds_configs_| that are currently active. At any time ftrace is
   // enabled iff |active_configs_| is not empty.
   std::set<FtraceConfigId> active_configs_;
+
+  // See set_buffer_size_scale().
+  size_t buffer_size_scale_ = 1;
 };
 
 size_t ComputeCpuBufferSizeInPages(size_t requested_buffer_size_kb);
@@ -24,6 +24,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <string>
 #include <utility>
@@ -61,6 +62,20 @@ constexpr int kMaxDrainPeriodMs = 1000 * 60;
 // tasks get some cpu time before continuing reading.
 constexpr size_t kMaxPagesPerCpuPerReadTick = 256;  // 1 MB per cpu
 
+// Parameters for FtraceConfig.adaptive_drain_period. When the fullest cpu
+// buffer is filled above |kHighFillPercent| in a drain period, the period is
+// halved, down to 1/|kMaxDrainPeriodShrink| of the configured one. After
+// |kLowFillPeriodsBeforeGrowing| consecutive periods below |kLowFillPercent|
+// it is doubled, up to the configured one.
+constexpr uint32_t kHighFillPercent = 50;
+constexpr uint32_t kLowFillPercent = 12;
+constexpr uint32_t kLowFillPeriodsBeforeGrowing = 10;
+constexpr uint32_t kMaxDrainPeriodShrink = 16;
+constexpr size_t kMaxDrainPeriodChanges = 256;
+
+// Upper bound of the buffer size scale for FtraceConfig.adaptive_buffer_size.
+constexpr uint32_t kMaxBufferSizeScale = 8;
+
 // When reading and parsing data for a particular cpu, we do it in batches of
 // this many pages. In other words, we'll read up to
 // |kParsingBufferSizePages| into memory, parse them, and then repeat if we
@@ -222,7 +237,7 @@ void FtraceController::StartIfNeeded() {
 
   // Start the repeating read tasks.
   auto generation = ++generation_;
-  auto drain_period_ms = GetDrainPeriodMs();
+  auto drain_period_ms = GetCurrentDrainPeriodMs();
   auto weak_this = weak_factory_.GetWeakPtr();
   task_runner_->PostDelayedTask(
       [weak_this, generation] {
@@ -314,14 +329,26 @@ void FtraceController::ReadTick(int generation) {
   } else {
     // Done until next drain period.
     size_t period_page_quota = ftrace_config_muxer_->GetPerCpuBufferSizePages();
-    for (auto& per_cpu : per_cpu_)
+    size_t max_pages_read = 0;
+    for (auto& per_cpu : per_cpu_) {
+      max_pages_read = std::max(
+          max_pages_read, period_page_quota - per_cpu.period_page_quota);
       per_cpu.period_page_quota = period_page_quota;
+    }
+    bool read_again_now = AdaptDrainPeriod(max_pages_read, period_page_quota);
 
     // Snapshot the clock so the data in the next period will be clock synced as
     // well.
     MaybeSnapshotFtraceClock();
 
-    auto drain_period_ms = GetDrainPeriodMs();
+    if (read_again_now) {
+      task_runner_->PostTask([weak_this, generation] {
+        if (weak_this)
+          weak_this->ReadTick(generation);
+      });
+      return;
+    }
+    auto drain_period_ms = GetCurrentDrainPeriodMs();
     task_runner_->PostDelayedTask(
         [weak_this, generation] {
           if (weak_this)
@@ -342,6 +369,67 @@ uint32_t FtraceController::GetDrainPeriodMs() {
   return ClampDrainPeriodMs(min_drain_period_ms);
 }
 
+uint32_t FtraceController::GetCurrentDrainPeriodMs() {
+  uint32_t drain_period_ms = GetDrainPeriodMs();
+  if (adaptive_drain_period_ms_)
+    drain_period_ms = std::min(drain_period_ms, adaptive_drain_period_ms_);
+  return drain_period_ms;
+}
+
+// The fill level of a cpu buffer is estimated from the number of pages read
+// from it over the drain period. Reading the per-cpu stats files instead
+// would cost two syscalls per cpu per period.
+bool FtraceController::AdaptDrainPeriod(size_t max_pages_read,
+                                        size_t buffer_size_pages) {
+  bool enabled = false;
+  for (const FtraceDataSource* data_source : started_data_sources_)
+    enabled |= data_source->config().adaptive_drain_period();
+  if (!enabled || buffer_size_pages == 0) {
+    adaptive_drain_period_ms_ = 0;
+    return false;
+  }
+
+  const bool exhausted = max_pages_read >= buffer_size_pages;
+  const uint32_t fill_percent =
+      exhausted ? 100
+                : static_cast<uint32_t>(max_pages_read * 100 /
+                                        buffer_size_pages);
+  max_fill_percent_ = std::max(max_fill_percent_, fill_percent);
+
+  const uint32_t configured_ms = GetDrainPeriodMs();
+  const uint32_t min_ms = std::max(static_cast<uint32_t>(kMinDrainPeriodMs),
+                                   configured_ms / kMaxDrainPeriodShrink);
+  const uint32_t cur_ms = GetCurrentDrainPeriodMs();
+  uint32_t new_ms = cur_ms;
+  if (fill_percent >= kHighFillPercent) {
+    low_fill_periods_ = 0;
+    new_ms = std::max(min_ms, cur_ms / 2);
+    if (exhausted && cur_ms == min_ms)
+      overflowed_at_min_drain_period_ = true;
+  } else if (fill_percent < kLowFillPercent && cur_ms < configured_ms) {
+    if (++low_fill_periods_ >= kLowFillPeriodsBeforeGrowing) {
+      low_fill_periods_ = 0;
+      new_ms = std::min(configured_ms, cur_ms * 2);
+    }
+  } else {
+    low_fill_periods_ = 0;
+  }
+
+  if (new_ms != cur_ms) {
+    PERFETTO_DLOG("Ftrace buffers %u%% full, drain period %u -> %u ms",
+                  fill_percent, cur_ms, new_ms);
+    if (drain_period_changes_.size() < kMaxDrainPeriodChanges) {
+      FtraceDrainPeriodChange change;
+      change.timestamp = static_cast<uint64_t>(base::GetBootTimeNs().count());
+      change.drain_period_ms = new_ms;
+      change.max_fill_percent = fill_percent;
+      drain_period_changes_.push_back(change);
+    }
+  }
+  adaptive_drain_period_ms_ = new_ms;
+  return exhausted;
+}
+
 void FtraceController::ClearTrace() {
   ftrace_procfs_->ClearTrace();
 }
@@ -385,6 +473,24 @@ void FtraceController::StopIfNeeded() {
 
   per_cpu_.clear();
   cpu_zero_stats_fd_.reset();
+
+  // Pick the buffer size for the next session, if it adapts to the rate of
+  // events of this one.
+  if (adaptive_buffer_size_) {
+    if (overflowed_at_min_drain_period_) {
+      buffer_size_scale_ = std::min(buffer_size_scale_ * 2, kMaxBufferSizeScale);
+    } else if (max_fill_percent_ < kLowFillPercent) {
+      buffer_size_scale_ = std::max(buffer_size_scale_ / 2, 1u);
+    }
+    ftrace_config_muxer_->set_buffer_size_scale(buffer_size_scale_);
+  }
+  adaptive_buffer_size_ = false;
+  adaptive_drain_period_ms_ = 0;
+  low_fill_periods_ = 0;
+  max_fill_percent_ = 0;
+  overflowed_at_min_drain_period_ = false;
+  drain_period_changes_.clear();
+
   if (!retain_ksyms_on_stop_) {
     symbolizer_->Destroy();
   }
@@ -423,6 +529,8 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
 
   started_data_sources_.insert(data_source);
   StartIfNeeded();
+  adaptive_buffer_size_ |= data_source->config().adaptive_drain_period() &&
+                           data_source->config().adaptive_buffer_size();
 
   // Parse kernel symbols if required by the config. This can be an expensive
   // operation (cpu-bound for 500ms+), so delay the StartDataSource
@@ -461,6 +569,10 @@ void FtraceController::DumpFtraceStats(FtraceStats* stats) {
     stats->kernel_symbols_mem_kb =
         static_cast<uint32_t>(symbol_map->size_bytes() / 1024);
   }
+  stats->drain_period_changes = drain_period_changes_;
+  stats->cpu_buffer_size_kb = static_cast<uint32_t>(
+      ftrace_config_muxer_->GetPerCpuBufferSizePages() * base::kPageSize /
+      1024);
 }
 
 void FtraceController::MaybeSnapshotFtraceClock() {
@@ -26,6 +26,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -34,6 +35,7 @@
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
+#include "src/traced/probes/ftrace/ftrace_stats.h"
 
 namespace perfetto {
 
@@ -42,7 +44,6 @@ class FtraceDataSource;
 class FtraceProcfs;
 class LazyKernelSymbolizer;
 class ProtoTranslationTable;
-struct FtraceStats;
 
 // Method of last resort to reset ftrace state.
 bool HardResetFtraceState();
@@ -120,8 +121,19 @@ class FtraceController {
   // Periodic task that reads all per-cpu ftrace buffers.
   void ReadTick(int generation);
 
+  // Returns the drain period requested by the configs.
   uint32_t GetDrainPeriodMs();
 
+  // Returns the drain period in use, which differs from GetDrainPeriodMs()
+  // if FtraceConfig.adaptive_drain_period is set.
+  uint32_t GetCurrentDrainPeriodMs();
+
+  // Called at the end of each drain period with the most pages read from a
+  // single cpu buffer in the period. Adjusts the drain period if
+  // FtraceConfig.adaptive_drain_period is set. Returns true if the buffers
+  // should be read again immediately.
+  bool AdaptDrainPeriod(size_t max_pages_read, size_t buffer_size_pages);
+
   void StartIfNeeded();
   void StopIfNeeded();
 
@@ -139,6 +151,19 @@ class FtraceController {
   int generation_ = 0;
   bool atrace_running_ = false;
   bool retain_ksyms_on_stop_ = false;
+
+  // State for FtraceConfig.adaptive_drain_period, reset on stop.
+  uint32_t adaptive_drain_period_ms_ = 0;  // 0 until the first adjustment.
+  uint32_t low_fill_periods_ = 0;
+  uint32_t max_fill_percent_ = 0;
+  bool overflowed_at_min_drain_period_ = false;
+  std::vector<FtraceDrainPeriodChange> drain_period_changes_;
+
+  // State for FtraceConfig.adaptive_buffer_size. The scale factor carries
+  // over to the next tracing session.
+  bool adaptive_buffer_size_ = false;
+  uint32_t buffer_size_scale_ = 1;
+
   std::vector<PerCpuState> per_cpu_;  // empty if tracing isn't active
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
@@ -183,6 +183,11 @@ class TestFtraceController : public FtraceController,
   MockFtraceProcfs* procfs() { return procfs_; }
   uint64_t NowMs() const override { return now_ms; }
   uint32_t drain_period_ms() { return GetDrainPeriodMs(); }
+  uint32_t current_drain_period_ms() { return GetCurrentDrainPeriodMs(); }
+  bool AdaptDrainPeriod(size_t max_pages_read, size_t buffer_size_pages) {
+    return FtraceController::AdaptDrainPeriod(max_pages_read,
+                                              buffer_size_pages);
+  }
 
   std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
     std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
@@ -472,6 +477,113 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, AdaptiveDrainPeriod) {
+  auto controller = CreateTestController(true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_period_ms(160);
+  config.set_adaptive_drain_period(true);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  EXPECT_EQ(controller->current_drain_period_ms(), 160u);
+
+  // Buffers at least half full halve the period, down to 1/16.
+  EXPECT_FALSE(controller->AdaptDrainPeriod(50, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 80u);
+  EXPECT_FALSE(controller->AdaptDrainPeriod(30, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 80u);
+  EXPECT_FALSE(controller->AdaptDrainPeriod(75, 100));
+  EXPECT_FALSE(controller->AdaptDrainPeriod(75, 100));
+  EXPECT_FALSE(controller->AdaptDrainPeriod(75, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 10u);
+  EXPECT_FALSE(controller->AdaptDrainPeriod(75, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 10u);
+
+  // Buffers drained entirely are read again right away.
+  EXPECT_TRUE(controller->AdaptDrainPeriod(100, 100));
+
+  // Mostly empty buffers double it back, after a while.
+  for (int i = 0; i < 9; i++)
+    EXPECT_FALSE(controller->AdaptDrainPeriod(1, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 10u);
+  EXPECT_FALSE(controller->AdaptDrainPeriod(1, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 20u);
+  EXPECT_EQ(controller->drain_period_ms(), 160u);
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  ASSERT_EQ(stats.drain_period_changes.size(), 5u);
+  EXPECT_EQ(stats.drain_period_changes[0].drain_period_ms, 80u);
+  EXPECT_EQ(stats.drain_period_changes[0].max_fill_percent, 50u);
+  EXPECT_EQ(stats.drain_period_changes[3].drain_period_ms, 10u);
+  EXPECT_EQ(stats.drain_period_changes[4].drain_period_ms, 20u);
+  EXPECT_EQ(stats.drain_period_changes[4].max_fill_percent, 1u);
+}
+
+TEST(FtraceControllerTest, AdaptiveDrainPeriodDisabled) {
+  auto controller = CreateTestController(true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_period_ms(160);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  EXPECT_FALSE(controller->AdaptDrainPeriod(100, 100));
+  EXPECT_EQ(controller->current_drain_period_ms(), 160u);
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_TRUE(stats.drain_period_changes.empty());
+}
+
+TEST(FtraceControllerTest, AdaptiveBufferSize) {
+  auto controller = CreateTestController(true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_buffer_size_kb(64);
+  config.set_drain_period_ms(16);
+  config.set_adaptive_drain_period(true);
+  config.set_adaptive_buffer_size(true);
+  const uint32_t page_kb = static_cast<uint32_t>(base::kPageSize / 1024);
+  const size_t buffer_pages = 64 / page_kb;
+
+  {
+    auto data_source = controller->AddFakeDataSource(config);
+    ASSERT_TRUE(data_source);
+    ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+    FtraceStats stats{};
+    controller->DumpFtraceStats(&stats);
+    EXPECT_EQ(stats.cpu_buffer_size_kb, 64u);
+
+    // The buffers keep overflowing at the shortest drain period.
+    for (int i = 0; i < 6; i++)
+      controller->AdaptDrainPeriod(buffer_pages, buffer_pages);
+    EXPECT_EQ(controller->current_drain_period_ms(), 1u);
+  }
+
+  // The next session gets bigger buffers.
+  {
+    auto data_source = controller->AddFakeDataSource(config);
+    ASSERT_TRUE(data_source);
+    ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+    FtraceStats stats{};
+    controller->DumpFtraceStats(&stats);
+    EXPECT_EQ(stats.cpu_buffer_size_kb, 128u);
+    controller->AdaptDrainPeriod(0, 2 * buffer_pages);
+  }
+
+  // And the one after shrinks them back, as they stayed empty.
+  {
+    auto data_source = controller->AddFakeDataSource(config);
+    ASSERT_TRUE(data_source);
+    ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+    FtraceStats stats{};
+    controller->DumpFtraceStats(&stats);
+    EXPECT_EQ(stats.cpu_buffer_size_kb, 64u);
+  }
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
@@ -32,6 +32,10 @@ void FtraceStats::Write(protos::pbzero::FtraceStats* writer) const {
     writer->add_unknown_ftrace_events(err);
   for (const std::string& err : setup_errors.failed_ftrace_events)
     writer->add_failed_ftrace_events(err);
+  for (const FtraceDrainPeriodChange& change : drain_period_changes)
+    change.Write(writer->add_drain_period_changes());
+  if (cpu_buffer_size_kb)
+    writer->set_cpu_buffer_size_kb(cpu_buffer_size_kb);
 }
 
 void FtraceCpuStats::Write(protos::pbzero::FtraceCpuStats* writer) const {
@@ -46,4 +50,11 @@ void FtraceCpuStats::Write(protos::pbzero::FtraceCpuStats* writer) const {
   writer->set_read_events(read_events);
 }
 
+void FtraceDrainPeriodChange::Write(
+    protos::pbzero::FtraceDrainPeriodChange* writer) const {
+  writer->set_timestamp(timestamp);
+  writer->set_drain_period_ms(drain_period_ms);
+  writer->set_max_fill_percent(max_fill_percent);
+}
+
 }  // namespace perfetto
@@ -27,6 +27,7 @@ namespace protos {
 namespace pbzero {
 class FtraceStats;
 class FtraceCpuStats;
+class FtraceDrainPeriodChange;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -44,6 +45,14 @@ struct FtraceCpuStats {
   void Write(protos::pbzero::FtraceCpuStats*) const;
 };
 
+struct FtraceDrainPeriodChange {
+  uint64_t timestamp = 0;
+  uint32_t drain_period_ms = 0;
+  uint32_t max_fill_percent = 0;
+
+  void Write(protos::pbzero::FtraceDrainPeriodChange*) const;
+};
+
 struct FtraceSetupErrors {
   std::string atrace_errors;
   std::vector<std::string> unknown_ftrace_events;
@@ -55,6 +64,8 @@ struct FtraceStats {
   FtraceSetupErrors setup_errors;
   uint32_t kernel_symbols_parsed = 0;
   uint32_t kernel_symbols_mem_kb = 0;
+  std::vector<FtraceDrainPeriodChange> drain_period_changes;
+  uint32_t cpu_buffer_size_kb = 0;
 
   void Write(protos::pbzero::FtraceStats*) const;
 };
@@ -500,6 +500,22 @@ ProtoTranslationTable::ProtoTranslationTable(
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
   }
+
+  // The common fields are decoded for every event, so none of the events can
+  // be specialized if they can't.
+  if (CreateFieldDecoders(common_fields_, &common_field_decoders_)) {
+    // FtraceEventBundle.CompactEvents has room only for the common pid.
+    bool compact_common_fields =
+        common_field_decoders_.size() == 1 &&
+        common_field_decoders_[0].proto_field_id ==
+            protos::pbzero::FtraceEvent::kPidFieldNumber &&
+        common_field_decoders_[0].read;
+    event_decoders_.reserve(events_.size());
+    for (const Event& event : events_) {
+      event_decoders_.push_back(CreateEventDecoder(event));
+      event_decoders_.back().compact &= compact_common_fields;
+    }
+  }
 }
 
 const Event* ProtoTranslationTable::GetOrCreateEvent(
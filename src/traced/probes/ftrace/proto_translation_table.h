@@ -29,6 +29,7 @@
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/event_decoder.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/format_parser/format_parser.h"
 #include "src/traced/probes/ftrace/printk_formats_parser.h"
@@ -170,6 +171,19 @@ class ProtoTranslationTable {
     return printk_formats_.at(address);
   }
 
+  // Returns the specialized decoder of the event with the given id, or nullptr
+  // if it has to be parsed field by field (see EventDecoder).
+  const EventDecoder* GetEventDecoder(size_t id) const {
+    if (id >= event_decoders_.size() || !event_decoders_[id].valid)
+      return nullptr;
+    return &event_decoders_[id];
+  }
+
+  // Only meaningful if GetEventDecoder() returned a decoder.
+  const std::vector<FieldDecoder>& common_field_decoders() const {
+    return common_field_decoders_;
+  }
+
  private:
   ProtoTranslationTable(const ProtoTranslationTable&) = delete;
   ProtoTranslationTable& operator=(const ProtoTranslationTable&) = delete;
@@ -191,6 +205,10 @@ class ProtoTranslationTable {
   std::set<std::string> interned_strings_;
   CompactSchedEventFormat compact_sched_format_;
   PrintkMap printk_formats_;
+  // Indexed by ftrace event id, built once at construction time. Events
+  // created later by GetOrCreateEvent() are generic and never specialized.
+  std::vector<EventDecoder> event_decoders_;
+  std::vector<FieldDecoder> common_field_decoders_;
 };
 
 // Class for efficient 'is event with id x enabled?' checks.
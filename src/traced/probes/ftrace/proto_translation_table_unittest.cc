@@ -314,6 +314,44 @@ TEST(TranslationTableTest, CompactSchedFormatParsingSeedData) {
   ASSERT_FALSE(format.format_valid);
 }
 
+TEST(TranslationTableTest, EventDecodersWalleyeData) {
+  std::string path = base::GetTestDataPath(
+      "src/traced/probes/ftrace/test/data/"
+      "android_walleye_OPM5.171019.017.A1_4.4.88/");
+  FtraceProcfs ftrace_procfs(path);
+  auto table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+  PERFETTO_CHECK(table);
+  ASSERT_EQ(table->common_field_decoders().size(),
+            table->common_fields().size());
+
+  // All the fields of sched_switch are fixed size.
+  size_t switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  const EventDecoder* switch_decoder = table->GetEventDecoder(switch_id);
+  ASSERT_TRUE(switch_decoder);
+  EXPECT_EQ(static_cast<int>(switch_decoder->proto_field_id),
+            protos::pbzero::FtraceEvent::kSchedSwitchFieldNumber);
+  const Event* switch_event = table->GetEventById(switch_id);
+  ASSERT_EQ(switch_decoder->fields.size(), switch_event->fields.size());
+  for (size_t i = 0; i < switch_event->fields.size(); i++) {
+    EXPECT_EQ(switch_decoder->fields[i].ftrace_offset,
+              switch_event->fields[i].ftrace_offset);
+    EXPECT_EQ(switch_decoder->fields[i].proto_field_id,
+              switch_event->fields[i].proto_field_id);
+  }
+
+  // print ends with a variable length string, so it goes through the generic
+  // path.
+  size_t print_id = table->EventToFtraceId(GroupAndName("ftrace", "print"));
+  ASSERT_NE(print_id, 0u);
+  EXPECT_FALSE(table->GetEventDecoder(print_id));
+
+  // Unknown ids have no decoder.
+  EXPECT_FALSE(table->GetEventDecoder(0));
+  EXPECT_FALSE(table->GetEventDecoder(table->largest_id() + 1));
+}
+
 TEST(TranslationTableTest, InferFtraceType) {
   FtraceFieldType type;
 
@@ -466,6 +504,9 @@ print fmt: "some format")"));
   EXPECT_EQ(table->largest_id(), 42ul);
   EXPECT_EQ(table->EventToFtraceId(group_and_name), 42ul);
 
+  // Events created at runtime are always parsed with the generic path.
+  EXPECT_FALSE(table->GetEventDecoder(42));
+
   // Check getters
   EXPECT_EQ(static_cast<int>(table->GetEventById(42)->proto_field_id),
             protos::pbzero::FtraceEvent::kGenericFieldNumber);
@@ -28,6 +28,7 @@
 #include "perfetto/ext/traced/traced.h"
 #include "perfetto/ext/tracing/ipc/default_socket.h"
 
+#include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/kmem_activity_trigger.h"
 #include "src/traced/probes/probes_producer.h"
@@ -40,15 +41,20 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
     OPT_VERSION,
     OPT_BACKGROUND,
     OPT_RESET_FTRACE,
+    OPT_INODE_CACHE,
+    OPT_KALLSYMS_CACHE,
   };
 
   bool background = false;
   bool reset_ftrace = false;
+  const char* inode_cache_path = nullptr;
 
   static const option long_options[] = {
       {"background", no_argument, nullptr, OPT_BACKGROUND},
       {"cleanup-after-crash", no_argument, nullptr, OPT_CLEANUP_AFTER_CRASH},
       {"reset-ftrace", no_argument, nullptr, OPT_RESET_FTRACE},
+      {"inode-cache", required_argument, nullptr, OPT_INODE_CACHE},
+      {"kallsyms-cache", required_argument, nullptr, OPT_KALLSYMS_CACHE},
       {"version", no_argument, nullptr, OPT_VERSION},
       {nullptr, 0, nullptr, 0}};
 
@@ -69,6 +75,12 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         // This is like --cleanup-after-crash but doesn't quit.
         reset_ftrace = true;
         break;
+      case OPT_INODE_CACHE:
+        inode_cache_path = optarg;
+        break;
+      case OPT_KALLSYMS_CACHE:
+        LazyKernelSymbolizer::SetCacheDir(optarg);
+        break;
       case OPT_VERSION:
         printf("%s\n", base::GetVersionString());
         return 0;
@@ -76,7 +88,7 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         fprintf(
             stderr,
             "Usage: %s [--background] [--reset-ftrace] [--cleanup-after-crash] "
-            "[--version]\n",
+            "[--inode-cache=PATH] [--kallsyms-cache=DIR] [--version]\n",
             argv[0]);
         return 1;
     }
@@ -117,6 +129,8 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
 
   base::UnixTaskRunner task_runner;
   ProbesProducer producer;
+  if (inode_cache_path)
+    producer.SetInodeCachePath(inode_cache_path);
   // If the TRACED_PROBES_NOTIFY_FD env var is set, write 1 and close the FD,
   // when all data sources have been registered. This is used for //src/tracebox
   // --background-wait, to make sure that the data sources are registered before
@@ -163,9 +163,11 @@ ProbesProducer::CreateDSInstance<InodeFileDataSource>(
   auto buffer_id = static_cast<BufferID>(source_config.target_buffer());
   if (system_inodes_.empty())
     CreateStaticDeviceToInodeMap("/system", &system_inodes_);
+  if (persistent_inode_cache_)
+    persistent_inode_cache_->Load();
   return std::unique_ptr<InodeFileDataSource>(new InodeFileDataSource(
       source_config, task_runner_, session_id, &system_inodes_, &cache_,
-      endpoint_->CreateTraceWriter(buffer_id)));
+      endpoint_->CreateTraceWriter(buffer_id), persistent_inode_cache_.get()));
 }
 
 template <>
@@ -19,6 +19,7 @@
 
 #include <functional>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <utility>
 
@@ -80,6 +81,12 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
     all_data_sources_registered_cb_ = cb;
   }
 
+  // Persists the inodes resolved by the linux.inode_file_map data source in
+  // |path|, so that they don't need to be scanned for again after a restart.
+  void SetInodeCachePath(std::string path) {
+    persistent_inode_cache_.reset(new PersistentInodeCache(std::move(path)));
+  }
+
  private:
   static ProbesProducer* instance_;
 
@@ -132,6 +139,7 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
 
   std::unordered_map<DataSourceInstanceID, base::Watchdog::Timer> watchdogs_;
   LRUInodeCache cache_{kLRUInodeCacheSize};
+  std::unique_ptr<PersistentInodeCache> persistent_inode_cache_;
   std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
       system_inodes_;
 
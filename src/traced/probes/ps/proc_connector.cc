@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+
+namespace {
+
+constexpr size_t kBufSize = 4096;
+
+// Process creation storms can generate thousands of events per second. Ask
+// for a larger receive buffer to avoid dropping them between two reads.
+constexpr int kRcvBufSize = 1024 * 1024;
+
+// Same batching period of the AndroidLogDataSource: events are read at most
+// every 100 ms, so that a burst of forks is handled in one go.
+constexpr uint32_t kBatchMs = 100;
+
+// Values of proc_event.what. Spelled out because, depending on the version of
+// the uapi headers, the enum is either nested in proc_event or not.
+constexpr uint32_t kProcEventFork = 0x00000001;
+constexpr uint32_t kProcEventExec = 0x00000002;
+constexpr uint32_t kProcEventComm = 0x00000200;
+constexpr uint32_t kProcEventExit = 0x80000000;
+
+bool SendMcastOp(int fd, proc_cn_mcast_op op) {
+  alignas(nlmsghdr) uint8_t buf[NLMSG_SPACE(sizeof(cn_msg) + sizeof(op))] = {};
+  auto* nl_hdr = reinterpret_cast<nlmsghdr*>(buf);
+  nl_hdr->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(op));
+  nl_hdr->nlmsg_type = NLMSG_DONE;
+  nl_hdr->nlmsg_pid = static_cast<uint32_t>(getpid());
+  auto* msg = reinterpret_cast<cn_msg*>(NLMSG_DATA(nl_hdr));
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(op);
+  memcpy(msg->data, &op, sizeof(op));
+  return PERFETTO_EINTR(send(fd, buf, nl_hdr->nlmsg_len, 0)) ==
+         static_cast<ssize_t>(nl_hdr->nlmsg_len);
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<ProcConnector> ProcConnector::Create(
+    base::TaskRunner* task_runner,
+    EventsCallback callback) {
+  base::ScopedFile sock(socket(AF_NETLINK,
+                               SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               NETLINK_CONNECTOR));
+  if (!sock) {
+    PERFETTO_PLOG("Failed to create the proc connector socket");
+    return nullptr;
+  }
+
+  setsockopt(*sock, SOL_SOCKET, SO_RCVBUF, &kRcvBufSize, sizeof(kRcvBufSize));
+
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(*sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+    PERFETTO_PLOG("Failed to bind the proc connector socket");
+    return nullptr;
+  }
+
+  if (!SendMcastOp(*sock, PROC_CN_MCAST_LISTEN)) {
+    PERFETTO_PLOG("Failed to subscribe to the proc connector");
+    return nullptr;
+  }
+
+  std::unique_ptr<ProcConnector> connector(
+      new ProcConnector(task_runner, std::move(sock), std::move(callback)));
+  connector->EnableSocketWatchTask(true);
+  return connector;
+}
+
+ProcConnector::ProcConnector(base::TaskRunner* task_runner,
+                             base::ScopedFile sock,
+                             EventsCallback callback)
+    : task_runner_(task_runner),
+      sock_(std::move(sock)),
+      callback_(std::move(callback)),
+      buf_(base::PagedMemory::Allocate(kBufSize)),
+      weak_factory_(this) {}
+
+ProcConnector::~ProcConnector() {
+  EnableSocketWatchTask(false);
+  // The kernel keeps generating proc events as long as there is at least one
+  // listener, regardless of the socket being open.
+  SendMcastOp(*sock_, PROC_CN_MCAST_IGNORE);
+}
+
+void ProcConnector::EnableSocketWatchTask(bool enable) {
+  if (fd_watch_task_enabled_ == enable)
+    return;
+
+  if (enable) {
+    auto weak_this = weak_factory_.GetWeakPtr();
+    task_runner_->AddFileDescriptorWatch(*sock_, [weak_this] {
+      if (weak_this)
+        weak_this->OnSocketDataAvailable();
+    });
+  } else {
+    task_runner_->RemoveFileDescriptorWatch(*sock_);
+  }
+
+  fd_watch_task_enabled_ = enable;
+}
+
+void ProcConnector::OnSocketDataAvailable() {
+  PERFETTO_DCHECK(fd_watch_task_enabled_);
+  auto now_ms = base::GetWallTimeMs().count();
+
+  // Disable the FD watch until the delayed read happens, otherwise we get a
+  // storm of OnSocketDataAvailable() in the meantime.
+  EnableSocketWatchTask(false);
+
+  uint32_t delay_ms = kBatchMs - static_cast<uint32_t>(now_ms % kBatchMs);
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (weak_this) {
+          weak_this->ReadSocket();
+          weak_this->EnableSocketWatchTask(true);
+        }
+      },
+      delay_ms);
+}
+
+void ProcConnector::ReadSocket() {
+  events_.clear();
+  for (;;) {
+    sockaddr_nl from{};
+    socklen_t from_len = sizeof(from);
+    ssize_t rsize = PERFETTO_EINTR(
+        recvfrom(*sock_, buf_.Get(), kBufSize, 0,
+                 reinterpret_cast<sockaddr*>(&from), &from_len));
+    if (rsize < 0) {
+      // ENOBUFS means that the kernel dropped events because the receive
+      // buffer was full. The pids of the missed forks will still be picked up
+      // by the next OnPids() or full scan.
+      if (errno == ENOBUFS) {
+        PERFETTO_DLOG("Proc connector receive buffer overrun");
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        PERFETTO_PLOG("recvfrom() failed on the proc connector socket");
+      break;
+    }
+    if (rsize == 0)
+      break;
+    // Only trust messages that come from the kernel.
+    if (from.nl_pid != 0)
+      continue;
+    ParseMessages(static_cast<const uint8_t*>(buf_.Get()),
+                  static_cast<size_t>(rsize), &events_);
+  }
+  if (!events_.empty())
+    callback_(events_);
+}
+
+// static
+void ProcConnector::ParseMessages(const uint8_t* data,
+                                  size_t size,
+                                  std::vector<Event>* out) {
+  // NLMSG_NEXT() and NLMSG_OK() take a signed length.
+  int len = static_cast<int>(size);
+  const nlmsghdr* nl_hdr = reinterpret_cast<const nlmsghdr*>(data);
+  for (; NLMSG_OK(nl_hdr, len); nl_hdr = NLMSG_NEXT(nl_hdr, len)) {
+    if (nl_hdr->nlmsg_type == NLMSG_NOOP || nl_hdr->nlmsg_type == NLMSG_ERROR)
+      continue;
+    if (nl_hdr->nlmsg_len < NLMSG_LENGTH(sizeof(cn_msg)))
+      continue;
+    const auto* msg = reinterpret_cast<const cn_msg*>(NLMSG_DATA(nl_hdr));
+    if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+      continue;
+    size_t payload_size = nl_hdr->nlmsg_len - NLMSG_LENGTH(sizeof(cn_msg));
+    if (msg->len > payload_size)
+      continue;
+
+    // The payload is only 4-byte aligned, copy it out to read the 64-bit
+    // timestamp. Older kernels send shorter events, zero-fill them.
+    proc_event ev{};
+    memcpy(&ev, msg->data, std::min<size_t>(msg->len, sizeof(ev)));
+    switch (static_cast<uint32_t>(ev.what)) {
+      case kProcEventFork:
+        out->push_back({EventType::kFork, ev.event_data.fork.child_pid,
+                        ev.event_data.fork.child_tgid});
+        break;
+      case kProcEventExec:
+        out->push_back({EventType::kExec, ev.event_data.exec.process_pid,
+                        ev.event_data.exec.process_tgid});
+        break;
+      case kProcEventComm:
+        out->push_back({EventType::kComm, ev.event_data.comm.process_pid,
+                        ev.event_data.comm.process_tgid});
+        break;
+      case kProcEventExit:
+        out->push_back({EventType::kExit, ev.event_data.exit.process_pid,
+                        ev.event_data.exit.process_tgid});
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+}  // namespace perfetto
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+#define SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/weak_ptr.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+// Subscribes to the process events (fork, exec, comm change and exit) that the
+// kernel multicasts on the netlink proc connector (CONFIG_PROC_EVENTS) and
+// passes them, in batches, to a callback. Subscribing requires CAP_NET_ADMIN.
+class ProcConnector {
+ public:
+  enum class EventType { kFork, kExec, kComm, kExit };
+
+  struct Event {
+    EventType type;
+    // For kFork, the child. For the other events, the thread that exec'd,
+    // changed name or exited.
+    int32_t pid;
+    int32_t tgid;
+  };
+
+  using EventsCallback = std::function<void(const std::vector<Event>&)>;
+
+  // Returns nullptr if the kernel doesn't support the proc connector or the
+  // caller is not allowed to listen to it.
+  static std::unique_ptr<ProcConnector> Create(base::TaskRunner*,
+                                               EventsCallback);
+
+  ~ProcConnector();
+
+  // Appends to |out| the events in a datagram received from the proc
+  // connector socket. Messages that are not proc events are skipped.
+  static void ParseMessages(const uint8_t* data,
+                            size_t size,
+                            std::vector<Event>* out);
+
+ private:
+  ProcConnector(base::TaskRunner*, base::ScopedFile, EventsCallback);
+  ProcConnector(const ProcConnector&) = delete;
+  ProcConnector& operator=(const ProcConnector&) = delete;
+
+  void EnableSocketWatchTask(bool enable);
+  void OnSocketDataAvailable();
+  void ReadSocket();
+
+  base::TaskRunner* const task_runner_;
+  base::ScopedFile sock_;
+  EventsCallback callback_;
+  base::PagedMemory buf_;
+  std::vector<Event> events_;
+  bool fd_watch_task_enabled_ = false;
+
+  base::WeakPtrFactory<ProcConnector> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
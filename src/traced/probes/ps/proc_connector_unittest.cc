@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+// The what enum is nested in proc_event only in older uapi headers.
+template <typename T>
+void SetWhat(T* what, uint32_t value) {
+  *what = static_cast<T>(value);
+}
+
+// Appends a netlink message with the given proc connector |ev| to |buf|.
+void AppendProcEvent(const proc_event& ev,
+                     uint32_t cn_idx,
+                     std::vector<uint8_t>* buf) {
+  size_t off = buf->size();
+  buf->resize(off + NLMSG_SPACE(sizeof(cn_msg) + sizeof(ev)));
+  nlmsghdr nl_hdr{};
+  nl_hdr.nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(ev));
+  nl_hdr.nlmsg_type = NLMSG_DONE;
+  cn_msg msg{};
+  msg.id.idx = cn_idx;
+  msg.id.val = CN_VAL_PROC;
+  msg.len = sizeof(ev);
+  memcpy(&(*buf)[off], &nl_hdr, sizeof(nl_hdr));
+  memcpy(&(*buf)[off + NLMSG_HDRLEN], &msg, sizeof(msg));
+  memcpy(&(*buf)[off + NLMSG_HDRLEN + sizeof(msg)], &ev, sizeof(ev));
+}
+
+TEST(ProcConnectorTest, ParseMessages) {
+  std::vector<uint8_t> buf;
+
+  proc_event fork{};
+  SetWhat(&fork.what, 0x00000001);  // PROC_EVENT_FORK
+  fork.event_data.fork.parent_pid = 1;
+  fork.event_data.fork.parent_tgid = 1;
+  fork.event_data.fork.child_pid = 42;
+  fork.event_data.fork.child_tgid = 42;
+  AppendProcEvent(fork, CN_IDX_PROC, &buf);
+
+  // Not a proc connector message, must be skipped.
+  AppendProcEvent(fork, CN_IDX_PROC + 1, &buf);
+
+  proc_event uid{};
+  SetWhat(&uid.what, 0x00000004);  // PROC_EVENT_UID
+  AppendProcEvent(uid, CN_IDX_PROC, &buf);
+
+  proc_event comm{};
+  SetWhat(&comm.what, 0x00000200);  // PROC_EVENT_COMM
+  comm.event_data.comm.process_pid = 43;
+  comm.event_data.comm.process_tgid = 42;
+  AppendProcEvent(comm, CN_IDX_PROC, &buf);
+
+  proc_event exit{};
+  SetWhat(&exit.what, 0x80000000);  // PROC_EVENT_EXIT
+  exit.event_data.exit.process_pid = 42;
+  exit.event_data.exit.process_tgid = 42;
+  AppendProcEvent(exit, CN_IDX_PROC, &buf);
+
+  std::vector<ProcConnector::Event> events;
+  ProcConnector::ParseMessages(buf.data(), buf.size(), &events);
+  ASSERT_EQ(events.size(), 3u);
+  EXPECT_EQ(events[0].type, ProcConnector::EventType::kFork);
+  EXPECT_EQ(events[0].pid, 42);
+  EXPECT_EQ(events[0].tgid, 42);
+  EXPECT_EQ(events[1].type, ProcConnector::EventType::kComm);
+  EXPECT_EQ(events[1].pid, 43);
+  EXPECT_EQ(events[1].tgid, 42);
+  EXPECT_EQ(events[2].type, ProcConnector::EventType::kExit);
+  EXPECT_EQ(events[2].pid, 42);
+
+  // A truncated message must not be read past the end of the buffer.
+  events.clear();
+  ProcConnector::ParseMessages(buf.data(), NLMSG_HDRLEN + 4, &events);
+  EXPECT_TRUE(events.empty());
+}
+
+}  // namespace
+}  // namespace perfetto
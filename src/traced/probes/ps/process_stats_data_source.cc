@@ -16,7 +16,11 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -29,6 +33,8 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/tracing/core/data_source_config.h"
 
 #include "protos/perfetto/config/process_stats/process_stats_config.pbzero.h"
@@ -36,8 +42,9 @@
 #include "protos/perfetto/trace/ps/process_tree.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
-// TODO(primiano): the code in this file assumes that PIDs are never recycled
-// and that processes/threads never change names. Neither is always true.
+// TODO(primiano): unless |use_proc_connector| is set, the code in this file
+// assumes that PIDs are never recycled and that processes/threads never change
+// names. Neither is always true.
 
 // The notion of PID in the Linux kernel is a bit confusing.
 // - PID: is really the thread id (for the main thread: PID == TID).
@@ -69,6 +76,32 @@ inline uint32_t ToU32(const char* str) {
   return static_cast<uint32_t>(strtol(str, nullptr, 10));
 }
 
+// Upper bound for the number of processes whose polled files are kept open,
+// regardless of RLIMIT_NOFILE.
+constexpr size_t kMaxPolledFdsPids = 16384;
+
+// Reads |fd| from the start into |out|, reusing its capacity. pread() avoids
+// the lseek() needed to re-read an fd that is kept open.
+bool PreadAll(int fd, std::string* out) {
+  out->resize(std::max<size_t>(out->capacity(), 4096));
+  size_t rsize = 0;
+  for (;;) {
+    if (rsize == out->size())
+      out->resize(out->size() * 2);
+    ssize_t res = PERFETTO_EINTR(pread(fd, &(*out)[rsize], out->size() - rsize,
+                                       static_cast<off_t>(rsize)));
+    if (res < 0) {
+      out->clear();
+      return false;
+    }
+    if (res == 0)
+      break;
+    rsize += static_cast<size_t>(res);
+  }
+  out->resize(rsize);
+  return true;
+}
+
 }  // namespace
 
 // static
@@ -93,6 +126,7 @@ ProcessStatsDataSource::ProcessStatsDataSource(
   ProcessStatsConfig::Decoder cfg(ds_config.process_stats_config_raw());
   record_thread_names_ = cfg.record_thread_names();
   dump_all_procs_on_start_ = cfg.scan_all_processes_on_start();
+  use_proc_connector_ = cfg.use_proc_connector();
 
   enable_on_demand_dumps_ = true;
   for (auto quirk = cfg.quirks(); quirk; ++quirk) {
@@ -112,12 +146,31 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     auto proc_stats_ttl_ms = cfg.proc_stats_cache_ttl_ms();
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
+
+    // Each polled process takes two fds, leave at least half of the fd limit
+    // to the rest of traced_probes.
+    struct rlimit rlim {};
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+      max_polled_fds_pids_ = static_cast<size_t>(
+          std::min<rlim_t>(rlim.rlim_cur / 4, kMaxPolledFdsPids));
+    }
   }
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
 
 void ProcessStatsDataSource::Start() {
+  // Subscribe before the initial scan, so that processes created while it's
+  // in progress are not missed.
+  if (use_proc_connector_) {
+    proc_connector_ = ProcConnector::Create(
+        task_runner_, [this](const std::vector<ProcConnector::Event>& events) {
+          OnProcEvents(events);
+        });
+    if (!proc_connector_)
+      PERFETTO_ELOG("Proc connector unavailable, relying on on-demand dumps");
+  }
+
   if (dump_all_procs_on_start_)
     WriteAllProcesses();
 
@@ -143,8 +196,7 @@ void ProcessStatsDataSource::WriteAllProcesses() {
     return;
   while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
     WriteProcessOrThread(pid);
-    base::StackString<128> task_path("/proc/%d/task", pid);
-    base::ScopedDir task_dir(opendir(task_path.c_str()));
+    base::ScopedDir task_dir = OpenProcPidTaskDir(pid);
     if (!task_dir)
       continue;
 
@@ -196,6 +248,42 @@ void ProcessStatsDataSource::OnRenamePids(const base::FlatSet<int32_t>& pids) {
     seen_pids_.erase(pid);
 }
 
+void ProcessStatsDataSource::OnProcEvents(
+    const std::vector<ProcConnector::Event>& events) {
+  PERFETTO_DCHECK(!cur_ps_tree_);
+  base::FlatSet<int32_t> pids;
+  for (const ProcConnector::Event& evt : events) {
+    switch (evt.type) {
+      case ProcConnector::EventType::kFork:
+        pids.insert(evt.pid);
+        break;
+      case ProcConnector::EventType::kExec:
+        // exec() replaces the cmdline of the whole thread group.
+        seen_pids_.erase(evt.tgid);
+        pids.insert(evt.tgid);
+        break;
+      case ProcConnector::EventType::kComm:
+        seen_pids_.erase(evt.pid);
+        pids.insert(evt.pid);
+        break;
+      case ProcConnector::EventType::kExit: {
+        // Forget everything about the pid, so that it's scanned again if the
+        // kernel recycles it.
+        seen_pids_.erase(evt.pid);
+        pids.erase(evt.pid);
+        process_stats_cache_.erase(evt.pid);
+        polled_fds_.erase(evt.pid);
+        uint32_t pid_u = static_cast<uint32_t>(evt.pid);
+        if (skip_stats_for_pids_.size() > pid_u)
+          skip_stats_for_pids_[pid_u] = false;
+        break;
+      }
+    }
+  }
+  // Reads /proc only for the pids that are not in |seen_pids_|.
+  WriteProcessTree(pids);
+}
+
 void ProcessStatsDataSource::Flush(FlushRequestID,
                                    std::function<void()> callback) {
   // We shouldn't get this in the middle of WriteAllProcesses() or OnPids().
@@ -326,16 +414,75 @@ base::ScopedDir ProcessStatsDataSource::OpenProcDir() {
   return proc_dir;
 }
 
+base::ScopedFile ProcessStatsDataSource::OpenAtProcDir(const char* path,
+                                                       int flags) {
+  if (!proc_dir_fd_) {
+    proc_dir_fd_.reset(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!proc_dir_fd_)
+      return base::ScopedFile();
+  }
+  return base::ScopedFile(openat(*proc_dir_fd_, path, flags | O_CLOEXEC));
+}
+
+base::ScopedDir ProcessStatsDataSource::OpenProcPidTaskDir(int32_t pid) {
+  base::StackString<32> path("%" PRId32 "/task", pid);
+  base::ScopedFile fd = OpenAtProcDir(path.c_str(), O_RDONLY | O_DIRECTORY);
+  if (!fd)
+    return base::ScopedDir();
+  base::ScopedDir task_dir(fdopendir(*fd));
+  if (task_dir)
+    fd.release();  // Now owned by |task_dir|.
+  return task_dir;
+}
+
 std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
                                                     const std::string& file) {
-  base::StackString<128> path("/proc/%" PRId32 "/%s", pid, file.c_str());
+  base::StackString<128> path("%" PRId32 "/%s", pid, file.c_str());
+  base::ScopedFile fd = OpenAtProcDir(path.c_str(), O_RDONLY);
+  if (!fd)
+    return "";
   std::string contents;
   contents.reserve(4096);
-  if (!base::ReadFile(path.c_str(), &contents))
+  if (!base::ReadFileDescriptor(*fd, &contents))
     return "";
   return contents;
 }
 
+bool ProcessStatsDataSource::ReadPolledProcPidFile(int32_t pid,
+                                                   PolledFile file,
+                                                   std::string* out) {
+  PolledFds* fds = nullptr;
+  auto it = polled_fds_.find(pid);
+  if (it != polled_fds_.end()) {
+    fds = &it->second;
+  } else if (polled_fds_.size() < max_polled_fds_pids_) {
+    fds = &polled_fds_[pid];
+  }
+
+  base::ScopedFile uncached_fd;
+  base::ScopedFile* fd = &uncached_fd;
+  if (fds)
+    fd = file == PolledFile::kStatus ? &fds->status : &fds->oom_score_adj;
+  if (!*fd) {
+    base::StackString<32> path(
+        "%" PRId32 "/%s", pid,
+        file == PolledFile::kStatus ? "status" : "oom_score_adj");
+    *fd = OpenAtProcDir(path.c_str(), O_RDONLY);
+  }
+
+  // Reading the files of a process that has been reaped fails with ESRCH,
+  // even if its pid has been recycled in the meantime.
+  if (*fd && PreadAll(**fd, out)) {
+    if (fds)
+      fds->last_poll = poll_count_;
+    return true;
+  }
+  out->clear();
+  if (fds)
+    polled_fds_.erase(pid);
+  return false;
+}
+
 std::string ProcessStatsDataSource::ReadProcStatusEntry(const std::string& buf,
                                                         const char* key) {
   auto begin = buf.find(key);
@@ -437,6 +584,8 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   base::ScopedDir proc_dir = OpenProcDir();
   if (!proc_dir)
     return;
+  poll_count_++;
+  int pids_polled = 0;
   base::FlatSet<int32_t> pids;
   while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
     cur_ps_stats_process_ = nullptr;
@@ -445,11 +594,13 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
     if (skip_stats_for_pids_.size() > pid_u && skip_stats_for_pids_[pid_u])
       continue;
 
-    std::string proc_status = ReadProcPidFile(pid, "status");
-    if (proc_status.empty())
+    if (!ReadPolledProcPidFile(pid, PolledFile::kStatus, &poll_buf_) ||
+        poll_buf_.empty()) {
       continue;
+    }
+    pids_polled++;
 
-    if (!WriteMemCounters(pid, proc_status)) {
+    if (!WriteMemCounters(pid, poll_buf_)) {
       // If WriteMemCounters() fails the pid is very likely a kernel thread
       // that has a valid /proc/[pid]/status but no memory values. In this
       // case avoid keep polling it over and over.
@@ -459,10 +610,10 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
       continue;
     }
 
-    std::string oom_score_adj = ReadProcPidFile(pid, "oom_score_adj");
-    if (!oom_score_adj.empty()) {
+    if (ReadPolledProcPidFile(pid, PolledFile::kOomScoreAdj, &poll_buf_) &&
+        !poll_buf_.empty()) {
       CachedProcessStats& cached = process_stats_cache_[pid];
-      auto counter = ToInt(oom_score_adj);
+      auto counter = ToInt(poll_buf_);
       if (counter != cached.oom_score_adj) {
         GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
         cached.oom_score_adj = counter;
@@ -473,6 +624,19 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   }
   FinalizeCurPacket();
 
+  // Close the fds of the processes that were not polled this time, either
+  // because they are gone or because they are kernel threads.
+  for (auto it = polled_fds_.begin(); it != polled_fds_.end();) {
+    if (it->second.last_poll != poll_count_) {
+      it = polled_fds_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  PERFETTO_METATRACE_COUNTER(TAG_PROC_POLLERS, PS_PIDS_POLLED, pids_polled);
+  PERFETTO_METATRACE_COUNTER(TAG_PROC_POLLERS, PS_POLLED_FDS_PIDS,
+                             static_cast<int>(polled_fds_.size()));
+
   // Ensure that we write once long-term process info (e.g., name) for new pids
   // that we haven't seen before.
   WriteProcessTree(pids);
@@ -483,6 +647,33 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
 // memory counters).
 bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
                                               const std::string& proc_status) {
+  using protos::pbzero::ProcessStats_Process;
+  struct MemCounter {
+    const char* key;
+    uint32_t field_id;
+    uint32_t CachedProcessStats::*cached;
+  };
+  // In the order in which they appear in /proc/[pid]/status.
+  static constexpr MemCounter kMemCounters[] = {
+      {"VmSize", ProcessStats_Process::kVmSizeKbFieldNumber,
+       &CachedProcessStats::vm_size_kb},
+      {"VmLck", ProcessStats_Process::kVmLockedKbFieldNumber,
+       &CachedProcessStats::vm_locked_kb},
+      {"VmHWM", ProcessStats_Process::kVmHwmKbFieldNumber,
+       &CachedProcessStats::vm_hvm_kb},
+      {"VmRSS", ProcessStats_Process::kVmRssKbFieldNumber,
+       &CachedProcessStats::vm_rss_kb},
+      {"RssAnon", ProcessStats_Process::kRssAnonKbFieldNumber,
+       &CachedProcessStats::rss_anon_kb},
+      {"RssFile", ProcessStats_Process::kRssFileKbFieldNumber,
+       &CachedProcessStats::rss_file_kb},
+      {"RssShmem", ProcessStats_Process::kRssShmemKbFieldNumber,
+       &CachedProcessStats::rss_shmem_kb},
+      {"VmSwap", ProcessStats_Process::kVmSwapKbFieldNumber,
+       &CachedProcessStats::vm_swap_kb},
+  };
+  constexpr size_t kNumMemCounters = base::ArraySize(kMemCounters);
+
   bool proc_status_has_mem_counters = false;
   CachedProcessStats& cached = process_stats_cache_[pid];
 
@@ -496,95 +687,45 @@ bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
   // VmSize:     5992 kB
   // VmLck:         0 kB
   // ...
-  std::vector<char> key;
-  std::vector<char> value;
-  enum { kKey, kSeparator, kValue } state = kKey;
-  for (char c : proc_status) {
-    if (c == '\n') {
-      key.push_back('\0');
-      value.push_back('\0');
-
-      // |value| will contain "1234 KB". We rely on strtol() (in ToU32()) to
-      // stop parsing at the first non-numeric character.
-      if (strcmp(key.data(), "VmSize") == 0) {
-        // Assume that if we see VmSize we'll see also the others.
-        proc_status_has_mem_counters = true;
-
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_size_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
-          cached.vm_size_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmLck") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_locked_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
-          cached.vm_locked_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmHWM") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_hvm_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
-          cached.vm_hvm_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmRSS") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_rss_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
-          cached.vm_rss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssAnon") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_anon_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
-          cached.rss_anon_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssFile") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_file_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
-          cached.rss_file_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssShmem") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_shmem_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
-          cached.rss_shmem_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmSwap") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_swap_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
-          cached.vm_swap_kb = counter;
+  // Only the lines starting with "Vm" or "Rss" are looked at, and the scan
+  // stops as soon as all the counters have been found, which skips the second
+  // half of the file (signal masks, cpu and memory lists, context switches).
+  const char* line = proc_status.data();
+  const char* const end = line + proc_status.size();
+  size_t num_found = 0;
+  while (line < end && num_found < kNumMemCounters) {
+    const char* eol = static_cast<const char*>(
+        memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (!eol)
+      break;  // Truncated line.
+    if (*line == 'V' || *line == 'R') {
+      const char* colon = static_cast<const char*>(
+          memchr(line, ':', static_cast<size_t>(eol - line)));
+      if (colon) {
+        base::StringView key(line, static_cast<size_t>(colon - line));
+        for (const MemCounter& mem_counter : kMemCounters) {
+          if (key != mem_counter.key)
+            continue;
+          // Assume that if we see VmSize (the first entry) we'll see also the
+          // others.
+          if (&mem_counter == &kMemCounters[0])
+            proc_status_has_mem_counters = true;
+          // The value looks like "1234 kB". We rely on strtol() (in ToU32())
+          // to skip the leading whitespace and stop at the first non-numeric
+          // character. |proc_status| is NUL terminated, so this can't overrun.
+          uint32_t counter = ToU32(colon + 1);
+          uint32_t& cached_counter = cached.*mem_counter.cached;
+          if (counter != cached_counter) {
+            GetOrCreateStatsProcess(pid)->AppendVarInt(mem_counter.field_id,
+                                                       counter);
+            cached_counter = counter;
+          }
+          num_found++;
+          break;
         }
       }
-
-      key.clear();
-      state = kKey;
-      continue;
-    }
-
-    if (state == kKey) {
-      if (c == ':') {
-        state = kSeparator;
-        continue;
-      }
-      key.push_back(c);
-      continue;
-    }
-
-    if (state == kSeparator) {
-      if (isspace(c))
-        continue;
-      value.clear();
-      value.push_back(c);
-      state = kValue;
-      continue;
-    }
-
-    if (state == kValue) {
-      value.push_back(c);
     }
+    line = eol + 1;
   }
   return proc_status_has_mem_counters;
 }
@@ -32,6 +32,7 @@
 #include "perfetto/tracing/core/forward_decls.h"
 #include "src/traced/probes/common/cpu_freq_info.h"
 #include "src/traced/probes/probes_data_source.h"
+#include "src/traced/probes/ps/proc_connector.h"
 
 namespace perfetto {
 
@@ -62,6 +63,7 @@ class ProcessStatsDataSource : public ProbesDataSource {
   void WriteAllProcesses();
   void OnPids(const base::FlatSet<int32_t>& pids);
   void OnRenamePids(const base::FlatSet<int32_t>& pids);
+  void OnProcEvents(const std::vector<ProcConnector::Event>& events);
 
   // ProbesDataSource implementation.
   void Start() override;
@@ -70,10 +72,20 @@ class ProcessStatsDataSource : public ProbesDataSource {
 
   bool on_demand_dumps_enabled() const { return enable_on_demand_dumps_; }
 
+  // The /proc/pid files read on each proc_stats poll.
+  enum class PolledFile { kStatus, kOomScoreAdj };
+
   // Virtual for testing.
   virtual base::ScopedDir OpenProcDir();
   virtual std::string ReadProcPidFile(int32_t pid, const std::string& file);
 
+  // Reads |file| of |pid| into |out|, reusing its capacity, through an fd that
+  // is kept open across polls. Returns false if the file couldn't be read,
+  // e.g. because the process died.
+  virtual bool ReadPolledProcPidFile(int32_t pid,
+                                     PolledFile file,
+                                     std::string* out);
+
  private:
   struct CachedProcessStats {
     uint32_t vm_size_kb = std::numeric_limits<uint32_t>::max();
@@ -90,6 +102,14 @@ class ProcessStatsDataSource : public ProbesDataSource {
     uint64_t cpu_time = std::numeric_limits<uint64_t>::max();
   };
 
+  struct PolledFds {
+    base::ScopedFile status;
+    base::ScopedFile oom_score_adj;
+    // Value of |poll_count_| when the files were last read. Used to close the
+    // fds of the processes that are gone.
+    uint64_t last_poll = 0;
+  };
+
   // Common functions.
   ProcessStatsDataSource(const ProcessStatsDataSource&) = delete;
   ProcessStatsDataSource& operator=(const ProcessStatsDataSource&) = delete;
@@ -109,6 +129,10 @@ class ProcessStatsDataSource : public ProbesDataSource {
   void WriteProcessOrThread(int32_t pid);
   std::string ReadProcStatusEntry(const std::string& buf, const char* key);
 
+  // Opens |path|, relative to /proc, through the cached |proc_dir_fd_|.
+  base::ScopedFile OpenAtProcDir(const char* path, int flags);
+  base::ScopedDir OpenProcPidTaskDir(int32_t pid);
+
   constexpr static size_t kMaxNamespacedTidSize = 8;
   using TidArray = std::array<int32_t, kMaxNamespacedTidSize>;
   // Reads the thread IDs in each non-root level of PID namespace from
@@ -152,6 +176,15 @@ class ProcessStatsDataSource : public ProbesDataSource {
   bool record_thread_names_ = false;
   bool enable_on_demand_dumps_ = true;
   bool dump_all_procs_on_start_ = false;
+  bool use_proc_connector_ = false;
+
+  // Opened on first use. Per-pid files are opened relative to it, rather than
+  // by absolute path, to save the lookup of /proc on each open().
+  base::ScopedFile proc_dir_fd_;
+
+  // Only set if |use_proc_connector_| and the kernel let us subscribe to the
+  // process events.
+  std::unique_ptr<ProcConnector> proc_connector_;
 
   // This set contains PIDs as per the Linux kernel notion of a PID (which is
   // really a TID). In practice this set will contain all TIDs for all processes
@@ -170,6 +203,15 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // Open fds of the files read on each poll. Bounded to |max_polled_fds_pids_|
+  // processes, the files of the others are opened and closed on each poll.
+  std::unordered_map<int32_t, PolledFds> polled_fds_;
+  size_t max_polled_fds_pids_ = 0;
+  uint64_t poll_count_ = 0;
+
+  // Reused across polls to read the /proc files into.
+  std::string poll_buf_;
+
   using TimeInStateCacheEntry = std::tuple</* tid */ int32_t,
                                            /* cpu_freq_index */ uint32_t,
                                            /* ticks */ uint64_t>;
@@ -17,6 +17,7 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <dirent.h>
+#include <unistd.h>
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
@@ -58,6 +59,15 @@ class TestProcessStatsDataSource : public ProcessStatsDataSource {
 
   MOCK_METHOD0(OpenProcDir, base::ScopedDir());
   MOCK_METHOD2(ReadProcPidFile, std::string(int32_t pid, const std::string&));
+
+  // Route the files read on each poll through the ReadProcPidFile() mock.
+  bool ReadPolledProcPidFile(int32_t pid,
+                             PolledFile file,
+                             std::string* out) override {
+    *out = ReadProcPidFile(
+        pid, file == PolledFile::kStatus ? "status" : "oom_score_adj");
+    return true;
+  }
 };
 
 class ProcessStatsDataSourceTest : public ::testing::Test {
@@ -317,6 +327,42 @@ TEST_F(ProcessStatsDataSourceTest, RenamePids) {
   EXPECT_EQ(ps_tree.threads_size(), 0);
 }
 
+TEST_F(ProcessStatsDataSourceTest, ProcConnectorEvents) {
+  using Event = ProcConnector::Event;
+  using EventType = ProcConnector::EventType;
+
+  DataSourceConfig config;
+  auto data_source = GetProcessStatsDataSource(config);
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "status"))
+      .WillRepeatedly(
+          Return("Name: \tproc_10\nTgid:  10\nPid:   10\nPPid:  1\n"));
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "cmdline"))
+      .WillOnce(Return(std::string("proc_10\0", 8)))
+      .WillOnce(Return(std::string("exec_10\0", 8)))
+      .WillOnce(Return(std::string("recycled_10\0", 12)));
+  EXPECT_CALL(*data_source, ReadProcPidFile(30, _)).Times(0);
+
+  data_source->OnProcEvents({Event{EventType::kFork, 10, 10}});
+  // Already seen, must not be scanned again.
+  data_source->OnProcEvents({Event{EventType::kFork, 10, 10}});
+  data_source->OnProcEvents({Event{EventType::kExec, 10, 10}});
+  // The pid is recycled.
+  data_source->OnProcEvents(
+      {Event{EventType::kExit, 10, 10}, Event{EventType::kFork, 10, 10}});
+  // Forked and exited before the events were read: nothing to scan.
+  data_source->OnProcEvents(
+      {Event{EventType::kFork, 30, 30}, Event{EventType::kExit, 30, 30}});
+
+  auto trace = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(trace.size(), 3u);
+  std::vector<std::string> cmdlines;
+  for (const auto& packet : trace) {
+    ASSERT_EQ(packet.process_tree().processes_size(), 1);
+    cmdlines.push_back(packet.process_tree().processes()[0].cmdline()[0]);
+  }
+  EXPECT_THAT(cmdlines, ElementsAre("proc_10", "exec_10", "recycled_10"));
+}
+
 TEST_F(ProcessStatsDataSourceTest, ProcessStats) {
   DataSourceConfig ds_config;
   ProcessStatsConfig cfg;
@@ -464,6 +510,33 @@ TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
   base::Rmdir(path);
 }
 
+TEST_F(ProcessStatsDataSourceTest, ReadPolledProcPidFile) {
+  DataSourceConfig ds_config;
+  ProcessStatsConfig cfg;
+  cfg.set_proc_stats_poll_ms(100);
+  ds_config.set_process_stats_config_raw(cfg.SerializeAsString());
+  auto data_source = GetProcessStatsDataSource(ds_config);
+
+  using PolledFile = ProcessStatsDataSource::PolledFile;
+  const int32_t pid = static_cast<int32_t>(getpid());
+  std::string expected_pid_line = "\nPid:\t" + std::to_string(pid) + "\n";
+  std::string buf;
+  // The second read goes through the fd kept open by the first one.
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(data_source->ProcessStatsDataSource::ReadPolledProcPidFile(
+        pid, PolledFile::kStatus, &buf));
+    EXPECT_NE(buf.find(expected_pid_line), std::string::npos);
+    EXPECT_NE(buf.find("\nVmRSS:"), std::string::npos);
+  }
+  ASSERT_TRUE(data_source->ProcessStatsDataSource::ReadPolledProcPidFile(
+      pid, PolledFile::kOomScoreAdj, &buf));
+  EXPECT_FALSE(buf.empty());
+
+  EXPECT_FALSE(data_source->ProcessStatsDataSource::ReadPolledProcPidFile(
+      std::numeric_limits<int32_t>::max(), PolledFile::kStatus, &buf));
+  EXPECT_TRUE(buf.empty());
+}
+
 TEST_F(ProcessStatsDataSourceTest, NamespacedProcess) {
   auto data_source = GetProcessStatsDataSource(DataSourceConfig());
   EXPECT_CALL(*data_source, ReadProcPidFile(42, "status"))
@@ -17,6 +17,7 @@
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -34,6 +35,8 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/traced/sys_stats_counters.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_utils.h"
 
 #include "protos/perfetto/common/sys_stats_counters.pbzero.h"
 #include "protos/perfetto/config/sys_stats/sys_stats_config.pbzero.h"
@@ -54,6 +57,19 @@ base::ScopedFile OpenReadOnly(const char* path) {
   return fd;
 }
 
+// When delta encoding counters, how often they are written in full, so that
+// the trace can be decoded after the ring buffer wraps or packets are lost.
+constexpr uint32_t kKeyframePeriodMs = 1000;
+
+uint32_t Gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
 uint32_t ClampTo10Ms(uint32_t period_ms, const char* counter_name) {
   if (period_ms > 0 && period_ms < 10) {
     PERFETTO_ILOG("%s %" PRIu32
@@ -138,6 +154,12 @@ SysStatsDataSource::SysStatsDataSource(
       vmstat_counters_.emplace(k.str, k.id);
   }
 
+  delta_encode_counters_ = cfg.delta_encode_counters();
+  if (delta_encode_counters_) {
+    last_meminfo_values_.resize(kMaxMeminfoEnum + 1);
+    last_vmstat_values_.resize(kMaxVmstatEnum + 1);
+  }
+
   if (!cfg.has_stat_counters())
     stat_enabled_fields_ = ~0u;
   for (auto counter = cfg.stat_counters(); counter; ++counter) {
@@ -178,6 +200,17 @@ SysStatsDataSource::SysStatsDataSource(
   devfreq_ticks_ = ticks[3];
   cpufreq_ticks_ = ticks[4];
   buddyinfo_ticks_ = ticks[5];
+
+  if (delta_encode_counters_) {
+    // Keyframes must fall on ticks on which both meminfo and vmstat are read.
+    uint32_t lcm = 1;
+    for (uint32_t t : {meminfo_ticks_, vmstat_ticks_}) {
+      if (t)
+        lcm = lcm / Gcd(lcm, t) * t;
+    }
+    keyframe_ticks_ =
+        lcm * std::max(1u, kKeyframePeriodMs / (lcm * tick_period_ms_));
+  }
 }
 
 void SysStatsDataSource::Start() {
@@ -209,11 +242,26 @@ void SysStatsDataSource::ReadSysStats() {
   packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
   auto* sys_stats = packet->set_sys_stats();
 
-  if (meminfo_ticks_ && tick_ % meminfo_ticks_ == 0)
+  is_keyframe_ = delta_encode_counters_ && tick_ % keyframe_ticks_ == 0;
+  bool has_deltas = false;
+
+  // A keyframe clears the counters of the trace processor even if reading
+  // /proc/meminfo or /proc/vmstat fails below, so the next deltas must be
+  // relative to 0 as well.
+  if (is_keyframe_) {
+    std::fill(last_meminfo_values_.begin(), last_meminfo_values_.end(), 0);
+    std::fill(last_vmstat_values_.begin(), last_vmstat_values_.end(), 0);
+  }
+
+  if (meminfo_ticks_ && tick_ % meminfo_ticks_ == 0) {
     ReadMeminfo(sys_stats);
+    has_deltas = delta_encode_counters_;
+  }
 
-  if (vmstat_ticks_ && tick_ % vmstat_ticks_ == 0)
+  if (vmstat_ticks_ && tick_ % vmstat_ticks_ == 0) {
     ReadVmstat(sys_stats);
+    has_deltas = delta_encode_counters_;
+  }
 
   if (stat_ticks_ && tick_ % stat_ticks_ == 0)
     ReadStat(sys_stats);
@@ -230,6 +278,16 @@ void SysStatsDataSource::ReadSysStats() {
   sys_stats->set_collection_end_timestamp(
       static_cast<uint64_t>(base::GetBootTimeNs().count()));
 
+  // The deltas are relative to the previous packets of the sequence, which
+  // the trace processor discards until the next keyframe if any is lost.
+  if (has_deltas) {
+    using protos::pbzero::TracePacket;
+    uint32_t seq_flags = TracePacket::SEQ_NEEDS_INCREMENTAL_STATE;
+    if (is_keyframe_)
+      seq_flags |= TracePacket::SEQ_INCREMENTAL_STATE_CLEARED;
+    packet->set_sequence_flags(seq_flags);
+  }
+
   tick_++;
 }
 
@@ -316,22 +374,24 @@ void SysStatsDataSource::ReadMeminfo(protos::pbzero::SysStats* sys_stats) {
   if (!rsize)
     return;
   char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    // Extract the meminfo key, dropping trailing ':' (e.g., "MemTotal: NN KB").
-    words.cur_token()[words.cur_token_size() - 1] = '\0';
-    auto it = meminfo_counters_.find(words.cur_token());
-    if (it == meminfo_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+  ParseCounterLines(buf, rsize, meminfo_counters_, &meminfo_layout_);
+
+  if (delta_encode_counters_) {
+    protozero::PackedVarInt keys;
+    protozero::PackedVarInt deltas;
+    AppendCounterDeltas(&last_meminfo_values_, &keys, &deltas);
+    if (keys.size()) {
+      sys_stats->set_meminfo_delta_keys(keys);
+      sys_stats->set_meminfo_delta_values(deltas);
+    }
+    return;
+  }
+
+  for (const auto& counter : counter_values_) {
     auto* meminfo = sys_stats->add_meminfo();
-    meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(counter_id));
-    meminfo->set_value(value);
+    meminfo->set_key(
+        static_cast<protos::pbzero::MeminfoCounters>(counter.first));
+    meminfo->set_value(counter.second);
   }
 }
 
@@ -340,20 +400,101 @@ void SysStatsDataSource::ReadVmstat(protos::pbzero::SysStats* sys_stats) {
   if (!rsize)
     return;
   char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    auto it = vmstat_counters_.find(words.cur_token());
-    if (it == vmstat_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+  ParseCounterLines(buf, rsize, vmstat_counters_, &vmstat_layout_);
+
+  if (delta_encode_counters_) {
+    protozero::PackedVarInt keys;
+    protozero::PackedVarInt deltas;
+    AppendCounterDeltas(&last_vmstat_values_, &keys, &deltas);
+    if (keys.size()) {
+      sys_stats->set_vmstat_delta_keys(keys);
+      sys_stats->set_vmstat_delta_values(deltas);
+    }
+    return;
+  }
+
+  for (const auto& counter : counter_values_) {
     auto* vmstat = sys_stats->add_vmstat();
-    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
-    vmstat->set_value(value);
+    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter.first));
+    vmstat->set_value(counter.second);
+  }
+}
+
+// The set and the order of the keys of /proc/meminfo and /proc/vmstat don't
+// change while the kernel is running. The first time a file is read, the line
+// of each enabled counter is found by looking up the key of every line in
+// |counters|. Afterwards, only the lines of the enabled counters are looked
+// at, and their key is just checked to be the expected one.
+void SysStatsDataSource::ParseCounterLines(char* buf,
+                                           size_t size,
+                                           const CounterMap& counters,
+                                           std::vector<CounterLine>* layout) {
+  // |size| includes the null terminator added by ReadFile().
+  char* const end = buf + size - 1;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool build_layout = layout->empty();
+    bool layout_matches = true;
+    size_t line_idx = 0;
+    counter_values_.clear();
+    for (char* line = buf; line < end; line_idx++) {
+      char* eol = static_cast<char*>(memchr(line, '\n', size_t(end - line)));
+      eol = eol ? eol : end;
+      // Meminfo keys are followed by ':', vmstat ones by ' '.
+      char* key_end = line;
+      while (key_end < eol && *key_end != ':' && *key_end != ' ')
+        key_end++;
+      size_t key_len = static_cast<size_t>(key_end - line);
+
+      if (build_layout) {
+        CounterLine counter_line{0, nullptr, 0};
+        if (key_len > 0 && key_end < eol) {
+          char key_end_char = *key_end;
+          *key_end = '\0';
+          auto it = counters.find(line);
+          *key_end = key_end_char;
+          if (it != counters.end())
+            counter_line = CounterLine{it->second, it->first, key_len};
+        }
+        layout->push_back(counter_line);
+      } else if (line_idx >= layout->size()) {
+        layout_matches = false;
+        break;
+      }
+
+      const CounterLine& counter_line = (*layout)[line_idx];
+      if (counter_line.id) {
+        if (key_len != counter_line.key_len ||
+            memcmp(line, counter_line.key, key_len) != 0 || key_end == eol) {
+          layout_matches = false;
+          break;
+        }
+        // strtoull() skips the leading whitespace and stops at the first
+        // non-numeric character, e.g. the " kB" suffix of meminfo.
+        counter_values_.emplace_back(
+            counter_line.id,
+            static_cast<uint64_t>(strtoull(key_end + 1, nullptr, 10)));
+      }
+      line = eol + 1;
+    }
+    if (layout_matches && line_idx == layout->size())
+      return;
+    layout->clear();
+  }
+  PERFETTO_DLOG("Failed to parse counter lines");
+}
+
+void SysStatsDataSource::AppendCounterDeltas(std::vector<uint64_t>* last_values,
+                                             protozero::PackedVarInt* keys,
+                                             protozero::PackedVarInt* deltas) {
+  for (const auto& counter : counter_values_) {
+    uint64_t& last_value = (*last_values)[static_cast<size_t>(counter.first)];
+    // Keyframes write all the counters, even the ones that are 0.
+    if (!is_keyframe_ && counter.second == last_value)
+      continue;
+    keys->Append(counter.first);
+    deltas->Append(protozero::proto_utils::ZigZagEncode(
+        static_cast<int64_t>(counter.second - last_value)));
+    last_value = counter.second;
   }
 }
 
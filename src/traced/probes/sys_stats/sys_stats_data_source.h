@@ -22,6 +22,8 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -32,6 +34,10 @@
 #include "src/traced/probes/common/cpu_freq_info.h"
 #include "src/traced/probes/probes_data_source.h"
 
+namespace protozero {
+class PackedVarInt;
+}  // namespace protozero
+
 namespace perfetto {
 
 namespace base {
@@ -76,6 +82,16 @@ class SysStatsDataSource : public ProbesDataSource {
       return strcmp(a, b) < 0;
     }
   };
+  using CounterMap = std::map<const char*, int, CStrCmp>;
+
+  // A line of a file made of "key value" lines, like /proc/meminfo and
+  // /proc/vmstat.
+  struct CounterLine {
+    // 0 if the counter of this line is not enabled.
+    int id;
+    const char* key;
+    size_t key_len;
+  };
 
   static void Tick(base::WeakPtr<SysStatsDataSource>);
 
@@ -90,6 +106,20 @@ class SysStatsDataSource : public ProbesDataSource {
   void ReadBuddyInfo(protos::pbzero::SysStats* sys_stats);
   size_t ReadFile(base::ScopedFile*, const char* path);
 
+  // Fills |counter_values_| with the counters of |counters| found in |buf|.
+  // The key of each line is looked up in |counters| only when |layout| is
+  // empty or doesn't match the file any more.
+  void ParseCounterLines(char* buf,
+                         size_t size,
+                         const CounterMap& counters,
+                         std::vector<CounterLine>* layout);
+
+  // Appends to |keys| and |deltas| the counters in |counter_values_| whose
+  // value differs from the one in |last_values|, and updates it.
+  void AppendCounterDeltas(std::vector<uint64_t>* last_values,
+                           protozero::PackedVarInt* keys,
+                           protozero::PackedVarInt* deltas);
+
   base::TaskRunner* const task_runner_;
   std::unique_ptr<TraceWriter> writer_;
   base::ScopedFile meminfo_fd_;
@@ -98,8 +128,22 @@ class SysStatsDataSource : public ProbesDataSource {
   base::ScopedFile buddy_fd_;
   base::PagedMemory read_buf_;
   TraceWriter::TracePacketHandle cur_packet_;
-  std::map<const char*, int, CStrCmp> meminfo_counters_;
-  std::map<const char*, int, CStrCmp> vmstat_counters_;
+  CounterMap meminfo_counters_;
+  CounterMap vmstat_counters_;
+  std::vector<CounterLine> meminfo_layout_;
+  std::vector<CounterLine> vmstat_layout_;
+  // Scratch buffer for ParseCounterLines(), pairs of (counter id, value).
+  std::vector<std::pair<int, uint64_t>> counter_values_;
+
+  // Used when SysStatsConfig.delta_encode_counters is set. The counters are
+  // written in full, and the incremental state of the sequence is cleared,
+  // every |keyframe_ticks_|.
+  bool delta_encode_counters_ = false;
+  bool is_keyframe_ = false;
+  uint32_t keyframe_ticks_ = 1;
+  std::vector<uint64_t> last_meminfo_values_;
+  std::vector<uint64_t> last_vmstat_values_;
+
   uint64_t ns_per_user_hz_ = 0;
   uint32_t tick_ = 0;
   uint32_t tick_period_ms_ = 0;
@@ -18,6 +18,7 @@
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/base/test/test_task_runner.h"
 #include "src/traced/probes/common/cpu_freq_info_for_testing.h"
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
@@ -28,6 +29,7 @@
 #include "protos/perfetto/config/data_source_config.gen.h"
 #include "protos/perfetto/config/sys_stats/sys_stats_config.gen.h"
 #include "protos/perfetto/trace/sys_stats/sys_stats.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
 
 using ::testing::_;
 using ::testing::Invoke;
@@ -248,17 +250,19 @@ class SysStatsDataSourceTest : public ::testing::Test {
     return instance;
   }
 
-  void Poller(SysStatsDataSource* ds, std::function<void()> checkpoint) {
-    if (ds->tick_for_testing())
+  void Poller(SysStatsDataSource* ds,
+              uint32_t ticks,
+              std::function<void()> checkpoint) {
+    if (ds->tick_for_testing() >= ticks)
       checkpoint();
     else
       task_runner_.PostDelayedTask(
-          [ds, checkpoint, this] { Poller(ds, checkpoint); }, 1);
+          [ds, ticks, checkpoint, this] { Poller(ds, ticks, checkpoint); }, 1);
   }
 
-  void WaitTick(SysStatsDataSource* data_source) {
+  void WaitTick(SysStatsDataSource* data_source, uint32_t ticks = 1) {
     auto checkpoint = task_runner_.CreateCheckpoint("on_tick");
-    Poller(data_source, checkpoint);
+    Poller(data_source, ticks, checkpoint);
     task_runner_.RunUntilCheckpoint("on_tick");
   }
 
@@ -374,6 +378,52 @@ TEST_F(SysStatsDataSourceTest, VmstatAll) {
   EXPECT_GE(sys_stats.vmstat_size(), 10);
 }
 
+TEST_F(SysStatsDataSourceTest, DeltaEncodedCounters) {
+  using protos::gen::TracePacket;
+  using protozero::proto_utils::ZigZagDecode;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.add_meminfo_counters(protos::gen::MEMINFO_MEM_TOTAL);
+  sys_cfg.add_meminfo_counters(protos::gen::MEMINFO_CMA_FREE);
+  sys_cfg.set_vmstat_period_ms(20);
+  sys_cfg.add_vmstat_counters(protos::gen::VMSTAT_NR_FREE_PAGES);
+  sys_cfg.set_delta_encode_counters(true);
+  DataSourceConfig config;
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config);
+
+  WaitTick(data_source.get(), 2);
+
+  std::vector<TracePacket> packets = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 2u);
+
+  // The first packet is a keyframe with all the counters, relative to 0.
+  EXPECT_EQ(packets[0].sequence_flags(),
+            static_cast<uint32_t>(TracePacket::SEQ_INCREMENTAL_STATE_CLEARED |
+                                  TracePacket::SEQ_NEEDS_INCREMENTAL_STATE));
+  const auto& keyframe = packets[0].sys_stats();
+  EXPECT_EQ(keyframe.meminfo_size(), 0);
+  EXPECT_EQ(keyframe.vmstat_size(), 0);
+  ASSERT_EQ(keyframe.meminfo_delta_keys().size(), 2u);
+  ASSERT_EQ(keyframe.meminfo_delta_values().size(), 2u);
+  EXPECT_EQ(keyframe.meminfo_delta_keys()[0],
+            static_cast<uint32_t>(protos::gen::MEMINFO_MEM_TOTAL));
+  EXPECT_EQ(ZigZagDecode(keyframe.meminfo_delta_values()[0]), 3744240);
+  EXPECT_EQ(keyframe.meminfo_delta_keys()[1],
+            static_cast<uint32_t>(protos::gen::MEMINFO_CMA_FREE));
+  EXPECT_EQ(ZigZagDecode(keyframe.meminfo_delta_values()[1]), 60);
+  ASSERT_EQ(keyframe.vmstat_delta_keys().size(), 1u);
+  EXPECT_EQ(keyframe.vmstat_delta_keys()[0],
+            static_cast<uint32_t>(protos::gen::VMSTAT_NR_FREE_PAGES));
+  EXPECT_EQ(ZigZagDecode(keyframe.vmstat_delta_values()[0]), 16449);
+
+  // The counters didn't change, so the second packet doesn't have any.
+  EXPECT_EQ(packets[1].sequence_flags(),
+            static_cast<uint32_t>(TracePacket::SEQ_NEEDS_INCREMENTAL_STATE));
+  EXPECT_TRUE(packets[1].sys_stats().meminfo_delta_keys().empty());
+  EXPECT_TRUE(packets[1].sys_stats().vmstat_delta_keys().empty());
+}
+
 TEST_F(SysStatsDataSourceTest, BuddyinfoAll) {
   DataSourceConfig config;
   protos::gen::SysStatsConfig sys_cfg;
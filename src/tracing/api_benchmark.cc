@@ -167,6 +167,26 @@ static void BM_TracingTrackEventLambda(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+// Measures the TrackEvent throughput when emitting events from several
+// threads concurrently, which exercises chunk acquisition in the
+// SharedMemoryArbiter.
+static void BM_TracingTrackEventThreads(benchmark::State& state) {
+  static std::unique_ptr<perfetto::TracingSession> tracing_session;
+  if (state.thread_index == 0)
+    tracing_session = StartTracing("track_event");
+
+  for (auto _ : state) {
+    TRACE_EVENT_BEGIN("benchmark", "Event");
+    benchmark::ClobberMemory();
+  }
+
+  if (state.thread_index == 0) {
+    tracing_session->StopBlocking();
+    PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+    tracing_session.reset();
+  }
+}
+
 }  // namespace
 
 BENCHMARK(BM_TracingDataSourceDisabled);
@@ -176,3 +196,4 @@ BENCHMARK(BM_TracingTrackEventBasic);
 BENCHMARK(BM_TracingTrackEventDebugAnnotations);
 BENCHMARK(BM_TracingTrackEventDisabled);
 BENCHMARK(BM_TracingTrackEventLambda);
+BENCHMARK(BM_TracingTrackEventThreads)->ThreadRange(1, 64)->UseRealTime();
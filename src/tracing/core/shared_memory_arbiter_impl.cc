@@ -103,10 +103,19 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
   static const int kFlushCommitsAfterEveryNStalls = 2;
   static const int kAssertAtNStalls = 200;
 
+  // Fast path: page partitioning and chunk acquisition only rely on the
+  // atomic Try* operations of SharedMemoryABI, so we can grab a free chunk
+  // without contending on |lock_| with the other writer threads. The lock is
+  // only required if the SMB is filling up, as we might have to commit
+  // synchronously (see below), or if no chunk is free.
+  if (bytes_pending_commit_.load(std::memory_order_relaxed) <
+      shmem_abi_.size() / 2) {
+    Chunk chunk = TryAcquireFreeChunk(header);
+    if (chunk.is_valid())
+      return chunk;
+  }
+
   for (;;) {
-    // TODO(primiano): Probably this lock is not really required and this code
-    // could be rewritten leveraging only the Try* atomic operations in
-    // SharedMemoryABI. But let's not be too adventurous for the moment.
     {
       std::unique_lock<std::mutex> scoped_lock(lock_);
 
@@ -136,48 +145,32 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
           buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
           commit_data_req_ && bytes_pending_commit_ >= shmem_abi_.size() / 2;
 
-      const size_t initial_page_idx = page_idx_;
-      for (size_t i = 0; i < shmem_abi_.num_pages(); i++) {
-        page_idx_ = (initial_page_idx + i) % shmem_abi_.num_pages();
-        bool is_new_page = false;
-
-        // TODO(primiano): make the page layout dynamic.
-        auto layout = SharedMemoryArbiterImpl::default_page_layout;
-
-        if (shmem_abi_.is_page_free(page_idx_)) {
-          // TODO(primiano): Use the |size_hint| here to decide the layout.
-          is_new_page = shmem_abi_.TryPartitionPage(page_idx_, layout);
+      Chunk chunk = TryAcquireFreeChunk(header);
+      if (chunk.is_valid()) {
+        if (stall_count > kLogAfterNStalls) {
+          PERFETTO_LOG("Recovered from stall after %d iterations",
+                       stall_count);
         }
-        uint32_t free_chunks;
-        if (is_new_page) {
-          free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
+
+        if (should_commit_synchronously) {
+          // We can't flush while holding the lock.
+          scoped_lock.unlock();
+          FlushPendingCommitDataRequests();
+          return chunk;
         } else {
-          free_chunks = shmem_abi_.GetFreeChunks(page_idx_);
+          return chunk;
         }
+      }
 
-        for (uint32_t chunk_idx = 0; free_chunks;
-             chunk_idx++, free_chunks >>= 1) {
-          if (!(free_chunks & 1))
-            continue;
-          // We found a free chunk.
-          Chunk chunk = shmem_abi_.TryAcquireChunkForWriting(
-              page_idx_, chunk_idx, &header);
-          if (!chunk.is_valid())
-            continue;
-          if (stall_count > kLogAfterNStalls) {
-            PERFETTO_LOG("Recovered from stall after %d iterations",
-                         stall_count);
-          }
-
-          if (should_commit_synchronously) {
-            // We can't flush while holding the lock.
-            scoped_lock.unlock();
-            FlushPendingCommitDataRequests();
-            return chunk;
-          } else {
-            return chunk;
-          }
-        }
+      // No free chunk was found. Keep track of it, so the service can report
+      // SMB exhaustion in the TraceStats. Stalls are counted once per
+      // GetNewChunk() call rather than once per retry.
+      if (buffer_exhausted_policy == BufferExhaustedPolicy::kDrop) {
+        smb_stats_.chunks_dropped++;
+        smb_stats_changed_ = true;
+      } else if (stall_count == 0) {
+        smb_stats_.stalls++;
+        smb_stats_changed_ = true;
       }
     }  // scoped_lock
 
@@ -255,6 +248,9 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
   base::TaskRunner* task_runner_to_post_delayed_callback_on = nullptr;
   // The delay with which the flush will be posted.
   uint32_t flush_delay_ms = 0;
+  // Whether the posted flush is the one tracked by
+  // |immediate_flush_scheduled_|.
+  bool immediate_flush = false;
   base::WeakPtr<SharedMemoryArbiterImpl> weak_this;
   {
     std::lock_guard<std::mutex> scoped_lock(lock_);
@@ -359,11 +355,17 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     // accumulate the patch and a crash occurs before the patch is sent, the
     // service will not know of the patch and won't be able to reconstruct the
     // trace.
-    if (fully_bound_ &&
+    //
+    // If an immediate flush is already pending, it will pick up this chunk and
+    // patches too, so there's no need to wake up the task runner again for
+    // every chunk returned until then.
+    if (fully_bound_ && !immediate_flush_scheduled_ &&
         (last_patch_req || bytes_pending_commit_ >= shmem_abi_.size() / 2)) {
       weak_this = weak_ptr_factory_.GetWeakPtr();
       task_runner_to_post_delayed_callback_on = task_runner_;
       flush_delay_ms = 0;
+      immediate_flush = true;
+      immediate_flush_scheduled_ = true;
     }
   }  // scoped_lock(lock_)
 
@@ -372,7 +374,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
   // because |task_runner_| is never reset.
   if (task_runner_to_post_delayed_callback_on) {
     task_runner_to_post_delayed_callback_on->PostDelayedTask(
-        [weak_this] {
+        [weak_this, immediate_flush] {
           if (!weak_this)
             return;
           {
@@ -380,6 +382,11 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
             // Clear |delayed_flush_scheduled_|, allowing the next call to
             // UpdateCommitDataRequest to start another batching period.
             weak_this->delayed_flush_scheduled_ = false;
+            // Only the task that set |immediate_flush_scheduled_| clears it:
+            // if a delayed flush cleared it while an immediate one is still
+            // queued, the next returned chunk would post a second one.
+            if (immediate_flush)
+              weak_this->immediate_flush_scheduled_ = false;
           }
           weak_this->FlushPendingCommitDataRequests();
         },
@@ -548,8 +555,13 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
         shmem_abi_.ReleaseChunkAsComplete(std::move(chunk));
       }
 
+      MaybeAttachSmbStatsLocked();
       req = std::move(commit_data_req_);
       bytes_pending_commit_ = 0;
+    } else if (smb_stats_changed_) {
+      commit_data_req_.reset(new CommitDataRequest());
+      MaybeAttachSmbStatsLocked();
+      req = std::move(commit_data_req_);
     }
   }  // scoped_lock
 
@@ -796,6 +808,7 @@ std::unique_ptr<TraceWriter> SharedMemoryArbiterImpl::CreateTraceWriterInternal(
     id = active_writer_ids_.Allocate();
     if (!id)
       return std::unique_ptr<TraceWriter>(new NullTraceWriter());
+    num_active_writers_++;
 
     PERFETTO_DCHECK(!pending_writers_.count(id));
 
@@ -853,6 +866,8 @@ void SharedMemoryArbiterImpl::ReleaseWriterID(WriterID id) {
   {
     std::lock_guard<std::mutex> scoped_lock(lock_);
     active_writer_ids_.Free(id);
+    PERFETTO_DCHECK(num_active_writers_ > 0);
+    num_active_writers_--;
 
     auto it = pending_writers_.find(id);
     if (it != pending_writers_.end()) {
@@ -927,4 +942,80 @@ bool SharedMemoryArbiterImpl::UpdateFullyBoundLocked() {
   return fully_bound_;
 }
 
+Chunk SharedMemoryArbiterImpl::TryAcquireFreeChunk(
+    const SharedMemoryABI::ChunkHeader& header) {
+  // |page_idx_| is only a hint of where to start scanning from: concurrent
+  // callers may start from the same page, in which case all but one of them
+  // will fail the CAS in TryPartitionPage() / TryAcquireChunkForWriting() and
+  // move on to the next free chunk.
+  const size_t num_pages = shmem_abi_.num_pages();
+  const size_t initial_page_idx = page_idx_.load(std::memory_order_relaxed);
+  const auto layout = GetPageLayout();
+  for (size_t i = 0; i < num_pages; i++) {
+    const size_t page_idx = (initial_page_idx + i) % num_pages;
+    bool is_new_page = false;
+
+    if (shmem_abi_.is_page_free(page_idx)) {
+      // TODO(primiano): Use the |size_hint| of GetNewChunk() here to decide
+      // the layout.
+      is_new_page = shmem_abi_.TryPartitionPage(page_idx, layout);
+    }
+    uint32_t free_chunks;
+    if (is_new_page) {
+      free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
+    } else {
+      free_chunks = shmem_abi_.GetFreeChunks(page_idx);
+    }
+
+    for (uint32_t chunk_idx = 0; free_chunks;
+         chunk_idx++, free_chunks >>= 1) {
+      if (!(free_chunks & 1))
+        continue;
+      // We found a free chunk.
+      Chunk chunk =
+          shmem_abi_.TryAcquireChunkForWriting(page_idx, chunk_idx, &header);
+      if (!chunk.is_valid())
+        continue;
+      page_idx_.store(page_idx, std::memory_order_relaxed);
+      return chunk;
+    }
+  }
+  return Chunk();
+}
+
+SharedMemoryABI::PageLayout SharedMemoryArbiterImpl::GetPageLayout() const {
+  // Pages are not split further than |default_page_layout| by default: larger
+  // chunks mean less per-chunk overhead and fewer entries in CommitData().
+  // However, each TraceWriter holds onto a whole chunk while writing. If there
+  // are more active writers than pages, writers end up stalling (or dropping
+  // data) even if the SMB is mostly empty. In this case, split the new pages
+  // further to have at least one chunk per writer, as long as the chunks don't
+  // become too small.
+  static constexpr size_t kMinChunkSize = 1024;
+  const size_t num_pages = shmem_abi_.num_pages();
+  auto layout = default_page_layout;
+  while (layout < SharedMemoryABI::kPageDiv14 &&
+         num_pages * SharedMemoryABI::kNumChunksForLayout[layout] <
+             num_active_writers_.load(std::memory_order_relaxed)) {
+    const auto next_layout = static_cast<SharedMemoryABI::PageLayout>(
+        static_cast<uint32_t>(layout) + 1);
+    if (shmem_abi_.page_size() /
+            SharedMemoryABI::kNumChunksForLayout[next_layout] <
+        kMinChunkSize) {
+      break;
+    }
+    layout = next_layout;
+  }
+  return layout;
+}
+
+void SharedMemoryArbiterImpl::MaybeAttachSmbStatsLocked() {
+  if (!smb_stats_changed_ || !commit_data_req_)
+    return;
+  auto* stats = commit_data_req_->mutable_smb_stats();
+  stats->set_stalls(smb_stats_.stalls);
+  stats->set_chunks_dropped(smb_stats_.chunks_dropped);
+  smb_stats_changed_ = false;
+}
+
 }  // namespace perfetto
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -241,6 +242,21 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // state.
   bool UpdateFullyBoundLocked();
 
+  // Scans the SMB starting from |page_idx_| and tries to acquire a free chunk
+  // for writing, partitioning free pages as needed. Only relies on the atomic
+  // operations of SharedMemoryABI, so it can be called without holding
+  // |lock_|. Returns an invalid Chunk if no chunk is free.
+  SharedMemoryABI::Chunk TryAcquireFreeChunk(
+      const SharedMemoryABI::ChunkHeader& header);
+
+  // Returns the layout to use for partitioning a free page, based on the
+  // number of active writers. See comments in the .cc file.
+  SharedMemoryABI::PageLayout GetPageLayout() const;
+
+  // Attaches |smb_stats_| to |commit_data_req_| if they changed since they
+  // were last sent to the service.
+  void MaybeAttachSmbStatsLocked();
+
   // Only accessed on |task_runner_| after the producer endpoint was bound.
   TracingService::ProducerEndpoint* producer_endpoint_ = nullptr;
 
@@ -250,12 +266,31 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   base::TaskRunner* task_runner_ = nullptr;
   SharedMemoryABI shmem_abi_;
-  size_t page_idx_ = 0;
   std::unique_ptr<CommitDataRequest> commit_data_req_;
-  size_t bytes_pending_commit_ = 0;  // SUM(chunk.size() : commit_data_req_).
   IdAllocator<WriterID> active_writer_ids_;
   bool did_shutdown_ = false;
 
+  // Hint of where TryAcquireFreeChunk() starts scanning the SMB from. Read and
+  // written with relaxed ordering both with and without |lock_| held, as any
+  // page index is a valid starting point.
+  std::atomic<size_t> page_idx_{0};
+
+  // The following are only modified while holding |lock_|, but are also read
+  // without it by the lock-free fast path of GetNewChunk(). Those reads are
+  // heuristics: the fast path doesn't rely on them for correctness.
+  // SUM(chunk.size() : commit_data_req_).
+  std::atomic<size_t> bytes_pending_commit_{0};
+  std::atomic<size_t> num_active_writers_{0};
+
+  // Cumulative counters reported to the service, see
+  // CommitDataRequest::SmbStats.
+  struct SmbStats {
+    uint64_t stalls = 0;
+    uint64_t chunks_dropped = 0;
+  };
+  SmbStats smb_stats_;
+  bool smb_stats_changed_ = false;
+
   // Whether the arbiter itself and all startup target buffer reservations are
   // bound. Note that this can become false again later if a new target buffer
   // reservation is created by calling CreateStartupTraceWriter() with a new
@@ -296,6 +331,11 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // batching period.
   bool delayed_flush_scheduled_ = false;
 
+  // Whether an immediate (non-delayed) flush task was posted and didn't run
+  // yet. Used to avoid posting one flush task per returned chunk while the SMB
+  // is filling up.
+  bool immediate_flush_scheduled_ = false;
+
   // Stores target buffer reservations for writers created via
   // CreateStartupTraceWriter(). A bound reservation sets
   // TargetBufferReservation::resolved to true and is associated with the actual
@@ -17,6 +17,10 @@
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include <bitset>
+#include <deque>
+#include <set>
+#include <thread>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/commit_data_request.h"
@@ -203,6 +207,127 @@ TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   arbiter_->FlushPendingCommitDataRequests();
 }
 
+class CountingTaskRunner : public base::TestTaskRunner {
+ public:
+  void PostDelayedTask(std::function<void()> task, uint32_t delay_ms) override {
+    num_posted_tasks++;
+    base::TestTaskRunner::PostDelayedTask(std::move(task), delay_ms);
+  }
+
+  size_t num_posted_tasks = 0;
+};
+
+// While the SMB is more than half full, every returned chunk requires an
+// immediate commit. Verify that these don't result in one flush task (and one
+// wakeup of the task runner) per chunk.
+TEST_P(SharedMemoryArbiterImplTest, CoalesceImmediateFlushes) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  CountingTaskRunner task_runner;
+  arbiter_.reset(new SharedMemoryArbiterImpl(buf(), buf_size(), page_size(),
+                                             &mock_producer_endpoint_,
+                                             &task_runner));
+  arbiter_->SetBatchCommitsDuration(UINT32_MAX);
+
+  static constexpr size_t kTotChunks = kNumPages;
+  SharedMemoryABI::Chunk chunks[kTotChunks];
+  for (size_t i = 0; i < kTotChunks; i++) {
+    chunks[i] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+    ASSERT_TRUE(chunks[i].is_valid());
+  }
+
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(static_cast<int>(kTotChunks), req.chunks_to_move_size());
+      }));
+  PatchList ignored;
+  for (size_t i = 0; i < kTotChunks; i++)
+    arbiter_->ReturnCompletedChunk(std::move(chunks[i]), 1, &ignored);
+
+  // One task for the delayed flush at the end of the batching period and one
+  // for the immediate flush.
+  EXPECT_EQ(2u, task_runner.num_posted_tasks);
+  task_runner.RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  arbiter_.reset();
+}
+
+// Runs the posted tasks only when asked to, in the order they were posted.
+class ManualTaskRunner : public base::TestTaskRunner {
+ public:
+  void PostDelayedTask(std::function<void()> task, uint32_t) override {
+    tasks.push_back(std::move(task));
+  }
+
+  void RunNextTask() {
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+    task();
+  }
+
+  std::deque<std::function<void()>> tasks;
+};
+
+// The end of a batching period flushes everything, but must not allow a
+// second immediate flush to be posted while the first one is still queued.
+TEST_P(SharedMemoryArbiterImplTest, DelayedFlushKeepsImmediateFlushPending) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  ManualTaskRunner task_runner;
+  arbiter_.reset(new SharedMemoryArbiterImpl(buf(), buf_size(), page_size(),
+                                             &mock_producer_endpoint_,
+                                             &task_runner));
+  SharedMemoryABI* shmem_abi = arbiter_->shmem_abi_for_testing();
+
+  // Each chunk is slightly smaller than a page, so it takes one more than half
+  // of the pages to fill half of the SMB.
+  static constexpr size_t kChunksToFillHalf = kNumPages / 2 + 1;
+  PatchList ignored;
+  auto return_chunks = [&] {
+    for (size_t i = 0; i < kChunksToFillHalf; i++) {
+      SharedMemoryABI::Chunk chunk =
+          arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+      ASSERT_TRUE(chunk.is_valid());
+      arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+    }
+  };
+  auto expect_commit = [&] {
+    EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+        .WillOnce(Invoke([shmem_abi](const CommitDataRequest& req,
+                                     MockProducerEndpoint::CommitDataCallback) {
+          ASSERT_EQ(static_cast<int>(kChunksToFillHalf),
+                    req.chunks_to_move_size());
+          for (const auto& ctm : req.chunks_to_move()) {
+            shmem_abi->ReleaseChunkAsFree(
+                shmem_abi->TryAcquireChunkForReading(ctm.page(), ctm.chunk()));
+          }
+        }));
+  };
+
+  // Filling half of the SMB posts the delayed flush of the batching period,
+  // followed by an immediate flush.
+  return_chunks();
+  ASSERT_EQ(2u, task_runner.tasks.size());
+
+  // The batching period ends first and commits all the chunks.
+  expect_commit();
+  task_runner.RunNextTask();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // Filling half of the SMB again starts a new batching period, but doesn't
+  // post another immediate flush: the one still queued will commit these
+  // chunks.
+  return_chunks();
+  EXPECT_EQ(2u, task_runner.tasks.size());
+
+  expect_commit();
+  while (!task_runner.tasks.empty())
+    task_runner.RunNextTask();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  arbiter_.reset();
+}
+
 // Check that we can actually create up to kMaxWriterID TraceWriter(s).
 TEST_P(SharedMemoryArbiterImplTest, WriterIDsAllocation) {
   auto checkpoint = task_runner_->CreateCheckpoint("last_unregistered");
@@ -297,6 +422,96 @@ TEST_P(SharedMemoryArbiterImplTest, BufferExhaustedPolicyDrop) {
   ASSERT_TRUE(chunks[0].is_valid());
 }
 
+// Verify that SMB exhaustion is reported to the service in the next commit.
+TEST_P(SharedMemoryArbiterImplTest, SmbStatsReportedOnCommit) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  static constexpr size_t kTotChunks = kNumPages;
+  SharedMemoryABI::Chunk chunks[kTotChunks];
+  for (size_t i = 0; i < kTotChunks; i++) {
+    chunks[i] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+    ASSERT_TRUE(chunks[i].is_valid());
+  }
+  ASSERT_FALSE(arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop)
+                   .is_valid());
+  ASSERT_FALSE(arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop)
+                   .is_valid());
+
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(1, req.chunks_to_move_size());
+        ASSERT_TRUE(req.has_smb_stats());
+        EXPECT_EQ(2u, req.smb_stats().chunks_dropped());
+        EXPECT_EQ(0u, req.smb_stats().stalls());
+      }));
+  PatchList ignored;
+  arbiter_->ReturnCompletedChunk(std::move(chunks[0]), 1, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // The stats didn't change, so they shouldn't be sent again.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_FALSE(req.has_smb_stats());
+      }));
+  arbiter_->ReturnCompletedChunk(std::move(chunks[1]), 1, &ignored);
+  task_runner_->RunUntilIdle();
+}
+
+// Verify that pages are split further when there are more active writers than
+// pages in the SMB.
+TEST_P(SharedMemoryArbiterImplTest, PageLayoutFollowsActiveWriters) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+
+  std::vector<std::unique_ptr<TraceWriter>> writers;
+  for (size_t i = 0; i < kNumPages; i++)
+    writers.push_back(arbiter_->CreateTraceWriter(1));
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_EQ(1u, SharedMemoryABI::GetNumChunksForLayout(abi->GetPageLayout(0)));
+
+  for (size_t i = 0; i < kNumPages; i++)
+    writers.push_back(arbiter_->CreateTraceWriter(1));
+  chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_EQ(2u, SharedMemoryABI::GetNumChunksForLayout(abi->GetPageLayout(1)));
+}
+
+// Several threads acquire chunks concurrently through the lock-free fast path
+// of GetNewChunk(). Every chunk in the SMB should be handed out exactly once.
+TEST_P(SharedMemoryArbiterImplTest, ConcurrentGetNewChunk) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv4);
+  static constexpr size_t kNumThreads = 4;
+  std::vector<std::vector<SharedMemoryABI::Chunk>> chunks(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([this, &chunks, t] {
+      for (;;) {
+        SharedMemoryABI::Chunk chunk =
+            arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+        if (!chunk.is_valid())
+          break;
+        chunks[t].push_back(std::move(chunk));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  std::set<uint8_t*> chunk_begins;
+  for (const auto& thread_chunks : chunks) {
+    for (const auto& chunk : thread_chunks)
+      EXPECT_TRUE(chunk_begins.insert(chunk.begin()).second);
+  }
+  EXPECT_EQ(kNumPages * 4, chunk_begins.size());
+}
+
 TEST_P(SharedMemoryArbiterImplTest, CreateUnboundAndBind) {
   auto checkpoint_writer = task_runner_->CreateCheckpoint("writer_registered");
   auto checkpoint_flush = task_runner_->CreateCheckpoint("flush_completed");
@@ -79,6 +79,7 @@ bool TraceBuffer::Initialize(size_t size) {
   wptr_ = begin();
   index_.clear();
   last_chunk_id_written_.clear();
+  producer_stats_.clear();
   read_iter_ = GetReadIterForSequence(index_.end());
   return true;
 }
@@ -213,7 +214,19 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   }
 
   if (PERFETTO_UNLIKELY(discard_writes_))
-    return DiscardWrite();
+    return DiscardWrite(producer_id_trusted);
+
+  ProducerStats& producer_stats = producer_stats_[producer_id_trusted];
+  if (PERFETTO_UNLIKELY(max_bytes_per_producer_ &&
+                        producer_stats.bytes_in_buffer + record_size >
+                            max_bytes_per_producer_)) {
+    // Unlike DiscardWrite(), this doesn't prevent further writes from other
+    // producers, which still have room within their own quota.
+    TRACE_BUFFER_DLOG("  producer over quota, discarding write");
+    stats_.set_chunks_discarded(stats_.chunks_discarded() + 1);
+    producer_stats.chunks_discarded++;
+    return;
+  }
 
   // If there isn't enough room from the given write position. Write a padding
   // record to clear the end of the buffer and wrap back.
@@ -221,7 +234,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   if (PERFETTO_UNLIKELY(record_size > cached_size_to_end)) {
     ssize_t res = DeleteNextChunksFor(cached_size_to_end);
     if (res == -1)
-      return DiscardWrite();
+      return DiscardWrite(producer_id_trusted);
     PERFETTO_DCHECK(static_cast<size_t>(res) <= cached_size_to_end);
     AddPaddingRecord(cached_size_to_end);
     wptr_ = begin();
@@ -251,12 +264,13 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // Deletes all chunks from |wptr_| to |wptr_| + |record_size|.
   ssize_t del_res = DeleteNextChunksFor(record_size);
   if (del_res == -1)
-    return DiscardWrite();
+    return DiscardWrite(producer_id_trusted);
   size_t padding_size = static_cast<size_t>(del_res);
 
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
+  producer_stats.bytes_in_buffer += record_size;
   auto it_and_inserted = index_.emplace(
       key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
                      chunk_flags, producer_uid_trusted, producer_pid_trusted));
@@ -346,6 +360,7 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
             return -1;
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
+          producer_stats_[key.producer_id].chunks_overwritten++;
         }
         index_delete.push_back(it);
         will_remove = true;
@@ -371,6 +386,7 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
 
   // Remove from the index.
   for (auto it : index_delete) {
+    ReleaseProducerBytes(&it->second);
     index_.erase(it);
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
@@ -812,6 +828,7 @@ TraceBuffer::ReadPacketResult TraceBuffer::ReadNextPacketInChunk(
       stats_.set_chunks_read(stats_.chunks_read() + 1);
       stats_.set_bytes_read(stats_.bytes_read() +
                             chunk_meta->chunk_record->size);
+      ReleaseProducerBytes(chunk_meta);
     }
     return ReadPacketResult::kFailedInvalidPacket;
   }
@@ -846,6 +863,7 @@ TraceBuffer::ReadPacketResult TraceBuffer::ReadNextPacketInChunk(
       stats_.set_chunks_read(stats_.chunks_read() + 1);
       stats_.set_bytes_read(stats_.bytes_read() +
                             chunk_meta->chunk_record->size);
+      ReleaseProducerBytes(chunk_meta);
     }
     return ReadPacketResult::kFailedInvalidPacket;
   }
@@ -859,6 +877,7 @@ TraceBuffer::ReadPacketResult TraceBuffer::ReadNextPacketInChunk(
                         chunk_meta->is_complete())) {
     stats_.set_chunks_read(stats_.chunks_read() + 1);
     stats_.set_bytes_read(stats_.bytes_read() + chunk_meta->chunk_record->size);
+    ReleaseProducerBytes(chunk_meta);
   } else {
     // We have at least one more packet to parse. It should be within the chunk.
     if (chunk_meta->cur_fragment_offset + sizeof(ChunkRecord) >=
@@ -878,11 +897,29 @@ TraceBuffer::ReadPacketResult TraceBuffer::ReadNextPacketInChunk(
   return ReadPacketResult::kSucceeded;
 }
 
-void TraceBuffer::DiscardWrite() {
+void TraceBuffer::DiscardWrite(ProducerID producer_id) {
   PERFETTO_DCHECK(overwrite_policy_ == kDiscard);
   discard_writes_ = true;
   stats_.set_chunks_discarded(stats_.chunks_discarded() + 1);
+  producer_stats_[producer_id].chunks_discarded++;
   TRACE_BUFFER_DLOG("  discarding write");
 }
 
+void TraceBuffer::ReleaseProducerBytes(ChunkMeta* chunk_meta) {
+  if (chunk_meta->bytes_released())
+    return;
+  chunk_meta->set_bytes_released();
+  ProducerStats& producer_stats =
+      producer_stats_[chunk_meta->chunk_record->producer_id];
+  PERFETTO_DCHECK(producer_stats.bytes_in_buffer >=
+                  chunk_meta->chunk_record->size);
+  producer_stats.bytes_in_buffer -= chunk_meta->chunk_record->size;
+}
+
+TraceBuffer::ProducerStats TraceBuffer::GetProducerStats(
+    ProducerID producer_id) const {
+  auto it = producer_stats_.find(producer_id);
+  return it == producer_stats_.end() ? ProducerStats() : it->second;
+}
+
 }  // namespace perfetto
@@ -162,6 +162,22 @@ class TraceBuffer {
     WriterID writer_id;
   };
 
+  // Per-producer counters of the chunks lost by the buffer, used to attribute
+  // data losses to the producers that suffered them.
+  struct ProducerStats {
+    // Bytes (including ChunkRecord headers) of the chunks stored in the buffer
+    // that haven't been fully read yet. This is what |max_bytes_per_producer|
+    // is checked against.
+    uint64_t bytes_in_buffer = 0;
+
+    // Chunks overwritten before being read (kOverwrite).
+    uint64_t chunks_overwritten = 0;
+
+    // Chunks rejected because the buffer was full or because the producer
+    // exceeded |max_bytes_per_producer| (kDiscard).
+    uint64_t chunks_discarded = 0;
+  };
+
   // Can return nullptr if the memory allocation fails.
   static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
                                              OverwritePolicy = kOverwrite);
@@ -261,6 +277,20 @@ class TraceBuffer {
                            PacketSequenceProperties* sequence_properties,
                            bool* previous_packet_on_sequence_dropped);
 
+  // Limits the amount of data that each producer can store in the buffer,
+  // so that a single producer can't fill the whole buffer and starve the
+  // others. Chunks that would exceed the limit are discarded. 0 (default)
+  // means no limit. Only honored with the kDiscard policy: with kOverwrite the
+  // ring buffer always prefers newer data.
+  void set_max_bytes_per_producer(uint64_t max_bytes) {
+    PERFETTO_DCHECK(overwrite_policy_ == kDiscard || !max_bytes);
+    max_bytes_per_producer_ = max_bytes;
+  }
+
+  // Returns the stats for the given producer, or all zeros if the producer
+  // never wrote into this buffer.
+  ProducerStats GetProducerStats(ProducerID) const;
+
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
 
@@ -376,7 +406,11 @@ class TraceBuffer {
       // If set, we skipped the last packet that we read from this chunk e.g.
       // because we it was a continuation from a previous chunk that was dropped
       // or due to an ABI violation.
-      kLastReadPacketSkipped = 1 << 1
+      kLastReadPacketSkipped = 1 << 1,
+
+      // If set, the chunk has been fully read and its size was already
+      // subtracted from ProducerStats.bytes_in_buffer.
+      kBytesReleased = 1 << 2
     };
 
     ChunkMeta(ChunkRecord* r,
@@ -416,6 +450,10 @@ class TraceBuffer {
       }
     }
 
+    bool bytes_released() const { return index_flags & kBytesReleased; }
+
+    void set_bytes_released() { index_flags |= kBytesReleased; }
+
     ChunkRecord* const chunk_record;  // Addr of ChunkRecord within |data_|.
     const uid_t trusted_uid;          // uid of the producer.
     const pid_t trusted_pid;          // pid of the producer.
@@ -581,7 +619,11 @@ class TraceBuffer {
     return reinterpret_cast<ChunkRecord*>(ptr);
   }
 
-  void DiscardWrite();
+  void DiscardWrite(ProducerID);
+
+  // Called when |chunk_meta| has been fully read or is removed from the index.
+  // Subtracts its size from the producer's |bytes_in_buffer|, only once.
+  void ReleaseProducerBytes(ChunkMeta* chunk_meta);
 
   // |src| can be nullptr (in which case |size| must be ==
   // record.size - sizeof(ChunkRecord)), for the case of writing a padding
@@ -659,6 +701,13 @@ class TraceBuffer {
   // many producers/writers within the same trace session).
   std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
 
+  // See set_max_bytes_per_producer().
+  uint64_t max_bytes_per_producer_ = 0;
+
+  // Like |last_chunk_id_written_|, this is never cleaned up, but has only one
+  // entry per producer that wrote into the buffer.
+  std::map<ProducerID, ProducerStats> producer_stats_;
+
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
 
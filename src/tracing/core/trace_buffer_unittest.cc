@@ -1739,6 +1739,111 @@ TEST_F(TraceBufferTest, DiscardPolicy) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+// A producer that exceeds its quota in a kDiscard buffer should not prevent
+// other producers from writing.
+TEST_F(TraceBufferTest, DiscardPolicy_MaxBytesPerProducer) {
+  ResetBuffer(4096, TraceBuffer::kDiscard);
+  trace_buffer()->set_max_bytes_per_producer(1024);
+
+  for (ChunkID chunk_id = 0; chunk_id < 4; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(512 - 16, 'x')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(1))
+      .AddPacket(512 - 16, 'y')
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(1024u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+  EXPECT_EQ(1024u, trace_buffer()->GetProducerStats(2).bytes_in_buffer);
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'x')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'y')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  EXPECT_EQ(2u, trace_buffer()->stats().chunks_discarded());
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+  EXPECT_EQ(2u, trace_buffer()->GetProducerStats(1).chunks_discarded);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(2).bytes_in_buffer);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(2).chunks_discarded);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(3).bytes_in_buffer);
+}
+
+// Reading a producer's chunks should give its quota back, so that it can keep
+// writing after the buffer has been drained.
+TEST_F(TraceBufferTest, DiscardPolicy_MaxBytesPerProducerAfterRead) {
+  ResetBuffer(4096, TraceBuffer::kDiscard);
+  trace_buffer()->set_max_bytes_per_producer(1024);
+
+  for (ChunkID chunk_id = 0; chunk_id < 2; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  CreateChunk(ProducerID(1), WriterID(2), ChunkID(0))
+      .AddPacket(512 - 16, 'x')
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(1u, trace_buffer()->GetProducerStats(1).chunks_discarded);
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+
+  // Write enough to wrap around and overwrite the chunks that were read. Their
+  // size must not be subtracted a second time when they are deleted.
+  for (ChunkID chunk_id = 2; chunk_id < 10; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+    trace_buffer()->BeginRead();
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(
+                                  512 - 16, static_cast<char>('a' + chunk_id))));
+    ASSERT_THAT(ReadPacket(), IsEmpty());
+  }
+  EXPECT_EQ(1u, trace_buffer()->GetProducerStats(1).chunks_discarded);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(10))
+      .AddPacket(512 - 16, 'k')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(11))
+      .AddPacket(512 - 16, 'l')
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(1024u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+  EXPECT_EQ(1u, trace_buffer()->GetProducerStats(1).chunks_discarded);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'k')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(512 - 16, 'l')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+// Overwritten chunks should be attributed to the producer that wrote them,
+// not to the one whose write caused the overwrite.
+TEST_F(TraceBufferTest, Overwrite_PerProducerStats) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(1024 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  for (ChunkID chunk_id = 0; chunk_id < 4; chunk_id++) {
+    CreateChunk(ProducerID(2), WriterID(1), chunk_id)
+        .AddPacket(1024 - 16, static_cast<char>('b' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+
+  EXPECT_EQ(1u, trace_buffer()->stats().chunks_overwritten());
+  EXPECT_EQ(1u, trace_buffer()->GetProducerStats(1).chunks_overwritten);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(1).bytes_in_buffer);
+  EXPECT_EQ(0u, trace_buffer()->GetProducerStats(2).chunks_overwritten);
+  EXPECT_EQ(4096u, trace_buffer()->GetProducerStats(2).bytes_in_buffer);
+}
+
 TEST_F(TraceBufferTest, MissingPacketsOnSequence) {
   ResetBuffer(4096);
   SuppressClientDchecksForTesting();
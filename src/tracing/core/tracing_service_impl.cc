@@ -868,6 +868,10 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
       did_allocate_all_buffers = false;
       break;
     }
+    if (policy == TraceBuffer::kDiscard && buffer_cfg.max_kb_per_producer()) {
+      trace_buffer->set_max_bytes_per_producer(
+          static_cast<uint64_t>(buffer_cfg.max_kb_per_producer()) * 1024u);
+    }
   }
 
   UpdateMemoryGuardrail();
@@ -3208,6 +3212,38 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     }
     *trace_stats.add_buffer_stats() = buf->stats();
   }  // for (buf in session).
+
+  for (const auto& kv : producers_) {
+    ProducerEndpointImpl* producer = kv.second;
+    if (!producer->shared_memory_ ||
+        tracing_session->data_source_instances.count(producer->id_) == 0) {
+      continue;
+    }
+    auto* producer_stats = trace_stats.add_producer_stats();
+    producer_stats->set_producer_id(producer->id_);
+    producer_stats->set_producer_name(producer->name_);
+    producer_stats->set_smb_size_bytes(producer->shared_memory_->size());
+    producer_stats->set_smb_page_size_bytes(
+        producer->shared_buffer_page_size_kb() * 1024);
+    producer_stats->set_chunks_committed(producer->chunks_committed_);
+    producer_stats->set_bytes_committed(producer->bytes_committed_);
+    producer_stats->set_stalls(producer->smb_stalls_);
+    producer_stats->set_chunks_dropped(producer->smb_chunks_dropped_);
+
+    uint64_t chunks_overwritten = 0;
+    uint64_t chunks_discarded = 0;
+    for (BufferID buf_id : tracing_session->buffers_index) {
+      TraceBuffer* buf = GetBufferByID(buf_id);
+      if (!buf)
+        continue;
+      TraceBuffer::ProducerStats buf_stats =
+          buf->GetProducerStats(producer->id_);
+      chunks_overwritten += buf_stats.chunks_overwritten;
+      chunks_discarded += buf_stats.chunks_discarded;
+    }
+    producer_stats->set_chunks_overwritten(chunks_overwritten);
+    producer_stats->set_chunks_discarded(chunks_discarded);
+  }
   return trace_stats;
 }
 
@@ -3899,6 +3935,8 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
         id_, uid_, pid_, writer_id, chunk_id, buffer_id, num_fragments,
         chunk_flags,
         /*chunk_complete=*/true, chunk.payload_begin(), chunk.payload_size());
+    chunks_committed_++;
+    bytes_committed_ += chunk.size();
 
     // This one has release-store semantics.
     shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
@@ -3906,6 +3944,11 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
 
   service_->ApplyChunkPatches(id_, req_untrusted.chunks_to_patch());
 
+  if (req_untrusted.has_smb_stats()) {
+    smb_stalls_ = req_untrusted.smb_stats().stalls();
+    smb_chunks_dropped_ = req_untrusted.smb_stats().chunks_dropped();
+  }
+
   if (req_untrusted.flush_request_id()) {
     service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
   }
@@ -176,6 +176,14 @@ class TracingServiceImpl : public TracingService {
     bool in_process_;
     bool smb_scraping_enabled_;
 
+    // SMB usage counters, reported in TraceStats.ProducerStats. The
+    // |smb_stalls_| and |smb_chunks_dropped_| ones are reported by the
+    // producer via CommitDataRequest.smb_stats.
+    uint64_t chunks_committed_ = 0;
+    uint64_t bytes_committed_ = 0;
+    uint64_t smb_stalls_ = 0;
+    uint64_t smb_chunks_dropped_ = 0;
+
     // Set of the global target_buffer IDs that the producer is configured to
     // write into in any active tracing session.
     std::set<BufferID> allowed_target_buffers_;
@@ -3125,6 +3125,56 @@ TEST_F(TracingServiceImplTest, GetTraceStats) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, GetTraceStatsProducerStats) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  // This producer doesn't take part in the session and shouldn't be reported.
+  std::unique_ptr<MockProducer> producer2 = CreateMockProducer();
+  producer2->Connect(svc.get(), "mock_producer2");
+  producer2->RegisterDataSource("data_source2");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < 10; i++)
+    writer->NewTracePacket()->set_for_testing()->set_str("payload");
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+  ASSERT_EQ(stats.producer_stats_size(), 1);
+  const auto& producer_stats = stats.producer_stats()[0];
+  EXPECT_EQ(producer_stats.producer_name(), "mock_producer");
+  EXPECT_GT(producer_stats.smb_size_bytes(), 0u);
+  EXPECT_GT(producer_stats.smb_page_size_bytes(), 0u);
+  EXPECT_GT(producer_stats.chunks_committed(), 0u);
+  EXPECT_GT(producer_stats.bytes_committed(), 0u);
+  EXPECT_EQ(producer_stats.stalls(), 0u);
+  EXPECT_EQ(producer_stats.chunks_dropped(), 0u);
+  EXPECT_EQ(producer_stats.chunks_overwritten(), 0u);
+  EXPECT_EQ(producer_stats.chunks_discarded(), 0u);
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
 TEST_F(TracingServiceImplTest, ObserveEventsDataSourceInstances) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -2782,6 +2782,51 @@ TEST_P(PerfettoApiTest, TrackEventTypedArgsWithInterningByHashing) {
   EXPECT_THAT(log_messages, ElementsAre("Though this be madness,"));
 }
 
+struct InternedLogMessageBodyLru
+    : public perfetto::TrackEventInternedDataIndex<
+          InternedLogMessageBodyLru,
+          perfetto::protos::pbzero::InternedData::kLogMessageBodyFieldNumber,
+          std::string,
+          perfetto::LruInternedDataTraits<2>> {
+  static void Add(perfetto::protos::pbzero::InternedData* interned_data,
+                  size_t iid,
+                  const std::string& value) {
+    auto l = interned_data->add_log_message_body();
+    l->set_iid(iid);
+    l->set_body(value.data(), value.size());
+  }
+};
+
+TEST_P(PerfettoApiTest, TrackEventTypedArgsWithInterningLru) {
+  // Create a new trace session.
+  auto* tracing_session = NewTraceWithCategories({"foo"});
+  tracing_session->get()->StartBlocking();
+
+  TRACE_EVENT_BEGIN("foo", "EventWithState", [&](perfetto::EventContext ctx) {
+    auto first_iid = InternedLogMessageBodyLru::Get(&ctx, "first");
+    auto second_iid = InternedLogMessageBodyLru::Get(&ctx, "second");
+    EXPECT_NE(first_iid, second_iid);
+    EXPECT_EQ(first_iid, InternedLogMessageBodyLru::Get(&ctx, "first"));
+
+    // The index is full: "second" is the least recently used entry and gets
+    // evicted. When seen again, it's re-emitted under a new id.
+    auto third_iid = InternedLogMessageBodyLru::Get(&ctx, "third");
+    EXPECT_EQ(first_iid, InternedLogMessageBodyLru::Get(&ctx, "first"));
+    auto second_iid2 = InternedLogMessageBodyLru::Get(&ctx, "second");
+    EXPECT_NE(second_iid, second_iid2);
+    EXPECT_NE(third_iid, second_iid2);
+    EXPECT_NE(first_iid, second_iid2);
+
+    auto log = ctx.event()->set_log_message();
+    log->set_body_iid(second_iid2);
+  });
+  TRACE_EVENT_END("foo");
+
+  tracing_session->get()->StopBlocking();
+  auto log_messages = ReadLogMessagesFromTrace(tracing_session->get());
+  EXPECT_THAT(log_messages, ElementsAre("second"));
+}
+
 struct InternedSourceLocation
     : public perfetto::TrackEventInternedDataIndex<
           InternedSourceLocation,
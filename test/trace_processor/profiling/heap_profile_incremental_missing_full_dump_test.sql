@@ -0,0 +1,2 @@
+select name, idx, severity, source, value
+from stats where name = 'heapprofd_missing_full_dump';